@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr_arena.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE   256
+#define BUFFER_COUNT  4
+
+
+static long long
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void
+separate(size_t n)
+{
+	shr_key_t *keys = calloc(n, sizeof(*keys));
+	long long start, created, removed;
+	size_t i, made;
+	shr_t shr;
+
+	if (!keys)
+		goto fail;
+
+	start = now();
+	for (made = 0; made < n; made++) {
+		if (shr_create(keys + made, BUFFER_SIZE, BUFFER_COUNT, 0600) < 0)
+			break;
+		t (shr_open(&shr, keys + made, SHR_WRITE));
+		shr_close(&shr);
+	}
+	if (made < n)
+		perror("shr_create");
+	created = now();
+	for (i = 0; i < made; i++)
+		shr_remove_by_key(keys + i);
+	removed = now();
+
+	printf("separate: %zu rings, created and opened in %.1f ms, removed in %.1f ms\n",
+	       made, (double)(created - start) / 1e6, (double)(removed - created) / 1e6);
+	free(keys);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+arena(size_t n)
+{
+	struct shr_arena_ring *rings = calloc(n, sizeof(*rings));
+	long long start, created, opened, transferred, removed;
+	shr_arena_t *arena;
+	key_t key;
+	size_t i, len;
+	const char *rbuf;
+	char *wbuf;
+	shr_t shr;
+	pid_t pid;
+	int status;
+
+	if (!rings)
+		goto fail;
+	for (i = 0; i < n; i++) {
+		rings[i].buffer_size = BUFFER_SIZE;
+		rings[i].buffer_count = BUFFER_COUNT;
+		rings[i].flags = 0;
+	}
+
+	start = now();
+	t (shr_arena_create(&key, rings, n, 0600));
+	created = now();
+	arena = shr_arena_open(key);
+	t (arena ? 0 : -1);
+	opened = now();
+
+	/* Send one message through every ring to another process. */
+	pid = fork();
+	t (pid);
+	if (!pid) {
+		for (i = 0; i < n; i++) {
+			t (shr_arena_ring(arena, i, SHR_READ, &shr));
+			t (shr_read(&shr, &rbuf, &len));
+			if (len != sizeof(i) || memcmp(rbuf, &i, sizeof(i)))
+				fprintf(stderr, "ring %zu: bad message\n", i), exit(1);
+			t (shr_read_done(&shr));
+			shr_close(&shr);
+		}
+		exit(0);
+	}
+	for (i = 0; i < n; i++) {
+		t (shr_arena_ring(arena, i, SHR_WRITE, &shr));
+		t (shr_write(&shr, &wbuf));
+		memcpy(wbuf, &i, sizeof(i));
+		t (shr_write_done(&shr, sizeof(i)));
+		shr_close(&shr);
+	}
+	t (waitpid(pid, &status, 0));
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		exit(1);
+	transferred = now();
+
+	shr_arena_close(arena);
+	t (shr_arena_remove(key));
+	removed = now();
+
+	printf("arena:    %zu rings, created in %.1f ms, opened in %.1f ms, "
+	       "one message each in %.1f ms, removed in %.1f ms\n",
+	       n, (double)(created - start) / 1e6, (double)(opened - created) / 1e6,
+	       (double)(transferred - opened) / 1e6, (double)(removed - transferred) / 1e6);
+	free(rings);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	size_t n = argc > 1 ? (size_t)atol(argv[1]) : 10000;
+	if (!n)
+		return fprintf(stderr, "usage: %s [ring-count]\n", argv[0]), 1;
+	arena(n);
+	fflush(stdout);
+	separate(n);
+	return 0;
+}
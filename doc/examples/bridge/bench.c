@@ -0,0 +1,188 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr_bridge.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_COUNT  64
+
+
+struct end
+{
+	shr_t shr;
+	int fd;
+	size_t batch;
+	int flags;
+	struct shr_bridge_stats stats;
+};
+
+
+static unsigned long messages;
+static size_t size;
+static char *text;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void *
+writer(void *arg)
+{
+	shr_t *shr = arg;
+	unsigned long i;
+
+	for (i = 0; i < messages; i++)
+		t (shr_write_copy(shr, text + i % 64, size));
+	t (shr_write_copy(shr, NULL, 0));
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+sender(void *arg)
+{
+	struct end *end = arg;
+	t (shr_bridge_send(&end->shr, end->fd, end->batch, end->flags, &end->stats));
+	close(end->fd);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+receiver(void *arg)
+{
+	struct end *end = arg;
+	t (shr_bridge_recv(&end->shr, end->fd, &end->stats));
+	close(end->fd);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(size_t buffer_size, size_t batch, int flags)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	struct end in, out;
+	shr_t writing, reading;
+	pthread_t threads[3];
+	const char *buffer;
+	size_t length;
+	int listener, one = 1, i;
+	double start;
+
+	size = buffer_size;
+	memset(&in, 0, sizeof(in));
+	memset(&out, 0, sizeof(out));
+	in.batch = batch;
+	in.flags = flags;
+
+	t (shr_open_local(&writing, NULL, size, BUFFER_COUNT, 0));
+	t (shr_reverse_dup(&writing, &in.shr));
+	t (shr_open_local(&out.shr, NULL, size, BUFFER_COUNT, 0));
+	t (shr_reverse_dup(&out.shr, &reading));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	t (listener = socket(AF_INET, SOCK_STREAM, 0));
+	t (bind(listener, (struct sockaddr *)&addr, sizeof(addr)));
+	t (listen(listener, 1));
+	t (getsockname(listener, (struct sockaddr *)&addr, &addrlen));
+	t (in.fd = socket(AF_INET, SOCK_STREAM, 0));
+	t (connect(in.fd, (struct sockaddr *)&addr, sizeof(addr)));
+	t (out.fd = accept(listener, NULL, NULL));
+	close(listener);
+	setsockopt(in.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(out.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	start = now();
+	pthread_create(&threads[0], NULL, writer, &writing);
+	pthread_create(&threads[1], NULL, sender, &in);
+	pthread_create(&threads[2], NULL, receiver, &out);
+	do {
+		t (shr_read(&reading, &buffer, &length));
+		t (shr_read_done(&reading));
+	} while (length);
+	for (i = 0; i < 3; i++)
+		pthread_join(threads[i], NULL);
+	start = now() - start;
+
+	printf("%8zu %6zu %10.1f %8.2f %8llu\n", size, batch,
+	       (double)messages * (double)size / start / 1e6,
+	       (double)in.stats.wire_bytes / (double)in.stats.bytes,
+	       (unsigned long long)in.stats.stalls);
+
+	shr_remove(&reading);
+	shr_remove(&in.shr);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	static const size_t sizes[] = {64, 1024, 16384, 65536};
+	static const size_t batches[] = {1, 8, 64};
+	unsigned long megabytes;
+	size_t i, j;
+	int flags;
+
+	if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "z"))) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	megabytes = strtoul(argv[1], NULL, 10);
+	flags = argc == 3 ? SHR_BRIDGE_COMPRESS : 0;
+
+	text = malloc(65536 + 64 + 128);
+	if (!text) {
+		perror("malloc");
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < 65536 + 64;)
+		i += (size_t)sprintf(text + i, "2026-10-19T12:%02i:%02i host%02i GET /api/v1/items/%i 200 %i\n",
+		                     rand() % 60, rand() % 60, rand() % 16, rand() % 100000, rand() % 5000);
+
+	printf("%8s %6s %10s %8s %8s\n", "size", "batch", "MB/s", "wire", "stalls");
+	for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		messages = megabytes * 1000000UL / sizes[i];
+		for (j = 0; j < sizeof(batches) / sizeof(*batches); j++)
+			run(sizes[i], batches[j], flags);
+	}
+	free(text);
+	return 0;
+}
@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.;
+}
+
+
+static double
+run(size_t size, int flags, unsigned long messages)
+{
+	shr_key_t key;
+	shr_t shr;
+	shr_t revshr;
+	const char *rbuf;
+	char *wbuf;
+	size_t len;
+	unsigned long i;
+	double start;
+
+	SHR_PRIVATE_FLAGS(&key, size, 4, flags);
+	t (shr_open(&shr, &key, SHR_WRITE));
+	t (shr_reverse_dup(&shr, &revshr));
+
+	start = now();
+	for (i = 0; i < messages; i++) {
+		t (shr_write(&shr, &wbuf));
+		memset(wbuf, (int)i, size);
+		t (shr_write_done(&shr, size));
+		t (shr_read(&revshr, &rbuf, &len));
+		t (shr_read_done(&revshr));
+	}
+	start = now() - start;
+
+	shr_close(&shr);
+	shr_remove(&revshr);
+	return start;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned long messages;
+	double plain, checked;
+	size_t size;
+
+	if (argc != 2) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	messages = strtoul(argv[1], NULL, 10);
+
+	printf("%10s %14s %14s %12s %12s\n", "size", "ns/msg", "ns/msg (crc)", "MB/s", "MB/s (crc)");
+	for (size = 64; size <= 1 << 20; size *= 4) {
+		plain = run(size, 0, messages);
+		checked = run(size, SHR_CHECKSUM, messages);
+		printf("%10zu %14.1f %14.1f %12.1f %12.1f\n", size,
+		       plain * 1e9 / (double)messages, checked * 1e9 / (double)messages,
+		       (double)size * (double)messages / plain / 1e6,
+		       (double)size * (double)messages / checked / 1e6);
+	}
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr_classes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define SMALL     100
+#define LARGE     (1 << 20)
+#define MESSAGES  200000
+#define EVERY     1000  /* every 1000th message is large */
+
+
+static long long
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static size_t
+size_of(size_t i)
+{
+	return i % EVERY == EVERY - 1 ? LARGE : SMALL;
+}
+
+
+static void
+run(const char *name, const struct shr_class *classes, size_t count)
+{
+	shr_classes_t *end;
+	long long start;
+	size_t i, len, memory = 0;
+	const char *rbuf;
+	char *wbuf;
+	key_t key;
+	pid_t pid;
+	int r, status;
+
+	for (i = 0; i < count; i++)
+		memory += SHR_RING_SIZE(classes[i].buffer_size, 0, classes[i].buffer_count);
+	t (shr_classes_create(&key, classes, count, 0600, 0));
+
+	fflush(stdout);
+	pid = fork();
+	t (pid);
+	if (!pid) {
+		end = shr_classes_open(key, SHR_READ);
+		t (end ? 0 : -1);
+		for (i = 0; !(r = shr_classes_read(end, NULL, &rbuf, &len)); i++) {
+			if (len != size_of(i) || rbuf[len - 1] != (char)i)
+				fprintf(stderr, "message %zu: bad data\n", i), exit(1);
+			t (shr_classes_read_done(end));
+		}
+		t (r);
+		shr_classes_close(end);
+		exit(0);
+	}
+
+	end = shr_classes_open(key, SHR_WRITE);
+	t (end ? 0 : -1);
+	start = now();
+	for (i = 0; i < MESSAGES; i++) {
+		len = size_of(i);
+		t (shr_classes_write(end, len, &wbuf));
+		memset(wbuf, (char)i, len);
+		t (shr_classes_write_done(end, len));
+	}
+	t (shr_classes_finish(end));
+	t (waitpid(pid, &status, 0));
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		exit(1);
+	printf("%-8s %8.1f MiB  %8.0f messages/s\n", name,
+	       (double)memory / (1 << 20), MESSAGES / ((double)(now() - start) / 1e9));
+	shr_classes_close(end);
+	t (shr_classes_remove(key));
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int
+main(void)
+{
+	struct shr_class uniform[] = {{LARGE, 64}};
+	struct shr_class classes[] = {{SMALL, 64}, {LARGE, 4}};
+
+	run("uniform", uniform, 1);
+	run("classes", classes, 2);
+	return 0;
+}
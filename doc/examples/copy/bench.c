@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <shr.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+
+static size_t buffer_size;
+static unsigned long messages;
+static size_t *chain;
+static size_t chain_length;
+static volatile int stop;
+static volatile size_t sink;
+static int use_helpers;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.;
+}
+
+
+static int
+open_counter(unsigned long long config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+static void *
+workload(void *arg)
+{
+	double *result = arg;
+	unsigned long long loads = 0, refs = 0, misses = 0;
+	int ref_fd, miss_fd;
+	size_t i = 0;
+	double start;
+	int j;
+
+	ref_fd = open_counter(PERF_COUNT_HW_CACHE_REFERENCES);
+	miss_fd = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+	if (ref_fd >= 0 && miss_fd >= 0) {
+		ioctl(ref_fd, PERF_EVENT_IOC_ENABLE, 0);
+		ioctl(miss_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	start = now();
+	while (!stop) {
+		for (j = 0; j < 1024; j++)
+			i = chain[i];
+		loads += 1024;
+	}
+	result[0] = (double)loads / (now() - start);
+	sink = i;
+
+	result[1] = -1;
+	if (ref_fd >= 0 && miss_fd >= 0) {
+		if (read(ref_fd, &refs, sizeof(refs)) == sizeof(refs) &&
+		    read(miss_fd, &misses, sizeof(misses)) == sizeof(misses) && refs)
+			result[1] = (double)misses / (double)refs;
+		close(ref_fd);
+		close(miss_fd);
+	}
+	return NULL;
+}
+
+
+static void *
+writer(void *arg)
+{
+	shr_t *shr = arg;
+	char *data = malloc(buffer_size), *buffer;
+	unsigned long i;
+
+	memset(data, 1, buffer_size);
+	for (i = 0; i < messages; i++) {
+		if (use_helpers) {
+			t (shr_write_copy(shr, data, buffer_size));
+		} else {
+			t (shr_write(shr, &buffer));
+			memcpy(buffer, data, buffer_size);
+			t (shr_write_done(shr, buffer_size));
+		}
+	}
+	free(data);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+reader(void *arg)
+{
+	shr_t *shr = arg;
+	char *data = malloc(buffer_size);
+	const char *buffer;
+	size_t length;
+	unsigned long i;
+
+	for (i = 0; i < messages; i++) {
+		if (use_helpers) {
+			t (shr_read_copy(shr, data, buffer_size, NULL));
+		} else {
+			t (shr_read(shr, &buffer, &length));
+			memcpy(data, buffer, length);
+			t (shr_read_done(shr));
+		}
+	}
+	free(data);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(const char *name)
+{
+	shr_key_t key;
+	shr_t shr;
+	shr_t revshr;
+	pthread_t w, r, l;
+	double start, result[2];
+
+	SHR_PRIVATE(&key, buffer_size, 4);
+	t (shr_open(&shr, &key, SHR_WRITE));
+	t (shr_reverse_dup(&shr, &revshr));
+
+	stop = 0;
+	pthread_create(&l, NULL, workload, result);
+	start = now();
+	pthread_create(&w, NULL, writer, &shr);
+	pthread_create(&r, NULL, reader, &revshr);
+	pthread_join(w, NULL);
+	pthread_join(r, NULL);
+	start = now() - start;
+	stop = 1;
+	pthread_join(l, NULL);
+
+	printf("%-8s %10.1f MB/s %14.0f loads/s", name,
+	       (double)buffer_size * (double)messages / start / 1e6, result[0]);
+	if (result[1] >= 0)
+		printf(" %8.2f%% cache misses", result[1] * 100);
+	printf("\n");
+
+	shr_close(&shr);
+	shr_remove(&revshr);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t i, j, tmp, *order;
+
+	if (argc != 4) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	buffer_size = (size_t)strtoul(argv[1], NULL, 10);
+	messages = strtoul(argv[2], NULL, 10);
+	chain_length = (size_t)strtoul(argv[3], NULL, 10) * 1024 / sizeof(*chain);
+	if (!buffer_size || chain_length < 2) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+
+	/* A single random cycle through the working set. */
+	chain = malloc(chain_length * sizeof(*chain));
+	order = malloc(chain_length * sizeof(*order));
+	for (i = 0; i < chain_length; i++)
+		order[i] = i;
+	for (i = chain_length - 1; i > 0; i--) {
+		j = (size_t)rand() % (i + 1);
+		tmp = order[i], order[i] = order[j], order[j] = tmp;
+	}
+	for (i = 0; i < chain_length; i++)
+		chain[order[i]] = order[(i + 1) % chain_length];
+	free(order);
+
+	run("memcpy");
+	use_helpers = 1;
+	run("helpers");
+
+	free(chain);
+	return 0;
+}
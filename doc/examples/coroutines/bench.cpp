@@ -0,0 +1,96 @@
+#include <shr_coro.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+#define BUFFER_SIZE  64
+
+
+static libshr::task
+produce(libshr::async_ring &ring, unsigned long messages)
+{
+	for (unsigned long i = 0; i < messages; i++) {
+		auto g = co_await ring.write();
+		std::memcpy(g.data().data(), &i, sizeof(i));
+		g.commit(sizeof(i));
+	}
+}
+
+
+static libshr::task
+consume(libshr::async_ring &ring, unsigned long messages)
+{
+	for (unsigned long i = 0; i < messages; i++)
+		(void) co_await ring.read();
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned long rings, messages, threads;
+	std::vector<libshr::ring> writers, readers;
+	std::chrono::steady_clock::time_point start;
+	double coro_time, thread_time;
+
+	if (argc != 4) {
+		std::fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	rings = std::strtoul(argv[1], nullptr, 10);
+	messages = std::strtoul(argv[2], nullptr, 10);
+	threads = std::strtoul(argv[3], nullptr, 10);
+
+	for (unsigned long i = 0; i < rings; i++) {
+		writers.emplace_back(libshr::private_key(BUFFER_SIZE, 4), SHR_WRITE);
+		readers.push_back(writers.back().reverse_dup());
+	}
+
+	/* 2 * rings coroutines on `threads` threads. */
+	start = std::chrono::steady_clock::now();
+	{
+		libshr::executor ex(static_cast<unsigned>(threads));
+		std::vector<std::unique_ptr<libshr::async_ring>> ar;
+		for (unsigned long i = 0; i < rings; i++) {
+			ar.push_back(std::make_unique<libshr::async_ring>(writers[i], ex));
+			ar.push_back(std::make_unique<libshr::async_ring>(readers[i], ex));
+			ex.spawn(produce(*ar[2 * i + 0], messages));
+			ex.spawn(consume(*ar[2 * i + 1], messages));
+		}
+		ex.wait();
+	}
+	coro_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	/* One blocking thread per ring end. */
+	start = std::chrono::steady_clock::now();
+	{
+		std::vector<std::thread> ts;
+		for (unsigned long i = 0; i < rings; i++) {
+			ts.emplace_back([&, i] {
+				for (unsigned long j = 0; j < messages; j++) {
+					auto g = writers[i].write();
+					std::memcpy(g.data().data(), &j, sizeof(j));
+					g.commit(sizeof(j));
+				}
+			});
+			ts.emplace_back([&, i] {
+				for (unsigned long j = 0; j < messages; j++)
+					(void) readers[i].read();
+			});
+		}
+		for (auto &t : ts)
+			t.join();
+	}
+	thread_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::printf("coroutines: %lu threads, %.0f messages/s\n", threads, (double)(rings * messages) / coro_time);
+	std::printf("threads:    %lu threads, %.0f messages/s\n", 2 * rings, (double)(rings * messages) / thread_time);
+
+	for (auto &r : readers)
+		r.remove();
+	return 0;
+}
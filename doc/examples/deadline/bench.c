@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_COUNT  1024
+#define PERIOD_NS     100000L   /* a message every 100 us */
+#define TTL_NS        2000000L  /* that is stale after 2 ms */
+#define WORK_NS       50000L    /* and takes 50 us to process */
+#define PAUSE_EVERY   200000000L
+#define PAUSE_NS      50000000L /* the reader pauses 50 ms every 200 ms */
+#define DURATION_S    2
+
+
+static shr_t writer;
+static shr_t reader;
+
+
+static long long
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void
+spin(long long ns)
+{
+	long long end = now() + ns;
+	while (now() < end);
+}
+
+
+static int
+cmp(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+static void *
+write_thread(void *arg)
+{
+	struct timespec next, ttl = {0, TTL_NS};
+	long long stamp, end;
+
+	t (shr_set_ttl(&writer, &ttl));
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	end = now() + DURATION_S * 1000000000LL;
+	while ((stamp = now()) < end) {
+		t (shr_write_copy(&writer, &stamp, sizeof(stamp)));
+		next.tv_nsec += PERIOD_NS;
+		if (next.tv_nsec >= 1000000000L)
+			next.tv_sec += 1, next.tv_nsec -= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	t (shr_write_copy(&writer, NULL, 0));
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(int skip)
+{
+	static long long ages[DURATION_S * 1000000000LL / PERIOD_NS + 1024];
+	pthread_t thread;
+	const char *buf;
+	size_t len, n = 0, late = 0;
+	long long stamp, next_pause;
+
+	t (shr_open_local(&writer, NULL, sizeof(stamp), BUFFER_COUNT, SHR_DEADLINE));
+	t (shr_reverse_dup(&writer, &reader));
+	pthread_create(&thread, NULL, write_thread, NULL);
+
+	next_pause = now() + PAUSE_EVERY;
+	for (;;) {
+		if (skip)
+			t (shr_skip_stale(&reader));
+		t (shr_read(&reader, &buf, &len));
+		if (!len) {
+			t (shr_read_done(&reader));
+			break;
+		}
+		memcpy(&stamp, buf, sizeof(stamp));
+		t (shr_read_done(&reader));
+
+		ages[n] = now() - stamp;
+		late += ages[n] > TTL_NS;
+		n++;
+		spin(WORK_NS);
+		if (now() >= next_pause) {
+			spin(PAUSE_NS);
+			next_pause = now() + PAUSE_EVERY;
+		}
+	}
+	pthread_join(thread, NULL);
+
+	qsort(ages, n, sizeof(*ages), cmp);
+	printf("%-16s %6zu processed %6llu skipped %6zu processed stale  age p50 %8.3f ms  p99 %8.3f ms\n",
+	       skip ? "shr_skip_stale" : "drain in order", n, (unsigned long long)SHR_SKIPPED(&reader), late,
+	       ages[n / 2] / 1e6, ages[n * 99 / 100] / 1e6);
+
+	shr_close(&reader);
+	shr_remove(&writer);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(void)
+{
+	run(0);
+	run(1);
+	return 0;
+}
@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr_desc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BATCH  16
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static int
+filter(shr_bufpool_t *pool, const shr_key_t *in_key, const shr_key_t *out_key)
+{
+	struct shr_desc descs[BATCH], keep[BATCH];
+	unsigned long long seq;
+	shr_t in, out;
+	ssize_t n, i, k;
+	char *data;
+
+	t (shr_open(&in, in_key, SHR_READ));
+	t (shr_open(&out, out_key, SHR_WRITE));
+	do {
+		t (n = shr_desc_recv(&in, pool, descs, BATCH, NULL));
+		for (i = k = 0; i < n; i++) {
+			data = SHR_DESC_DATA(pool, &descs[i]);
+			memcpy(&seq, data, sizeof(seq));
+			if (seq % 4 == 3) {
+				t (shr_bufpool_free(pool, &descs[i]));
+				continue;
+			}
+			descs[i].offset += (uint32_t)sizeof(seq);
+			descs[i].length -= sizeof(seq);
+			data[sizeof(seq)] = (char)seq;
+			keep[k++] = descs[i];
+		}
+		if (k || !n)
+			t (shr_desc_send(&out, keep, (size_t)k));
+	} while (n);
+	shr_close(&in);
+	shr_close(&out);
+	return 0;
+
+fail:
+	perror(called);
+	return 1;
+}
+
+
+static int
+consumer(shr_bufpool_t *pool, const shr_key_t *key, unsigned long long messages, size_t size)
+{
+	struct shr_desc descs[BATCH];
+	unsigned long long received = 0, expected = 0;
+	shr_t in;
+	ssize_t n, i;
+	char *data;
+
+	t (shr_open(&in, key, SHR_READ));
+	do {
+		t (n = shr_desc_recv(&in, pool, descs, BATCH, NULL));
+		for (i = 0; i < n; i++, expected++) {
+			if (expected % 4 == 3)
+				expected++;
+			data = SHR_DESC_DATA(pool, &descs[i]);
+			if (descs[i].length != size || data[0] != (char)expected) {
+				fprintf(stderr, "consumer: bad message %llu\n", expected);
+				return 1;
+			}
+			received++;
+		}
+		while (i--)
+			t (shr_bufpool_free(pool, &descs[i]));
+	} while (n);
+	shr_close(&in);
+	if (received != messages - messages / 4) {
+		fprintf(stderr, "consumer: received %llu messages\n", received);
+		return 1;
+	}
+	return 0;
+
+fail:
+	perror(called);
+	return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	shr_bufpool_key_t pool_key;
+	shr_bufpool_t pool;
+	shr_key_t a, b;
+	shr_t out;
+	struct shr_desc descs[BATCH];
+	unsigned long long messages, seq = 0;
+	size_t size, n;
+	int status, i, ret = 0;
+	double start, end;
+	char *data;
+
+	if (argc != 3) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	messages = strtoull(argv[1], NULL, 10);
+	size = (size_t)strtoul(argv[2], NULL, 10);
+
+	SHR_BUFPOOL_PRIVATE(&pool_key, size + sizeof(seq), 256);
+	t (shr_bufpool_open(&pool, &pool_key));
+	t (shr_create(&a, BATCH * sizeof(struct shr_desc), 3, S_IRUSR | S_IWUSR));
+	t (shr_create(&b, BATCH * sizeof(struct shr_desc), 3, S_IRUSR | S_IWUSR));
+
+	start = now();
+	switch (fork()) {
+	case -1:
+		called = "fork";
+		goto fail;
+	case 0:
+		return filter(&pool, &a, &b);
+	default:
+		break;
+	}
+	switch (fork()) {
+	case -1:
+		called = "fork";
+		goto fail;
+	case 0:
+		return consumer(&pool, &b, messages, size);
+	default:
+		break;
+	}
+
+	t (shr_open(&out, &a, SHR_WRITE));
+	while (seq < messages) {
+		for (n = 0; n < BATCH && seq < messages; n++, seq++) {
+			t (shr_bufpool_alloc(&pool, &descs[n]));
+			data = SHR_DESC_DATA(&pool, &descs[n]);
+			memcpy(data, &seq, sizeof(seq));
+			memset(data + sizeof(seq), 'x', size);
+			descs[n].length = size + sizeof(seq);
+		}
+		t (shr_desc_send(&out, descs, n));
+	}
+	t (shr_desc_send(&out, NULL, 0));
+	shr_close(&out);
+
+	for (i = 0; i < 2; i++) {
+		wait(&status);
+		ret |= !WIFEXITED(status) || WEXITSTATUS(status);
+	}
+	end = now();
+	if (!ret)
+		printf("%.1f ns/message\n", (end - start) * 1e9 / (double)messages);
+
+	shr_remove_by_key(&a);
+	shr_remove_by_key(&b);
+	shr_bufpool_remove(&pool);
+	return ret;
+
+fail:
+	perror(called);
+	return 1;
+}
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE   (1 << 20)
+#define BUFFER_COUNT  64
+
+
+static shr_t writer;
+static shr_t reader;
+static char *data;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void
+report(const char *when)
+{
+	size_t resident, total;
+	t (shr_stat_memory(&writer, &resident, &total));
+	printf("  %-28s %6.1f of %6.1f MiB resident\n", when, resident / 1048576., total / 1048576.);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+/* Write and read one message, return the time the write took. */
+static double
+message(void)
+{
+	const char *buf;
+	size_t len;
+	double start;
+
+	start = now();
+	t (shr_write_copy(&writer, data, BUFFER_SIZE));
+	start = now() - start;
+	t (shr_read(&reader, &buf, &len));
+	t (shr_read_done(&reader));
+	return start;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(void)
+{
+	struct timespec idle = {1, 0};
+	double resident_time = 0, released_time = 0;
+	ssize_t released;
+	int i;
+
+	report("after opening");
+
+	/* Bursts that use every buffer, the first one faults them in. */
+	for (i = 0; i < BUFFER_COUNT; i++)
+		message();
+	for (i = 0; i < BUFFER_COUNT; i++)
+		resident_time += message();
+	report("after two bursts");
+
+	/* Then low load, a few messages a second. */
+	for (i = 0; i < 8; i++) {
+		usleep(150000);
+		message();
+	}
+	t (released = shr_trim(&writer, &idle));
+	printf("  shr_trim released %zi buffers\n", released);
+	report("after low load and shr_trim");
+
+	/* Released buffers are faulted back in when written. */
+	for (i = 0; i < BUFFER_COUNT; i++)
+		released_time += message();
+	report("after another burst");
+
+	printf("  1 MiB write into a resident buffer: %7.1f us\n", resident_time / BUFFER_COUNT * 1e6);
+	printf("  1 MiB write into a released buffer: %7.1f us, on average over the burst\n",
+	       released_time / BUFFER_COUNT * 1e6);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(void)
+{
+	shr_key_t key;
+
+	data = malloc(BUFFER_SIZE);
+	memset(data, 'x', BUFFER_SIZE);
+
+	printf("XSI shared memory, %i buffers of %i MiB\n", BUFFER_COUNT, BUFFER_SIZE >> 20);
+	t (shr_create_flags(&key, BUFFER_SIZE, BUFFER_COUNT, S_IRUSR | S_IWUSR, SHR_ELASTIC));
+	t (shr_open(&writer, &key, SHR_WRITE));
+	t (shr_open(&reader, &key, SHR_READ));
+	run();
+	shr_close(&reader);
+	shr_remove(&writer);
+
+	printf("local, %i buffers of %i MiB\n", BUFFER_COUNT, BUFFER_SIZE >> 20);
+	t (shr_open_local(&writer, NULL, BUFFER_SIZE, BUFFER_COUNT, SHR_ELASTIC));
+	t (shr_reverse_dup(&writer, &reader));
+	run();
+	shr_close(&reader);
+	shr_remove(&writer);
+
+	free(data);
+	return 0;
+
+fail:
+	perror(called);
+	return 1;
+}
@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define LEVELS  32
+
+struct book
+{
+	unsigned long long version;
+	struct { double price, quantity; } bid[LEVELS], ask[LEVELS];
+	unsigned long long version_again;
+};
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static int
+consistent(const struct book *book)
+{
+	int i;
+	if (book->version != book->version_again)
+		return 0;
+	for (i = 0; i < LEVELS; i++)
+		if (book->bid[i].quantity != (double)(book->version + (unsigned)i) ||
+		    book->ask[i].quantity != (double)(book->version + (unsigned)i))
+			return 0;
+	return 1;
+}
+
+
+static int
+reader(const shr_key_t *key, long interval)
+{
+	struct timespec delay = {interval / 1000000L, interval % 1000000L * 1000L};
+	struct book book;
+	unsigned long long reads = 0, distinct = 0, retries = 0, last = 0;
+	const char *buf;
+	size_t len;
+	shr_t shr;
+	int r;
+
+	t (shr_open(&shr, key, SHR_READ));
+	for (;;) {
+		t (shr_read(&shr, &buf, &len));
+		memcpy(&book, buf, sizeof(book));
+		r = shr_read_done(&shr);
+		if (r < 0 && errno == ESTALE) {
+			retries++;
+			continue;
+		}
+		t (r);
+		if (!consistent(&book) || book.version < last) {
+			fprintf(stderr, "[%i] bad snapshot %llu\n", getpid(), book.version);
+			return 1;
+		}
+		distinct += book.version != last || !reads;
+		last = book.version;
+		reads++;
+		if (r)
+			break;
+		if (interval)
+			nanosleep(&delay, NULL);
+	}
+	printf("[%i] read %llu snapshots, %llu distinct, %llu retried, last version %llu\n",
+	       getpid(), reads, distinct, retries, last);
+	shr_close(&shr);
+	return 0;
+
+fail:
+	perror(called);
+	return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	shr_key_t key;
+	shr_t shr;
+	struct book *book;
+	unsigned long long snapshots, v;
+	long interval;
+	int readers, i, j, status, ret = 0;
+	char *buf;
+	double start;
+
+	if (argc != 4) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	snapshots = strtoull(argv[1], NULL, 10);
+	readers = atoi(argv[2]);
+	interval = strtol(argv[3], NULL, 10);
+
+	t (shr_create_flags(&key, sizeof(struct book), 3, S_IRUSR | S_IWUSR, SHR_LATEST));
+	for (i = 0; i < readers; i++) {
+		switch (fork()) {
+		case -1:
+			called = "fork";
+			goto fail;
+		case 0:
+			return reader(&key, interval);
+		default:
+			break;
+		}
+	}
+
+	t (shr_open(&shr, &key, SHR_WRITE));
+	start = now();
+	for (v = 1; v <= snapshots; v++) {
+		t (shr_write(&shr, &buf));
+		book = (struct book *)(void *)buf;
+		book->version = v;
+		for (j = 0; j < LEVELS; j++) {
+			book->bid[j].price = 100.0 - j, book->bid[j].quantity = (double)(v + (unsigned)j);
+			book->ask[j].price = 101.0 + j, book->ask[j].quantity = (double)(v + (unsigned)j);
+		}
+		book->version_again = v;
+		t (shr_write_done(&shr, sizeof(*book)));
+	}
+	printf("writer: %.1f ns/snapshot\n", (now() - start) * 1e9 / (double)snapshots);
+	fflush(stdout);
+	shr_close(&shr);
+
+	for (i = 0; i < readers; i++) {
+		wait(&status);
+		ret |= !WIFEXITED(status) || WEXITSTATUS(status);
+	}
+	shr_remove_by_key(&key);
+	return ret;
+
+fail:
+	perror(called);
+	return 1;
+}
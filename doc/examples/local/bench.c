@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+
+#define BUFFER_SIZE  64
+
+
+static unsigned long messages;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.;
+}
+
+
+static void *
+writer(void *arg)
+{
+	shr_t *shr = arg;
+	char *buffer;
+	unsigned long i;
+
+	for (i = 0; i < messages; i++) {
+		t (shr_write(shr, &buffer));
+		memcpy(buffer, &i, sizeof(i));
+		t (shr_write_done(shr, sizeof(i)));
+	}
+	shr_close(shr);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(const char *name, shr_t *shr)
+{
+	shr_t revshr;
+	pthread_t thread;
+	const char *buffer;
+	size_t length;
+	unsigned long i;
+	double start;
+
+	t (shr_reverse_dup(shr, &revshr));
+
+	start = now();
+	pthread_create(&thread, NULL, writer, shr);
+	for (i = 0; i < messages; i++) {
+		t (shr_read(&revshr, &buffer, &length));
+		t (shr_read_done(&revshr));
+	}
+	pthread_join(thread, NULL);
+	start = now() - start;
+
+	printf("%-8s %8.1f ns/message\n", name, start * 1e9 / (double)messages);
+	shr_remove(&revshr);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	shr_key_t key;
+	shr_t shr;
+
+	if (argc != 2) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	messages = strtoul(argv[1], NULL, 10);
+
+	t (shr_open_local(&shr, NULL, BUFFER_SIZE, 8, 0));
+	run("local", &shr);
+
+	SHR_PRIVATE(&key, BUFFER_SIZE, 8);
+	t (shr_open(&shr, &key, SHR_WRITE));
+	run("private", &shr);
+
+	return 0;
+
+fail:
+	perror(called);
+	return 1;
+}
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define MESSAGE_SIZE  256
+
+static shr_key_t key;
+static unsigned long long messages;
+static unsigned long long observed, torn;
+static uint64_t lost;
+static long stall_ms;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void *
+write_thread(void *arg)
+{
+	unsigned long long i;
+	size_t j;
+	shr_t shr;
+	char *buf;
+
+	t (shr_open(&shr, &key, SHR_WRITE));
+	for (i = 0; i < messages; i++) {
+		t (shr_write(&shr, &buf));
+		for (j = 0; j < MESSAGE_SIZE; j += sizeof(i))
+			memcpy(buf + j, &i, sizeof(i));
+		t (shr_write_done(&shr, MESSAGE_SIZE));
+	}
+	/* An empty message marks the end. */
+	t (shr_write(&shr, &buf));
+	t (shr_write_done(&shr, 0));
+	shr_close(&shr);
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+observe_thread(void *arg)
+{
+	char data[MESSAGE_SIZE];
+	struct timespec delay;
+	FILE *f;
+	ssize_t r;
+	size_t j;
+	shr_t shr;
+	int closed = 0;
+
+	t ((f = fopen("/dev/null", "w")) ? 0 : -1);
+	t (shr_open(&shr, &key, SHR_OBSERVE));
+	delay.tv_sec = 0;
+	delay.tv_nsec = stall_ms * 1000000L;
+	observed = torn = 0;
+	while (!closed) {
+		r = shr_observe(&shr, data, sizeof(data), &closed);
+		if (!r || (r < 0 && errno == EPIPE))
+			break;
+		t (r);
+		for (j = sizeof(unsigned long long); j < MESSAGE_SIZE; j += sizeof(unsigned long long))
+			torn += !!memcmp(data, data + j, sizeof(unsigned long long));
+		/* Stand-in for capture to disk. */
+		fwrite(data, 1, (size_t)r, f);
+		if (stall_ms && ++observed % 1000 == 0)
+			nanosleep(&delay, NULL);
+		else if (!stall_ms)
+			observed++;
+	}
+	lost = SHR_LOST(&shr);
+	shr_close(&shr);
+	fclose(f);
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static double
+run(int tap)
+{
+	pthread_t writer, observer;
+	char data[MESSAGE_SIZE];
+	unsigned long long received = 0;
+	double start;
+	ssize_t r;
+	shr_t shr;
+	int closed = 0;
+
+	t (shr_create_flags(&key, MESSAGE_SIZE, 16, S_IRWXU, SHR_OBSERVABLE));
+	t (shr_open(&shr, &key, SHR_READ));
+	start = now();
+	if (tap)
+		t (-pthread_create(&observer, NULL, observe_thread, NULL));
+	t (-pthread_create(&writer, NULL, write_thread, NULL));
+	while (!closed) {
+		t (r = shr_read_copy(&shr, data, sizeof(data), &closed));
+		if (!r)
+			break;
+		received++;
+	}
+	start = now() - start;
+	pthread_join(writer, NULL);
+	if (tap)
+		pthread_join(observer, NULL);
+	shr_close(&shr);
+	shr_remove_by_key(&key);
+	if (received != messages)
+		fprintf(stderr, "reader received %llu of %llu messages\n", received, messages);
+	return start;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	double t;
+
+	messages = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000ULL;
+
+	t = run(0);
+	printf("no observer:       %6.3f s, %5.2f Mmsg/s\n", t, messages / t / 1e6);
+
+	stall_ms = 0;
+	t = run(1);
+	printf("observer:          %6.3f s, %5.2f Mmsg/s, observed %llu, lost %llu, torn %llu\n",
+	       t, messages / t / 1e6, observed, (unsigned long long)lost, torn);
+
+	stall_ms = 20;
+	t = run(1);
+	printf("stalling observer: %6.3f s, %5.2f Mmsg/s, observed %llu, lost %llu, torn %llu\n",
+	       t, messages / t / 1e6, observed, (unsigned long long)lost, torn);
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+static shr_t writer;
+static shr_t reader;
+static unsigned long long messages;
+static double write_time;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void *
+write_thread(void *arg)
+{
+	unsigned long long i;
+	char *buf;
+	double start = now();
+
+	for (i = 0; i <= messages; i++) {
+		/* Never blocks, however far behind the reader is. */
+		t (shr_write(&writer, &buf));
+		memcpy(buf, &i, sizeof(i));
+		t (shr_write_done(&writer, sizeof(i)));
+	}
+	write_time = now() - start;
+	shr_close(&writer);
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	pthread_t thread;
+	struct timespec delay;
+	unsigned long long value, last = 0, received = 0, torn = 0;
+	const char *buf;
+	size_t len;
+	int have_last = 0, r;
+
+	if (argc != 3) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	messages = strtoull(argv[1], NULL, 10);
+	delay.tv_sec = 0;
+	delay.tv_nsec = strtol(argv[2], NULL, 10) * 1000L;
+
+	t (shr_open_local(&writer, NULL, sizeof(value), 64, SHR_OVERWRITE));
+	t (shr_reverse_dup(&writer, &reader));
+	t (-pthread_create(&thread, NULL, write_thread, NULL));
+
+	for (;;) {
+		if (shr_read(&reader, &buf, &len)) {
+			if (errno == ESTALE)
+				continue;
+			goto fail_read;
+		}
+		memcpy(&value, buf, sizeof(value));
+		r = shr_read_done(&reader);
+		if (r < 0) {
+			if (errno == ESTALE) {
+				torn++;
+				continue;
+			}
+			goto fail_read;
+		}
+		if (value == messages)
+			break;
+		if (have_last && value <= last) {
+			fprintf(stderr, "message %llu after %llu\n", value, last);
+			return 1;
+		}
+		have_last = 1;
+		last = value;
+		received++;
+		if (delay.tv_nsec)
+			nanosleep(&delay, NULL);
+	}
+	pthread_join(thread, NULL);
+
+	printf("received %llu, lost %llu (of which %llu torn), total %llu\n",
+	       received, (unsigned long long)SHR_LOST(&reader), torn,
+	       received + (unsigned long long)SHR_LOST(&reader));
+	printf("writer: %.1f ns/msg\n", write_time * 1e9 / (double)(messages + 1));
+
+	shr_remove(&reader);
+	return 0;
+
+fail_read:
+	called = "shr_read";
+fail:
+	perror(called);
+	return 1;
+}
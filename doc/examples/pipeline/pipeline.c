@@ -0,0 +1,127 @@
+#include <shr_pipeline.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+static unsigned long long messages;
+static unsigned long long work;
+
+
+static int
+source(shr_stage_t *stage, void *user)
+{
+	unsigned long long i;
+	char *buffer;
+	for (i = 0; i < messages; i++) {
+		if (shr_stage_write(stage, 0, &buffer))
+			return perror("source"), -1;
+		memcpy(buffer, &i, sizeof(i));
+		if (shr_stage_write_done(stage, 0, sizeof(i)))
+			return perror("source"), -1;
+	}
+	return (void) user, 0;
+}
+
+
+static int
+work_stage(shr_stage_t *stage, void *user)
+{
+	volatile unsigned long long sink;
+	unsigned long long i, value;
+	const char *in;
+	char *out;
+	size_t length;
+	int r;
+	for (;;) {
+		r = shr_stage_read(stage, 0, &in, &length);
+		if (r)
+			return r < 0 ? perror("work"), -1 : 0;
+		memcpy(&value, in, sizeof(value));
+		if (shr_stage_read_done(stage, 0))
+			return perror("work"), -1;
+		for (i = 0; i < work; i++)
+			sink = i;
+		if (shr_stage_write(stage, 0, &out))
+			return perror("work"), -1;
+		memcpy(out, &value, sizeof(value));
+		if (shr_stage_write_done(stage, 0, sizeof(value)))
+			return perror("work"), -1;
+	}
+	return (void) sink, (void) user, 0;
+}
+
+
+static int
+sink(shr_stage_t *stage, void *user)
+{
+	unsigned long long expected = 0, value;
+	const char *buffer;
+	size_t length;
+	int r;
+	for (;;) {
+		r = shr_stage_read(stage, 0, &buffer, &length);
+		if (r)
+			break;
+		memcpy(&value, buffer, sizeof(value));
+		if (value != expected++)
+			return fprintf(stderr, "sink: got %llu, expected %llu\n", value, expected - 1), -1;
+		if (shr_stage_read_done(stage, 0))
+			return perror("sink"), -1;
+	}
+	if (r < 0)
+		return perror("sink"), -1;
+	if (expected != messages)
+		return fprintf(stderr, "sink: got %llu messages\n", expected), -1;
+	return (void) user, 0;
+}
+
+
+static const struct shr_stage_func functions[] = {
+	{"source", source},
+	{"work",   work_stage},
+	{"sink",   sink},
+	{NULL, NULL}
+};
+
+
+int
+main(int argc, char *argv[])
+{
+	shr_pipeline_t *pipeline;
+	char config[4096];
+	size_t n, line;
+	FILE *f;
+	int ret;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s CONFIG MESSAGES WORK\n", *argv);
+		return 1;
+	}
+	messages = strtoull(argv[2], NULL, 10);
+	work = strtoull(argv[3], NULL, 10);
+
+	if (!(f = fopen(argv[1], "r")))
+		return perror(argv[1]), 1;
+	n = fread(config, 1, sizeof(config) - 1, f);
+	fclose(f);
+	config[n] = '\0';
+
+	if (!(pipeline = shr_pipeline_create()))
+		return perror("shr_pipeline_create"), 1;
+	if (shr_pipeline_load(pipeline, config, functions, NULL, &line)) {
+		fprintf(stderr, "%s:%zu: ", argv[1], line);
+		perror(NULL);
+		return shr_pipeline_destroy(pipeline), 1;
+	}
+	if (shr_pipeline_start(pipeline, SHR_PIPELINE_PIN)) {
+		perror("shr_pipeline_start");
+		return shr_pipeline_destroy(pipeline), 1;
+	}
+	ret = shr_pipeline_wait(pipeline);
+	shr_pipeline_report(pipeline, stdout);
+	shr_pipeline_destroy(pipeline);
+	return ret ? 1 : 0;
+}
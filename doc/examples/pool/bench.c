@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+
+#define BUFFER_SIZE  64
+
+
+struct ring
+{
+	shr_t writer;
+	unsigned long messages;
+	unsigned long next;
+};
+
+
+static unsigned long work;
+static volatile unsigned long sink;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.;
+}
+
+
+static void *
+writer(void *arg)
+{
+	struct ring *ring = arg;
+	char *buffer;
+	unsigned long i;
+
+	for (i = 0; i < ring->messages; i++) {
+		t (shr_write(&ring->writer, &buffer));
+		memcpy(buffer, &i, sizeof(i));
+		t (shr_write_done(&ring->writer, sizeof(i)));
+	}
+	shr_close(&ring->writer);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static int
+handler(void *user, size_t i, const char *buffer, size_t length)
+{
+	struct ring *rings = user;
+	unsigned long value, j, x = 0;
+
+	(void) length;
+	memcpy(&value, buffer, sizeof(value));
+	if (value != rings[i].next++) {
+		fprintf(stderr, "ring %zu: got message %lu, expected %lu\n", i, value, rings[i].next - 1);
+		exit(1);
+	}
+	for (j = 0; j < work; j++)
+		x = x * 31 + j;
+	sink = x;
+	return 0;
+}
+
+
+static void
+run(const char *name, size_t count, unsigned long messages, size_t threads, int flags)
+{
+	struct ring *rings = calloc(count, sizeof(*rings));
+	shr_t *readers = calloc(count, sizeof(*readers));
+	pthread_t *writers = calloc(count, sizeof(*writers));
+	unsigned long total = 0;
+	double harmonic = 0, start;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		harmonic += 1. / (double)(i + 1);
+	for (i = 0; i < count; i++) {
+		rings[i].messages = (unsigned long)((double)messages / harmonic / (double)(i + 1));
+		total += rings[i].messages;
+		t (shr_open_local(&rings[i].writer, NULL, BUFFER_SIZE, 16, 0));
+		t (shr_reverse_dup(&rings[i].writer, readers + i));
+	}
+
+	start = now();
+	for (i = 0; i < count; i++)
+		pthread_create(writers + i, NULL, writer, rings + i);
+	t (shr_pool_run(readers, count, threads, flags, handler, rings));
+	for (i = 0; i < count; i++)
+		pthread_join(writers[i], NULL);
+	start = now() - start;
+
+	printf("%-12s %12.0f messages/s\n", name, (double)total / start);
+
+	for (i = 0; i < count; i++)
+		shr_remove(readers + i);
+	free(rings);
+	free(readers);
+	free(writers);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t count, threads;
+	unsigned long messages;
+
+	if (argc != 5) {
+		fprintf(stderr, "See README for usage.\n");
+		return 1;
+	}
+	count = (size_t)strtoul(argv[1], NULL, 10);
+	messages = strtoul(argv[2], NULL, 10);
+	work = strtoul(argv[3], NULL, 10);
+	threads = (size_t)strtoul(argv[4], NULL, 10);
+
+	run("stealing", count, messages, threads, 0);
+	run("no stealing", count, messages, threads, SHR_POOL_NO_STEAL);
+	return 0;
+}
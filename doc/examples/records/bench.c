@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <shr_records.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE   16384
+#define BUFFER_COUNT  256
+#define ROUNDS        20
+
+static shr_t writer;
+static shr_t reader;
+static char *text;
+static size_t text_length;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+/* Fill all buffers but one with the text, split without regard to the lines, and end it. */
+static void
+fill(void)
+{
+	size_t off, n;
+	char *buf;
+
+	for (off = 0; off < text_length; off += n) {
+		n = text_length - off < BUFFER_SIZE ? text_length - off : BUFFER_SIZE;
+		t (shr_write(&writer, &buf));
+		memcpy(buf, text + off, n);
+		t (shr_write_done(&writer, n));
+	}
+	t (shr_write(&writer, &buf));
+	t (shr_write_done(&writer, 0));
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+consume(const char *record, size_t length, unsigned long long *records, unsigned long long *sum)
+{
+	*records += 1;
+	*sum += length + (length ? (unsigned char)record[0] : 0);
+}
+
+
+static double
+naive(unsigned long long *records, unsigned long long *sum)
+{
+	char *carry = malloc(BUFFER_SIZE);
+	size_t carry_length = 0, length;
+	const char *buf, *p, *end, *nl;
+	double start, elapsed = 0;
+	int round;
+
+	for (round = 0; round < ROUNDS; round++) {
+		fill();
+		start = now();
+		for (;;) {
+			t (shr_read(&reader, &buf, &length));
+			if (!length) {
+				t (shr_read_done(&reader));
+				break;
+			}
+			for (p = buf, end = buf + length; (nl = memchr(p, '\n', (size_t)(end - p))); p = nl + 1) {
+				if (carry_length) {
+					memcpy(carry + carry_length, p, (size_t)(nl - p));
+					consume(carry, carry_length + (size_t)(nl - p), records, sum);
+					carry_length = 0;
+				} else {
+					consume(p, (size_t)(nl - p), records, sum);
+				}
+			}
+			memcpy(carry + carry_length, p, (size_t)(end - p));
+			carry_length += (size_t)(end - p);
+			t (shr_read_done(&reader));
+		}
+		if (carry_length)
+			consume(carry, carry_length, records, sum), carry_length = 0;
+		elapsed += now() - start;
+	}
+	free(carry);
+	return elapsed;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static double
+iterator(unsigned long long *records, unsigned long long *sum)
+{
+	shr_records_t it;
+	const char *record;
+	size_t length;
+	double start, elapsed = 0;
+	int round, r;
+
+	for (round = 0; round < ROUNDS; round++) {
+		fill();
+		start = now();
+		shr_records_init(&it, &reader, '\n');
+		while ((r = shr_records_next(&it, &record, &length)) > 0)
+			consume(record, length, records, sum);
+		t (r);
+		shr_records_destroy(&it);
+		elapsed += now() - start;
+	}
+	return elapsed;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	static const size_t means[] = {8, 32, 128, 512};
+	unsigned long long records[2], sums[2];
+	double times[2];
+	size_t i, j, n, mean;
+
+	t (shr_open_local(&writer, NULL, BUFFER_SIZE, BUFFER_COUNT, 0));
+	t (shr_reverse_dup(&writer, &reader));
+	text_length = (size_t)BUFFER_SIZE * (BUFFER_COUNT - 1);
+	text = malloc(text_length);
+
+	for (i = 0; i < sizeof(means) / sizeof(*means); i++) {
+		mean = means[i];
+		srand(1);
+		for (j = 0; j < text_length; j += n + 1) {
+			n = (size_t)rand() % (2 * mean);
+			memset(text + j, 'x', j + n < text_length ? n : text_length - j);
+			if (j + n < text_length)
+				text[j + n] = '\n';
+		}
+		records[0] = records[1] = sums[0] = sums[1] = 0;
+		times[0] = naive(&records[0], &sums[0]);
+		times[1] = iterator(&records[1], &sums[1]);
+		if (records[0] != records[1] || sums[0] != sums[1])
+			fprintf(stderr, "mismatch: %llu/%llu records, %llu/%llu\n", records[0], records[1], sums[0], sums[1]);
+		printf("mean record %4zu bytes:  memchr loop %6.2f GB/s, %6.1f Mrec/s;  shr_records %6.2f GB/s, %6.1f Mrec/s\n",
+		       mean,
+		       text_length * ROUNDS / times[0] / 1e9, records[0] / times[0] / 1e6,
+		       text_length * ROUNDS / times[1] / 1e9, records[1] / times[1] / 1e6);
+	}
+
+	free(text);
+	shr_close(&reader);
+	shr_close(&writer);
+	shr_remove(&writer);
+	return 0;
+	(void) argc;
+	(void) argv;
+
+fail:
+	perror(called);
+	return 1;
+}
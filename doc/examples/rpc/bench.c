@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr_rpc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE   256
+#define BUFFER_COUNT  64
+#define WARMUP        10000
+#define CALLS         200000
+
+
+static shr_rpc_t *client;
+static shr_rpc_t *server;
+static size_t completed;
+
+
+static long long
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int
+cmp(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+static ssize_t
+echo(void *user, uint64_t id, const char *request, size_t length, char *reply, size_t size)
+{
+	(void) user;
+	(void) id;
+	(void) size;
+	memcpy(reply, request, length);
+	return (ssize_t)length;
+}
+
+
+static void
+done(void *user, uint64_t id, const char *reply, size_t length)
+{
+	(void) user;
+	(void) id;
+	(void) reply;
+	(void) length;
+	completed++;
+}
+
+
+static void *
+serve_thread(void *arg)
+{
+	t (shr_rpc_serve(server, echo, NULL));
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(int local)
+{
+	static long long rtt[CALLS];
+	struct shr_rpc_key key;
+	pthread_t thread;
+	char request[32], reply[32];
+	long long start, elapsed;
+	size_t i;
+
+	if (local) {
+		t (shr_rpc_open_local(&client, &server, BUFFER_SIZE, BUFFER_COUNT, 0));
+	} else {
+		t (shr_rpc_create(&key, BUFFER_SIZE, BUFFER_COUNT, 0600, 0));
+		t ((client = shr_rpc_open(&key, SHR_RPC_CLIENT)) ? 0 : -1);
+		t ((server = shr_rpc_open(&key, SHR_RPC_SERVER)) ? 0 : -1);
+	}
+	pthread_create(&thread, NULL, serve_thread, NULL);
+	memset(request, 'x', sizeof(request));
+
+	/* Ping-pong: one call at a time. */
+	for (i = 0; i < WARMUP; i++)
+		t (shr_rpc_call(client, request, sizeof(request), reply, sizeof(reply)));
+	for (i = 0; i < CALLS; i++) {
+		start = now();
+		t (shr_rpc_call(client, request, sizeof(request), reply, sizeof(reply)));
+		rtt[i] = now() - start;
+	}
+	qsort(rtt, CALLS, sizeof(*rtt), cmp);
+
+	/* Pipelined: as many calls in flight as there are buffers. */
+	completed = 0;
+	start = now();
+	for (i = 0; i < CALLS; i++)
+		t (shr_rpc_send(client, request, sizeof(request), done, NULL, NULL));
+	while (shr_rpc_pending(client))
+		t (shr_rpc_complete(client, 0));
+	elapsed = now() - start;
+
+	printf("%-6s round trip p50 %6.2f us  p99 %6.2f us   pipelined %9.0f calls/s\n",
+	       local ? "local" : "XSI", rtt[CALLS / 2] / 1e3, rtt[CALLS * 99 / 100] / 1e3,
+	       completed / (elapsed / 1e9));
+
+	shr_rpc_close(client);
+	pthread_join(thread, NULL);
+	shr_rpc_remove(server);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(void)
+{
+	run(1);
+	run(0);
+	return 0;
+}
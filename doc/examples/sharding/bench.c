@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr_shard.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE   64
+#define BUFFER_COUNT  256
+#define MAX_SHARDS    8
+#define KEYS          1000
+#define MESSAGES      400000
+#define WORK_NS       1000L  /* processing a message takes 1 us */
+
+
+static shr_key_t keys[MAX_SHARDS];
+static size_t shards;
+
+
+static long long
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void
+spin(long long ns)
+{
+	long long end = now() + ns;
+	while (now() < end);
+}
+
+
+static void *
+read_thread(void *arg)
+{
+	size_t member = (size_t)arg;
+	shr_shard_t *shard;
+	const char *buf;
+	size_t len;
+	int r;
+
+	shard = shr_shard_join(keys, shards, member, shards);
+	t (shard ? 0 : -1);
+	while (!(r = shr_shard_read(shard, NULL, &buf, &len))) {
+		spin(WORK_NS);
+		t (shr_shard_read_done(shard));
+	}
+	t (r);
+	shr_shard_close(shard);
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(size_t n, int hot)
+{
+	pthread_t threads[MAX_SHARDS];
+	shr_shard_t *shard;
+	struct shr_shard_stats stats;
+	unsigned seed = 1, key;
+	long long start, elapsed;
+	uint64_t blocked = 0;
+	char *buf;
+	size_t i;
+
+	shards = n;
+	t (shr_shard_create(keys, shards, BUFFER_SIZE, BUFFER_COUNT, 0600, 0));
+	shard = shr_shard_open(keys, shards);
+	t (shard ? 0 : -1);
+	for (i = 0; i < shards; i++)
+		pthread_create(threads + i, NULL, read_thread, (void *)i);
+
+	start = now();
+	for (i = 0; i < MESSAGES; i++) {
+		/* With a hot key, half of the messages have the same key. */
+		key = hot && (i & 1) ? 0 : (unsigned)rand_r(&seed) % KEYS;
+		t (shr_shard_write(shard, &key, sizeof(key), &buf));
+		memcpy(buf, &i, sizeof(i));
+		t (shr_shard_write_done(shard, sizeof(i)));
+	}
+	t (shr_shard_finish(shard));
+	for (i = 0; i < shards; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = now() - start;
+
+	for (i = 0; i < shards; i++) {
+		t (shr_shard_stats(shard, i, &stats));
+		blocked += stats.blocked_ns;
+	}
+	printf("%zu shard%s %-10s %10.0f messages/s  skew %5.2f  writer blocked %6.1f%%\n",
+	       shards, shards == 1 ? " " : "s", hot ? "(hot key)" : "",
+	       MESSAGES / (elapsed / 1e9), shr_shard_skew(shard), 100.0 * (double)blocked / (double)elapsed);
+
+	shr_shard_close(shard);
+	shr_shard_remove(keys, shards);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(void)
+{
+	run(1, 0);
+	run(2, 0);
+	run(4, 0);
+	run(4, 1);
+	return 0;
+}
@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <shr.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_COUNT  256
+#define BATCH         64
+
+
+static unsigned long packets;
+static size_t size;
+static struct sockaddr_in address;
+static int batched;
+static unsigned long syscalls;
+static unsigned long received;
+static double first_time, last_time;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static int
+udp_socket(int bind_it)
+{
+	struct timeval timeout = {0, 200000};
+	int fd, bufsize = 64 << 20;
+	t (fd = socket(AF_INET, SOCK_DGRAM, 0));
+	t (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)));
+	t (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+	if (bind_it) {
+		t (bind(fd, (struct sockaddr *)&address, sizeof(address)));
+	}
+	return fd;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+flood(void *arg)
+{
+	struct mmsghdr msgs[BATCH];
+	struct iovec iov;
+	char *data = calloc(1, size);
+	unsigned long i;
+	int fd = *(int *)arg, j, n;
+
+	iov.iov_base = data;
+	iov.iov_len = size;
+	memset(msgs, 0, sizeof(msgs));
+	for (j = 0; j < BATCH; j++) {
+		msgs[j].msg_hdr.msg_iov = &iov;
+		msgs[j].msg_hdr.msg_iovlen = 1;
+		msgs[j].msg_hdr.msg_name = &address;
+		msgs[j].msg_hdr.msg_namelen = sizeof(address);
+	}
+
+	for (i = 0; i < packets; i += (unsigned long)n) {
+		n = packets - i < BATCH ? (int)(packets - i) : BATCH;
+		t (n = sendmmsg(fd, msgs, (unsigned int)n, 0));
+	}
+	free(data);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+ingest(void *arg)
+{
+	shr_t *shr = arg;
+	char *data = malloc(size);
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	ssize_t r;
+	int fd = udp_socket(1);
+
+	for (;;) {
+		syscalls++;
+		if (batched) {
+			r = shr_dgram_in(shr, fd, BATCH, 0);
+		} else {
+			fromlen = sizeof(from);
+			r = recvfrom(fd, data, size, 0, (struct sockaddr *)&from, &fromlen);
+			if (r >= 0) {
+				t (shr_write_copy(shr, data, (size_t)r));
+				t (shr_write_address(shr, (struct sockaddr *)&from, fromlen));
+				r = 1;
+			}
+		}
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		t (r);
+		if (!received)
+			first_time = now();
+		received += (unsigned long)r;
+		last_time = now();
+		if (received >= packets)
+			break;
+	}
+
+	t (shr_write_copy(shr, NULL, 0));
+	close(fd);
+	free(data);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+drain(void *arg)
+{
+	shr_t *shr = arg;
+	const char *buffer;
+	size_t length;
+
+	for (;;) {
+		t (shr_read(shr, &buffer, &length));
+		t (shr_read_done(shr));
+		if (!length)
+			break;
+	}
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run_ingest(void)
+{
+	pthread_t threads[3];
+	shr_t writer, reader;
+	int fd;
+
+	t (shr_open_local(&writer, NULL, size, BUFFER_COUNT, SHR_ADDRESS));
+	t (shr_reverse_dup(&writer, &reader));
+	syscalls = received = 0;
+
+	fd = udp_socket(0);
+	pthread_create(threads + 0, NULL, ingest, &writer);
+	usleep(50000);
+	pthread_create(threads + 1, NULL, drain, &reader);
+	pthread_create(threads + 2, NULL, flood, &fd);
+	pthread_join(threads[2], NULL);
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+	close(fd);
+
+	printf("  ingest %-14s %8lu packets  %8.0f kpackets/s  %6.3f socket calls/packet\n",
+	       batched ? "shr_dgram_in" : "recvfrom", received,
+	       received / (last_time - first_time) / 1e3, (double)syscalls / (double)received);
+
+	shr_close(&reader);
+	shr_close(&writer);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void *
+produce(void *arg)
+{
+	shr_t *shr = arg;
+	char *data = calloc(1, size);
+	unsigned long i;
+
+	for (i = 0; i < packets; i++) {
+		char *buffer;
+		t (shr_write(shr, &buffer));
+		memcpy(buffer, data, size);
+		t (shr_write_address(shr, (struct sockaddr *)&address, sizeof(address)));
+		t (shr_write_done(shr, size));
+	}
+	t (shr_write_copy(shr, NULL, 0));
+	free(data);
+	return NULL;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run_egress(void)
+{
+	pthread_t thread;
+	shr_t writer, reader;
+	struct sockaddr_in to;
+	socklen_t tolen;
+	const char *buffer;
+	size_t length;
+	unsigned long sent = 0;
+	double start, end;
+	ssize_t r;
+	int fd, sink;
+
+	t (shr_open_local(&writer, NULL, size, BUFFER_COUNT, SHR_ADDRESS));
+	t (shr_reverse_dup(&writer, &reader));
+	sink = udp_socket(1);
+	fd = udp_socket(0);
+	syscalls = 0;
+
+	pthread_create(&thread, NULL, produce, &writer);
+	start = now();
+	for (;;) {
+		syscalls++;
+		if (batched) {
+			t (r = shr_dgram_out(&reader, fd, BATCH, NULL));
+			if (!r)
+				break;
+			sent += (unsigned long)r;
+		} else {
+			t (shr_read(&reader, &buffer, &length));
+			if (!length) {
+				t (shr_read_done(&reader));
+				break;
+			}
+			tolen = sizeof(to);
+			t (shr_read_address(&reader, (struct sockaddr *)&to, &tolen));
+			t (sendto(fd, buffer, length, 0, (struct sockaddr *)&to, tolen));
+			t (shr_read_done(&reader));
+			sent += 1;
+		}
+	}
+	end = now();
+	pthread_join(thread, NULL);
+
+	printf("  egress %-14s %8lu packets  %8.0f kpackets/s  %6.3f socket calls/packet\n",
+	       batched ? "shr_dgram_out" : "sendto", sent,
+	       sent / (end - start) / 1e3, (double)syscalls / (double)sent);
+
+	close(fd);
+	close(sink);
+	shr_close(&reader);
+	shr_close(&writer);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	static const size_t sizes[] = {64, 512, 1400};
+	size_t i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s PACKETS\n", *argv);
+		return 1;
+	}
+	packets = strtoul(argv[1], NULL, 10);
+
+	address.sin_family = AF_INET;
+	address.sin_port = htons(47339);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		size = sizes[i];
+		printf("%zu-byte packets\n", size);
+		for (batched = 0; batched < 2; batched++)
+			run_ingest();
+		for (batched = 0; batched < 2; batched++)
+			run_egress();
+	}
+	return 0;
+}
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <shr_uring.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE  3000
+#define QUEUE_DEPTH  64
+#define INGRESS      2
+#define EGRESS       4
+
+
+/* The parts of an io_uring that are used, set up without liburing. */
+struct uring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned tail;
+};
+
+
+static int source[2];
+static int sink[2];
+static size_t total;
+
+
+static unsigned char
+pattern(size_t offset)
+{
+	return (unsigned char)(offset * 7 % 251);
+}
+
+
+static int
+uring_setup(struct uring *u)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = (int)syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+	if (u->fd < 0)
+		return -1;
+	sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(unsigned), PROT_READ | PROT_WRITE,
+	          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	cq = mmap(NULL, p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe), PROT_READ | PROT_WRITE,
+	          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || u->sqes == MAP_FAILED)
+		return -1;
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	u->tail = *u->sq_tail;
+	return 0;
+}
+
+
+static struct io_uring_sqe *
+get_sqe(void *context)
+{
+	struct uring *u = context;
+	unsigned i = u->tail++ & *u->sq_mask;
+	u->sq_array[i] = i;
+	memset(&u->sqes[i], 0, sizeof(u->sqes[i]));
+	return &u->sqes[i];
+}
+
+
+static int
+uring_enter(struct uring *u)
+{
+	unsigned n = u->tail - *u->sq_tail;
+	__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+	return (int)syscall(__NR_io_uring_enter, u->fd, n, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+
+/* Writes the data into the file the write end reads from, in pieces of odd sizes. */
+static void *
+produce(void *arg)
+{
+	static unsigned char buf[5000];
+	size_t offset = 0, i, n;
+	ssize_t r;
+
+	while (offset < total) {
+		n = total - offset < sizeof(buf) ? total - offset : sizeof(buf) - offset % 17;
+		for (i = 0; i < n; i++)
+			buf[i] = pattern(offset + i);
+		t (r = write(source[1], buf, n));
+		offset += (size_t)r;
+	}
+	close(source[1]);
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+/* Reads the data from the socket the read end writes to, a little at a time. */
+static void *
+consume(void *arg)
+{
+	static unsigned char buf[1 << 12];
+	size_t offset = 0;
+	ssize_t i, n;
+
+	while ((n = read(sink[1], buf, sizeof(buf))) > 0)
+		for (i = 0; i < n; i++, offset++)
+			if (buf[i] != pattern(offset))
+				fprintf(stderr, "mismatch at byte %zu\n", offset), exit(1);
+	t (n);
+	if (offset != total)
+		fprintf(stderr, "received %zu of %zu bytes\n", offset, total), exit(1);
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	struct uring ring;
+	shr_t writer, reader;
+	shr_uring_t in, out;
+	shr_uring_t *u;
+	struct io_uring_cqe *cqe;
+	pthread_t producer, consumer;
+	size_t buffer_count = argc > 1 ? (size_t)atol(argv[1]) : 4;
+	size_t waits = 0, partial = 0;
+	unsigned head, tail;
+	int sndbuf = 4096, in_done = 0, out_done = 0, r;
+	ssize_t n;
+
+	total = (argc > 2 ? (size_t)atol(argv[2]) : 64) << 20;
+
+	t (shr_open_local(&writer, NULL, BUFFER_SIZE, buffer_count, 0));
+	t (shr_reverse_dup(&writer, &reader));
+	t (uring_setup(&ring));
+	t (pipe(source));
+	t (socketpair(AF_UNIX, SOCK_STREAM, 0, sink));
+	t (setsockopt(sink[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)));
+	t (shr_uring_init(&in, &writer, source[0], INGRESS));
+	t (shr_uring_init(&out, &reader, sink[0], EGRESS));
+
+	pthread_create(&producer, NULL, produce, NULL);
+	pthread_create(&consumer, NULL, consume, NULL);
+
+	t (shr_uring_submit(&in, SHR_URING_MAX, get_sqe, &ring));
+	t (shr_uring_submit(&out, SHR_URING_MAX, get_sqe, &ring));
+
+	while (!out_done) {
+		if (uring_enter(&ring) < 0 && errno != EINTR)
+			t (uring_enter(&ring));
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			u = SHR_URING_USER_DATA(cqe->user_data) == INGRESS ? &in : &out;
+			waits += cqe->user_data & 1;
+			n = shr_uring_complete(u, cqe->user_data, cqe->res, NULL);
+			if (n < 0 && errno == EINPROGRESS)
+				continue;
+			if (n < 0 && errno != EAGAIN)
+				t (n);
+			if (u == &in) {
+				/* The write end has published an empty buffer, which marks the end. */
+				if (!n) {
+					in_done = 1;
+					shr_close(&writer);
+					continue;
+				}
+				t (shr_uring_submit(&in, SHR_URING_MAX, get_sqe, &ring));
+			} else {
+				partial += n > 0 && out.offset;
+				t (r = shr_uring_submit(&out, SHR_URING_MAX, get_sqe, &ring));
+				out_done = r;
+			}
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	close(sink[0]);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+	shr_close(&reader);
+
+	printf("%zu bytes through %zu buffers: ok\n", total, buffer_count);
+	printf("futex waits: %zu, partial writes resumed: %zu, end of data: %s\n",
+	       waits, partial, in_done ? "yes" : "no");
+	return 0;
+
+fail:
+	perror(called);
+	return 1;
+}
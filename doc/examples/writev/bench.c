@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+#include <shr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define t(c)  if (called = #c, (c) < 0)  goto fail
+static const char* called = NULL;
+
+#define BUFFER_SIZE   (16 << 10)
+#define BUFFER_COUNT  64
+#define MESSAGES      100000
+
+
+struct header {
+	size_t length;
+	size_t sequence;
+};
+
+
+static shr_t writer;
+static shr_t reader;
+static size_t payload_size;
+static char *payload;
+static char *staging;
+static int use_writev;
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+static void *
+write_thread(void *arg)
+{
+	struct header header;
+	struct iovec iov[2];
+	size_t i, off, len, total;
+
+	header.length = payload_size;
+	total = sizeof(header) + payload_size;
+	for (i = 0; i < MESSAGES; i++) {
+		header.sequence = i;
+		if (use_writev) {
+			iov[0].iov_base = &header;
+			iov[0].iov_len = sizeof(header);
+			iov[1].iov_base = payload;
+			iov[1].iov_len = payload_size;
+			t (shr_writev(&writer, iov, 2));
+		} else {
+			/* Assemble the message, then write it one buffer at a time. */
+			memcpy(staging, &header, sizeof(header));
+			memcpy(staging + sizeof(header), payload, payload_size);
+			for (off = 0; off < total; off += len) {
+				len = total - off < BUFFER_SIZE ? total - off : BUFFER_SIZE;
+				t (shr_write_copy(&writer, staging + off, len));
+			}
+		}
+	}
+	t (shr_write_copy(&writer, NULL, 0));
+	return arg;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+static void
+run(int writev)
+{
+	pthread_t thread;
+	const char *buf;
+	size_t len, bytes = 0, messages = 0, left = 0;
+	struct header header;
+	double start, elapsed;
+
+	use_writev = writev;
+	t (shr_open_local(&writer, NULL, BUFFER_SIZE, BUFFER_COUNT, 0));
+	t (shr_reverse_dup(&writer, &reader));
+	start = now();
+	pthread_create(&thread, NULL, write_thread, NULL);
+
+	for (;;) {
+		t (shr_read(&reader, &buf, &len));
+		if (!len) {
+			t (shr_read_done(&reader));
+			break;
+		}
+		if (!left) {
+			memcpy(&header, buf, sizeof(header));
+			left = sizeof(header) + header.length;
+			messages++;
+		}
+		left -= len;
+		bytes += len;
+		t (shr_read_done(&reader));
+	}
+	pthread_join(thread, NULL);
+	elapsed = now() - start;
+
+	printf("%-28s %6zu B payload  %8.2f GB/s  %8.0f messages/s\n",
+	       writev ? "shr_writev" : "staging + shr_write_copy", payload_size,
+	       (double)bytes / elapsed / 1e9, (double)messages / elapsed);
+
+	shr_close(&reader);
+	shr_remove(&writer);
+	return;
+
+fail:
+	perror(called);
+	exit(1);
+}
+
+
+int main(void)
+{
+	static const size_t sizes[] = {1000, 16000, 40000, 120000};
+	size_t i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		payload_size = sizes[i];
+		payload = malloc(payload_size);
+		staging = malloc(sizeof(struct header) + payload_size);
+		if (!payload || !staging)
+			return perror("malloc"), 1;
+		memset(payload, 'x', payload_size);
+		run(0);
+		run(1);
+		free(payload);
+		free(staging);
+	}
+	return 0;
+}
@@ -0,0 +1,357 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_arena.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * Round a size up to a multiple of 64, so that each
+ * shared ring buffer starts at a new cache line
+ * 
+ * @param   n:size_t  The size
+ * @return  :size_t   The size rounded up
+ */
+#define ALIGN64(n)  (((n) + 63) & ~(size_t)63)
+
+/**
+ * Get the offset of the first shared ring buffer in an arena
+ * 
+ * @param   count:size_t  The number of shared ring buffers
+ * @return  :size_t       The offset
+ */
+#define FIRST_RING(count)  \
+	ALIGN64(sizeof(struct shr_arena_header) + (count) * sizeof(struct shr_arena_entry))
+
+
+
+/**
+ * An arena, as opened by a process
+ */
+struct shr_arena
+{
+	/**
+	 * The shared memory of the arena
+	 */
+	char *address;
+
+	/**
+	 * The ring table of the arena, copied when the
+	 * arena was opened, after it had been validated
+	 */
+	struct shr_arena_entry *table;
+
+	/**
+	 * The number of shared ring buffers in the arena
+	 */
+	size_t count;
+};
+
+
+
+/**
+ * Get the size of the memory of a shared ring buffer,
+ * rounded up to a multiple of 64, if it is representable
+ * 
+ * @param   buffer_size   The size of each buffer
+ * @param   buffer_count  The number of buffers
+ * @param   flags         The flags of the shared ring buffer
+ * @param   size          Output parameter for the size
+ * @return                Whether the size is representable
+ */
+static int
+ring_size(uint64_t buffer_size, uint64_t buffer_count, int flags, size_t *size)
+{
+	size_t stride;
+
+	if (buffer_size > SIZE_MAX - 64)
+		return 0;
+	stride = SHR_BUFFER_STRIDE((size_t)buffer_size, flags);
+	if (buffer_count > (SIZE_MAX - SHR_HEADER_SIZE - 64) / stride)
+		return 0;
+	*size = ALIGN64(SHR_RING_SIZE((size_t)buffer_size, flags, (size_t)buffer_count));
+	return 1;
+}
+
+
+/**
+ * Create an arena of shared ring buffers
+ * 
+ * @param   key          Output parameter for the key of the arena
+ * @param   rings        The geometry of each shared ring buffer
+ * @param   count        The number of shared ring buffers
+ * @param   permissions  The permissions for the arena
+ * @return               Zero on success, -1 on error
+ */
+int
+shr_arena_create(key_t *restrict key, const struct shr_arena_ring *restrict rings, size_t count, mode_t permissions)
+{
+	struct shr_arena_header *header;
+	struct shr_arena_entry *table;
+	shr_key_t ring_key;
+	size_t i, offset, size;
+	char *address;
+	int shm_id, rint, saved_errno;
+	double r;
+
+	*key = IPC_PRIVATE;
+
+	if (!count || count > (SIZE_MAX / 2 - sizeof(*header)) / sizeof(*table))
+		return errno = EINVAL, -1;
+
+	/* Lay out the shared ring buffers. */
+	offset = FIRST_RING(count);
+	for (i = 0; i < count; i++) {
+		if (!rings[i].buffer_count || !VALID_FLAGS(rings[i].flags))
+			return errno = EINVAL, -1;
+		if (!ring_size(rings[i].buffer_size, rings[i].buffer_count, rings[i].flags, &size) ||
+		    size > SIZE_MAX - offset)
+			return errno = EINVAL, -1;
+		offset += size;
+	}
+
+	permissions |= (permissions & S_IRWXU) ? S_IRWXU : 0;
+	permissions |= (permissions & S_IRWXG) ? S_IRWXG : 0;
+	permissions |= (permissions & S_IRWXO) ? S_IRWXO : 0;
+	permissions &= (mode_t)~(S_IXUSR | S_IXGRP | S_IXOTH);
+
+	/* Create shared memory. */
+	for (;;) {
+		rint = rand();
+		r = (double)rint;
+		r /= (double)RAND_MAX + 1;
+		r *= (1 << (8 * sizeof(key_t) - 2)) - 1;
+
+		*key = (key_t)r + 1;
+		if (*key == IPC_PRIVATE)
+			continue;
+
+		shm_id = shmget(*key, offset, IPC_CREAT | IPC_EXCL | (int)permissions);
+		if (shm_id != -1)
+			break;
+
+		if ((errno != EEXIST) && (errno != EINTR)) {
+			*key = IPC_PRIVATE;
+			return -1;
+		}
+	}
+
+	/* Get shared memory. */
+	address = shmat(shm_id, NULL, 0);
+	if (!address || (address == (void*)-1))
+		goto fail;
+
+	/* Initialise shared memory, XSI shared memory is zeroed. */
+	header = (void *)address;
+	table = (void *)(address + sizeof(*header));
+	header->magic = SHR_ARENA_MAGIC;
+	header->version = SHR_VERSION;
+	header->count = count;
+	header->size = offset;
+	ring_key.shm = ring_key.sem = IPC_PRIVATE;
+	offset = FIRST_RING(count);
+	for (i = 0; i < count; i++) {
+		ring_key.buffer_size = rings[i].buffer_size;
+		ring_key.buffer_count = rings[i].buffer_count;
+		ring_key.flags = rings[i].flags;
+		table[i].offset = offset;
+		table[i].buffer_size = ring_key.buffer_size;
+		table[i].buffer_count = ring_key.buffer_count;
+		table[i].flags = (uint64_t)ring_key.flags;
+		shr_init_header_(address + offset, &ring_key);
+		((struct shr_header *)(void *)(address + offset))->local = SHR_LOCAL_ARENA;
+		ring_size(ring_key.buffer_size, ring_key.buffer_count, ring_key.flags, &size);
+		offset += size;
+	}
+
+	shmdt(address);
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	shmctl(shm_id, IPC_RMID, NULL);
+	*key = IPC_PRIVATE;
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Remove an arena
+ * 
+ * @param   key  The key of the arena
+ * @return       Zero on success, -1 on error
+ */
+int
+shr_arena_remove(key_t key)
+{
+	int shm_id, saved_errno = errno;
+
+	shm_id = shmget(key, 0, 0);
+	if (shm_id == -1 || shmctl(shm_id, IPC_RMID, NULL) == -1)
+		return -1;
+	errno = saved_errno;
+	return 0;
+}
+
+
+/**
+ * Open an arena
+ * 
+ * @param   key  The key of the arena
+ * @return       The arena, `NULL` on error
+ */
+shr_arena_t *
+shr_arena_open(key_t key)
+{
+	const struct shr_arena_header *header;
+	const struct shr_arena_entry *entry;
+	const struct shr_header *ring;
+	struct shr_arena *arena = NULL;
+	struct shmid_ds info;
+	char *address = NULL;
+	size_t i, size;
+	int shm_id, saved_errno;
+
+	shm_id = shmget(key, 0, 0);
+	if (shm_id == -1 || shmctl(shm_id, IPC_STAT, &info) == -1)
+		return NULL;
+	if ((size_t)info.shm_segsz < sizeof(*header))
+		return errno = EINVAL, NULL;
+ retry_mem:
+	address = shmat(shm_id, NULL, 0);
+	if (!address || (address == (void*)-1)) {
+		if (errno == EINTR)
+			goto retry_mem;
+		return NULL;
+	}
+
+	/* Check everything once, so that getting a ring is free. */
+	header = (void *)address;
+	if (header->magic != SHR_ARENA_MAGIC || header->version != SHR_VERSION ||
+	    header->size != (uint64_t)info.shm_segsz || !header->count ||
+	    header->count > (info.shm_segsz - sizeof(*header)) / sizeof(*entry))
+		goto invalid;
+	for (i = 0; i < header->count; i++) {
+		entry = (const void *)(address + sizeof(*header) + i * sizeof(*entry));
+		if (entry->offset % 64 || entry->offset < FIRST_RING((size_t)header->count) ||
+		    entry->flags > INT_MAX || !entry->buffer_count || !VALID_FLAGS((int)entry->flags) ||
+		    !ring_size(entry->buffer_size, entry->buffer_count, (int)entry->flags, &size) ||
+		    entry->offset > header->size || size > header->size - entry->offset)
+			goto invalid;
+		ring = (const void *)(address + entry->offset);
+		if (ring->magic != SHR_MAGIC || ring->version != SHR_VERSION || ring->local != SHR_LOCAL_ARENA ||
+		    ring->flags != (uint32_t)entry->flags || ring->buffer_size != entry->buffer_size ||
+		    ring->buffer_count != entry->buffer_count)
+			goto invalid;
+	}
+
+	arena = malloc(sizeof(*arena));
+	if (!arena)
+		goto fail;
+	arena->address = address;
+	arena->count = (size_t)header->count;
+	arena->table = malloc(arena->count * sizeof(*arena->table));
+	if (!arena->table)
+		goto fail;
+	memcpy(arena->table, address + sizeof(*header), arena->count * sizeof(*arena->table));
+	return arena;
+
+ invalid:
+	errno = EINVAL;
+ fail:
+	saved_errno = errno;
+	free(arena);
+	shmdt(address);
+	return errno = saved_errno, NULL;
+}
+
+
+/**
+ * Close an arena
+ * 
+ * @param  arena  The arena, nothing will happen if this is `NULL`
+ */
+void
+shr_arena_close(shr_arena_t *arena)
+{
+	if (!arena)
+		return;
+	shmdt(arena->address);
+	free(arena->table);
+	free(arena);
+}
+
+
+/**
+ * Get the number of shared ring buffers in an arena
+ * 
+ * @param   arena  The arena
+ * @return         The number of shared ring buffers
+ */
+size_t
+shr_arena_count(const shr_arena_t *restrict arena)
+{
+	return arena->count;
+}
+
+
+/**
+ * Open an end of a shared ring buffer in an arena
+ * 
+ * @param   arena      The arena
+ * @param   i          The index of the shared ring buffer
+ * @param   direction  `SHR_READ` or `SHR_WRITE`
+ * @param   shr        Output parameter for the shared ring buffer
+ * @return             Zero on success, -1 on error
+ */
+int
+shr_arena_ring(shr_arena_t *restrict arena, size_t i, shr_direction_t direction, shr_t *restrict shr)
+{
+	const struct shr_arena_entry *entry;
+
+	if (i >= arena->count || (direction != SHR_READ && direction != SHR_WRITE))
+		return errno = EINVAL, -1;
+	entry = arena->table + i;
+
+	shr->shm = shr->sem = -1;
+	shr->key.shm = shr->key.sem = IPC_PRIVATE;
+	shr->key.buffer_size = (size_t)entry->buffer_size;
+	shr->key.buffer_count = (size_t)entry->buffer_count;
+	shr->key.flags = (int)entry->flags;
+	shr->direction = direction;
+	shr->address = arena->address + entry->offset;
+	shr->sequence = shr->lost = 0;
+	shr->ttl = shr->skipped = 0;
+	shr_local_reset_(shr);
+	if (OVERWRITE(shr))
+		shr_overwrite_reset_(shr);
+	return 0;
+}
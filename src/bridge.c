@@ -0,0 +1,588 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_bridge.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+
+/**
+ * The value of `struct hello.magic`
+ */
+#define BRIDGE_MAGIC  UINT32_C(0x53485242)
+
+/**
+ * The value of `struct hello.version`
+ */
+#define BRIDGE_VERSION  1
+
+/**
+ * `struct frame.flags`: the data is compressed
+ */
+#define FRAME_LZ  0x0001
+
+/**
+ * `struct frame.flags`: the stream has ended, `size` is 0
+ */
+#define FRAME_END  0x0002
+
+/**
+ * The number of bytes the receiving end reads from the
+ * socket at once, frames that are not larger are copied
+ * into the shared ring buffer from this staging buffer
+ */
+#define STAGING_SIZE  65536
+
+
+
+/**
+ * The first message, sent by the receiving end,
+ * all fields are in network byte order
+ */
+struct hello
+{
+	/**
+	 * `BRIDGE_MAGIC`
+	 */
+	uint32_t magic;
+
+	/**
+	 * `BRIDGE_VERSION`
+	 */
+	uint32_t version;
+
+	/**
+	 * The buffer size of the receiving shared ring buffer,
+	 * the high 32 bits followed by the low 32 bits
+	 */
+	uint32_t buffer_size[2];
+
+	/**
+	 * The initial number of credits
+	 */
+	uint32_t credits;
+
+	/**
+	 * Zero
+	 */
+	uint32_t reserved;
+};
+
+
+/**
+ * The header of each buffer sent by the sending
+ * end, all fields are in network byte order
+ */
+struct frame
+{
+	/**
+	 * The number of bytes that follow the header
+	 */
+	uint32_t size;
+
+	/**
+	 * Bitwise-OR of `FRAME_LZ` and `FRAME_END`
+	 */
+	uint32_t flags;
+};
+
+
+
+/**
+ * Receive an exact number of bytes
+ * 
+ * @param   fd   The socket
+ * @param   buf  Output buffer
+ * @param   n    The number of bytes
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  ECONNRESET  The other end closed the socket
+ * @throws  Any error specified for recv(3) except EINTR
+ */
+static int
+recv_all(int fd, void *buf, size_t n)
+{
+	ssize_t got;
+	while (n) {
+		got = recv(fd, buf, n, MSG_WAITALL);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!got)
+			return errno = ECONNRESET, -1;
+		buf = (char *)buf + got;
+		n -= (size_t)got;
+	}
+	return 0;
+}
+
+
+/**
+ * Send an array of memory segments completely
+ * 
+ * @param   fd   The socket
+ * @param   iov  The memory segments, will be modified
+ * @param   n    The number of memory segments
+ * @return       The number of bytes sent, -1 on error; on
+ *               error, `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for sendmsg(3) except EINTR
+ */
+static ssize_t
+send_all(int fd, struct iovec *iov, size_t n)
+{
+	struct msghdr msg;
+	size_t total = 0;
+	ssize_t sent;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	while (msg.msg_iovlen) {
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		total += (size_t)sent;
+		for (; msg.msg_iovlen && (size_t)sent >= msg.msg_iov->iov_len; msg.msg_iov++, msg.msg_iovlen--)
+			sent -= (ssize_t)msg.msg_iov->iov_len;
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + sent;
+			msg.msg_iov->iov_len -= (size_t)sent;
+		}
+	}
+	return (ssize_t)total;
+}
+
+
+/**
+ * Collect credits sent by the receiving end
+ * 
+ * @param   fd       The socket
+ * @param   pending  Buffer for a partially received credit message,
+ *                   with room for 4 bytes
+ * @param   have     The number of bytes in `pending`
+ * @param   block    Whether to wait until at least one credit is received
+ * @param   stats    Metrics to update, may be `NULL`
+ * @return           The number of credits, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  ECONNRESET  The other end closed the socket
+ * @throws  Any error specified for recv(3) except EINTR and EAGAIN
+ */
+static ssize_t
+take_credits(int fd, unsigned char *pending, size_t *have, int block, struct shr_bridge_stats *stats)
+{
+	unsigned char buf[256];
+	size_t credits = 0, i, n;
+	ssize_t got;
+	uint32_t value;
+
+	do {
+		got = recv(fd, buf, sizeof(buf), block && !credits ? 0 : MSG_DONTWAIT);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		if (!got)
+			return errno = ECONNRESET, -1;
+		if (stats)
+			stats->wire_bytes += (uint64_t)got;
+		for (n = (size_t)got, i = 0; i < n;) {
+			while (*have < 4 && i < n)
+				pending[(*have)++] = buf[i++];
+			if (*have == 4) {
+				memcpy(&value, pending, 4);
+				credits += ntohl(value);
+				*have = 0;
+			}
+		}
+	} while ((size_t)got == sizeof(buf) || (block && !credits));
+
+	return (ssize_t)credits;
+}
+
+
+/**
+ * Send credits to the sending end
+ * 
+ * @param   fd       The socket
+ * @param   credits  The number of credits
+ * @param   stats    Metrics to update, may be `NULL`
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for sendmsg(3) except EINTR
+ */
+static int
+give_credits(int fd, size_t credits, struct shr_bridge_stats *stats)
+{
+	uint32_t value = htonl((uint32_t)credits);
+	struct iovec iov = {&value, sizeof(value)};
+	if (send_all(fd, &iov, 1) < 0)
+		return -1;
+	if (stats) {
+		stats->wire_bytes += sizeof(value);
+		stats->batches += 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Advance the current buffer
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  n    The number of buffers to advance
+ */
+static void
+advance(shr_t *restrict shr, size_t n)
+{
+	shr->current_buffer = next_buffer(shr, n);
+}
+
+
+
+/**
+ * Forward the data in a shared ring buffer, over a stream socket, to
+ * another shared ring buffer, filled by `shr_bridge_recv` at the other
+ * end of the socket, until an empty buffer, which marks the end of the
+ * stream and is forwarded too, has been read, or the write end has
+ * closed and all data has been forwarded
+ * 
+ * As many readable buffers as are available, and as the other end has
+ * granted credits for, are sent with each call to sendmsg(3); the other
+ * end grants one credit for each buffer it has been able to publish, so
+ * at most as many buffers as the receiving shared ring buffer has are in
+ * flight, and a reader of it that falls behind will in turn block the
+ * writer of `shr`
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, opened for reading, must not be `NULL`
+ * @param   fd           The socket
+ * @param   max_buffers  The maximum number of buffers to send at once, 0 for no limit
+ * @param   flags        Bitwise-OR of `enum shr_bridge_flags` values
+ * @param   stats        Output parameter for metrics, that are updated
+ *                       continuously, ignored if `NULL`
+ * @return               Zero on success, -1 on error; on error,
+ *                       `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL        `flags` contains an unsupported flag, or the shared
+ *                        ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  EPROTO        The other end is not `shr_bridge_recv`
+ * @throws  EMSGSIZE      A buffer is larger than the buffers at the other end
+ * @throws  ECONNRESET    The other end closed the socket
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for sendmsg(3), recv(3) and malloc(3)
+ */
+int
+shr_bridge_send(shr_t *restrict shr, int fd, size_t max_buffers, int flags, struct shr_bridge_stats *restrict stats)
+{
+	struct iovec iov[2 * SHR_BATCH_MAX];
+	struct frame frames[SHR_BATCH_MAX];
+	struct hello hello;
+	size_t size = shr->key.buffer_size, credits, have = 0, n, i, j, length, packed;
+	uint64_t remote_size;
+	unsigned char pending[4];
+	uint32_t *table = NULL;
+	char *staging = NULL;
+	ssize_t r;
+	int end = 0, saved_errno;
+
+	if ((flags & ~SHR_BRIDGE_COMPRESS) || OVERWRITE(shr))
+		return errno = EINVAL, -1;
+	if (!max_buffers || max_buffers > SHR_BATCH_MAX)
+		max_buffers = SHR_BATCH_MAX;
+	if (max_buffers > shr->key.buffer_count)
+		max_buffers = shr->key.buffer_count;
+
+	if (recv_all(fd, &hello, sizeof(hello)))
+		return -1;
+	if (ntohl(hello.magic) != BRIDGE_MAGIC || ntohl(hello.version) != BRIDGE_VERSION)
+		return errno = EPROTO, -1;
+	remote_size = (uint64_t)ntohl(hello.buffer_size[0]) << 32 | ntohl(hello.buffer_size[1]);
+	credits = ntohl(hello.credits);
+	if (stats)
+		stats->wire_bytes += sizeof(hello);
+
+	if (flags & SHR_BRIDGE_COMPRESS) {
+		table = calloc(SHR_LZ_TABLE_SIZE, sizeof(*table));
+		staging = malloc(max_buffers * size + 1);
+		if (!table || !staging)
+			goto fail;
+	}
+
+	for (;;) {
+		if ((r = take_credits(fd, pending, &have, !credits, stats)) < 0)
+			goto fail;
+		if (!credits && stats)
+			stats->stalls += 1;
+		credits += (size_t)r;
+
+		n = shr_acquire_(shr, 0, credits < max_buffers ? credits : max_buffers);
+		if (!n)
+			goto fail;
+
+		for (i = j = packed = 0; i < n; i++) {
+			length = *LENGTH(shr, next_buffer(shr, i));
+			if (length > remote_size || length > UINT32_MAX) {
+				if (i)
+					break;
+				shr_batch_op_(shr, 0, 0, n, +1);
+				errno = EMSGSIZE;
+				goto fail;
+			}
+			if (shr_verify_(shr, next_buffer(shr, i))) {
+				if (i)
+					break;
+				/* Drop the corrupt buffer, it would be given a valid checksum at the other end. */
+				shr_batch_op_(shr, 0, 1, n - 1, +1);
+				if (shr_batch_op_(shr, 1, 0, 1, +1))
+					goto fail;
+				advance(shr, 1);
+				if (stats)
+					stats->dropped += 1;
+				n = 0;
+				break;
+			}
+			iov[j].iov_base = &frames[i];
+			iov[j++].iov_len = sizeof(frames[i]);
+			iov[j].iov_base = BUFFER(shr, next_buffer(shr, i));
+			iov[j].iov_len = length;
+			frames[i].flags = 0;
+			if (staging && length > 1) {
+				r = (ssize_t)shr_lz_compress_(table, staging + packed, length - 1, iov[j].iov_base, length);
+				if (r) {
+					iov[j].iov_base = staging + packed;
+					iov[j].iov_len = (size_t)r;
+					frames[i].flags = htonl(FRAME_LZ);
+					packed += (size_t)r;
+				}
+			}
+			frames[i].size = htonl((uint32_t)iov[j++].iov_len);
+			if (stats)
+				stats->bytes += length;
+			if (!length) {
+				/* An empty buffer marks the end of the stream, it is forwarded as such. */
+				end = 1;
+				i++;
+				break;
+			}
+		}
+		if (n) {
+			if (i < n && shr_batch_op_(shr, 0, i, n - i, +1))
+				goto fail;
+			n = i;
+
+			if ((r = send_all(fd, iov, j)) < 0) {
+				saved_errno = errno;
+				shr_batch_op_(shr, 0, 0, n, +1);
+				errno = saved_errno;
+				goto fail;
+			}
+			if (shr_batch_op_(shr, 1, 0, n, +1))
+				goto fail;
+			advance(shr, n);
+			credits -= n;
+			if (stats) {
+				stats->buffers += n;
+				stats->wire_bytes += (uint64_t)r;
+				stats->batches += 1;
+			}
+		}
+
+		if (end || HEADER(shr)->closed == shr->current_buffer + 1)
+			break;
+	}
+
+	/* Mark the end, and wait for the other end to close, so that no data is discarded. */
+	frames[0].size = 0;
+	frames[0].flags = htonl(FRAME_END);
+	iov[0].iov_base = &frames[0];
+	iov[0].iov_len = sizeof(frames[0]);
+	if (send_all(fd, iov, 1) < 0)
+		goto fail;
+	if (stats)
+		stats->wire_bytes += sizeof(frames[0]);
+	shutdown(fd, SHUT_WR);
+	while (take_credits(fd, pending, &have, 1, stats) >= 0);
+
+	free(table);
+	free(staging);
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	free(table);
+	free(staging);
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Fill a shared ring buffer with the data `shr_bridge_send`
+ * sends over a stream socket, until it has forwarded all
+ * data, the caller should then close the shared ring buffer
+ * 
+ * @param   shr    The shared ring buffer, opened for writing, must not be `NULL`
+ * @param   fd     The socket
+ * @param   stats  Output parameter for metrics, that are updated
+ *                 continuously, ignored if `NULL`
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  EPROTO      The other end is not `shr_bridge_send`
+ * @throws  EBADMSG     A compressed buffer is malformed
+ * @throws  ECONNRESET  The other end closed the socket before all data was forwarded
+ * @throws  Any error specified for `shr_write`, send(3), recv(3) and malloc(3)
+ */
+int
+shr_bridge_recv(shr_t *restrict shr, int fd, struct shr_bridge_stats *restrict stats)
+{
+	size_t size = shr->key.buffer_size, threshold, credits = 0, have = 0, used = 0, n, k;
+	uint64_t size64 = (uint64_t)size;
+	struct hello hello;
+	struct frame frame;
+	struct iovec iov;
+	char *staging, *packed = NULL, *buffer, *target;
+	uint32_t flags;
+	ssize_t got;
+	int saved_errno;
+
+	staging = malloc(STAGING_SIZE);
+	if (!staging)
+		return -1;
+
+	/* Grant a credit for every buffer, and return them in batches of half the buffers. */
+	threshold = (shr->key.buffer_count + 1) / 2;
+	hello.magic = htonl(BRIDGE_MAGIC);
+	hello.version = htonl(BRIDGE_VERSION);
+	hello.buffer_size[0] = htonl((uint32_t)(size64 >> 32));
+	hello.buffer_size[1] = htonl((uint32_t)size64);
+	hello.credits = htonl((uint32_t)(shr->key.buffer_count < UINT32_MAX ? shr->key.buffer_count : UINT32_MAX));
+	hello.reserved = 0;
+	iov.iov_base = &hello;
+	iov.iov_len = sizeof(hello);
+	if (send_all(fd, &iov, 1) < 0)
+		goto fail;
+	if (stats)
+		stats->wire_bytes += sizeof(hello);
+
+	for (;;) {
+		/* Refill the staging buffer until it has the frame header. */
+		while (have - used < sizeof(frame)) {
+			memmove(staging, staging + used, have - used);
+			have -= used;
+			used = 0;
+			got = recv(fd, staging + have, STAGING_SIZE - have, 0);
+			if (got < 0) {
+				if (errno == EINTR)
+					continue;
+				goto fail;
+			}
+			if (!got) {
+				errno = ECONNRESET;
+				goto fail;
+			}
+			have += (size_t)got;
+			if (stats)
+				stats->wire_bytes += (uint64_t)got;
+		}
+		memcpy(&frame, staging + used, sizeof(frame));
+		used += sizeof(frame);
+		n = ntohl(frame.size);
+		flags = ntohl(frame.flags);
+		if (flags & FRAME_END)
+			break;
+		if ((flags & ~(uint32_t)FRAME_LZ) || n > size) {
+			errno = EPROTO;
+			goto fail;
+		}
+
+		if (shr_write(shr, &buffer))
+			goto fail;
+		target = buffer;
+		if (flags & FRAME_LZ) {
+			if (!packed && !(packed = malloc(size)))
+				goto fail;
+			target = packed;
+		}
+		k = have - used < n ? have - used : n;
+		memcpy(target, staging + used, k);
+		used += k;
+		if (k < n) {
+			/* Large frames are received directly, past the staging buffer. */
+			if (recv_all(fd, target + k, n - k))
+				goto fail;
+			if (stats)
+				stats->wire_bytes += n - k;
+		}
+		if (flags & FRAME_LZ) {
+			got = shr_lz_decompress_(buffer, size, packed, n);
+			if (got < 0) {
+				errno = EBADMSG;
+				goto fail;
+			}
+			n = (size_t)got;
+		}
+		if (shr_write_done(shr, n))
+			goto fail;
+		if (stats) {
+			stats->buffers += 1;
+			stats->bytes += n;
+		}
+
+		if (++credits >= threshold) {
+			if (give_credits(fd, credits, stats))
+				goto fail;
+			credits = 0;
+		}
+	}
+
+	free(staging);
+	free(packed);
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	free(staging);
+	free(packed);
+	return errno = saved_errno, -1;
+}
@@ -0,0 +1,402 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_classes.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+
+
+/**
+ * The flags that may be used for
+ * the size classes of a stream
+ */
+#define CLASS_FLAGS  (SHR_CHECKSUM | SHR_ELASTIC)
+
+/**
+ * The tag, in the first size class, of messages
+ * stored inline, and of the end of the stream
+ */
+#define INLINE_TAG  0
+
+
+
+/**
+ * An end of a stream with size classes
+ */
+struct shr_classes
+{
+	/**
+	 * The arena that holds the size classes
+	 */
+	shr_arena_t *arena;
+
+	/**
+	 * The shared ring buffer of each size class
+	 */
+	shr_t *rings;
+
+	/**
+	 * The number of size classes
+	 */
+	size_t count;
+
+	/**
+	 * The size class of the acquired buffer
+	 */
+	size_t current;
+
+	/**
+	 * Whether the end of the stream has been read
+	 */
+	int eof;
+
+	/**
+	 * Whether this is the write end
+	 */
+	int write;
+};
+
+
+
+/**
+ * Create a stream with size classes
+ * 
+ * @param   key          Output parameter for the key of the stream
+ * @param   classes      The size classes
+ * @param   count        The number of size classes
+ * @param   permissions  The permissions for the stream
+ * @param   flags        Bitwise-OR of `enum shr_flags` values
+ * @return               Zero on success, -1 on error
+ */
+int
+shr_classes_create(key_t *restrict key, const struct shr_class *restrict classes,
+		   size_t count, mode_t permissions, int flags)
+{
+	struct shr_arena_ring *rings;
+	size_t i;
+	int r, saved_errno;
+
+	*key = IPC_PRIVATE;
+
+	if (!count || (flags & ~CLASS_FLAGS))
+		return errno = EINVAL, -1;
+	for (i = 1; i < count; i++)
+		if (classes[i].buffer_size <= classes[i - 1].buffer_size)
+			return errno = EINVAL, -1;
+
+	rings = malloc(count * sizeof(*rings));
+	if (!rings)
+		return -1;
+	for (i = 0; i < count; i++) {
+		rings[i].buffer_size = classes[i].buffer_size;
+		rings[i].buffer_count = classes[i].buffer_count;
+		rings[i].flags = flags;
+	}
+	/* The first size class orders the stream. */
+	rings[0].flags |= SHR_TAGGED;
+
+	r = shr_arena_create(key, rings, count, permissions);
+	saved_errno = errno;
+	free(rings);
+	return errno = saved_errno, r;
+}
+
+
+/**
+ * Remove a stream with size classes
+ * 
+ * @param   key  The key of the stream
+ * @return       Zero on success, -1 on error
+ */
+int
+shr_classes_remove(key_t key)
+{
+	return shr_arena_remove(key);
+}
+
+
+/**
+ * Open an end of a stream with size classes
+ * 
+ * @param   key        The key of the stream
+ * @param   direction  `SHR_READ` or `SHR_WRITE`
+ * @return             The end, `NULL` on error
+ */
+shr_classes_t *
+shr_classes_open(key_t key, shr_direction_t direction)
+{
+	shr_classes_t *classes;
+	shr_t *ring;
+	size_t i;
+	int saved_errno;
+
+	if (direction != SHR_READ && direction != SHR_WRITE)
+		return errno = EINVAL, NULL;
+
+	classes = calloc(1, sizeof(*classes));
+	if (!classes)
+		return NULL;
+	classes->write = direction == SHR_WRITE;
+	classes->arena = shr_arena_open(key);
+	if (!classes->arena)
+		goto fail;
+	classes->count = shr_arena_count(classes->arena);
+	classes->rings = malloc(classes->count * sizeof(*classes->rings));
+	if (!classes->rings)
+		goto fail;
+
+	for (i = 0; i < classes->count; i++) {
+		ring = classes->rings + i;
+		if (shr_arena_ring(classes->arena, i, direction, ring))
+			goto fail;
+		if (!(ring->key.flags & SHR_TAGGED) != !!i ||
+		    (i && ring->key.buffer_size <= ring[-1].key.buffer_size))
+			goto invalid;
+	}
+	return classes;
+
+ invalid:
+	errno = EINVAL;
+ fail:
+	saved_errno = errno;
+	free(classes->rings);
+	shr_arena_close(classes->arena);
+	free(classes);
+	return errno = saved_errno, NULL;
+}
+
+
+/**
+ * Close an end of a stream with size classes
+ * 
+ * @param  classes  The end, nothing will happen if this is `NULL`
+ */
+void
+shr_classes_close(shr_classes_t *classes)
+{
+	size_t i;
+	if (!classes)
+		return;
+	for (i = 0; i < classes->count; i++)
+		shr_close(classes->rings + i);
+	free(classes->rings);
+	shr_arena_close(classes->arena);
+	free(classes);
+}
+
+
+/**
+ * Wait for the smallest buffer that has room
+ * for a number of bytes to be ready for writing
+ * 
+ * @param   classes   The write end
+ * @param   capacity  The number of bytes the buffer must have room for
+ * @param   buffer    Output parameter for the buffer to write
+ * @return            The index of the size class of the buffer, -1 on error
+ */
+ssize_t
+shr_classes_write(shr_classes_t *restrict classes, size_t capacity, char **restrict buffer)
+{
+	size_t i;
+
+	if (!classes->write)
+		return errno = EBADF, -1;
+	/* Empty messages mark the end of the stream, so they cannot be written. */
+	if (!capacity)
+		return errno = EINVAL, -1;
+
+	for (i = 0; i < classes->count; i++)
+		if (classes->rings[i].key.buffer_size >= capacity)
+			break;
+	if (i == classes->count)
+		return errno = EMSGSIZE, -1;
+
+	if (shr_write(classes->rings + i, buffer))
+		return -1;
+	classes->current = i;
+	return (ssize_t)i;
+}
+
+
+/**
+ * Publish the buffer acquired with `shr_classes_write`
+ * 
+ * @param   classes  The write end
+ * @param   length   The number of written bytes
+ * @return           Zero on success, -1 on error
+ */
+int
+shr_classes_write_done(shr_classes_t *restrict classes, size_t length)
+{
+	shr_t *order = classes->rings;
+	size_t i = classes->current;
+	char *reference;
+
+	if (!classes->write)
+		return errno = EBADF, -1;
+	if (!length) {
+		/* The buffer is given back, so that the writer stays in step with the ring. */
+		shr_write_cancel(classes->rings + i);
+		return errno = EINVAL, -1;
+	}
+
+	if (!i) {
+		shr_write_tag(order, INLINE_TAG);
+		return shr_write_done(order, length);
+	}
+
+	if (shr_write_done(classes->rings + i, length))
+		return -1;
+	/* The message is published, so the reference must be too. */
+	while (shr_write(order, &reference))
+		if (errno != EINTR)
+			return -1;
+	shr_write_tag(order, (uint64_t)i);
+	return shr_write_done(order, 0);
+}
+
+
+/**
+ * Mark the end of a stream with size classes
+ * 
+ * @param   classes  The write end
+ * @return           Zero on success, -1 on error
+ */
+int
+shr_classes_finish(shr_classes_t *restrict classes)
+{
+	shr_t *order = classes->rings;
+	char *buffer;
+
+	if (!classes->write)
+		return errno = EBADF, -1;
+
+	if (shr_write(order, &buffer))
+		return -1;
+	shr_write_tag(order, INLINE_TAG);
+	return shr_write_done(order, 0);
+}
+
+
+/**
+ * Wait for the next message in a stream with size classes
+ * 
+ * @param   classes  The read end
+ * @param   index    Output parameter for the index of the size class, may be `NULL`
+ * @param   buffer   Output parameter for the buffer
+ * @param   length   Output parameter for the length of the data
+ * @return           Zero on success, 1 at the end of the stream, -1 on error
+ */
+int
+shr_classes_read(shr_classes_t *restrict classes, size_t *restrict index,
+		 const char **restrict buffer, size_t *restrict length)
+{
+	shr_t *order = classes->rings;
+	uint64_t tag;
+	int r;
+
+	if (classes->write)
+		return errno = EBADF, -1;
+	if (classes->eof)
+		return 1;
+
+	if (shr_read(order, buffer, length))
+		return -1;
+	shr_read_tag(order, &tag);
+
+	if (tag == INLINE_TAG) {
+		if (!*length) {
+			classes->eof = 1;
+			return shr_read_done(order) < 0 ? -1 : 1;
+		}
+		classes->current = 0;
+	} else {
+		if (tag >= classes->count)
+			return errno = EPROTO, -1;
+		/* The message was published before the reference. */
+		r = shr_read_try(classes->rings + tag, buffer, length);
+		if (r)
+			return errno == EAGAIN ? (errno = EPROTO, -1) : -1;
+		classes->current = (size_t)tag;
+	}
+
+	if (index)
+		*index = classes->current;
+	return 0;
+}
+
+
+/**
+ * Mark the buffer acquired with `shr_classes_read` as fully read
+ * 
+ * @param   classes  The read end
+ * @return           Zero on success, -1 on error
+ */
+int
+shr_classes_read_done(shr_classes_t *restrict classes)
+{
+	int r;
+
+	if (classes->write)
+		return errno = EBADF, -1;
+
+	if (classes->current && shr_read_done(classes->rings + classes->current) < 0)
+		return -1;
+	r = shr_read_done(classes->rings);
+	if (r < 0)
+		return -1;
+	/* The writer closed without marking the end of the stream. */
+	if (r)
+		classes->eof = 1;
+	return 0;
+}
+
+
+/**
+ * Get the number of size classes in a stream
+ * 
+ * @param   classes  The end
+ * @return           The number of size classes
+ */
+size_t
+shr_classes_count(const shr_classes_t *restrict classes)
+{
+	return classes->count;
+}
+
+
+/**
+ * Get the shared ring buffer of a size class
+ * 
+ * @param   classes  The end
+ * @param   i        The index of the size class
+ * @return           The shared ring buffer
+ */
+shr_t *
+shr_classes_ring(shr_classes_t *restrict classes, size_t i)
+{
+	return classes->rings + i;
+}
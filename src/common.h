@@ -0,0 +1,917 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_COMMON_H
+#define SHR_COMMON_H
+
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include "shr.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/sem.h>
+#include <time.h>
+
+#if defined(SHR_PROBES) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  define _SDT_HAS_SEMAPHORES 1
+#  include <sys/sdt.h>
+#  define SHR_HAVE_PROBES
+# endif
+#endif
+
+
+
+/**
+ * The value of `struct shr_header.magic`
+ */
+#define SHR_MAGIC  UINT32_C(0x52485323)
+
+/**
+ * The value of `struct shr_header.version`
+ */
+#define SHR_VERSION  2
+
+/**
+ * The value of `struct shr_arena_header.magic`
+ */
+#define SHR_ARENA_MAGIC  UINT32_C(0x41485323)
+
+/**
+ * All flags in `enum shr_flags`
+ */
+#define SHR_ALL_FLAGS  (SHR_CHECKSUM | SHR_OVERWRITE | SHR_LATEST | SHR_ADDRESS | SHR_ELASTIC | SHR_DEADLINE |\
+                        SHR_OBSERVABLE | SHR_TAGGED)
+
+/**
+ * The flags in `enum shr_flags` that
+ * add a field to the metadata of each buffer
+ */
+#define SHR_META_FLAGS  (SHR_CHECKSUM | SHR_OVERWRITE | SHR_LATEST | SHR_ADDRESS | SHR_ELASTIC | SHR_DEADLINE |\
+                         SHR_OBSERVABLE | SHR_TAGGED)
+
+
+
+/**
+ * Values for `struct shr_header.local`
+ */
+enum shr_local_kind
+{
+	/**
+	 * The shared ring buffer is not local
+	 */
+	SHR_LOCAL_NONE = 0,
+
+	/**
+	 * The shared ring buffer is local, and its memory
+	 * was supplied by the user
+	 */
+	SHR_LOCAL_USER = 1,
+
+	/**
+	 * The shared ring buffer is local, and its memory
+	 * was allocated by `shr_open_local`
+	 */
+	SHR_LOCAL_ALLOCATED = 2,
+
+	/**
+	 * The shared ring buffer is local, and its memory
+	 * is part of an arena, and may be mapped by other
+	 * processes
+	 */
+	SHR_LOCAL_ARENA = SHR_LOCAL_KIND_ARENA
+};
+
+
+/**
+ * The number of buffers one end of a local shared
+ * ring buffer has handed over to the other end
+ */
+struct shr_counter
+{
+	/**
+	 * The number of buffers, modulo 2 to the power of 32,
+	 * this is also the futex the other end sleeps on
+	 */
+	_Atomic uint32_t count;
+
+	/**
+	 * The number of threads sleeping on `count`
+	 */
+	_Atomic uint32_t waiters;
+};
+
+
+/**
+ * The beginning of the shared memory of
+ * a shared ring buffer, it is followed by
+ * unused space up to `SHR_HEADER_SIZE` bytes
+ */
+struct shr_header
+{
+	/**
+	 * Zero, or the index of the writer's current buffer
+	 * plus one, after the writer has closed
+	 */
+	_Atomic size_t closed;
+
+	/**
+	 * `SHR_MAGIC`
+	 */
+	uint32_t magic;
+
+	/**
+	 * `SHR_VERSION`
+	 */
+	uint32_t version;
+
+	/**
+	 * The flags of the shared ring buffer
+	 */
+	uint32_t flags;
+
+	/**
+	 * A value of `enum shr_local_kind`
+	 */
+	uint32_t local;
+
+	/**
+	 * The buffer size of the shared ring buffer
+	 */
+	uint64_t buffer_size;
+
+	/**
+	 * The buffer count of the shared ring buffer
+	 */
+	uint64_t buffer_count;
+
+	/**
+	 * Only used by shared ring buffers with `SHR_OVERWRITE`,
+	 * `SHR_LATEST` or `SHR_OBSERVABLE`: the number of
+	 * published buffers
+	 */
+	_Atomic uint64_t head;
+
+	/**
+	 * The identifier of the semaphore array plus one,
+	 * zero for local shared ring buffers, so that
+	 * monitors can find the semaphore array
+	 */
+	uint32_t semaphores;
+
+	/**
+	 * Padding, so that the counters are in separate cache lines
+	 */
+	char padding1[64 - sizeof(size_t) - 5 * sizeof(uint32_t) - 3 * sizeof(uint64_t)];
+
+	/**
+	 * Only used by local shared ring buffers, and shared ring
+	 * buffers with `SHR_OVERWRITE`: the number of published
+	 * buffers, modulo 2 to the power of 32
+	 */
+	struct shr_counter written;
+
+	/**
+	 * Only used by shared ring buffers that are not local:
+	 * the number of published buffers, it is only written
+	 * by the writer, and only read by monitors
+	 */
+	_Atomic uint64_t published;
+
+	/**
+	 * Only used by local shared ring buffers: the index of
+	 * the writer's current buffer; it cannot be derived from
+	 * `written.count`, which wraps, unless the buffer count
+	 * is a power of two
+	 */
+	_Atomic uint32_t written_index;
+
+	/**
+	 * Padding, so that the counters are in separate cache lines
+	 */
+	char padding2[64 - sizeof(struct shr_counter) - sizeof(uint64_t) - sizeof(uint32_t)];
+
+	/**
+	 * Only used by local shared ring buffers:
+	 * the number of fully read buffers
+	 */
+	struct shr_counter read;
+
+	/**
+	 * Only used by local shared ring buffers:
+	 * the index of the reader's current buffer
+	 */
+	_Atomic uint32_t read_index;
+};
+
+_Static_assert(sizeof(struct shr_header) <= SHR_HEADER_SIZE, "struct shr_header is too large");
+_Static_assert(offsetof(struct shr_header, published) == SHR_PUBLISHED_OFFSET, "SHR_PUBLISHED_OFFSET is wrong");
+_Static_assert(offsetof(struct shr_header, written) == SHR_WRITTEN_OFFSET, "SHR_WRITTEN_OFFSET is wrong");
+_Static_assert(offsetof(struct shr_header, read) == SHR_READ_OFFSET, "SHR_READ_OFFSET is wrong");
+_Static_assert(offsetof(struct shr_header, written_index) == SHR_WRITTEN_INDEX_OFFSET, "SHR_WRITTEN_INDEX_OFFSET is wrong");
+_Static_assert(offsetof(struct shr_header, read_index) == SHR_READ_INDEX_OFFSET, "SHR_READ_INDEX_OFFSET is wrong");
+_Static_assert(offsetof(struct shr_header, local) == SHR_LOCAL_KIND_OFFSET, "SHR_LOCAL_KIND_OFFSET is wrong");
+
+
+/**
+ * The beginning of the shared memory of an arena,
+ * it is followed by one `struct shr_arena_entry`
+ * for each shared ring buffer in the arena
+ */
+struct shr_arena_header
+{
+	/**
+	 * `SHR_ARENA_MAGIC`
+	 */
+	uint32_t magic;
+
+	/**
+	 * `SHR_VERSION`
+	 */
+	uint32_t version;
+
+	/**
+	 * The number of shared ring buffers in the arena
+	 */
+	uint64_t count;
+
+	/**
+	 * The size of the shared memory of the arena
+	 */
+	uint64_t size;
+
+	/**
+	 * Reserved, zero
+	 */
+	uint64_t reserved;
+};
+
+
+/**
+ * The location of a shared ring buffer in an arena
+ */
+struct shr_arena_entry
+{
+	/**
+	 * The offset of the shared ring buffer's memory, from
+	 * the beginning of the arena, a multiple of 64
+	 */
+	uint64_t offset;
+
+	/**
+	 * The buffer size of the shared ring buffer
+	 */
+	uint64_t buffer_size;
+
+	/**
+	 * The buffer count of the shared ring buffer
+	 */
+	uint64_t buffer_count;
+
+	/**
+	 * The flags of the shared ring buffer
+	 */
+	uint64_t flags;
+};
+
+
+
+/**
+ * Get the index of the semaphore for flagging
+ * a buffer as being writeable
+ * 
+ * @param   i  The index of the buffer
+ * @return     The index of the semaphore
+ */
+#define WRITE_SEM(i)  (2 * (i) + 0)
+
+/**
+ * Get the index of the semaphore for flagging
+ * a buffer as being readable
+ * 
+ * @param   i  The index of the buffer
+ * @return     The index of the semaphore
+ */
+#define READ_SEM(i)   (2 * (i) + 1)
+
+/**
+ * Get the address of a buffer
+ * 
+ * @param   shr:shr_t *  The shared ring buffer
+ * @param   i:size_t     The index of the buffer
+ * @return  :char *      The address of the buffer
+ */
+#define BUFFER(shr, i)  \
+	((shr)->address + SHR_BUFFER_OFFSET((shr)->key.buffer_size, (shr)->key.flags, i))
+
+/**
+ * Get the address of the length of the data in a buffer
+ * 
+ * @param   shr:shr_t *  The shared ring buffer
+ * @param   i:size_t     The index of the buffer
+ * @return  :size_t *    The address of the length
+ */
+#define LENGTH(shr, i)  \
+	((size_t *)(void *)((shr)->address + SHR_LENGTH_OFFSET((shr)->key.buffer_size, (shr)->key.flags, i)))
+
+/**
+ * Get the address of a field in the metadata of a buffer
+ * 
+ * @param   shr:shr_t *  The shared ring buffer
+ * @param   i:size_t     The index of the buffer
+ * @param   FLAG:int     The flag that adds the field
+ * @return  :uint64_t *  The address of the field
+ */
+#define META(shr, i, FLAG)  \
+	((uint64_t *)(void *)((char *)LENGTH(shr, i) + meta_offset((shr)->key.flags, FLAG)))
+
+/**
+ * Check whether a shared ring buffer is local
+ * 
+ * @param   shr:const shr_t *  The shared ring buffer
+ * @return  :int               Whether the shared ring buffer is local
+ */
+#define LOCAL(shr)  SHR_UNLIKELY(SHR_IS_LOCAL(shr))
+
+/**
+ * Check whether the memory of a shared ring
+ * buffer may be mapped by other processes
+ * 
+ * @param   shr:const shr_t *  The shared ring buffer
+ * @return  :int               Whether the memory is shared between processes
+ */
+#define PROCESS_SHARED(shr)  (!SHR_IS_LOCAL(shr) || HEADER(shr)->local == SHR_LOCAL_ARENA)
+
+/**
+ * Get the futex operation to use on a shared ring buffer
+ * 
+ * @param   shr:const shr_t *  The shared ring buffer
+ * @param   op:int             `FUTEX_WAIT` or `FUTEX_WAKE`
+ * @return  :int               The futex operation
+ */
+#define FUTEX_CMD(shr, op)  \
+	(PROCESS_SHARED(shr) ? (op) : (op) | FUTEX_PRIVATE_FLAG)
+
+/**
+ * Check whether a shared ring buffer has the flag
+ * `SHR_OVERWRITE` or the flag `SHR_LATEST`
+ * 
+ * @param   shr:const shr_t *  The shared ring buffer
+ * @return  :int               Whether the writer overwrites unread buffers
+ */
+#define OVERWRITE(shr)  SHR_UNLIKELY((shr)->key.flags & (SHR_OVERWRITE | SHR_LATEST))
+
+/**
+ * Check whether a set of `enum shr_flags` values is valid
+ * 
+ * @param   flags:int  The flags
+ * @return  :int       Whether the flags are supported and compatible
+ */
+#define VALID_FLAGS(flags)  \
+	(!((flags) & ~SHR_ALL_FLAGS) && !(SEQUENCE_FLAGS(flags) & (SEQUENCE_FLAGS(flags) - 1)))
+
+/**
+ * Get the flags, of a set of `enum shr_flags` values, that give
+ * each buffer a sequence number; at most one of them may be set
+ * 
+ * @param   flags:int  The flags
+ * @return  :int       `flags & (SHR_OVERWRITE | SHR_LATEST | SHR_OBSERVABLE)`
+ */
+#define SEQUENCE_FLAGS(flags)  \
+	((flags) & (SHR_OVERWRITE | SHR_LATEST | SHR_OBSERVABLE))
+
+/**
+ * Get the sequence number of a buffer, in a shared ring buffer
+ * with `SHR_OVERWRITE`, `SHR_LATEST` or `SHR_OBSERVABLE`
+ * 
+ * While buffer n, counting from 0 since the shared ring buffer
+ * was created, is written, its sequence number is 2n + 1, once
+ * it has been published, its sequence number is 2n + 2
+ * 
+ * @param   shr:shr_t *           The shared ring buffer
+ * @param   i:size_t              The index of the buffer
+ * @return  :_Atomic uint64_t *  The sequence number
+ */
+#define SEQUENCE(shr, i)  \
+	((_Atomic uint64_t *)(void *)META(shr, i, SEQUENCE_FLAGS((shr)->key.flags)))
+
+/**
+ * Get the `shmat` flags for an end of a shared ring buffer,
+ * readers of shared ring buffers with `SHR_OVERWRITE` must
+ * be able to register themselves as waiting, observers
+ * never write to the shared memory
+ * 
+ * @param   key:const shr_key_t *      The key of the shared ring buffer
+ * @param   direction:shr_direction_t  The direction of the end
+ * @return  :int                       The flags for shmat(3)
+ */
+#define ATTACH_FLAGS(key, direction)  \
+	((direction) == SHR_OBSERVE ? SHM_RDONLY : ((key)->flags & SHR_OVERWRITE) ? 0 : (int)(direction))
+
+/**
+ * Get the header of a shared ring buffer
+ * 
+ * @param   shr:shr_t *             The shared ring buffer
+ * @return  :struct shr_header *  The header
+ */
+#define HEADER(shr)  ((struct shr_header *)(void *)((shr)->address))
+
+
+
+/**
+ * Fire a USDT probe, of the provider `shr`
+ * 
+ * The arguments are only evaluated if the library
+ * was built with probes, they are cheap enough to
+ * evaluate even when no tracer is attached; a probe
+ * with a more expensive argument shall be guarded
+ * with `PROBE_ENABLED`
+ * 
+ * @param  NAME  The name of the probe
+ * @param  ...   The arguments of the probe, at most 4
+ */
+#ifdef SHR_HAVE_PROBES
+# define PROBE(NAME, ...)  STAP_PROBEV(shr, NAME, __VA_ARGS__)
+#else
+# define PROBE(NAME, ...)  ((void)0)
+#endif
+
+/**
+ * Check whether a tracer is attached to a USDT probe
+ * 
+ * @param   NAME  The name of the probe
+ * @return  :int  Whether the probe is enabled, always 0
+ *                if the library was built without probes
+ */
+#ifdef SHR_HAVE_PROBES
+# define PROBE_ENABLED(NAME)  SHR_UNLIKELY(shr_##NAME##_semaphore)
+#else
+# define PROBE_ENABLED(NAME)  0
+#endif
+
+#ifdef SHR_HAVE_PROBES
+/**
+ * The is-enabled semaphores of the USDT probes, a tracer
+ * increments a probe's semaphore while it is attached
+ */
+extern unsigned short shr_create_semaphore SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+extern unsigned short shr_close_semaphore SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+extern unsigned short shr_acquire_semaphore SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+extern unsigned short shr_release_semaphore SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+extern unsigned short shr_block_start_semaphore SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+extern unsigned short shr_block_end_semaphore SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+#endif
+
+
+
+/**
+ * Get the identifier of a shared ring buffer that
+ * is passed to the USDT probes: the shared memory
+ * identifier, which is the same in all processes,
+ * or for a local shared ring buffer, the address
+ * of its memory
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       The identifier of the shared ring buffer
+ */
+static inline uint64_t
+probe_ring(const shr_t *restrict shr)
+{
+	return LOCAL(shr) ? (uint64_t)(uintptr_t)shr->address : (uint64_t)shr->shm;
+}
+
+
+/**
+ * Convert a duration to nanoseconds
+ * 
+ * @param   ts  The duration
+ * @return      The duration, in nanoseconds
+ */
+static inline uint64_t
+timespec_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * UINT64_C(1000000000) + (uint64_t)ts->tv_nsec;
+}
+
+
+/**
+ * Get the current time of a clock, this is used for
+ * the wait durations passed to the USDT probes, and
+ * for the times stored in the metadata of buffers,
+ * which must use `CLOCK_MONOTONIC` or a coarse
+ * version of it, so that they are the same in
+ * all processes
+ * 
+ * @param   clock  The clock
+ * @return         The time, in nanoseconds
+ */
+static inline uint64_t
+clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return timespec_ns(&ts);
+}
+
+
+/**
+ * Get the offset of a field in the metadata of a
+ * buffer, relative to the beginning of the metadata
+ * 
+ * @param   flags  The flags of the shared ring buffer
+ * @param   field  The flag that adds the field
+ * @return         The offset of the field
+ */
+static inline size_t
+meta_offset(int flags, int field)
+{
+	size_t offset = sizeof(size_t);
+	for (flags &= SHR_META_FLAGS & (field - 1); flags; flags &= flags - 1)
+		offset += (flags & -flags) == SHR_ADDRESS ? 32 : 8;
+	return offset;
+}
+
+
+/**
+ * Get the index of the buffer a number of
+ * buffers after the current buffer
+ * 
+ * @param   shr  The shared ring buffer
+ * @param   n    The number of buffers to skip
+ * @return       The index of the buffer
+ */
+static inline size_t
+next_buffer(const shr_t *restrict shr, size_t n)
+{
+	size_t i = shr->current_buffer + n;
+	return i < shr->key.buffer_count ? i : i - shr->key.buffer_count;
+}
+
+
+/**
+ * Give a buffer, that the writer of a shared ring buffer
+ * with `SHR_OBSERVABLE` has acquired, the sequence number
+ * of a buffer that is being written, so that observers
+ * that are copying the data it held can tell that it
+ * is being overwritten
+ * 
+ * The buffer is given the number of the first buffer that
+ * will be published, that is stored in the buffer and is not
+ * before the next buffer to be published; `shr_stamp_`
+ * publishes it under that number
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  i    The index of the buffer
+ */
+static inline void
+observe_begin(const shr_t *restrict shr, size_t i)
+{
+	uint64_t head, n;
+	if (SHR_LIKELY(!(shr->key.flags & SHR_OBSERVABLE)))
+		return;
+	head = atomic_load_explicit(&HEADER(shr)->head, memory_order_relaxed);
+	n = head + (i + shr->key.buffer_count - (size_t)(head % shr->key.buffer_count)) % shr->key.buffer_count;
+	atomic_store_explicit(SEQUENCE(shr, i), 2 * n + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+
+/**
+ * Give a buffer, that the writer of a shared ring buffer
+ * with `SHR_OVERWRITE`, `SHR_LATEST` or `SHR_OBSERVABLE`
+ * has acquired, a sequence number for being given back
+ * unpublished
+ * 
+ * The buffer was given the sequence number 2n + 1 when it
+ * was acquired, before, it held buffer n - buffer_count,
+ * with the sequence number 2(n - buffer_count) + 2. 2n is
+ * between them, so readers that want the old data skip it,
+ * and readers that want buffer n wait. If there is no even
+ * number between them, or the buffer has not held any data,
+ * 0 is used, so that all readers wait.
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  i    The index of the buffer
+ */
+static inline void
+cancel_sequence(const shr_t *restrict shr, size_t i)
+{
+	uint64_t n;
+	if (SHR_LIKELY(!SEQUENCE_FLAGS(shr->key.flags)))
+		return;
+	n = atomic_load_explicit(SEQUENCE(shr, i), memory_order_relaxed) / 2;
+	if (n < shr->key.buffer_count || shr->key.buffer_count == 1)
+		n = 0;
+	atomic_store_explicit(SEQUENCE(shr, i), 2 * n, memory_order_release);
+}
+
+
+/**
+ * Add the same value to the semaphores, of a number of consecutive
+ * buffers, that flag them as writable or readable, atomically
+ * 
+ * @param   shr    The shared ring buffer
+ * @param   write  Non-zero to use the semaphores that flag buffers as
+ *                 writeable, zero to use those that flag them as readable
+ * @param   first  The number of buffers after the current buffer to start at,
+ *                 must be 0 if the buffers are handed over to the other end
+ *                 of a local shared ring buffer
+ * @param   n      The number of buffers, at most `SHR_BATCH_MAX`
+ * @param   value  The value to add to each semaphore
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ */
+int shr_batch_op_(shr_t *restrict, int, size_t, size_t, short)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * The maximum number of buffers `shr_batch_op_` can operate on
+ */
+#define SHR_BATCH_MAX  64
+
+/**
+ * Wait for the current buffer of a shared ring buffer,
+ * that does not overwrite, to be ready for an end, and
+ * fire the USDT probes `block_start` and `block_end` if
+ * the call blocks
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   write    Non-zero to wait for the buffer to be ready
+ *                   for writing, zero to wait for it to be readable
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EAGAIN, EFAULT, EIDRM, EINTR and EINVAL,
+ *          as specified for semtimedop(3)
+ */
+int shr_wait_(shr_t *restrict, int, int, const struct timespec *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), visibility("hidden"))));
+
+/**
+ * Acquire the current buffer of a shared ring buffer,
+ * waiting if necessary, and as many of the following
+ * buffers as are immediately available, up to a limit
+ * 
+ * @param   shr    The shared ring buffer
+ * @param   write  Non-zero to acquire buffers for writing,
+ *                 zero to acquire buffers for reading
+ * @param   max    The maximum number of buffers to acquire, no more than
+ *                 `SHR_BATCH_MAX` are acquired, 0 is treated as 1
+ * @return         The number of acquired buffers, 0 on error; on
+ *                 error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+size_t shr_acquire_(shr_t *restrict, int, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Acquire the current buffer of a shared ring buffer, and
+ * the buffers following it, for writing, all at once
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   n       The number of buffers, at least 1 and at most `SHR_BATCH_MAX`
+ *                  and the number of buffers in the shared ring buffer
+ * @param   nowait  Whether to fail with EAGAIN instead of waiting
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EAGAIN, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+int shr_acquire_all_(shr_t *restrict, size_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Give back buffers, that have been acquired for writing
+ * with `shr_acquire_`, without publishing them, as
+ * `shr_write_cancel` does
+ * 
+ * @param   shr    The shared ring buffer
+ * @param   first  The number of buffers after the current buffer to start at
+ * @param   n      The number of buffers, at most `SHR_BATCH_MAX`
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ */
+int shr_give_back_(shr_t *restrict, size_t, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Fill in the metadata of a buffer, that is
+ * about to be published, other than its length
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  i    The index of the buffer
+ */
+void shr_stamp_(const shr_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Verify the metadata of a buffer that has been acquired for reading
+ * 
+ * @param   shr  The shared ring buffer
+ * @param   i    The index of the buffer
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The checksum does not match the content of the buffer
+ */
+int shr_verify_(const shr_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"), warn_unused_result)));
+
+/**
+ * Calculate the CRC32C checksum of a memory segment
+ * 
+ * @param   data  The memory segment
+ * @param   n     The size of the memory segment
+ * @return        The checksum
+ */
+uint32_t shr_crc32c_(const void *, size_t)
+	SHR_COMPILER_GCC(__attribute__((visibility("hidden"), pure)));
+
+/**
+ * The number of entries in the table `shr_lz_compress_` uses
+ */
+#define SHR_LZ_TABLE_SIZE  4096
+
+/**
+ * Compress a memory segment with LZ77, in the LZ4 block format
+ * 
+ * @param   table  Table of `SHR_LZ_TABLE_SIZE` entries, zero-initialised
+ *                 before the first call, and then reused between calls
+ * @param   dest   Output buffer for the compressed data
+ * @param   size   The size of `dest`
+ * @param   src    The data to compress
+ * @param   n      The length of `src`
+ * @return         The length of the compressed data,
+ *                 0 if it does not fit in `dest`
+ */
+size_t shr_lz_compress_(uint32_t *restrict, void *restrict, size_t, const void *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), visibility("hidden"))));
+
+/**
+ * Decompress data compressed with `shr_lz_compress_`
+ * 
+ * @param   dest  Output buffer for the data
+ * @param   size  The size of `dest`
+ * @param   src   The compressed data
+ * @param   n     The length of `src`
+ * @return        The length of the data, -1 if the compressed
+ *                data is malformed or does not fit in `dest`
+ */
+ssize_t shr_lz_decompress_(void *restrict, size_t, const void *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((visibility("hidden"))));
+
+/**
+ * Initialise the header of a shared ring buffer
+ * 
+ * @param  address  The address of the shared memory
+ * @param  key      The key of the shared ring buffer
+ */
+void shr_init_header_(void *, const shr_key_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Wait until a number of buffers in a local shared
+ * ring buffer are available to the current end
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   n        The number of buffers, at most the number of buffers in the ring
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  The buffers were not available in time
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+int shr_local_wait_(shr_t *restrict, size_t, int, const struct timespec *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), visibility("hidden"))));
+
+/**
+ * Get the number of buffers in a local shared ring
+ * buffer that are available to the current end
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       The number of available buffers
+ */
+size_t shr_local_available_(shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Load the state of the current end of a local shared ring
+ * buffer from its header, and set its current buffer
+ * 
+ * @param  shr  The shared ring buffer
+ */
+void shr_local_reset_(shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Hand over buffers in a local shared ring
+ * buffer from the current end to the other end
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  n    The number of buffers
+ */
+void shr_local_release_(shr_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * Set the current buffer of an end of a shared ring buffer with
+ * `SHR_OVERWRITE` or `SHR_LATEST` to the next buffer the writer will publish
+ * 
+ * @param  shr  The shared ring buffer
+ */
+void shr_overwrite_reset_(shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * `shr_read`, `shr_read_try` and `shr_read_timed`
+ * for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   buffer   Output parameter for the buffer to read
+ * @param   length   Output parameter for the length of `*buffer`
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN   No buffer was published in time
+ * @throws  EINTR    The wait was interrupted by a signal handler
+ * @throws  ESTALE   The writer has overwritten the current buffer,
+ *                   the reader has skipped to the newest buffer
+ * @throws  EBADMSG  As for `shr_read`
+ */
+int shr_overwrite_read_(shr_t *restrict, const char **restrict, size_t *restrict, int, const struct timespec *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2, 3), visibility("hidden"))));
+
+/**
+ * `shr_read_done` for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       Zero on success, -1 on error, 1 if the write
+ *               end has closed and all data has been read; on
+ *               error, `errno` will be set to describe the error
+ * 
+ * @throws  ESTALE  The buffer was overwritten while it was read
+ */
+int shr_overwrite_read_done_(shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * `shr_write`, `shr_write_try` and `shr_write_timed`
+ * for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   buffer  Output parameter for the buffer to write
+ * @return          Zero
+ */
+int shr_overwrite_write_(shr_t *restrict, char **restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+/**
+ * `shr_write_done` for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   length  The number of written bytes
+ * @return          Zero
+ */
+int shr_overwrite_write_done_(shr_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, visibility("hidden"))));
+
+
+
+#endif
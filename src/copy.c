@@ -0,0 +1,414 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+# include <immintrin.h>
+# define HAVE_X86_NT
+#elif defined(__GNUC__) && defined(__aarch64__)
+# define HAVE_ARM_NT
+#endif
+
+
+
+/**
+ * The smallest copy, in bytes, for which `shr_write_copy` uses
+ * non-temporal stores, if the size of the CPU's second level
+ * cache is unknown
+ * 
+ * Copies that fit in that cache are faster with normal stores,
+ * since the reader then gets the data from a cache rather than
+ * from memory: in doc/examples/copy, with a 2 MiB L2 cache,
+ * non-temporal stores were 60 % slower for 64 KiB buffers and
+ * 20 % slower for 1 MiB buffers, but 10 % faster for 3 MiB
+ * buffers and larger
+ */
+#define NT_THRESHOLD  (1 << 20)
+
+/**
+ * The number of cache lines, at the beginning of the
+ * next buffer, that `shr_read_copy` prefetches
+ */
+#define PREFETCH_LINES  4
+
+
+
+/**
+ * Copy a memory segment with non-temporal stores,
+ * without a store fence
+ * 
+ * @param  dest  The destination, aligned to 64 bytes
+ * @param  src   The source
+ * @param  n     The number of bytes, a multiple of 64
+ */
+typedef void nt_copy_func(void *restrict, const void *restrict, size_t);
+
+
+#if defined(HAVE_X86_NT)
+__attribute__((target("avx512f")))
+static void
+nt_copy_avx512(void *restrict dest, const void *restrict src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+	for (; n; n -= 64, d += 64, s += 64)
+		_mm512_stream_si512((void *)d, _mm512_loadu_si512((const void *)s));
+}
+
+__attribute__((target("avx2")))
+static void
+nt_copy_avx2(void *restrict dest, const void *restrict src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+	for (; n; n -= 64, d += 64, s += 64) {
+		_mm256_stream_si256((__m256i *)(void *)(d +  0), _mm256_loadu_si256((const __m256i *)(const void *)(s +  0)));
+		_mm256_stream_si256((__m256i *)(void *)(d + 32), _mm256_loadu_si256((const __m256i *)(const void *)(s + 32)));
+	}
+}
+
+static void
+nt_copy_sse2(void *restrict dest, const void *restrict src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+	for (; n; n -= 64, d += 64, s += 64) {
+		_mm_stream_si128((__m128i *)(void *)(d +  0), _mm_loadu_si128((const __m128i *)(const void *)(s +  0)));
+		_mm_stream_si128((__m128i *)(void *)(d + 16), _mm_loadu_si128((const __m128i *)(const void *)(s + 16)));
+		_mm_stream_si128((__m128i *)(void *)(d + 32), _mm_loadu_si128((const __m128i *)(const void *)(s + 32)));
+		_mm_stream_si128((__m128i *)(void *)(d + 48), _mm_loadu_si128((const __m128i *)(const void *)(s + 48)));
+	}
+}
+#elif defined(HAVE_ARM_NT)
+static void
+nt_copy_neon(void *restrict dest, const void *restrict src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+	for (; n; n -= 64, d += 64, s += 64)
+		__asm__ volatile("ldp q0, q1, [%1]\n\t"
+		                 "ldp q2, q3, [%1, #32]\n\t"
+		                 "stnp q0, q1, [%0]\n\t"
+		                 "stnp q2, q3, [%0, #32]"
+		                 : : "r"(d), "r"(s) : "v0", "v1", "v2", "v3", "memory");
+}
+#endif
+
+
+/**
+ * The non-temporal copy function selected for
+ * the CPU, `NULL` if there is none
+ */
+static nt_copy_func *nt_copy;
+
+/**
+ * The smallest copy, in bytes, for which
+ * non-temporal stores are used
+ */
+static size_t nt_threshold = NT_THRESHOLD;
+
+
+/**
+ * Select the best non-temporal copy
+ * function supported by the CPU
+ */
+SHR_COMPILER_GCC(__attribute__((constructor)))
+static void
+copy_init(void)
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2 > 0)
+		nt_threshold = (size_t)l2;
+#endif
+#if defined(HAVE_X86_NT)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		nt_copy = nt_copy_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		nt_copy = nt_copy_avx2;
+	else
+		nt_copy = nt_copy_sse2;
+#elif defined(HAVE_ARM_NT)
+	nt_copy = nt_copy_neon;
+#endif
+}
+
+
+/**
+ * Copy data into a buffer, bypassing the cache
+ * for large copies if the CPU supports it
+ * 
+ * @param   dest  The buffer
+ * @param   src   The data
+ * @param   n     The number of bytes to copy
+ * @return        Whether non-temporal stores were used, in which
+ *                case `nt_fence` must be called before the buffer
+ *                is published
+ */
+static int
+copy_in(char *restrict dest, const char *restrict src, size_t n)
+{
+	size_t head, body;
+
+	if (n < nt_threshold || !nt_copy) {
+		memcpy(dest, src, n);
+		return 0;
+	}
+
+	head = -(uintptr_t)dest & 63;
+	body = (n - head) & ~(size_t)63;
+	memcpy(dest, src, head);
+	nt_copy(dest + head, src + head, body);
+	memcpy(dest + head + body, src + head + body, n - head - body);
+	return 1;
+}
+
+
+/**
+ * Make non-temporal stores, which are weakly ordered,
+ * visible before a buffer is published
+ */
+static inline void
+nt_fence(void)
+{
+#if defined(HAVE_X86_NT)
+	_mm_sfence();
+#elif defined(HAVE_ARM_NT)
+	__asm__ volatile("dmb ishst" : : : "memory");
+#endif
+}
+
+
+
+/**
+ * Wait for a buffer in a shared ring buffer to be ready
+ * for writing, copy data into it, and publish it
+ * 
+ * Large copies use non-temporal stores, if supported by
+ * the CPU, so that the data, which the writer will not
+ * read again, does not evict the writer's cache
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   data    The data to write, must not be `NULL` unless `length` is 0
+ * @param   length  The number of bytes to write
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EMSGSIZE  `length` is greater than `SHR_BUFFER_SIZE(shr)`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+int
+shr_write_copy(shr_t *restrict shr, const void *restrict data, size_t length)
+{
+	char *buffer;
+
+	if (length > shr->key.buffer_size)
+		return errno = EMSGSIZE, -1;
+
+	if (shr_write(shr, &buffer))
+		return -1;
+	if (copy_in(buffer, data, length))
+		nt_fence();
+	return shr_write_done(shr, length);
+}
+
+
+/**
+ * Copy pieces of data into as many consecutive buffers
+ * as they need and publish the buffers atomically
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   iov     The pieces of data
+ * @param   iovcnt  The number of elements in `iov`
+ * @param   nowait  Whether to fail with EAGAIN instead of waiting
+ * @return          The number of bytes written, -1 on error
+ */
+static ssize_t
+gather(shr_t *restrict shr, const struct iovec *restrict iov, int iovcnt, int nowait)
+{
+	size_t size = shr->key.buffer_size, total = 0, n, i, j, off, len, used = 0;
+	char *buffer;
+	int saved_errno, nt = 0;
+
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return errno = EINVAL, -1;
+	for (j = 0; j < (size_t)iovcnt; j++) {
+		if (iov[j].iov_len > (size_t)SSIZE_MAX - total)
+			return errno = EINVAL, -1;
+		total += iov[j].iov_len;
+	}
+
+	n = size ? (total + size - 1) / size : (total ? SIZE_MAX : 0);
+	if (!n)
+		n = 1;
+	if (n > shr->key.buffer_count || n > SHR_BATCH_MAX)
+		return errno = EMSGSIZE, -1;
+
+	if (shr_acquire_all_(shr, n, nowait))
+		return -1;
+
+	i = 0;
+	buffer = BUFFER(shr, next_buffer(shr, 0));
+	for (j = 0; j < (size_t)iovcnt; j++) {
+		for (off = 0; off < iov[j].iov_len; off += len) {
+			if (used == size) {
+				*LENGTH(shr, next_buffer(shr, i)) = size;
+				buffer = BUFFER(shr, next_buffer(shr, ++i));
+				used = 0;
+			}
+			len = iov[j].iov_len - off;
+			if (len > size - used)
+				len = size - used;
+			nt |= copy_in(buffer + used, (const char *)iov[j].iov_base + off, len);
+			used += len;
+		}
+	}
+	*LENGTH(shr, next_buffer(shr, i)) = used;
+	/* One fence covers every piece. */
+	if (nt)
+		nt_fence();
+
+	for (i = 0; i < n; i++)
+		shr_stamp_(shr, next_buffer(shr, i));
+	if (shr_batch_op_(shr, 0, 0, n, +1)) {
+		saved_errno = errno;
+		shr_batch_op_(shr, 1, 0, n, +1);
+		return errno = saved_errno, -1;
+	}
+	shr->current_buffer = next_buffer(shr, n);
+	return (ssize_t)total;
+}
+
+
+/**
+ * Wait for enough consecutive buffers in a shared ring buffer to be
+ * ready for writing, gather pieces of data into them, and publish
+ * the buffers atomically
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   iov     The pieces of data, must not be `NULL` unless `iovcnt` is 0
+ * @param   iovcnt  The number of elements in `iov`
+ * @return          The number of bytes written, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL    `iovcnt` is negative or greater than `IOV_MAX`, the
+ *                    total length overflows `ssize_t`, or the shared ring
+ *                    buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  EMSGSIZE  The data needs more buffers than the shared ring
+ *                    buffer has, or more than 64 buffers
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+ssize_t
+shr_writev(shr_t *restrict shr, const struct iovec *restrict iov, int iovcnt)
+{
+	return gather(shr, iov, iovcnt, 0);
+}
+
+
+/**
+ * Like `shr_writev`, but fail with EAGAIN instead of
+ * waiting if the buffers are not ready for writing
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   iov     The pieces of data, must not be `NULL` unless `iovcnt` is 0
+ * @param   iovcnt  The number of elements in `iov`
+ * @return          The number of bytes written, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  The buffers were not ready for writing
+ * @throws  Any error specified for `shr_writev`
+ */
+ssize_t
+shr_writev_try(shr_t *restrict shr, const struct iovec *restrict iov, int iovcnt)
+{
+	return gather(shr, iov, iovcnt, 1);
+}
+
+
+/**
+ * Wait for a buffer in a shared ring buffer to be filled with
+ * readable data, copy the data out of it, and mark it as fully read
+ * 
+ * The beginning of the next buffer is prefetched, so that
+ * it is likely to be cached by the next call
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   data    Output buffer for the data, must not be `NULL` unless `size` is 0
+ * @param   size    The size of `data`, if the data is longer, it is truncated
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been read, ignored if `NULL`
+ * @return          The length of the data in the buffer, which may be greater
+ *                  than `size`, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, the data
+ *                   is copied and the buffer is discarded
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`,
+ *                   and the writer overwrote the buffer before or while it was copied
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+ssize_t
+shr_read_copy(shr_t *restrict shr, void *restrict data, size_t size, int *restrict closed)
+{
+	const char *buffer, *next;
+	size_t length, i;
+	int r, bad = 0;
+
+	if (shr_read(shr, &buffer, &length)) {
+		if (errno != EBADMSG)
+			return -1;
+		bad = 1;
+	}
+	memcpy(data, buffer, length < size ? length : size);
+
+	if ((r = shr_read_done(shr)) < 0)
+		return -1;
+	if (closed)
+		*closed = r;
+
+	next = BUFFER(shr, shr->current_buffer);
+	SHR_COMPILER_GCC(__builtin_prefetch(LENGTH(shr, shr->current_buffer)));
+	for (i = 0; i < PREFETCH_LINES && i * 64 < shr->key.buffer_size; i++)
+		SHR_COMPILER_GCC(__builtin_prefetch(next + i * 64));
+
+	if (bad)
+		return errno = EBADMSG, -1;
+	return (ssize_t)length;
+}
@@ -0,0 +1,275 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <nmmintrin.h>
+# define HAVE_SSE42_CRC
+#elif defined(__GNUC__) && defined(__aarch64__)
+# include <arm_acle.h>
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+# define HAVE_ARM_CRC
+#endif
+
+
+
+/**
+ * The CRC32C polynomial, in reversed bit order
+ */
+#define POLYNOMIAL  UINT32_C(0x82F63B78)
+
+/**
+ * The number of bytes in each of the three lanes
+ * that are checksummed in parallel by the
+ * hardware-accelerated implementations
+ */
+#define LANE  256
+
+
+
+/**
+ * Tables for the slice-by-8 implementation
+ */
+static uint32_t table[8][256];
+
+/**
+ * Tables for multiplying a checksum by x^(8 * LANE)
+ * modulo the polynomial, one for each byte of the checksum
+ */
+static uint32_t shift_table[4][256];
+
+/**
+ * The selected implementation, it takes the checksum
+ * so far, without the final inversion, and returns
+ * the updated checksum
+ */
+static uint32_t (*implementation)(uint32_t, const unsigned char *, size_t);
+
+
+
+/**
+ * Calculate the CRC32C checksum of a memory segment,
+ * without hardware acceleration
+ * 
+ * @param   crc   The checksum so far, without the final inversion
+ * @param   data  The memory segment
+ * @param   n     The size of the memory segment
+ * @return        The checksum, without the final inversion
+ */
+static uint32_t
+crc32c_sw(uint32_t crc, const unsigned char *data, size_t n)
+{
+	for (; n && ((uintptr_t)data & 7); n--)
+		crc = table[0][(crc ^ *data++) & 255] ^ (crc >> 8);
+
+	for (; n >= 8; n -= 8, data += 8) {
+		crc ^= (uint32_t)data[0] << 0 | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+		crc = table[7][(crc >>  0) & 255] ^ table[6][(crc >>  8) & 255] ^
+		      table[5][(crc >> 16) & 255] ^ table[4][(crc >> 24) & 255] ^
+		      table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+	}
+
+	for (; n; n--)
+		crc = table[0][(crc ^ *data++) & 255] ^ (crc >> 8);
+
+	return crc;
+}
+
+
+/**
+ * Multiply a checksum by x^(8 * LANE) modulo the polynomial,
+ * that is, append `LANE` zero bytes to the checksummed data
+ * 
+ * @param   crc  The checksum, without the final inversion
+ * @return       The shifted checksum
+ */
+static inline uint32_t
+shift(uint32_t crc)
+{
+	return shift_table[0][(crc >>  0) & 255] ^ shift_table[1][(crc >>  8) & 255] ^
+	       shift_table[2][(crc >> 16) & 255] ^ shift_table[3][(crc >> 24) & 255];
+}
+
+
+#if defined(HAVE_SSE42_CRC)
+/**
+ * Calculate the CRC32C checksum of a memory segment,
+ * using the SSE4.2 CRC32 instruction
+ * 
+ * @param   crc   The checksum so far, without the final inversion
+ * @param   data  The memory segment
+ * @param   n     The size of the memory segment
+ * @return        The checksum, without the final inversion
+ */
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_sse42(uint32_t crc, const unsigned char *data, size_t n)
+{
+# if defined(__x86_64__)
+	uint64_t a, b, c, w;
+	size_t i;
+
+	for (; n && ((uintptr_t)data & 7); n--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	/* Three independent lanes hide the latency of the instruction. */
+	for (; n >= 3 * LANE; n -= 3 * LANE, data += 3 * LANE) {
+		a = crc, b = 0, c = 0;
+		for (i = 0; i < LANE; i += 8) {
+			memcpy(&w, data + 0 * LANE + i, 8), a = _mm_crc32_u64(a, w);
+			memcpy(&w, data + 1 * LANE + i, 8), b = _mm_crc32_u64(b, w);
+			memcpy(&w, data + 2 * LANE + i, 8), c = _mm_crc32_u64(c, w);
+		}
+		crc = shift(shift((uint32_t)a) ^ (uint32_t)b) ^ (uint32_t)c;
+	}
+
+	for (w = crc; n >= 8; n -= 8, data += 8) {
+		uint64_t v;
+		memcpy(&v, data, 8);
+		w = _mm_crc32_u64(w, v);
+	}
+	crc = (uint32_t)w;
+# else
+	uint32_t w;
+	for (; n >= 4; n -= 4, data += 4) {
+		memcpy(&w, data, 4);
+		crc = _mm_crc32_u32(crc, w);
+	}
+# endif
+
+	for (; n; n--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+#endif
+
+
+#if defined(HAVE_ARM_CRC)
+/**
+ * Calculate the CRC32C checksum of a memory segment,
+ * using the ARMv8 CRC32 instructions
+ * 
+ * @param   crc   The checksum so far, without the final inversion
+ * @param   data  The memory segment
+ * @param   n     The size of the memory segment
+ * @return        The checksum, without the final inversion
+ */
+__attribute__((target("+crc")))
+static uint32_t
+crc32c_arm(uint32_t crc, const unsigned char *data, size_t n)
+{
+	uint32_t a, b, c;
+	uint64_t w;
+	size_t i;
+
+	for (; n && ((uintptr_t)data & 7); n--)
+		crc = __crc32cb(crc, *data++);
+
+	/* Three independent lanes hide the latency of the instruction. */
+	for (; n >= 3 * LANE; n -= 3 * LANE, data += 3 * LANE) {
+		a = crc, b = 0, c = 0;
+		for (i = 0; i < LANE; i += 8) {
+			memcpy(&w, data + 0 * LANE + i, 8), a = __crc32cd(a, w);
+			memcpy(&w, data + 1 * LANE + i, 8), b = __crc32cd(b, w);
+			memcpy(&w, data + 2 * LANE + i, 8), c = __crc32cd(c, w);
+		}
+		crc = shift(shift(a) ^ b) ^ c;
+	}
+
+	for (; n >= 8; n -= 8, data += 8) {
+		memcpy(&w, data, 8);
+		crc = __crc32cd(crc, w);
+	}
+
+	for (; n; n--)
+		crc = __crc32cb(crc, *data++);
+
+	return crc;
+}
+#endif
+
+
+/**
+ * Create the tables and select the best implementation
+ * supported by the CPU
+ */
+SHR_COMPILER_GCC(__attribute__((constructor)))
+static void
+crc32c_init(void)
+{
+	static const unsigned char zeroes[LANE];
+	uint32_t crc, basis[32];
+	int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = (uint32_t)i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (POLYNOMIAL & -(crc & 1));
+		table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 255];
+
+	/* Multiplication by x^(8 * LANE) is linear, so it is enough to shift each bit. */
+	for (j = 0; j < 32; j++)
+		basis[j] = crc32c_sw(UINT32_C(1) << j, zeroes, LANE);
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < 256; i++) {
+			for (crc = 0, j = 0; j < 8; j++)
+				if (i & (1 << j))
+					crc ^= basis[8 * k + j];
+			shift_table[k][i] = crc;
+		}
+	}
+
+	implementation = crc32c_sw;
+#if defined(HAVE_SSE42_CRC)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		implementation = crc32c_sse42;
+#elif defined(HAVE_ARM_CRC)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		implementation = crc32c_arm;
+#endif
+}
+
+
+/**
+ * Calculate the CRC32C checksum of a memory segment
+ * 
+ * @param   data  The memory segment
+ * @param   n     The size of the memory segment
+ * @return        The checksum
+ */
+uint32_t
+shr_crc32c_(const void *data, size_t n)
+{
+	if (SHR_UNLIKELY(!implementation))
+		crc32c_init();
+	return ~implementation(~UINT32_C(0), data, n);
+}
@@ -0,0 +1,143 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+
+
+
+/**
+ * Take the next readable buffer of a shared ring buffer,
+ * without waiting, if its deadline has passed
+ * 
+ * @param   shr  The read end of the shared ring buffer
+ * @param   n    The number of buffers after the current
+ *               buffer already taken
+ * @param   now  The current time, in nanoseconds
+ * @return       1 if the buffer was taken, 0 if it is not
+ *               readable or not stale, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+static int
+take_stale(shr_t *restrict shr, size_t n, uint64_t now)
+{
+	size_t i = next_buffer(shr, n);
+	struct sembuf op;
+	uint64_t deadline;
+	int stale;
+
+	if (LOCAL(shr)) {
+		if (n >= shr_local_available_(shr))
+			return 0;
+	} else {
+		op.sem_num = (unsigned short)READ_SEM(i);
+		op.sem_op = -1;
+		op.sem_flg = IPC_NOWAIT;
+		if (semop(shr->sem, &op, (size_t)1))
+			return errno == EAGAIN ? 0 : -1;
+	}
+
+	deadline = *META(shr, i, SHR_DEADLINE);
+	stale = deadline && deadline <= now && *LENGTH(shr, i);
+	if (!stale && !LOCAL(shr)) {
+		op.sem_op = +1;
+		while (semop(shr->sem, &op, (size_t)1))
+			if (errno != EINTR)
+				return -1;
+	}
+	return stale;
+}
+
+
+
+/**
+ * Select the time to live of the buffers the write end of a shared
+ * ring buffer with the flag `SHR_DEADLINE` publishes from now on
+ * 
+ * @param   shr  The write end of the shared ring buffer, must not be `NULL`
+ * @param   ttl  The time to live, relative, `NULL` or zero for no deadline
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_DEADLINE`
+ */
+int
+shr_set_ttl(shr_t *restrict shr, const struct timespec *ttl)
+{
+	if (!(shr->key.flags & SHR_DEADLINE))
+		return errno = EINVAL, -1;
+	shr->ttl = ttl ? timespec_ns(ttl) : 0;
+	return 0;
+}
+
+
+/**
+ * Skip, and mark as fully read, all readable buffers of a shared
+ * ring buffer with the flag `SHR_DEADLINE`, up to the first buffer
+ * whose deadline has not passed, and add them to `SHR_SKIPPED(shr)`
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr  The read end of the shared ring buffer, must not be `NULL`
+ * @return       The number of skipped buffers, -1 on error; on
+ *               error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_DEADLINE`,
+ *                  or it has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+ssize_t
+shr_skip_stale(shr_t *restrict shr)
+{
+	uint64_t now = clock_ns(CLOCK_MONOTONIC);
+	size_t n, total = 0;
+	int r = 1, saved_errno;
+
+	if (!(shr->key.flags & SHR_DEADLINE) || OVERWRITE(shr))
+		return errno = EINVAL, -1;
+
+	/* Stale buffers are released in batches, with one semaphore operation each. */
+	while (r > 0) {
+		for (n = 0; n < SHR_BATCH_MAX && n < shr->key.buffer_count; n++)
+			if ((r = take_stale(shr, n, now)) <= 0)
+				break;
+		if (r < 0) {
+			saved_errno = errno;
+			shr_batch_op_(shr, 0, 0, n, +1);
+			return errno = saved_errno, -1;
+		}
+		if (shr_batch_op_(shr, 1, 0, n, +1))
+			return -1;
+		shr->current_buffer = next_buffer(shr, n);
+		shr->skipped += n;
+		total += n;
+		if (n < SHR_BATCH_MAX)
+			break;
+	}
+
+	return (ssize_t)total;
+}
@@ -0,0 +1,597 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_desc.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+/**
+ * The value of `struct bufpool_header.magic`
+ */
+#define BUFPOOL_MAGIC  UINT32_C(0x50485323)
+
+/**
+ * The value of an entry in the free list of a buffer
+ * pool while the buffer is allocated
+ */
+#define ALLOCATED  UINT32_MAX
+
+/**
+ * Get the header of a buffer pool
+ * 
+ * @param   pool:shr_bufpool_t *         The buffer pool
+ * @return  :struct bufpool_header *  The header
+ */
+#define POOL_HEADER(pool)  ((struct bufpool_header *)(void *)((pool)->address))
+
+/**
+ * Get the free list of a buffer pool, entry `i` is the index
+ * plus one of the free buffer after buffer `i`, 0 if it is the
+ * last, or `ALLOCATED` if buffer `i` is allocated
+ * 
+ * @param   pool:shr_bufpool_t *   The buffer pool
+ * @return  :_Atomic uint32_t *  The free list
+ */
+#define NEXT(pool)  ((_Atomic uint32_t *)(void *)((pool)->address + SHR_HEADER_SIZE))
+
+
+
+/**
+ * The beginning of the shared memory of a buffer
+ * pool, it is followed by unused space up to
+ * `SHR_HEADER_SIZE` bytes, and then by the free
+ * list and the buffers
+ */
+struct bufpool_header
+{
+	/**
+	 * `BUFPOOL_MAGIC`
+	 */
+	uint32_t magic;
+
+	/**
+	 * `SHR_VERSION`
+	 */
+	uint32_t version;
+
+	/**
+	 * The buffer size of the buffer pool
+	 */
+	uint64_t buffer_size;
+
+	/**
+	 * The buffer count of the buffer pool
+	 */
+	uint64_t buffer_count;
+
+	/**
+	 * Padding, so that the free list head is in its own cache line
+	 */
+	char padding1[64 - 2 * sizeof(uint32_t) - 2 * sizeof(uint64_t)];
+
+	/**
+	 * The head of the free list: the index plus one of the
+	 * first free buffer, 0 if none is free, in the low 32 bits,
+	 * and the number of changes, which prevents a stale head
+	 * from being restored, in the high 32 bits
+	 */
+	_Atomic uint64_t head;
+
+	/**
+	 * Padding, so that the counter is in its own cache line
+	 */
+	char padding2[64 - sizeof(uint64_t)];
+
+	/**
+	 * The number of released buffers, modulo 2 to the power
+	 * of 32, which allocating threads sleep on when none is free
+	 */
+	struct shr_counter freed;
+};
+
+_Static_assert(sizeof(struct bufpool_header) <= SHR_HEADER_SIZE, "struct bufpool_header is too large");
+
+
+
+/**
+ * Initialise the shared memory of a buffer pool,
+ * with all buffers in the free list, in order
+ * 
+ * @param  address  The address of the shared memory
+ * @param  key      The key of the buffer pool
+ */
+static void
+init_pool(void *address, const shr_bufpool_key_t *restrict key)
+{
+	struct bufpool_header *header = address;
+	_Atomic uint32_t *next = (_Atomic uint32_t *)(void *)((char *)address + SHR_HEADER_SIZE);
+	size_t i;
+
+	memset(header, 0, SHR_HEADER_SIZE);
+	header->magic = BUFPOOL_MAGIC;
+	header->version = SHR_VERSION;
+	header->buffer_size = key->buffer_size;
+	header->buffer_count = key->buffer_count;
+	for (i = 0; i < key->buffer_count; i++)
+		atomic_init(&next[i], (uint32_t)(i + 1 < key->buffer_count ? i + 2 : 0));
+	atomic_init(&header->head, 1);
+}
+
+
+/**
+ * Check that the header of a buffer pool
+ * matches the key it was opened with
+ * 
+ * @param   address  The address of the shared memory
+ * @param   key      The key of the buffer pool
+ * @return           Whether the header matches
+ */
+static int
+check_pool(const void *address, const shr_bufpool_key_t *restrict key)
+{
+	const struct bufpool_header *header = address;
+	return header->magic == BUFPOOL_MAGIC &&
+	       header->version == SHR_VERSION &&
+	       header->buffer_size == key->buffer_size &&
+	       header->buffer_count == key->buffer_count;
+}
+
+
+/**
+ * Check the geometry of a buffer pool
+ * 
+ * @param   key  The key of the buffer pool
+ * @return       Whether the geometry can be represented by descriptors
+ */
+static int
+valid_geometry(const shr_bufpool_key_t *restrict key)
+{
+	return key->buffer_count && key->buffer_count < UINT32_MAX && key->buffer_size <= UINT32_MAX;
+}
+
+
+/**
+ * Take the first buffer from the free list of a buffer pool
+ * 
+ * @param   pool   The buffer pool
+ * @param   index  Output parameter for the index of the buffer
+ * @return         Whether a buffer was free
+ */
+static int
+pop(shr_bufpool_t *restrict pool, uint32_t *restrict index)
+{
+	_Atomic uint64_t *head = &POOL_HEADER(pool)->head;
+	_Atomic uint32_t *next = NEXT(pool);
+	uint64_t old = atomic_load_explicit(head, memory_order_acquire), new;
+	uint32_t i;
+
+	do {
+		if (!(uint32_t)old)
+			return 0;
+		i = (uint32_t)old - 1;
+		/* If buffer `i` has been taken since `old` was loaded, this is stale, but so is `old`. */
+		new = ((old >> 32) + 1) << 32 | atomic_load_explicit(&next[i], memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak_explicit(head, &old, new, memory_order_acquire, memory_order_acquire));
+
+	atomic_store_explicit(&next[i], ALLOCATED, memory_order_relaxed);
+	*index = i;
+	return 1;
+}
+
+
+/**
+ * Allocate a buffer from a buffer pool
+ * 
+ * @param   pool     The buffer pool
+ * @param   desc     Output parameter for a descriptor of the buffer
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  No buffer became free in time
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+static int
+alloc(shr_bufpool_t *restrict pool, struct shr_desc *restrict desc, int nowait, const struct timespec *timeout)
+{
+	struct bufpool_header *header = POOL_HEADER(pool);
+	uint32_t index, count;
+	int r;
+
+	while (!pop(pool, &index)) {
+		if (nowait)
+			return errno = EAGAIN, -1;
+
+		/* The sequentially consistent operations pair with those in `shr_bufpool_free`. */
+		atomic_fetch_add(&header->freed.waiters, 1);
+		count = atomic_load(&header->freed.count);
+		r = 0;
+		if (!(uint32_t)atomic_load(&header->head))
+			r = (int)syscall(SYS_futex, &header->freed.count, FUTEX_WAIT, count, timeout, NULL, 0);
+		atomic_fetch_sub(&header->freed.waiters, 1);
+		if (r && errno == ETIMEDOUT)
+			return errno = EAGAIN, -1;
+		if (r && errno == EINTR)
+			return -1;
+	}
+
+	desc->index = index;
+	desc->offset = 0;
+	desc->length = 0;
+	return 0;
+}
+
+
+
+/**
+ * Create a buffer pool
+ * 
+ * @param   key           Output parameter for the key, must not be `NULL`
+ * @param   buffer_size   The size of each buffer, in bytes, at most `UINT32_MAX`
+ * @param   buffer_count  The number of buffers, must be positive
+ *                        and less than `UINT32_MAX`
+ * @param   permissions   The permissions of the buffer pool
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `buffer_size` or `buffer_count` is out of range
+ * @throws  The errors EINVAL, ENOMEM and ENOSPC, as specified for shmget(3)
+ * @throws  Any error specified for shmat(3)
+ */
+int
+shr_bufpool_create(shr_bufpool_key_t *restrict key, size_t buffer_size, size_t buffer_count, mode_t permissions)
+{
+	void *address;
+	int shm_id, saved_errno;
+	double r;
+
+	key->shm = IPC_PRIVATE;
+	key->buffer_size = buffer_size;
+	key->buffer_count = buffer_count;
+
+	if (!valid_geometry(key))
+		return errno = EINVAL, -1;
+
+	permissions &= (mode_t)~(S_IXUSR | S_IXGRP | S_IXOTH);
+
+	/* Create shared memory. */
+	for (;;) {
+		r = (double)rand();
+		r /= (double)RAND_MAX + 1;
+		r *= (1 << (8 * sizeof(key_t) - 2)) - 1;
+
+		key->shm = (key_t)r + 1;
+		if (key->shm == IPC_PRIVATE)
+			continue;
+
+		shm_id = shmget(key->shm, SHR_BUFPOOL_SIZE(buffer_size, buffer_count),
+		                IPC_CREAT | IPC_EXCL | (int)permissions);
+		if (shm_id != -1)
+			break;
+
+		if ((errno != EEXIST) && (errno != EINTR)) {
+			key->shm = IPC_PRIVATE;
+			return -1;
+		}
+	}
+
+	/* Initialise shared memory. */
+	address = shmat(shm_id, NULL, 0);
+	if (!address || (address == (void *)-1)) {
+		saved_errno = errno;
+		shmctl(shm_id, IPC_RMID, NULL);
+		key->shm = IPC_PRIVATE;
+		return errno = saved_errno, -1;
+	}
+	init_pool(address, key);
+	shmdt(address);
+	return 0;
+}
+
+
+/**
+ * Open a buffer pool, always for both reading and writing
+ * 
+ * @param   pool  Output parameter for the buffer pool, must not be `NULL`
+ * @param   key   The key for the buffer pool, use `SHR_BUFPOOL_PRIVATE`
+ *                on the key before passing it to this function, to create
+ *                and open a private buffer pool
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared memory is not a buffer pool, or its
+ *                  geometry does not match the key
+ * @throws  Any error specified for shmget(3) and shmat(3) except EINTR
+ */
+int
+shr_bufpool_open(shr_bufpool_t *restrict pool, const shr_bufpool_key_t *restrict key)
+{
+	int private = key->shm == IPC_PRIVATE;
+	void *address;
+	int saved_errno;
+
+	pool->shm = -1;
+	pool->key = *key;
+	pool->address = NULL;
+
+	if (private && !valid_geometry(key))
+		return errno = EINVAL, -1;
+
+	/* Get shared memory. */
+	do
+		pool->shm = shmget(key->shm, SHR_BUFPOOL_SIZE(key->buffer_size, key->buffer_count),
+		                   private ? IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR : 0);
+	while (pool->shm == -1 && errno == EINTR);
+	if (pool->shm == -1)
+		return -1;
+	do
+		address = shmat(pool->shm, NULL, 0);
+	while ((!address || address == (void *)-1) && errno == EINTR);
+	if (!address || address == (void *)-1)
+		goto fail;
+
+	if (private) {
+		init_pool(address, key);
+	} else if (!check_pool(address, key)) {
+		shmdt(address);
+		errno = EINVAL;
+		goto fail;
+	}
+	pool->address = address;
+	return 0;
+
+fail:
+	saved_errno = errno;
+	if (private)
+		shmctl(pool->shm, IPC_RMID, NULL);
+	pool->shm = -1;
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Close a buffer pool, buffers allocated by
+ * this process are not released
+ * 
+ * @param  pool  The buffer pool, must not be `NULL`
+ */
+void
+shr_bufpool_close(shr_bufpool_t *restrict pool)
+{
+	if (pool->address)
+		shmdt(pool->address);
+	pool->address = NULL;
+}
+
+
+/**
+ * Close and remove a buffer pool, the memory is
+ * freed once all processes have closed it
+ * 
+ * @param  pool  The buffer pool, must not be `NULL`
+ */
+void
+shr_bufpool_remove(shr_bufpool_t *restrict pool)
+{
+	shr_bufpool_close(pool);
+	if (pool->shm != -1)
+		shmctl(pool->shm, IPC_RMID, NULL);
+	pool->shm = -1;
+}
+
+
+/**
+ * Allocate a buffer from a buffer pool, and wait
+ * until one is released if none is free
+ * 
+ * @param   pool  The buffer pool, must not be `NULL`
+ * @param   desc  Output parameter for a descriptor of the buffer,
+ *                with `offset` and `length` set to 0, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINTR  The wait was interrupted by a signal handler
+ */
+int
+shr_bufpool_alloc(shr_bufpool_t *restrict pool, struct shr_desc *restrict desc)
+{
+	return alloc(pool, desc, 0, NULL);
+}
+
+
+/**
+ * Variant of `shr_bufpool_alloc` that fails if no buffer is free
+ * 
+ * @param   pool  The buffer pool, must not be `NULL`
+ * @param   desc  Output parameter for a descriptor of the buffer,
+ *                with `offset` and `length` set to 0, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  No buffer is free
+ */
+int
+shr_bufpool_alloc_try(shr_bufpool_t *restrict pool, struct shr_desc *restrict desc)
+{
+	return alloc(pool, desc, 1, NULL);
+}
+
+
+/**
+ * Variant of `shr_bufpool_alloc` that fails if no
+ * buffer has become free within a specified time
+ * 
+ * @param   pool     The buffer pool, must not be `NULL`
+ * @param   desc     Output parameter for a descriptor of the buffer,
+ *                   with `offset` and `length` set to 0, must not be `NULL`
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  No buffer became free in time
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+int
+shr_bufpool_alloc_timed(shr_bufpool_t *restrict pool, struct shr_desc *restrict desc, const struct timespec *timeout)
+{
+	return alloc(pool, desc, 0, timeout);
+}
+
+
+/**
+ * Release a buffer to its buffer pool, buffers
+ * can be released in any order, by any process
+ * 
+ * @param   pool  The buffer pool, must not be `NULL`
+ * @param   desc  A descriptor of the buffer, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The descriptor does not refer to an allocated buffer
+ */
+int
+shr_bufpool_free(shr_bufpool_t *restrict pool, const struct shr_desc *restrict desc)
+{
+	struct bufpool_header *header = POOL_HEADER(pool);
+	_Atomic uint32_t *next = NEXT(pool);
+	uint32_t i = desc->index, allocated = ALLOCATED;
+	uint64_t old, new;
+
+	/* Claiming the entry first makes a second release of the same buffer fail. */
+	if (i >= pool->key.buffer_count ||
+	    !atomic_compare_exchange_strong_explicit(&next[i], &allocated, 0, memory_order_relaxed, memory_order_relaxed))
+		return errno = EINVAL, -1;
+
+	old = atomic_load_explicit(&header->head, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&next[i], (uint32_t)old, memory_order_relaxed);
+		new = ((old >> 32) + 1) << 32 | (i + 1);
+	} while (!atomic_compare_exchange_weak(&header->head, &old, new));
+
+	atomic_fetch_add(&header->freed.count, 1);
+	if (atomic_load(&header->freed.waiters))
+		syscall(SYS_futex, &header->freed.count, FUTEX_WAKE, 1, NULL, NULL, 0);
+	return 0;
+}
+
+
+/**
+ * Pass descriptors to the read end of a shared ring buffer,
+ * as many as fit in one of its buffers
+ * 
+ * The buffers the descriptors refer to are passed along with them, the
+ * caller must not use them afterwards; forwarding a buffer to another
+ * shared ring buffer thus copies only its descriptor
+ * 
+ * @param   shr    The shared ring buffer, must not be `NULL`
+ * @param   descs  The descriptors, must not be `NULL` unless `n` is 0
+ * @param   n      The number of descriptors, if 0, an empty
+ *                 buffer, which can mark the end of a stream, is sent
+ * @return         The number of descriptors passed, at most `SHR_DESC_MAX(shr)`,
+ *                 -1 on error; on error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `SHR_DESC_MAX(shr)` is 0
+ * @throws  Any error specified for `shr_write`
+ */
+ssize_t
+shr_desc_send(shr_t *restrict shr, const struct shr_desc *restrict descs, size_t n)
+{
+	char *buffer;
+
+	if (!SHR_DESC_MAX(shr))
+		return errno = EINVAL, -1;
+	if (n > SHR_DESC_MAX(shr))
+		n = SHR_DESC_MAX(shr);
+
+	if (shr_write(shr, &buffer))
+		return -1;
+	if (n)
+		memcpy(buffer, descs, n * sizeof(*descs));
+	if (shr_write_done(shr, n * sizeof(*descs)))
+		return -1;
+	return (ssize_t)n;
+}
+
+
+/**
+ * Receive the descriptors in the next buffer of a shared ring buffer
+ * 
+ * The buffers the descriptors refer to are handed over to the caller,
+ * who may hold them for as long as it needs to, and release them in
+ * any order; the buffer in the shared ring buffer is released at once
+ * 
+ * Each descriptor is checked against the buffer pool, so that
+ * `SHR_DESC_DATA` and `shr_bufpool_free` can be used on it
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   pool    The buffer pool the descriptors belong to, must not be `NULL`
+ * @param   descs   Output buffer for the descriptors, must not be `NULL`
+ * @param   max     The size of `descs`, in descriptors, at least `SHR_DESC_MAX(shr)`
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been read, ignored if `NULL`
+ * @return          The number of descriptors received, 0 for an empty buffer,
+ *                  -1 on error; on error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The buffer does not hold whole descriptors, or a descriptor
+ *                   refers to a buffer that is not in `pool`, or to data that
+ *                   does not fit in its buffer; the buffer is discarded, and the
+ *                   buffers of its other descriptors are not released
+ * @throws  EINVAL   `max` is less than `SHR_DESC_MAX(shr)`
+ * @throws  Any error specified for `shr_read_copy`
+ */
+ssize_t
+shr_desc_recv(shr_t *restrict shr, const shr_bufpool_t *restrict pool, struct shr_desc *restrict descs,
+              size_t max, int *restrict closed)
+{
+	ssize_t r;
+	size_t i, n;
+
+	if (max < SHR_DESC_MAX(shr))
+		return errno = EINVAL, -1;
+
+	r = shr_read_copy(shr, descs, max * sizeof(*descs), closed);
+	if (r < 0)
+		return -1;
+	if ((size_t)r % sizeof(*descs) || (size_t)r > max * sizeof(*descs))
+		return errno = EBADMSG, -1;
+
+	/* The descriptors come from another process, which cannot be trusted to keep them in range. */
+	n = (size_t)r / sizeof(*descs);
+	for (i = 0; i < n; i++)
+		if ((size_t)descs[i].index >= pool->key.buffer_count ||
+		    (size_t)descs[i].offset > pool->key.buffer_size ||
+		    descs[i].length > (uint64_t)(pool->key.buffer_size - descs[i].offset))
+			return errno = EBADMSG, -1;
+	return (ssize_t)n;
+}
@@ -0,0 +1,306 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+
+/**
+ * Get the address of the length of the address stored with a buffer
+ * 
+ * @param   shr:const shr_t *  The shared ring buffer
+ * @param   i:size_t           The index of the buffer
+ * @return  :uint32_t *        The address of the length
+ */
+#define ADDRESS_LENGTH(shr, i)  ((uint32_t *)(void *)META(shr, i, SHR_ADDRESS))
+
+/**
+ * Get the address of the address stored with a buffer
+ * 
+ * @param   shr:const shr_t *  The shared ring buffer
+ * @param   i:size_t           The index of the buffer
+ * @return  :char *            The address of the address
+ */
+#define ADDRESS(shr, i)  ((char *)META(shr, i, SHR_ADDRESS) + sizeof(uint32_t))
+
+
+/**
+ * Advance the current buffer
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  n    The number of buffers to advance
+ */
+static void
+advance(shr_t *restrict shr, size_t n)
+{
+	shr->current_buffer = next_buffer(shr, n);
+}
+
+
+
+/**
+ * Receive datagrams directly into as many writable buffers of
+ * a shared ring buffer as are available, with a single recvmmsg,
+ * one datagram per buffer, and publish them atomically
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The socket to receive from
+ * @param   max_buffers  The maximum number of datagrams to receive
+ * @param   flags        Flags for recvmmsg(2), `MSG_WAITFORONE` is always added
+ * @return               The number of received datagrams, -1 on error; on
+ *                       error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for recvmmsg(2)
+ */
+ssize_t
+shr_dgram_in(shr_t *restrict shr, int fd, size_t max_buffers, int flags)
+{
+	struct mmsghdr msgs[SHR_BATCH_MAX];
+	struct iovec iov[SHR_BATCH_MAX];
+	int addressed = shr->key.flags & SHR_ADDRESS;
+	size_t i, j, n, held, used;
+	int got, saved_errno;
+
+	n = held = shr_acquire_(shr, 1, max_buffers);
+	if (!n)
+		return -1;
+
+	memset(msgs, 0, n * sizeof(*msgs));
+	for (i = 0; i < n; i++) {
+		j = next_buffer(shr, i);
+		iov[i].iov_base = BUFFER(shr, j);
+		iov[i].iov_len = shr->key.buffer_size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (addressed) {
+			msgs[i].msg_hdr.msg_name = ADDRESS(shr, j);
+			msgs[i].msg_hdr.msg_namelen = SHR_ADDRESS_MAX;
+		}
+	}
+
+	while ((got = recvmmsg(fd, msgs, (unsigned int)n, flags | MSG_WAITFORONE, NULL)) < 0)
+		if (errno != EINTR)
+			goto fail;
+
+	/* A datagram larger than a buffer is truncated, as by recv(2). */
+	used = (size_t)got;
+	for (i = 0; i < used; i++) {
+		j = next_buffer(shr, i);
+		*LENGTH(shr, j) = msgs[i].msg_len;
+		/* An address that was truncated to fit is unusable, so the datagram is stored without one. */
+		if (addressed)
+			*ADDRESS_LENGTH(shr, j) = msgs[i].msg_hdr.msg_namelen > SHR_ADDRESS_MAX ? 0 : msgs[i].msg_hdr.msg_namelen;
+		shr_stamp_(shr, j);
+	}
+
+	if (shr_give_back_(shr, used, n - used))        goto fail;
+	held = used;
+	if (shr_batch_op_(shr, 0, 0, used, +1))         goto fail;
+	advance(shr, used);
+	return (ssize_t)used;
+
+ fail:
+	/* Only the buffers that have not already been given back are given back. */
+	saved_errno = errno;
+	shr_give_back_(shr, 0, held);
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Send the data in as many readable buffers of a shared ring buffer
+ * as are available, one datagram per buffer, with a single sendmmsg
+ * if possible, and mark them as fully read
+ * 
+ * An empty buffer is only taken if it is the current buffer, it
+ * is not sent, and marks the end of the stream, so that 0 is
+ * returned when the end of the stream has been reached
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The socket to send to
+ * @param   max_buffers  The maximum number of datagrams to send
+ * @param   closed       Output parameter for whether the write end has
+ *                       closed and all data has been read, ignored if `NULL`
+ * @return               The number of sent datagrams, -1 on error; on
+ *                       error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and
+ *                   the checksum of the current buffer does not match its
+ *                   content, the buffer is discarded
+ * @throws  EINVAL   The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for sendmmsg(2)
+ */
+ssize_t
+shr_dgram_out(shr_t *restrict shr, int fd, size_t max_buffers, int *restrict closed)
+{
+	struct mmsghdr msgs[SHR_BATCH_MAX];
+	struct iovec iov[SHR_BATCH_MAX];
+	int addressed = shr->key.flags & SHR_ADDRESS;
+	size_t i, j, n, first = 0;
+	int sent, saved_errno;
+
+	n = shr_acquire_(shr, 0, max_buffers);
+	if (!n)
+		return -1;
+
+	memset(msgs, 0, n * sizeof(*msgs));
+	for (i = 0; i < n; i++) {
+		j = next_buffer(shr, i);
+		if (shr_verify_(shr, j)) {
+			if (i) {
+				/* Leave the corrupt buffer to the next call. */
+				if (shr_batch_op_(shr, 0, i, n - i, +1))
+					goto fail;
+				n = i;
+				break;
+			}
+			/* Discard the corrupt buffer and report it. */
+			saved_errno = errno;
+			shr_batch_op_(shr, 0, 1, n - 1, +1);
+			if (!shr_batch_op_(shr, 1, 0, 1, +1))
+				advance(shr, 1);
+			return errno = saved_errno, -1;
+		}
+		iov[i].iov_base = BUFFER(shr, j);
+		iov[i].iov_len = *LENGTH(shr, j);
+		if (!iov[i].iov_len) {
+			/* Leave empty buffers, that mark the end of the stream, to the next call. */
+			if (i) {
+				if (shr_batch_op_(shr, 0, i, n - i, +1))
+					goto fail;
+				n = i;
+				break;
+			}
+			if (shr_batch_op_(shr, 0, 1, n - 1, +1))
+				goto fail;
+			n = 1;
+			first = 1;
+			break;
+		}
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (addressed && *ADDRESS_LENGTH(shr, j)) {
+			msgs[i].msg_hdr.msg_name = ADDRESS(shr, j);
+			msgs[i].msg_hdr.msg_namelen = *ADDRESS_LENGTH(shr, j);
+			if (msgs[i].msg_hdr.msg_namelen > SHR_ADDRESS_MAX)
+				msgs[i].msg_hdr.msg_namelen = SHR_ADDRESS_MAX;
+		}
+	}
+
+	while (first < n) {
+		sent = sendmmsg(fd, msgs + first, (unsigned int)(n - first), 0);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		first += (size_t)sent;
+	}
+
+	if (shr_batch_op_(shr, 1, 0, n, +1))
+		goto fail;
+	advance(shr, n);
+	if (closed)
+		*closed = HEADER(shr)->closed == shr->current_buffer + 1;
+	return iov[0].iov_len ? (ssize_t)n : 0;
+
+ fail:
+	/* Sent buffers are consumed, the rest are given back. */
+	saved_errno = errno;
+	if (!shr_batch_op_(shr, 1, 0, first, +1)) {
+		shr_batch_op_(shr, 0, first, n - first, +1);
+		advance(shr, first);
+	}
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Store a socket address with the buffer that has been
+ * acquired with `shr_write`, `shr_write_try` or `shr_write_timed`
+ * 
+ * @param   shr      The shared ring buffer, must not be `NULL`
+ * @param   address  The address, `NULL` to store no address
+ * @param   length   The length of `address`
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_ADDRESS`
+ * @throws  EINVAL  `length` is greater than `SHR_ADDRESS_MAX`
+ */
+int
+shr_write_address(shr_t *restrict shr, const struct sockaddr *restrict address, socklen_t length)
+{
+	if (!(shr->key.flags & SHR_ADDRESS) || length > SHR_ADDRESS_MAX)
+		return errno = EINVAL, -1;
+	if (!address)
+		length = 0;
+	else
+		memcpy(ADDRESS(shr, shr->current_buffer), address, length);
+	*ADDRESS_LENGTH(shr, shr->current_buffer) = (uint32_t)length;
+	return 0;
+}
+
+
+/**
+ * Get the socket address stored with the buffer that has
+ * been acquired with `shr_read`, `shr_read_try` or `shr_read_timed`
+ * 
+ * @param   shr      The shared ring buffer, must not be `NULL`
+ * @param   address  Output buffer for the address, it is truncated if it
+ *                   is too small, may be `NULL` if `*length` is 0
+ * @param   length   The size of `address`, updated to the length of the
+ *                   address, which is 0 if no address was stored
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_ADDRESS`
+ */
+int
+shr_read_address(const shr_t *restrict shr, struct sockaddr *restrict address, socklen_t *restrict length)
+{
+	socklen_t stored;
+	if (!(shr->key.flags & SHR_ADDRESS))
+		return errno = EINVAL, -1;
+	stored = (socklen_t)*ADDRESS_LENGTH(shr, shr->current_buffer);
+	if (stored > SHR_ADDRESS_MAX)
+		stored = SHR_ADDRESS_MAX;
+	if (address)
+		memcpy(address, ADDRESS(shr, shr->current_buffer), stored < *length ? stored : *length);
+	*length = stored;
+	return 0;
+}
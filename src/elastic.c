@@ -0,0 +1,218 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+
+/**
+ * The number of pages `shr_stat_memory` checks per call to mincore(2)
+ */
+#define MINCORE_CHUNK  4096
+
+
+
+/**
+ * Release the whole pages of a buffer
+ * 
+ * @param   shr  The shared ring buffer
+ * @param   i    The index of the buffer
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for madvise(2)
+ */
+static int
+release_pages(const shr_t *restrict shr, size_t i)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)BUFFER(shr, i);
+	uintptr_t end = start + shr->key.buffer_size;
+	int r;
+
+	start = (start + page - 1) & ~(page - 1);
+	end &= ~(page - 1);
+	if (start >= end)
+		return 0;
+
+	/*
+	 * Holding the buffer does not stop observers, so it is marked as
+	 * being written while it is zeroed, and then as given back
+	 * unpublished, so that observers do not take the zeroes for
+	 * the data that was last published in it.
+	 */
+	observe_begin(shr, i);
+	/* MADV_DONTNEED does not release shared memory, it only unmaps it. */
+	r = madvise((void *)start, end - start, PROCESS_SHARED(shr) ? MADV_REMOVE : MADV_DONTNEED);
+	cancel_sequence(shr, i);
+	return r;
+}
+
+
+/**
+ * Check whether a buffer has not been published for a period of time,
+ * and has not been released since it was last published
+ * 
+ * @param   shr   The shared ring buffer
+ * @param   i     The index of the buffer
+ * @param   now   The current time, in nanoseconds
+ * @param   idle  The period of time, in nanoseconds
+ * @return        Whether the buffer shall be released
+ */
+static int
+is_idle(const shr_t *restrict shr, size_t i, uint64_t now, uint64_t idle)
+{
+	uint64_t published = *META(shr, i, SHR_ELASTIC);
+	return published && now - published >= idle;
+}
+
+
+
+/**
+ * Get the amount of memory a shared ring buffer
+ * uses, and how much of it is resident
+ * 
+ * @param   shr       The shared ring buffer, must not be `NULL`
+ * @param   resident  Output parameter for the number of bytes that
+ *                    are resident in memory, ignored if `NULL`
+ * @param   total     Output parameter for the size of the shared
+ *                    ring buffer, in bytes, ignored if `NULL`
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for mincore(2)
+ */
+int
+shr_stat_memory(const shr_t *restrict shr, size_t *restrict resident, size_t *restrict total)
+{
+	unsigned char vec[MINCORE_CHUNK];
+	size_t size = SHR_RING_SIZE(shr->key.buffer_size, shr->key.flags, shr->key.buffer_count);
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)shr->address & ~(page - 1);
+	uintptr_t end = (uintptr_t)shr->address + size;
+	size_t pages, n, i, count = 0;
+
+	if (total)
+		*total = size;
+	if (!resident)
+		return 0;
+
+	for (; start < end; start += pages * page) {
+		pages = (end - start + page - 1) / page;
+		if (pages > MINCORE_CHUNK)
+			pages = MINCORE_CHUNK;
+		if (mincore((void *)start, pages * page, vec))
+			return -1;
+		for (i = 0; i < pages; i++)
+			count += vec[i] & 1;
+	}
+
+	n = count * page;
+	*resident = n < size ? n : size;
+	return 0;
+}
+
+
+/**
+ * Release the memory of the buffers of a shared ring buffer with
+ * the flag `SHR_ELASTIC` that are free for writing and have not
+ * been published for a period of time
+ * 
+ * @param   shr   The write end of the shared ring buffer, must not be `NULL`
+ * @param   idle  The time, relative, a buffer must have been unused to
+ *                be released, `NULL` to release all free buffers
+ * @return        The number of released buffers, -1 on error; on
+ *                error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_ELASTIC`,
+ *                  or it has the flag `SHR_OVERWRITE` or `SHR_LATEST`, or
+ *                  `shr` is not the write end
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for madvise(2)
+ */
+ssize_t
+shr_trim(shr_t *restrict shr, const struct timespec *idle)
+{
+	struct sembuf op;
+	uint64_t now, min_idle = 0;
+	size_t k, i, n, released = 0;
+	int saved_errno;
+
+	/* Readers of overwriting shared ring buffers may be reading any buffer. */
+	if (!(shr->key.flags & SHR_ELASTIC) || OVERWRITE(shr) || shr->direction != SHR_WRITE)
+		return errno = EINVAL, -1;
+
+	now = clock_ns(CLOCK_MONOTONIC_COARSE);
+	if (idle)
+		min_idle = timespec_ns(idle);
+
+	if (LOCAL(shr)) {
+		/* The buffers the write end has not handed over are free. */
+		n = shr_local_available_(shr);
+		for (k = 0; k < n; k++) {
+			i = next_buffer(shr, k);
+			if (!is_idle(shr, i, now, min_idle))
+				continue;
+			if (release_pages(shr, i))
+				return -1;
+			*META(shr, i, SHR_ELASTIC) = 0;
+			released += 1;
+		}
+		return (ssize_t)released;
+	}
+
+	op.sem_flg = IPC_NOWAIT;
+	for (k = 0; k < shr->key.buffer_count; k++) {
+		i = next_buffer(shr, k);
+		if (!is_idle(shr, i, now, min_idle))
+			continue;
+
+		/* Hold the buffer so that it cannot be read while it is released. */
+		op.sem_num = (unsigned short)WRITE_SEM(i);
+		op.sem_op = -1;
+		if (semop(shr->sem, &op, (size_t)1)) {
+			if (errno == EAGAIN)
+				continue;
+			return -1;
+		}
+
+		saved_errno = 0;
+		if (release_pages(shr, i))
+			saved_errno = errno;
+		else
+			*META(shr, i, SHR_ELASTIC) = 0;
+
+		op.sem_op = +1;
+		if (semop(shr->sem, &op, (size_t)1))
+			return -1;
+		if (saved_errno)
+			return errno = saved_errno, -1;
+		released += 1;
+	}
+
+	return (ssize_t)released;
+}
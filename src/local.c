@@ -0,0 +1,365 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+/**
+ * The number of times to check the other end's
+ * counter before going to sleep on it
+ */
+#define SPIN_LIMIT  128
+
+/**
+ * Get the counter the current end of a local
+ * shared ring buffer hands over buffers with
+ * 
+ * @param   shr:shr_t *              The shared ring buffer
+ * @return  :struct shr_counter *  The counter
+ */
+#define OWN(shr)  \
+	((shr)->direction == SHR_WRITE ? &HEADER(shr)->written : &HEADER(shr)->read)
+
+/**
+ * Get the counter the other end of a local
+ * shared ring buffer hands over buffers with
+ * 
+ * @param   shr:shr_t *              The shared ring buffer
+ * @return  :struct shr_counter *  The counter
+ */
+#define PEER(shr)  \
+	((shr)->direction == SHR_WRITE ? &HEADER(shr)->read : &HEADER(shr)->written)
+
+/**
+ * Get the index of the current buffer of the current
+ * end of a local shared ring buffer, as stored in the
+ * shared memory for the next time the end is opened
+ * 
+ * @param   shr:shr_t *                The shared ring buffer
+ * @return  :_Atomic uint32_t *        The index
+ */
+#define OWN_INDEX(shr)  \
+	((shr)->direction == SHR_WRITE ? &HEADER(shr)->written_index : &HEADER(shr)->read_index)
+
+
+
+/**
+ * The number of times to check the other end's counter before
+ * going to sleep on it, zero on uniprocessor systems, where
+ * the other end cannot make progress while this end spins
+ */
+static int spin_limit = SPIN_LIMIT;
+
+
+
+/**
+ * Check whether spinning is worthwhile
+ */
+SHR_COMPILER_GCC(__attribute__((constructor)))
+static void
+local_init(void)
+{
+	if (sysconf(_SC_NPROCESSORS_ONLN) == 1)
+		spin_limit = 0;
+}
+
+
+/**
+ * Tell the CPU that the thread is spinning
+ */
+static inline void
+cpu_relax(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	__asm__ volatile("yield" : : : "memory");
+#endif
+}
+
+
+/**
+ * Get the number of buffers that were available to the
+ * current end, when the other end's counter was last checked
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       The number of available buffers
+ */
+static inline size_t
+available(const shr_t *restrict shr)
+{
+	unsigned int used = shr->released - shr->peer_released;
+	if (shr->direction == SHR_WRITE)
+		return shr->key.buffer_count - (size_t)used;
+	return (size_t)-used;
+}
+
+
+/**
+ * Subtract one point in time from another
+ * 
+ * @param   a  The minuend
+ * @param   b  The subtrahend
+ * @param   r  Output parameter for the difference
+ * @return     Whether the difference is positive
+ */
+static int
+time_sub(const struct timespec *a, const struct timespec *b, struct timespec *r)
+{
+	r->tv_sec = a->tv_sec - b->tv_sec;
+	r->tv_nsec = a->tv_nsec - b->tv_nsec;
+	if (r->tv_nsec < 0)
+		r->tv_sec -= 1, r->tv_nsec += 1000000000L;
+	return r->tv_sec > 0 || (r->tv_sec == 0 && r->tv_nsec > 0);
+}
+
+
+
+/**
+ * Create and open the write end of a local shared ring buffer,
+ * use `shr_reverse_dup` to get the read end
+ * 
+ * A local shared ring buffer can only be used between threads
+ * in the same process; it does not use any XSI IPC objects,
+ * instead it is synchronised with atomic operations, and the
+ * threads only call futex(2) when they have to sleep or wake
+ * the other end
+ * 
+ * `shr_remove` releases the memory if it was allocated by this
+ * function, `shr_chown`, `shr_chmod` and `shr_stat` fail with
+ * EINVAL, and the key of the shared ring buffer is meaningless
+ * 
+ * Undefined behaviour will be invoked if
+ * `SHR_RING_SIZE(buffer_size, flags, buffer_count) > SIZE_MAX`
+ * 
+ * @param   shr           Output parameter for the shared ring buffer, must not be `NULL`
+ * @param   memory        Memory of at least `SHR_RING_SIZE(buffer_size, flags, buffer_count)`
+ *                        bytes, aligned to 64 bytes, for the shared ring buffer, or `NULL`
+ *                        to allocate it
+ * @param   buffer_size   The size of each buffer, in bytes
+ * @param   buffer_count  The number of buffers, most be positive
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `buffer_count` is 0, or `flags` contains an unsupported
+ *                  flag, or both `SHR_OVERWRITE` and `SHR_LATEST`
+ * @throws  ENOMEM  `memory` is `NULL` and the memory could not be allocated
+ */
+int
+shr_open_local(shr_t *restrict shr, void *memory, size_t buffer_size, size_t buffer_count, int flags)
+{
+	uint32_t kind = SHR_LOCAL_USER;
+	size_t i;
+	int r;
+
+	shr->shm = shr->sem = -1;
+	shr->address = NULL;
+
+	if (!buffer_count || !VALID_FLAGS(flags))
+		return errno = EINVAL, -1;
+
+	if (!memory) {
+		r = posix_memalign(&memory, 64, SHR_RING_SIZE(buffer_size, flags, buffer_count));
+		if (r)
+			return errno = r, -1;
+		kind = SHR_LOCAL_ALLOCATED;
+	}
+
+	shr->key.shm = shr->key.sem = IPC_PRIVATE;
+	shr->key.buffer_size = buffer_size;
+	shr->key.buffer_count = buffer_count;
+	shr->key.flags = flags;
+	shr->direction = SHR_WRITE;
+	shr->address = memory;
+
+	shr_init_header_(memory, &shr->key);
+	HEADER(shr)->local = kind;
+	shr_local_reset_(shr);
+	/* Unlike XSI shared memory, the memory is not zeroed. */
+	for (i = 0; i < buffer_count; i++)
+		memset(LENGTH(shr, i), 0, SHR_TRAILER_SIZE(flags));
+	shr->sequence = shr->lost = 0;
+	shr->ttl = shr->skipped = 0;
+	PROBE(create, probe_ring(shr), buffer_size, buffer_count, flags);
+	return 0;
+}
+
+
+/**
+ * Load the state of the current end of a local shared ring
+ * buffer from its header, and set its current buffer
+ * 
+ * @param  shr  The shared ring buffer
+ */
+void
+shr_local_reset_(shr_t *restrict shr)
+{
+	shr->released = atomic_load(&OWN(shr)->count);
+	shr->peer_released = atomic_load(&PEER(shr)->count);
+	shr->current_buffer = atomic_load_explicit(OWN_INDEX(shr), memory_order_relaxed) % shr->key.buffer_count;
+}
+
+
+/**
+ * Sleep until a number of buffers in a local shared
+ * ring buffer are available to the current end
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   n        The number of buffers
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  The buffers were not available in time
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+static int
+sleep_until_available(shr_t *restrict shr, size_t n, const struct timespec *timeout)
+{
+	struct shr_counter *peer = PEER(shr);
+	struct timespec deadline, now, left;
+	unsigned int seen;
+	int r;
+
+	if (timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000L)
+			deadline.tv_sec += 1, deadline.tv_nsec -= 1000000000L;
+	}
+
+	for (;;) {
+		seen = shr->peer_released;
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (!time_sub(&deadline, &now, &left))
+				return errno = EAGAIN, -1;
+		}
+		/* The sequentially consistent operations pair with those in `shr_local_release_`. */
+		atomic_fetch_add(&peer->waiters, 1);
+		r = 0;
+		if (atomic_load(&peer->count) == seen)
+			r = (int)syscall(SYS_futex, &peer->count, FUTEX_CMD(shr, FUTEX_WAIT), seen, timeout ? &left : NULL, NULL, 0);
+		atomic_fetch_sub(&peer->waiters, 1);
+		if (r && errno == EINTR)
+			return -1;
+		shr->peer_released = atomic_load_explicit(&peer->count, memory_order_acquire);
+		if (available(shr) >= n)
+			return 0;
+	}
+}
+
+
+/**
+ * Wait until a number of buffers in a local shared
+ * ring buffer are available to the current end
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   n        The number of buffers, at most the number of buffers in the ring
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  The buffers were not available in time
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+int
+shr_local_wait_(shr_t *restrict shr, size_t n, int nowait, const struct timespec *timeout)
+{
+	struct shr_counter *peer;
+	uint64_t start = 0;
+	int i, r;
+
+	if (SHR_LIKELY(available(shr) >= n))
+		return 0;
+
+	peer = PEER(shr);
+	for (i = 0;; i++) {
+		shr->peer_released = atomic_load_explicit(&peer->count, memory_order_acquire);
+		if (available(shr) >= n)
+			return 0;
+		if (nowait)
+			return errno = EAGAIN, -1;
+		if (i >= spin_limit)
+			break;
+		cpu_relax();
+	}
+
+	/* Spinning is not reported as blocking, only sleeping is. */
+	PROBE(block_start, probe_ring(shr), shr->current_buffer, shr->direction == SHR_WRITE);
+	if (PROBE_ENABLED(block_end))
+		start = clock_ns(CLOCK_MONOTONIC);
+	r = sleep_until_available(shr, n, timeout);
+	/* `start` is only set if a tracer is attached, and reading the clock is not cheap. */
+	if (PROBE_ENABLED(block_end))
+		PROBE(block_end, probe_ring(shr), shr->current_buffer, shr->direction == SHR_WRITE, clock_ns(CLOCK_MONOTONIC) - start);
+	(void) start;
+	return r;
+}
+
+
+/**
+ * Get the number of buffers in a local shared ring
+ * buffer that are available to the current end
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       The number of available buffers
+ */
+size_t
+shr_local_available_(shr_t *restrict shr)
+{
+	shr->peer_released = atomic_load_explicit(&PEER(shr)->count, memory_order_acquire);
+	return available(shr);
+}
+
+
+/**
+ * Hand over buffers in a local shared ring
+ * buffer from the current end to the other end
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  n    The number of buffers
+ */
+void
+shr_local_release_(shr_t *restrict shr, size_t n)
+{
+	struct shr_counter *own = OWN(shr);
+	/* The handed over buffers start at the current buffer. */
+	atomic_store_explicit(OWN_INDEX(shr), (uint32_t)next_buffer(shr, n), memory_order_relaxed);
+	shr->released += (unsigned int)n;
+	atomic_store(&own->count, shr->released);
+	if (atomic_load(&own->waiters))
+		syscall(SYS_futex, &own->count, FUTEX_CMD(shr, FUTEX_WAKE), INT_MAX, NULL, NULL, 0);
+}
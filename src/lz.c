@@ -0,0 +1,286 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <string.h>
+
+
+
+/**
+ * The shortest match that is encoded
+ */
+#define MIN_MATCH  4
+
+/**
+ * The number of bytes at the end of the data that are
+ * always literals, as required by the LZ4 block format
+ */
+#define LAST_LITERALS  5
+
+/**
+ * The number of bytes at the end of the data
+ * within which no match may start
+ */
+#define MATCH_LIMIT  12
+
+/**
+ * The greatest distance back a match can refer to
+ */
+#define MAX_DISTANCE  65535
+
+
+
+/**
+ * Load 4 bytes, unaligned
+ * 
+ * @param   p  The address of the bytes
+ * @return     The bytes
+ */
+static inline uint32_t
+load32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+/**
+ * Get the number of bytes two strings have in common at
+ * their beginnings, but no more than a limit
+ * 
+ * @param   a      The first string
+ * @param   b      The second string
+ * @param   limit  The limit
+ * @return         The number of common bytes
+ */
+static inline size_t
+common_length(const unsigned char *a, const unsigned char *b, size_t limit)
+{
+	size_t n = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t x, y;
+	for (; n + 8 <= limit; n += 8) {
+		memcpy(&x, a + n, 8);
+		memcpy(&y, b + n, 8);
+		if (x != y)
+			return n + (size_t)__builtin_ctzll(x ^ y) / 8;
+	}
+#endif
+	while (n < limit && a[n] == b[n])
+		n++;
+	return n;
+}
+
+
+/**
+ * Get the index in the table of a sequence of 4 bytes
+ * 
+ * @param   v  The bytes
+ * @return     The index
+ */
+static inline uint32_t
+hash(uint32_t v)
+{
+	return (v * UINT32_C(2654435761)) >> (32 - 12);
+}
+
+_Static_assert(SHR_LZ_TABLE_SIZE == 1 << 12, "hash() does not match SHR_LZ_TABLE_SIZE");
+
+
+/**
+ * Write a length that did not fit in its nibble of a token
+ * 
+ * @param   op   The output pointer
+ * @param   len  The length less 15
+ * @return       The new output pointer
+ */
+static unsigned char *
+put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+
+/**
+ * Write a sequence: a token, literals, and unless
+ * `match` is 0, the offset and length of a match
+ * 
+ * @param   op      The output pointer
+ * @param   oend    The end of the output buffer
+ * @param   lit     The literals
+ * @param   nlit    The number of literals
+ * @param   offset  The offset of the match
+ * @param   match   The length of the match, 0 if none
+ * @return          The new output pointer, `NULL` if it does not fit
+ */
+static unsigned char *
+put_sequence(unsigned char *op, const unsigned char *oend, const unsigned char *lit, size_t nlit,
+             size_t offset, size_t match)
+{
+	unsigned char *token;
+	size_t mcode = match ? match - MIN_MATCH : 0;
+
+	/* Worst case: token, literal length, literals, offset, match length. */
+	if ((size_t)(oend - op) < 1 + nlit / 255 + 1 + nlit + 2 + mcode / 255 + 1)
+		return NULL;
+
+	token = op++;
+	*token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+	if (nlit >= 15)
+		op = put_length(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (match) {
+		*op++ = (unsigned char)(offset & 255);
+		*op++ = (unsigned char)(offset >> 8);
+		*token |= (unsigned char)(mcode < 15 ? mcode : 15);
+		if (mcode >= 15)
+			op = put_length(op, mcode - 15);
+	}
+	return op;
+}
+
+
+
+/**
+ * Compress a memory segment with LZ77, in the LZ4 block format
+ * 
+ * @param   table  Table of `SHR_LZ_TABLE_SIZE` entries, zero-initialised
+ *                 before the first call, and then reused between calls
+ * @param   dest   Output buffer for the compressed data
+ * @param   size   The size of `dest`
+ * @param   src    The data to compress
+ * @param   n      The length of `src`
+ * @return         The length of the compressed data,
+ *                 0 if it does not fit in `dest`
+ */
+size_t
+shr_lz_compress_(uint32_t *restrict table, void *restrict dest, size_t size, const void *restrict src, size_t n)
+{
+	const unsigned char *base = src, *ip = base, *anchor = base, *end = base + n, *ref;
+	unsigned char *op = dest, *oend = op + size;
+	size_t match, misses = 0;
+	uint32_t v, h;
+
+	if (n > MATCH_LIMIT && n <= UINT32_MAX) {
+		for (ip++; ip < end - MATCH_LIMIT;) {
+			v = load32(ip);
+			h = hash(v);
+			/* Entries left by earlier calls are harmless: they are behind `ip` or rejected. */
+			ref = base + table[h];
+			table[h] = (uint32_t)(ip - base);
+			if (ref >= ip || ip - ref > MAX_DISTANCE || load32(ref) != v) {
+				/* Skip faster through data that does not compress. */
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			while (ip > anchor && ref > base && ip[-1] == ref[-1])
+				ip--, ref--;
+			match = MIN_MATCH + common_length(ip + MIN_MATCH, ref + MIN_MATCH,
+			                                  (size_t)(end - LAST_LITERALS - ip) - MIN_MATCH);
+
+			op = put_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), match);
+			if (!op)
+				return 0;
+			ip += match;
+			anchor = ip;
+		}
+	}
+
+	op = put_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+	return op ? (size_t)(op - (unsigned char *)dest) : 0;
+}
+
+
+/**
+ * Decompress data compressed with `shr_lz_compress_`
+ * 
+ * @param   dest  Output buffer for the data
+ * @param   size  The size of `dest`
+ * @param   src   The compressed data
+ * @param   n     The length of `src`
+ * @return        The length of the data, -1 if the compressed
+ *                data is malformed or does not fit in `dest`
+ */
+ssize_t
+shr_lz_decompress_(void *restrict dest, size_t size, const void *restrict src, size_t n)
+{
+	const unsigned char *ip = src, *iend = ip + n, *ref;
+	unsigned char *op = dest, *oend = op + size;
+	size_t len, offset, k;
+	unsigned char token, b;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip == iend)
+					return -1;
+				len += b = *ip++;
+			} while (b == 255);
+		}
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		if (!offset || offset > (size_t)(op - (unsigned char *)dest))
+			return -1;
+
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip == iend)
+					return -1;
+				len += b = *ip++;
+			} while (b == 255);
+		}
+		len += MIN_MATCH;
+		if (len > (size_t)(oend - op))
+			return -1;
+		/* If the match overlaps the bytes it produces, they repeat with the period `offset`. */
+		for (ref = op - offset; len; len -= k, offset += k, op += k) {
+			k = len < offset ? len : offset;
+			memcpy(op, ref, k);
+		}
+	}
+
+	return (ssize_t)(op - (unsigned char *)dest);
+}
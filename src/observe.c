@@ -0,0 +1,172 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+
+
+/**
+ * The longest time, in nanoseconds, an observer sleeps
+ * before it checks again whether a buffer has been published
+ */
+#define MAX_BACKOFF  1000000L
+
+
+
+/**
+ * `shr_observe` and `shr_observe_try`
+ * 
+ * @param   shr     The observer
+ * @param   data    Output buffer for the data
+ * @param   size    The size of `data`
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been observed, ignored if `NULL`
+ * @param   nowait  Whether to fail with EAGAIN instead of waiting
+ * @return          The length of the data in the buffer, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  No new buffer has been published
+ * @throws  EINVAL  `shr` was not opened with `SHR_OBSERVE`
+ * @throws  EPIPE   The write end has closed, and all data has been observed
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+static ssize_t
+observe(shr_t *restrict shr, void *restrict data, size_t size, int *restrict closed, int nowait)
+{
+	struct timespec backoff = {0, 1000};
+	size_t count = shr->key.buffer_count, i, length;
+	_Atomic uint64_t *slot;
+	uint64_t head, n;
+	int done;
+
+	if (shr->direction != SHR_OBSERVE)
+		return errno = EINVAL, -1;
+
+	for (;;) {
+		/* The writer publishes its last buffer before it closes. */
+		done = !!atomic_load_explicit(&HEADER(shr)->closed, memory_order_acquire);
+		head = atomic_load_explicit(&HEADER(shr)->head, memory_order_acquire);
+		n = shr->sequence;
+
+		if (n >= head) {
+			if (done)
+				return errno = EPIPE, -1;
+			if (nowait)
+				return errno = EAGAIN, -1;
+			if (nanosleep(&backoff, NULL))
+				return -1;
+			if ((backoff.tv_nsec *= 2) > MAX_BACKOFF)
+				backoff.tv_nsec = MAX_BACKOFF;
+			continue;
+		}
+
+		/* The buffers before these may already be reused by the writer. */
+		if (head >= count && n < head - count + 1) {
+			shr->lost += head - count + 1 - n;
+			n = head - count + 1;
+		}
+
+		i = (size_t)(n % count);
+		slot = SEQUENCE(shr, i);
+		shr->sequence = n + 1;
+		shr->current_buffer = (size_t)(shr->sequence % count);
+
+		if (atomic_load_explicit(slot, memory_order_acquire) == 2 * n + 2) {
+			length = *LENGTH(shr, i);
+			if (length > shr->key.buffer_size)
+				length = shr->key.buffer_size;
+			memcpy(data, BUFFER(shr, i), length < size ? length : size);
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(slot, memory_order_relaxed) == 2 * n + 2) {
+				if (closed)
+					*closed = done && n + 1 >= head;
+				return (ssize_t)length;
+			}
+		}
+
+		/* The writer reused the buffer before or while it was copied. */
+		shr->lost += 1;
+	}
+}
+
+
+
+/**
+ * Copy the data out of the next buffer the writer of a shared
+ * ring buffer publishes, without taking part in the flow control
+ * 
+ * The observer follows the writer on a best-effort basis: the
+ * writer does not wait for it, and does not wake it, so until
+ * a new buffer has been published, the observer polls with
+ * exponential backoff; the data is copied, and the sequence
+ * number of the buffer checked again, so a buffer the writer
+ * reused while it was copied is never returned. Buffers the
+ * writer reused before they were copied are counted in
+ * `SHR_LOST(shr)` and skipped
+ * 
+ * @param   shr     The observer, opened with `SHR_OBSERVE`, must not be `NULL`
+ * @param   data    Output buffer for the data, must not be `NULL` unless `size` is 0
+ * @param   size    The size of `data`, if the data is longer, it is truncated
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been observed, ignored if `NULL`
+ * @return          The length of the data in the buffer, which may be greater
+ *                  than `size`, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EINVAL  `shr` was not opened with `SHR_OBSERVE`
+ * @throws  EPIPE   The write end has closed, and all data has been observed
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+ssize_t
+shr_observe(shr_t *restrict shr, void *restrict data, size_t size, int *restrict closed)
+{
+	return observe(shr, data, size, closed, 0);
+}
+
+
+/**
+ * Variant of `shr_observe` that fails
+ * if no new buffer has been published
+ * 
+ * @param   shr     The observer, opened with `SHR_OBSERVE`, must not be `NULL`
+ * @param   data    Output buffer for the data, must not be `NULL` unless `size` is 0
+ * @param   size    The size of `data`, if the data is longer, it is truncated
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been observed, ignored if `NULL`
+ * @return          The length of the data in the buffer, which may be greater
+ *                  than `size`, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EAGAIN  No new buffer has been published
+ * @throws  EINVAL  `shr` was not opened with `SHR_OBSERVE`
+ * @throws  EPIPE   The write end has closed, and all data has been observed
+ */
+ssize_t
+shr_observe_try(shr_t *restrict shr, void *restrict data, size_t size, int *restrict closed)
+{
+	return observe(shr, data, size, closed, 1);
+}
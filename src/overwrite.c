@@ -0,0 +1,315 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+/**
+ * The longest time, in nanoseconds, a reader of a shared
+ * ring buffer with `SHR_LATEST` sleeps before it checks
+ * again whether the first snapshot has been published
+ */
+#define MAX_BACKOFF  1000000L
+
+
+
+/**
+ * Advance the current buffer
+ * 
+ * @param  shr  The shared ring buffer
+ */
+static void
+advance(shr_t *restrict shr)
+{
+	shr->sequence += 1;
+	if (++(shr->current_buffer) == shr->key.buffer_count)
+		shr->current_buffer = 0;
+}
+
+
+/**
+ * Skip the read end of a shared ring buffer to
+ * the newest published buffer, and count the
+ * skipped buffers as lost
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       -1 with `errno` set to ESTALE
+ */
+static int
+resynchronise(shr_t *restrict shr)
+{
+	uint64_t head = atomic_load_explicit(&HEADER(shr)->head, memory_order_acquire);
+	if (head > shr->sequence + 1) {
+		shr->lost += head - 1 - shr->sequence;
+		shr->sequence = head - 1;
+		shr->current_buffer = (size_t)(shr->sequence % shr->key.buffer_count);
+	}
+	return errno = ESTALE, -1;
+}
+
+
+
+/**
+ * `shr_read`, `shr_read_try` and `shr_read_timed` for shared
+ * ring buffers with `SHR_LATEST`: take the newest snapshot,
+ * the writer does not wake readers, so until the first snapshot
+ * has been published, the reader polls with exponential backoff
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   buffer   Output parameter for the buffer to read
+ * @param   length   Output parameter for the length of `*buffer`
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN   No snapshot was published in time
+ * @throws  EINTR    The wait was interrupted by a signal handler
+ * @throws  EBADMSG  As for `shr_read`
+ */
+static int
+read_latest(shr_t *restrict shr, const char **restrict buffer, size_t *restrict length,
+	    int nowait, const struct timespec *timeout)
+{
+	struct timespec backoff = {0, 1000}, waited = {0, 0};
+	_Atomic uint64_t *slot;
+	uint64_t head, n;
+	size_t i;
+
+	for (;;) {
+		head = atomic_load_explicit(&HEADER(shr)->head, memory_order_acquire);
+		if (!head) {
+			if (nowait)
+				return errno = EAGAIN, -1;
+			if (timeout && (waited.tv_sec > timeout->tv_sec ||
+			                (waited.tv_sec == timeout->tv_sec && waited.tv_nsec >= timeout->tv_nsec)))
+				return errno = EAGAIN, -1;
+			if (nanosleep(&backoff, NULL))
+				return -1;
+			waited.tv_nsec += backoff.tv_nsec;
+			if (waited.tv_nsec >= 1000000000L)
+				waited.tv_sec += 1, waited.tv_nsec -= 1000000000L;
+			if ((backoff.tv_nsec *= 2) > MAX_BACKOFF)
+				backoff.tv_nsec = MAX_BACKOFF;
+			continue;
+		}
+
+		n = head - 1;
+		i = (size_t)(n % shr->key.buffer_count);
+		slot = SEQUENCE(shr, i);
+		/* If the writer has already begun to reuse the buffer, a newer snapshot exists. */
+		if (atomic_load_explicit(slot, memory_order_acquire) != 2 * n + 2)
+			continue;
+
+		shr->sequence = n;
+		shr->current_buffer = i;
+		*buffer = BUFFER(shr, i);
+		*length = *LENGTH(shr, i);
+		if (*length > shr->key.buffer_size)
+			*length = shr->key.buffer_size;
+		if (shr_verify_(shr, i)) {
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(slot, memory_order_relaxed) != 2 * n + 2)
+				continue;
+			return -1;
+		}
+		return 0;
+	}
+}
+
+
+
+/**
+ * Set the current buffer of an end of a shared ring buffer with
+ * `SHR_OVERWRITE` or `SHR_LATEST` to the next buffer the writer will publish
+ * 
+ * @param  shr  The shared ring buffer
+ */
+void
+shr_overwrite_reset_(shr_t *restrict shr)
+{
+	shr->sequence = atomic_load(&HEADER(shr)->head);
+	shr->current_buffer = (size_t)(shr->sequence % shr->key.buffer_count);
+	shr->lost = 0;
+}
+
+
+/**
+ * `shr_read`, `shr_read_try` and `shr_read_timed`
+ * for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   buffer   Output parameter for the buffer to read
+ * @param   length   Output parameter for the length of `*buffer`
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN   No buffer was published in time
+ * @throws  EINTR    The wait was interrupted by a signal handler
+ * @throws  ESTALE   The writer has overwritten the current buffer,
+ *                   the reader has skipped to the newest buffer
+ * @throws  EBADMSG  As for `shr_read`
+ */
+int
+shr_overwrite_read_(shr_t *restrict shr, const char **restrict buffer, size_t *restrict length,
+		    int nowait, const struct timespec *timeout)
+{
+	struct shr_counter *written = &HEADER(shr)->written;
+	_Atomic uint64_t *slot = SEQUENCE(shr, shr->current_buffer);
+	uint64_t want = 2 * shr->sequence + 2, seq;
+	uint32_t count;
+	int r;
+
+	if (shr->key.flags & SHR_LATEST)
+		return read_latest(shr, buffer, length, nowait, timeout);
+
+	for (;;) {
+		seq = atomic_load_explicit(slot, memory_order_acquire);
+		if (seq == want)
+			break;
+		if (seq > want)
+			return resynchronise(shr);
+		if (nowait)
+			return errno = EAGAIN, -1;
+
+		/* The sequentially consistent operations pair with those in `shr_overwrite_write_done_`. */
+		atomic_fetch_add(&written->waiters, 1);
+		count = atomic_load(&written->count);
+		r = 0;
+		if (atomic_load(slot) == seq)
+			r = (int)syscall(SYS_futex, &written->count, FUTEX_CMD(shr, FUTEX_WAIT), count, timeout, NULL, 0);
+		atomic_fetch_sub(&written->waiters, 1);
+		if (r && errno == ETIMEDOUT)
+			return errno = EAGAIN, -1;
+		if (r && errno == EINTR)
+			return -1;
+		/* A relative timeout is restarted after each wake-up, as by semtimedop(3) after EINTR. */
+	}
+
+	*buffer = BUFFER(shr, shr->current_buffer);
+	*length = *LENGTH(shr, shr->current_buffer);
+	if (*length > shr->key.buffer_size)
+		*length = shr->key.buffer_size;
+	if (shr_verify_(shr, shr->current_buffer)) {
+		/* A mismatch caused by the writer lapping the reader is not corruption. */
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(slot, memory_order_relaxed) != want)
+			return resynchronise(shr);
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * `shr_read_done` for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       Zero on success, -1 on error, 1 if the write
+ *               end has closed and all data has been read; on
+ *               error, `errno` will be set to describe the error
+ * 
+ * @throws  ESTALE  The buffer was overwritten while it was read
+ */
+int
+shr_overwrite_read_done_(shr_t *restrict shr)
+{
+	uint64_t want = 2 * shr->sequence + 2;
+	int torn;
+
+	/* Validate, after reading the data, that the writer did not touch the buffer. */
+	atomic_thread_fence(memory_order_acquire);
+	torn = atomic_load_explicit(SEQUENCE(shr, shr->current_buffer), memory_order_relaxed) != want;
+
+	if (shr->key.flags & SHR_LATEST) {
+		/* The snapshot is not consumed, the next read takes the newest snapshot. */
+		if (torn)
+			return errno = ESTALE, -1;
+		return HEADER(shr)->closed &&
+		       atomic_load_explicit(&HEADER(shr)->head, memory_order_acquire) == shr->sequence + 1;
+	}
+
+	advance(shr);
+	if (torn) {
+		shr->lost += 1;
+		return errno = ESTALE, -1;
+	}
+	return HEADER(shr)->closed &&
+	       atomic_load_explicit(&HEADER(shr)->head, memory_order_acquire) == shr->sequence;
+}
+
+
+/**
+ * `shr_write`, `shr_write_try` and `shr_write_timed`
+ * for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   buffer  Output parameter for the buffer to write
+ * @return          Zero
+ */
+int
+shr_overwrite_write_(shr_t *restrict shr, char **restrict buffer)
+{
+	atomic_store_explicit(SEQUENCE(shr, shr->current_buffer), 2 * shr->sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	*buffer = BUFFER(shr, shr->current_buffer);
+	return 0;
+}
+
+
+/**
+ * `shr_write_done` for shared ring buffers with `SHR_OVERWRITE` or `SHR_LATEST`
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   length  The number of written bytes
+ * @return          Zero
+ */
+int
+shr_overwrite_write_done_(shr_t *restrict shr, size_t length)
+{
+	struct shr_header *header = HEADER(shr);
+
+	*LENGTH(shr, shr->current_buffer) = length;
+	shr_stamp_(shr, shr->current_buffer);
+	atomic_store_explicit(SEQUENCE(shr, shr->current_buffer), 2 * shr->sequence + 2, memory_order_release);
+	advance(shr);
+	atomic_store_explicit(&header->head, shr->sequence, memory_order_release);
+
+	/* Readers of snapshots never sleep on the writer. */
+	if (shr->key.flags & SHR_LATEST)
+		return 0;
+	atomic_fetch_add(&header->written.count, 1);
+	if (atomic_load(&header->written.waiters))
+		syscall(SYS_futex, &header->written.count, FUTEX_CMD(shr, FUTEX_WAKE), INT_MAX, NULL, NULL, 0);
+	return 0;
+}
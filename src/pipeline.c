@@ -0,0 +1,1241 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_pipeline.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+/**
+ * The number of buffers in a ring
+ * if none is specified
+ */
+#define DEFAULT_BUFFER_COUNT  4
+
+/**
+ * The smallest and largest buffer size
+ * selected from the size of the cache
+ */
+#define MIN_BUFFER_SIZE  ((size_t)4 << 10)
+#define MAX_BUFFER_SIZE  ((size_t)1 << 20)
+
+/**
+ * The size of the level 2 cache assumed if
+ * it cannot be read from sysfs
+ */
+#define DEFAULT_L2_SIZE  ((size_t)256 << 10)
+
+/**
+ * Directory with the CPU topology
+ */
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+
+
+
+/**
+ * A ring connecting two stages
+ */
+struct ring
+{
+	/**
+	 * The indices of the writing and reading stages
+	 */
+	size_t from, to;
+
+	/**
+	 * The geometry of the ring, 0 if not specified
+	 */
+	size_t buffer_size, buffer_count;
+
+	/**
+	 * The write end, used by the `from` stage
+	 */
+	shr_t writer;
+
+	/**
+	 * The read end, used by the `to` stage
+	 */
+	shr_t reader;
+
+	/**
+	 * Whether the ring has been opened
+	 */
+	int opened;
+};
+
+
+/**
+ * A stage in a pipeline
+ */
+struct shr_stage
+{
+	/**
+	 * The name of the stage
+	 */
+	char *name;
+
+	/**
+	 * The function the stage runs
+	 */
+	shr_stage_func_t *func;
+
+	/**
+	 * The second argument for `func`
+	 */
+	void *user;
+
+	/**
+	 * Bitwise-OR of `enum shr_stage_flags` values
+	 */
+	int flags;
+
+	/**
+	 * The rings the stage reads from, in order
+	 */
+	shr_t **in;
+
+	/**
+	 * For each input, whether the end of the stream has been read
+	 */
+	char *eof;
+
+	/**
+	 * The number of inputs
+	 */
+	size_t inputs;
+
+	/**
+	 * The rings the stage writes to, in order
+	 */
+	shr_t **out;
+
+	/**
+	 * The number of outputs
+	 */
+	size_t outputs;
+
+	/**
+	 * The metrics of the stage, in memory
+	 * shared with child processes
+	 */
+	struct shr_stage_stats *stats;
+
+	/**
+	 * The thread running the stage
+	 */
+	pthread_t thread;
+
+	/**
+	 * The process running the stage, 0 if
+	 * it is not running in a process
+	 */
+	pid_t pid;
+
+	/**
+	 * Whether the stage has been started
+	 */
+	int started;
+
+	/**
+	 * Whether the stage failed
+	 */
+	int failed;
+};
+
+
+/**
+ * A pipeline
+ */
+struct shr_pipeline
+{
+	/**
+	 * The stages
+	 */
+	struct shr_stage *stages;
+
+	/**
+	 * The number of stages
+	 */
+	size_t stage_count;
+
+	/**
+	 * The rings
+	 */
+	struct ring *rings;
+
+	/**
+	 * The number of rings
+	 */
+	size_t ring_count;
+
+	/**
+	 * The metrics of all stages, in memory
+	 * shared with child processes
+	 */
+	struct shr_stage_stats *stats;
+
+	/**
+	 * Whether the pipeline has been started
+	 */
+	int started;
+
+	/**
+	 * Whether the pipeline has been waited for
+	 */
+	int waited;
+};
+
+
+
+/**
+ * Get the current time of the monotonic clock
+ * 
+ * @return  The time, in nanoseconds
+ */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * Read a small sysfs file
+ * 
+ * @param   path    The path of the file
+ * @param   buf     Output parameter for the content, NUL-terminated
+ * @param   size    The size of `buf`
+ * @return          Zero on success, -1 on error
+ */
+static int
+read_file(const char *path, char *buf, size_t size)
+{
+	FILE *f = fopen(path, "r");
+	size_t n;
+	if (!f)
+		return -1;
+	n = fread(buf, 1, size - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+	return n ? 0 : -1;
+}
+
+
+/**
+ * Parse a CPU list, such as "0-3,8-11"
+ * 
+ * @param   list  The CPU list
+ * @param   cpu   A CPU in the list
+ * @param   rank  Output parameter for the number of CPUs in the list
+ *                that are lower than `cpu`
+ * @return        The lowest CPU in the list, -1 if malformed
+ */
+static int
+parse_cpu_list(const char *list, int cpu, int *rank)
+{
+	long lo, hi, min = -1;
+	char *end;
+	*rank = 0;
+	while (*list && *list != '\n') {
+		lo = hi = strtol(list, &end, 10);
+		if (end == list || lo < 0)
+			return -1;
+		if (*end == '-')
+			hi = strtol(list = end + 1, &end, 10);
+		if (end == list || hi < lo)
+			return -1;
+		if (min < 0)
+			min = lo;
+		if (lo < cpu)
+			*rank += (int)((hi < cpu ? hi + 1 : cpu) - lo);
+		list = *end == ',' ? end + 1 : end;
+	}
+	return (int)min;
+}
+
+
+/**
+ * Get the lowest CPU that shares the last level cache with a CPU
+ * 
+ * @param   cpu  The CPU
+ * @return       The lowest CPU sharing the last level cache
+ *               with `cpu`, `cpu` if unknown
+ */
+static int
+llc_group(int cpu)
+{
+	char path[128], buf[4096];
+	int i, level, best_level = 0, group = cpu, first, rank;
+	for (i = 0;; i++) {
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%i/cache/index%i/level", cpu, i);
+		if (read_file(path, buf, sizeof(buf)))
+			break;
+		level = atoi(buf);
+		if (level <= best_level)
+			continue;
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%i/cache/index%i/shared_cpu_list", cpu, i);
+		if (read_file(path, buf, sizeof(buf)))
+			continue;
+		first = parse_cpu_list(buf, cpu, &rank);
+		if (first >= 0)
+			best_level = level, group = first;
+	}
+	return group;
+}
+
+
+/**
+ * Get the position of a CPU among its hardware threads
+ * 
+ * @param   cpu  The CPU
+ * @return       The number of hardware threads of the same
+ *               core with a lower index, 0 if unknown
+ */
+static int
+smt_rank(int cpu)
+{
+	char path[128], buf[4096];
+	int rank;
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%i/topology/thread_siblings_list", cpu);
+	if (read_file(path, buf, sizeof(buf)) || parse_cpu_list(buf, cpu, &rank) < 0)
+		return 0;
+	return rank;
+}
+
+
+/**
+ * Get the size of the level 2 data cache of the first CPU
+ * 
+ * @return  The size of the cache, in bytes
+ */
+static size_t
+l2_size(void)
+{
+	char path[128], buf[64], *end;
+	unsigned long size;
+	int i;
+	for (i = 0;; i++) {
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu0/cache/index%i/level", i);
+		if (read_file(path, buf, sizeof(buf)))
+			return DEFAULT_L2_SIZE;
+		if (atoi(buf) != 2)
+			continue;
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu0/cache/index%i/type", i);
+		if (read_file(path, buf, sizeof(buf)) || !strncmp(buf, "Instruction", 11))
+			continue;
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu0/cache/index%i/size", i);
+		if (read_file(path, buf, sizeof(buf)))
+			return DEFAULT_L2_SIZE;
+		size = strtoul(buf, &end, 10);
+		if (*end == 'K')  size <<= 10;
+		if (*end == 'M')  size <<= 20;
+		return size ? (size_t)size : DEFAULT_L2_SIZE;
+	}
+}
+
+
+/**
+ * A CPU, and the key it is ordered by
+ */
+struct cpu_place
+{
+	int llc, smt, cpu;
+};
+
+
+/**
+ * Compare two `struct cpu_place`
+ * 
+ * @param   a  The first CPU
+ * @param   b  The second CPU
+ * @return     Negative if `a` shall be used before `b`,
+ *             positive if `b` shall be used before `a`
+ */
+static int
+cpu_place_cmp(const void *a, const void *b)
+{
+	const struct cpu_place *x = a, *y = b;
+	if (x->llc != y->llc)  return x->llc < y->llc ? -1 : 1;
+	if (x->smt != y->smt)  return x->smt < y->smt ? -1 : 1;
+	return x->cpu < y->cpu ? -1 : x->cpu > y->cpu;
+}
+
+
+/**
+ * Order the CPUs the process may run on, such that CPUs that
+ * share a last level cache are consecutive, and within each such
+ * group, separate cores are used before the same core's other
+ * hardware threads
+ * 
+ * @param   cpus  Output parameter for the CPUs
+ * @return        The number of CPUs
+ */
+static size_t
+order_cpus(int cpus[CPU_SETSIZE])
+{
+	struct cpu_place places[CPU_SETSIZE];
+	size_t i, n = 0;
+	cpu_set_t set;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return 0;
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (!CPU_ISSET(i, &set))
+			continue;
+		places[n].cpu = (int)i;
+		places[n].llc = llc_group((int)i);
+		places[n].smt = smt_rank((int)i);
+		n++;
+	}
+	qsort(places, n, sizeof(*places), cpu_place_cmp);
+	for (i = 0; i < n; i++)
+		cpus[i] = places[i].cpu;
+	return n;
+}
+
+
+/**
+ * Order the stages of a pipeline such that each stage comes after
+ * the stages it reads from, except in cycles
+ * 
+ * @param   pipeline  The pipeline
+ * @param   order     Output parameter for the indices of the stages
+ * @return            Zero on success, -1 on error
+ */
+static int
+order_stages(const shr_pipeline_t *pipeline, size_t *order)
+{
+	size_t *indegree, i, j, n = 0, head = 0;
+	char *placed;
+
+	indegree = calloc(pipeline->stage_count + 1, sizeof(*indegree));
+	placed = calloc(pipeline->stage_count + 1, 1);
+	if (!indegree || !placed) {
+		free(indegree);
+		free(placed);
+		return -1;
+	}
+
+	for (i = 0; i < pipeline->ring_count; i++)
+		indegree[pipeline->rings[i].to]++;
+	while (n < pipeline->stage_count) {
+		if (head == n) {
+			/* Nothing is ready, so either a source or a cycle; take the first remaining. */
+			for (i = 0; placed[i]; i++);
+			placed[i] = 1;
+			order[n++] = i;
+		}
+		i = order[head++];
+		for (j = 0; j < pipeline->ring_count; j++) {
+			if (pipeline->rings[j].from != i)
+				continue;
+			if (!--indegree[pipeline->rings[j].to] && !placed[pipeline->rings[j].to]) {
+				placed[pipeline->rings[j].to] = 1;
+				order[n++] = pipeline->rings[j].to;
+			}
+		}
+	}
+
+	free(indegree);
+	free(placed);
+	return 0;
+}
+
+
+/**
+ * Publish an empty buffer, which marks the end of
+ * the stream, to each output of a stage, and close them
+ * 
+ * @param   stage  The stage
+ * @return         Zero on success, -1 on error
+ */
+static int
+close_outputs(shr_stage_t *stage)
+{
+	char *buffer;
+	size_t i;
+	int ret = 0;
+	for (i = 0; i < stage->outputs; i++) {
+		if (shr_write(stage->out[i], &buffer) || shr_write_done(stage->out[i], 0))
+			ret = -1;
+		shr_close(stage->out[i]);
+	}
+	return ret;
+}
+
+
+/**
+ * Discard the remaining data in each input of a stage,
+ * so that the stages writing to it are not blocked
+ * 
+ * @param  stage  The stage
+ */
+static void
+drain_inputs(shr_stage_t *stage)
+{
+	const char *buffer;
+	size_t i, length;
+	int r;
+	for (i = 0; i < stage->inputs; i++) {
+		while (!stage->eof[i]) {
+			r = shr_read(stage->in[i], &buffer, &length);
+			if (r && errno != EBADMSG)
+				break;
+			stage->eof[i] = !r && !length;
+			if (shr_read_done(stage->in[i]) < 0)
+				break;
+		}
+	}
+}
+
+
+/**
+ * Run a stage, then mark the end of its outputs
+ * and discard what remains in its inputs
+ * 
+ * @param   stage  The stage
+ * @return         Zero on success, -1 on error
+ */
+static int
+run_stage(shr_stage_t *stage)
+{
+	uint64_t start;
+	cpu_set_t set;
+	int ret;
+
+	if (stage->stats->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(stage->stats->cpu, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+
+	start = now();
+	ret = stage->func(stage, stage->user);
+	stage->stats->run_ns = now() - start;
+
+	if (close_outputs(stage))
+		ret = -1;
+	drain_inputs(stage);
+	return ret;
+}
+
+
+/**
+ * The main function of a thread running a stage
+ * 
+ * @param   arg  The stage
+ * @return       Non-`NULL` if the stage failed
+ */
+static void *
+stage_thread(void *arg)
+{
+	return run_stage(arg) ? arg : NULL;
+}
+
+
+/**
+ * Append an element to an array
+ * 
+ * @param   array  The array
+ * @param   count  The number of elements in the array, will be incremented
+ * @param   size   The size of each element
+ * @return         The new element, `NULL` on error
+ */
+static void *
+append(void *array, size_t *count, size_t size)
+{
+	void **arrayp = array;
+	char *new = realloc(*arrayp, (*count + 1) * size);
+	if (!new)
+		return NULL;
+	*arrayp = new;
+	memset(new + *count * size, 0, size);
+	return new + (*count)++ * size;
+}
+
+
+
+/**
+ * Create an empty pipeline
+ * 
+ * @return  The pipeline, `NULL` on error; on error,
+ *          `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for malloc(3)
+ */
+shr_pipeline_t *
+shr_pipeline_create(void)
+{
+	return calloc(1, sizeof(shr_pipeline_t));
+}
+
+
+/**
+ * Stop and destroy a pipeline, and remove its shared ring buffers
+ * 
+ * If the pipeline has been started, `shr_pipeline_wait` is
+ * called first, unless it already has been
+ * 
+ * @param  pipeline  The pipeline, nothing will happen if this is `NULL`
+ */
+void
+shr_pipeline_destroy(shr_pipeline_t *pipeline)
+{
+	size_t i;
+	int saved_errno = errno;
+	if (!pipeline)
+		return;
+	if (pipeline->started && !pipeline->waited)
+		shr_pipeline_wait(pipeline);
+	for (i = 0; i < pipeline->ring_count; i++) {
+		if (!pipeline->rings[i].opened)
+			continue;
+		shr_close(&pipeline->rings[i].writer);
+		shr_remove(&pipeline->rings[i].reader);
+	}
+	for (i = 0; i < pipeline->stage_count; i++) {
+		free(pipeline->stages[i].name);
+		free(pipeline->stages[i].in);
+		free(pipeline->stages[i].out);
+		free(pipeline->stages[i].eof);
+	}
+	if (pipeline->stats)
+		munmap(pipeline->stats, (pipeline->stage_count + 1) * sizeof(*pipeline->stats));
+	free(pipeline->stages);
+	free(pipeline->rings);
+	free(pipeline);
+	errno = saved_errno;
+}
+
+
+/**
+ * Add a stage to a pipeline
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @param   name      The name of the stage, must not be `NULL`
+ * @param   func      The function the stage runs, must not be `NULL`
+ * @param   user      The second argument for `func`
+ * @param   flags     Bitwise-OR of `enum shr_stage_flags` values
+ * @return            The index of the stage, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY   The pipeline has been started
+ * @throws  EEXIST  The pipeline already has a stage named `name`
+ * @throws  Any error specified for malloc(3)
+ */
+ssize_t
+shr_pipeline_add_stage(shr_pipeline_t *restrict pipeline, const char *restrict name,
+		       shr_stage_func_t *func, void *user, int flags)
+{
+	struct shr_stage *stage;
+	char *name_copy;
+	size_t i;
+
+	if (pipeline->started)
+		return errno = EBUSY, -1;
+	for (i = 0; i < pipeline->stage_count; i++)
+		if (!strcmp(pipeline->stages[i].name, name))
+			return errno = EEXIST, -1;
+
+	name_copy = strdup(name);
+	if (!name_copy)
+		return -1;
+	stage = append(&pipeline->stages, &pipeline->stage_count, sizeof(*stage));
+	if (!stage)
+		return free(name_copy), -1;
+	stage->name = name_copy;
+	stage->func = func;
+	stage->user = user;
+	stage->flags = flags;
+	return (ssize_t)(pipeline->stage_count - 1);
+}
+
+
+/**
+ * Connect two stages in a pipeline with a shared ring buffer,
+ * which will be the next output of `from` and the next input of `to`
+ * 
+ * If both stages run in threads, a local shared ring buffer is
+ * used, otherwise a private shared ring buffer is used
+ * 
+ * @param   pipeline      The pipeline, must not be `NULL`
+ * @param   from          The index of the writing stage
+ * @param   to            The index of the reading stage
+ * @param   buffer_size   The size of each buffer, 0 to select a size
+ *                        that lets the shared ring buffer fit in half
+ *                        of the level 2 cache
+ * @param   buffer_count  The number of buffers, 0 for 4
+ * @return                The index of the connection, -1 on error; on
+ *                        error, `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY   The pipeline has been started
+ * @throws  EINVAL  `from` or `to` is not the index of a stage
+ * @throws  Any error specified for malloc(3)
+ */
+ssize_t
+shr_pipeline_connect(shr_pipeline_t *restrict pipeline, size_t from, size_t to,
+		     size_t buffer_size, size_t buffer_count)
+{
+	struct ring *ring;
+
+	if (pipeline->started)
+		return errno = EBUSY, -1;
+	if (from >= pipeline->stage_count || to >= pipeline->stage_count)
+		return errno = EINVAL, -1;
+
+	ring = append(&pipeline->rings, &pipeline->ring_count, sizeof(*ring));
+	if (!ring)
+		return -1;
+	ring->from = from;
+	ring->to = to;
+	ring->buffer_size = buffer_size;
+	ring->buffer_count = buffer_count;
+	return (ssize_t)(pipeline->ring_count - 1);
+}
+
+
+/**
+ * Add stages and connections to a pipeline from a configuration
+ * 
+ * The configuration is a text with one declaration per line;
+ * empty lines and text after a '#' are ignored:
+ * 
+ *     stage NAME FUNCTION [thread | process]
+ *     ring FROM TO [BUFFER_SIZE [BUFFER_COUNT]]
+ * 
+ * where FUNCTION is the name of a function in `functions`,
+ * and FROM and TO are the names of previously declared stages
+ * 
+ * @param   pipeline   The pipeline, must not be `NULL`
+ * @param   config     The configuration, must not be `NULL`
+ * @param   functions  Table of the functions the configuration may refer to,
+ *                     terminated by an entry whose `name` is `NULL`
+ * @param   user       The user-supplied argument for every stage
+ * @param   line       Output parameter for the line of the error, ignored if `NULL`
+ * @return             Zero on success, -1 on error; on error,
+ *                     `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The configuration is malformed, or refers to an
+ *                  unknown function or stage
+ * @throws  Any error specified for `shr_pipeline_add_stage` and
+ *          `shr_pipeline_connect`
+ */
+int
+shr_pipeline_load(shr_pipeline_t *restrict pipeline, const char *restrict config,
+		  const struct shr_stage_func *functions, void *user, size_t *line)
+{
+	char buf[1024], *words[6], *p, *end;
+	size_t lineno = 0, n, len, i, j, stage[2];
+	unsigned long long geometry[2];
+	int flags;
+
+	while (*config) {
+		lineno++;
+		len = strcspn(config, "\n");
+		if (len >= sizeof(buf))
+			goto invalid;
+		memcpy(buf, config, len);
+		buf[len] = '\0';
+		config += len + (config[len] == '\n');
+		if ((p = strchr(buf, '#')))
+			*p = '\0';
+
+		for (n = 0, p = strtok(buf, " \t\r"); p; p = strtok(NULL, " \t\r")) {
+			if (n == sizeof(words) / sizeof(*words))
+				goto invalid;
+			words[n++] = p;
+		}
+		if (!n)
+			continue;
+
+		if (!strcmp(words[0], "stage")) {
+			if (n < 3 || n > 4)
+				goto invalid;
+			if (n == 3 || !strcmp(words[3], "thread"))
+				flags = 0;
+			else if (!strcmp(words[3], "process"))
+				flags = SHR_STAGE_PROCESS;
+			else
+				goto invalid;
+			for (i = 0; functions[i].name && strcmp(functions[i].name, words[2]); i++);
+			if (!functions[i].name)
+				goto invalid;
+			if (shr_pipeline_add_stage(pipeline, words[1], functions[i].func, user, flags) < 0)
+				goto fail;
+
+		} else if (!strcmp(words[0], "ring")) {
+			if (n < 3 || n > 5)
+				goto invalid;
+			for (j = 0; j < 2; j++) {
+				for (i = 0; i < pipeline->stage_count && strcmp(pipeline->stages[i].name, words[j + 1]); i++);
+				if (i == pipeline->stage_count)
+					goto invalid;
+				stage[j] = i;
+				geometry[j] = 0;
+				if (j + 3 < n) {
+					errno = 0;
+					geometry[j] = strtoull(words[j + 3], &end, 10);
+					if (errno || *end || !isdigit(*words[j + 3]) || geometry[j] > SIZE_MAX)
+						goto invalid;
+				}
+			}
+			if (shr_pipeline_connect(pipeline, stage[0], stage[1],
+						 (size_t)geometry[0], (size_t)geometry[1]) < 0)
+				goto fail;
+
+		} else {
+			goto invalid;
+		}
+	}
+
+	return 0;
+
+ invalid:
+	errno = EINVAL;
+ fail:
+	if (line)
+		*line = lineno;
+	return -1;
+}
+
+
+/**
+ * Create the shared ring buffers of a pipeline and start its stages,
+ * stages that run in processes are started before stages that
+ * run in threads
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @param   flags     Bitwise-OR of `enum shr_pipeline_flags` values
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY  The pipeline has already been started
+ * @throws  Any error specified for `shr_open`, `shr_open_local`, mmap(2),
+ *          fork(2) and pthread_create(3)
+ */
+int
+shr_pipeline_start(shr_pipeline_t *restrict pipeline, int flags)
+{
+	struct shr_stage *stage;
+	struct ring *ring;
+	shr_key_t key;
+	int cpus[CPU_SETSIZE], process, saved_errno;
+	size_t i, ncpus = 0, *order = NULL, size, count;
+	size_t default_size = 0;
+
+	if (pipeline->started)
+		return errno = EBUSY, -1;
+	pipeline->started = 1;
+	pipeline->waited = 1;
+
+	/* Shared with child processes, so that they can report their metrics. */
+	pipeline->stats = mmap(NULL, (pipeline->stage_count + 1) * sizeof(*pipeline->stats),
+			       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (pipeline->stats == MAP_FAILED)
+		return pipeline->stats = NULL, -1;
+
+	for (i = 0; i < pipeline->ring_count; i++) {
+		ring = pipeline->rings + i;
+		count = ring->buffer_count ? ring->buffer_count : DEFAULT_BUFFER_COUNT;
+		size = ring->buffer_size;
+		if (!size) {
+			if (!default_size)
+				default_size = l2_size() / 2;
+			size = default_size / count;
+			size = size < MIN_BUFFER_SIZE ? MIN_BUFFER_SIZE : size > MAX_BUFFER_SIZE ? MAX_BUFFER_SIZE : size;
+		}
+		process = (pipeline->stages[ring->from].flags | pipeline->stages[ring->to].flags) & SHR_STAGE_PROCESS;
+		if (process) {
+			SHR_PRIVATE(&key, size, count);
+			if (shr_open(&ring->writer, &key, SHR_WRITE))
+				goto fail;
+		} else if (shr_open_local(&ring->writer, NULL, size, count, 0)) {
+			goto fail;
+		}
+		if (shr_reverse_dup(&ring->writer, &ring->reader)) {
+			saved_errno = errno;
+			shr_remove(&ring->writer);
+			errno = saved_errno;
+			goto fail;
+		}
+		ring->opened = 1;
+	}
+
+	for (i = 0; i < pipeline->stage_count; i++) {
+		stage = pipeline->stages + i;
+		stage->stats = pipeline->stats + i;
+		stage->stats->cpu = -1;
+		stage->in = malloc((stage->inputs = 0, pipeline->ring_count + 1) * sizeof(*stage->in));
+		stage->out = malloc((stage->outputs = 0, pipeline->ring_count + 1) * sizeof(*stage->out));
+		stage->eof = calloc(pipeline->ring_count + 1, 1);
+		if (!stage->in || !stage->out || !stage->eof)
+			goto fail;
+	}
+	for (i = 0; i < pipeline->ring_count; i++) {
+		ring = pipeline->rings + i;
+		stage = pipeline->stages + ring->from;
+		stage->out[stage->outputs++] = &ring->writer;
+		stage = pipeline->stages + ring->to;
+		stage->in[stage->inputs++] = &ring->reader;
+	}
+
+	/* Consecutive stages in the flow are placed on consecutive CPUs in cache order. */
+	if (flags & SHR_PIPELINE_PIN) {
+		order = malloc((pipeline->stage_count + 1) * sizeof(*order));
+		if (!order || order_stages(pipeline, order))
+			goto fail;
+		ncpus = order_cpus(cpus);
+		for (i = 0; ncpus && i < pipeline->stage_count; i++)
+			pipeline->stages[order[i]].stats->cpu = cpus[i % ncpus];
+		free(order);
+		order = NULL;
+	}
+
+	pipeline->waited = 0;
+	for (process = 1; process >= 0; process--) {
+		for (i = 0; i < pipeline->stage_count; i++) {
+			stage = pipeline->stages + i;
+			if (!(stage->flags & SHR_STAGE_PROCESS) != !process)
+				continue;
+			if (process) {
+				stage->pid = fork();
+				if (stage->pid < 0)
+					goto fail_running;
+				if (!stage->pid)
+					_exit(run_stage(stage) ? 1 : 0);
+			} else {
+				errno = pthread_create(&stage->thread, NULL, stage_thread, stage);
+				if (errno)
+					goto fail_running;
+			}
+			stage->started = 1;
+		}
+	}
+
+	return 0;
+
+ fail_running:
+	/* The stages that were started may depend on those that were not,
+	 * so let the latter end their outputs and then drain their inputs. */
+	saved_errno = errno;
+	for (i = 0; i < pipeline->stage_count; i++)
+		if (!pipeline->stages[i].started)
+			pipeline->stages[i].failed = 1, close_outputs(pipeline->stages + i);
+	for (i = 0; i < pipeline->stage_count; i++)
+		if (!pipeline->stages[i].started)
+			drain_inputs(pipeline->stages + i);
+	shr_pipeline_wait(pipeline);
+	errno = saved_errno;
+	return -1;
+
+ fail:
+	saved_errno = errno;
+	free(order);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Wait for all stages of a started pipeline to finish
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @return            Zero if all stages succeeded, -1 otherwise
+ */
+int
+shr_pipeline_wait(shr_pipeline_t *restrict pipeline)
+{
+	struct shr_stage *stage;
+	void *result;
+	size_t i;
+	int status, ret = 0;
+
+	if (pipeline->waited)
+		return 0;
+	pipeline->waited = 1;
+
+	for (i = 0; i < pipeline->stage_count; i++) {
+		stage = pipeline->stages + i;
+		if (!stage->started)
+			continue;
+		if (stage->pid > 0) {
+			while (waitpid(stage->pid, &status, 0) < 0 && errno == EINTR);
+			stage->failed = !WIFEXITED(status) || WEXITSTATUS(status);
+		} else {
+			pthread_join(stage->thread, &result);
+			stage->failed = !!result;
+		}
+		if (stage->failed)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Get the metrics of a stage in a pipeline, they
+ * are only complete after `shr_pipeline_wait`
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @param   stage     The index of the stage
+ * @param   stats     Output parameter for the metrics, must not be `NULL`
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `stage` is not the index of a stage
+ */
+int
+shr_pipeline_stats(const shr_pipeline_t *restrict pipeline, size_t stage, struct shr_stage_stats *restrict stats)
+{
+	if (stage >= pipeline->stage_count)
+		return errno = EINVAL, -1;
+	if (pipeline->stats) {
+		*stats = pipeline->stats[stage];
+	} else {
+		memset(stats, 0, sizeof(*stats));
+		stats->cpu = -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Print a table of the metrics of all stages in a pipeline,
+ * and mark the stage that is most likely the bottleneck, that
+ * is, the stage that spent the smallest part of its time blocked
+ * 
+ * @param  pipeline  The pipeline, must not be `NULL`
+ * @param  stream    The stream to print to, must not be `NULL`
+ */
+void
+shr_pipeline_report(const shr_pipeline_t *restrict pipeline, FILE *restrict stream)
+{
+	struct shr_stage_stats s;
+	double blocked, least = 2, secs;
+	size_t i, bottleneck = SIZE_MAX;
+
+	for (i = 0; i < pipeline->stage_count; i++) {
+		shr_pipeline_stats(pipeline, i, &s);
+		if (!s.run_ns)
+			continue;
+		blocked = (double)(s.blocked_in_ns + s.blocked_out_ns) / (double)s.run_ns;
+		if (blocked < least)
+			least = blocked, bottleneck = i;
+	}
+
+	fprintf(stream, "%-16s %4s %12s %12s %10s %10s %9s %9s\n",
+		"STAGE", "CPU", "MSGS IN", "MSGS OUT", "MB/S IN", "MB/S OUT", "WAIT IN", "WAIT OUT");
+	for (i = 0; i < pipeline->stage_count; i++) {
+		shr_pipeline_stats(pipeline, i, &s);
+		secs = s.run_ns ? (double)s.run_ns / 1e9 : 1;
+		fprintf(stream, "%-16s %4i %12llu %12llu %10.1f %10.1f %8.1f%% %8.1f%%%s\n",
+			pipeline->stages[i].name, s.cpu,
+			(unsigned long long)s.messages_in, (unsigned long long)s.messages_out,
+			(double)s.bytes_in / secs / 1e6, (double)s.bytes_out / secs / 1e6,
+			s.run_ns ? 100 * (double)s.blocked_in_ns / (double)s.run_ns : 0.0,
+			s.run_ns ? 100 * (double)s.blocked_out_ns / (double)s.run_ns : 0.0,
+			i == bottleneck ? "  <- bottleneck" : "");
+	}
+}
+
+
+/**
+ * Get the name of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @return         The name of the stage
+ */
+const char *
+shr_stage_name(const shr_stage_t *restrict stage)
+{
+	return stage->name;
+}
+
+
+/**
+ * Get the number of inputs of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @return         The number of inputs
+ */
+size_t
+shr_stage_inputs(const shr_stage_t *restrict stage)
+{
+	return stage->inputs;
+}
+
+
+/**
+ * Get the number of outputs of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @return         The number of outputs
+ */
+size_t
+shr_stage_outputs(const shr_stage_t *restrict stage)
+{
+	return stage->outputs;
+}
+
+
+/**
+ * Get the shared ring buffer of an input or output of a stage
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   output  Non-zero for an output, zero for an input
+ * @param   i       The index of the input or output
+ * @return          The shared ring buffer
+ */
+shr_t *
+shr_stage_ring(shr_stage_t *restrict stage, int output, size_t i)
+{
+	return output ? stage->out[i] : stage->in[i];
+}
+
+
+/**
+ * Variant of `shr_read` for an input of a stage, that
+ * records metrics and recognises the end of the stream
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   i       The index of the input
+ * @param   buffer  Output parameter for the buffer to read, must not be `NULL`
+ * @param   length  Output parameter for the length of `*buffer`, must not be `NULL`
+ * @return          Zero on success, 1 at the end of the stream, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read` and `shr_read_done`
+ */
+int
+shr_stage_read(shr_stage_t *restrict stage, size_t i, const char **restrict buffer, size_t *restrict length)
+{
+	uint64_t start;
+	int r;
+
+	if (stage->eof[i])
+		return 1;
+
+	/* Only read the clock if the stage has to wait. */
+	r = shr_read_try(stage->in[i], buffer, length);
+	if (r && errno == EAGAIN) {
+		start = now();
+		r = shr_read(stage->in[i], buffer, length);
+		stage->stats->blocked_in_ns += now() - start;
+	}
+	if (r)
+		return -1;
+
+	if (!*length) {
+		stage->eof[i] = 1;
+		return shr_read_done(stage->in[i]) < 0 ? -1 : 1;
+	}
+	stage->stats->messages_in += 1;
+	stage->stats->bytes_in += *length;
+	return 0;
+}
+
+
+/**
+ * Variant of `shr_read_done` for an input of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @param   i      The index of the input
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read_done`
+ */
+int
+shr_stage_read_done(shr_stage_t *restrict stage, size_t i)
+{
+	return shr_read_done(stage->in[i]) < 0 ? -1 : 0;
+}
+
+
+/**
+ * Variant of `shr_write` for an output of a stage,
+ * that records metrics
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   i       The index of the output
+ * @param   buffer  Output parameter for the buffer to write, must not be `NULL`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_write`
+ */
+int
+shr_stage_write(shr_stage_t *restrict stage, size_t i, char **restrict buffer)
+{
+	uint64_t start;
+	int r;
+
+	r = shr_write_try(stage->out[i], buffer);
+	if (r && errno == EAGAIN) {
+		start = now();
+		r = shr_write(stage->out[i], buffer);
+		stage->stats->blocked_out_ns += now() - start;
+	}
+	return r;
+}
+
+
+/**
+ * Variant of `shr_write_done` for an output of a stage,
+ * empty buffers mark the end of the stream, and must not
+ * be written by the stage
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   i       The index of the output
+ * @param   length  The number of written bytes, must not be 0
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `length` is 0
+ * @throws  Any error specified for `shr_write_done`
+ */
+int
+shr_stage_write_done(shr_stage_t *restrict stage, size_t i, size_t length)
+{
+	if (!length)
+		return errno = EINVAL, -1;
+	if (shr_write_done(stage->out[i], length))
+		return -1;
+	stage->stats->messages_out += 1;
+	stage->stats->bytes_out += length;
+	return 0;
+}
@@ -0,0 +1,358 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/**
+ * The maximum number of buffers a worker reads
+ * from a ring before it looks at other rings
+ */
+#define BATCH  16
+
+/**
+ * The longest time, in nanoseconds, an idle
+ * worker sleeps before it polls the rings again
+ */
+#define MAX_BACKOFF  1000000L
+
+
+
+/**
+ * State shared by all workers in a pool
+ */
+struct pool
+{
+	/**
+	 * The read ends of the rings
+	 */
+	shr_t *rings;
+
+	/**
+	 * The number of rings
+	 */
+	size_t ring_count;
+
+	/**
+	 * The number of workers
+	 */
+	size_t threads;
+
+	/**
+	 * Bitwise-OR of `enum shr_pool_flags` values
+	 */
+	int flags;
+
+	/**
+	 * The function that processes each buffer
+	 */
+	shr_pool_handler_t *handler;
+
+	/**
+	 * The first argument for `handler`
+	 */
+	void *user;
+
+	/**
+	 * For each ring, set while a worker reads from it
+	 */
+	atomic_flag *locks;
+
+	/**
+	 * For each ring, whether the write end has
+	 * closed and all data has been read
+	 */
+	atomic_bool *closed;
+
+	/**
+	 * The number of rings that have not been closed
+	 */
+	atomic_size_t open_rings;
+
+	/**
+	 * The error that stopped the pool, zero if none
+	 */
+	atomic_int error;
+};
+
+
+/**
+ * A worker in a pool
+ */
+struct worker
+{
+	/**
+	 * The pool
+	 */
+	struct pool *pool;
+
+	/**
+	 * The index of the worker, it owns
+	 * the rings with this index modulo
+	 * the number of workers
+	 */
+	size_t index;
+
+	/**
+	 * The CPU to pin the worker to, -1 if none
+	 */
+	int cpu;
+
+	/**
+	 * The thread running the worker
+	 */
+	pthread_t thread;
+};
+
+
+
+/**
+ * Stop all workers because of an error,
+ * unless they have already been stopped
+ * 
+ * @param  pool   The pool
+ * @param  error  The error
+ */
+static void
+fail(struct pool *pool, int error)
+{
+	int expected = 0;
+	atomic_compare_exchange_strong(&pool->error, &expected, error ? error : EIO);
+}
+
+
+/**
+ * Read and process the buffers that are immediately
+ * available in a ring, unless another worker is
+ * reading from it
+ * 
+ * @param   pool  The pool
+ * @param   i     The index of the ring
+ * @return        Whether any buffer was processed
+ */
+static int
+poll_ring(struct pool *pool, size_t i)
+{
+	shr_t *shr = pool->rings + i;
+	const char *buffer;
+	size_t length, n;
+	int r;
+
+	if (atomic_load_explicit(pool->closed + i, memory_order_relaxed))
+		return 0;
+	if (atomic_flag_test_and_set_explicit(pool->locks + i, memory_order_acquire))
+		return 0;
+
+	for (n = 0; n < BATCH; n++) {
+		if (shr_read_try(shr, &buffer, &length)) {
+			if (errno == EAGAIN)
+				break;
+			fail(pool, errno);
+			/* A corrupt buffer has been acquired, and must be released. */
+			if (errno != EBADMSG)
+				break;
+		} else if (pool->handler(pool->user, i, buffer, length)) {
+			fail(pool, errno);
+		}
+		r = shr_read_done(shr);
+		if (r < 0) {
+			fail(pool, errno);
+			break;
+		}
+		if (r) {
+			atomic_store(pool->closed + i, 1);
+			atomic_fetch_sub(&pool->open_rings, 1);
+		}
+		if (r || atomic_load_explicit(&pool->error, memory_order_relaxed)) {
+			n++;
+			break;
+		}
+	}
+
+	atomic_flag_clear_explicit(pool->locks + i, memory_order_release);
+	return n > 0;
+}
+
+
+/**
+ * The main function of a worker
+ * 
+ * @param   arg  The worker
+ * @return       `NULL`
+ */
+static void *
+work(void *arg)
+{
+	struct worker *worker = arg;
+	struct pool *pool = worker->pool;
+	struct timespec backoff = {0, 0};
+	size_t i, k, n = pool->ring_count;
+	cpu_set_t set;
+	int found;
+
+	if (worker->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	while (!atomic_load_explicit(&pool->error, memory_order_relaxed) &&
+	       atomic_load_explicit(&pool->open_rings, memory_order_relaxed)) {
+		found = 0;
+		for (i = worker->index; i < n; i += pool->threads)
+			found |= poll_ring(pool, i);
+
+		/* Steal from the other workers' rings, starting with the next worker's. */
+		if (!found && !(pool->flags & SHR_POOL_NO_STEAL)) {
+			for (k = 1; k < n && !found; k++) {
+				i = (worker->index + k) % n;
+				if (i % pool->threads != worker->index)
+					found = poll_ring(pool, i);
+			}
+		}
+
+		if (found) {
+			backoff.tv_nsec = 0;
+		} else if (!backoff.tv_nsec) {
+			backoff.tv_nsec = 1000;
+			sched_yield();
+		} else {
+			nanosleep(&backoff, NULL);
+			backoff.tv_nsec *= 2;
+			if (backoff.tv_nsec > MAX_BACKOFF)
+				backoff.tv_nsec = MAX_BACKOFF;
+		}
+	}
+
+	return NULL;
+}
+
+
+
+/**
+ * Read from a set of shared ring buffers, with a pool of worker threads,
+ * until all of them have been closed and all data has been read
+ * 
+ * Each worker owns a subset of the shared ring buffers, and when none
+ * of them has readable data, it steals buffers from the other workers'
+ * shared ring buffers. Each shared ring buffer is only read by one
+ * worker at a time, so the buffers in a shared ring buffer are processed
+ * in order, but buffers from different shared ring buffers are processed
+ * concurrently
+ * 
+ * The pool polls the shared ring buffers with `shr_read_try`, and
+ * backs off exponentially, up to 1 millisecond, while all are empty
+ * 
+ * The shared ring buffers must not be used by any other thread
+ * until this function returns
+ * 
+ * @param   rings       The read ends of the shared ring buffers, must not be `NULL`
+ * @param   ring_count  The number of shared ring buffers
+ * @param   threads     The number of worker threads, 0 for one per
+ *                      CPU the process may run on
+ * @param   flags       Bitwise-OR of `enum shr_pool_flags` values
+ * @param   handler     Function that processes a buffer, its arguments are
+ *                      `user`, the index of the shared ring buffer, the buffer,
+ *                      and the length of the buffer; it shall return zero on
+ *                      success, and -1 with `errno` set to stop the pool
+ * @param   user        The first argument for `handler`
+ * @return              Zero on success, -1 on error; on error,
+ *                      `errno` will be set to describe the error
+ * 
+ * @throws  Any error returned by `handler`
+ * @throws  Any error specified for `shr_read_try` except EAGAIN, and
+ *          for `shr_read_done`
+ * @throws  Any error specified for malloc(3) and pthread_create(3)
+ */
+int
+shr_pool_run(shr_t *restrict rings, size_t ring_count, size_t threads, int flags,
+	     shr_pool_handler_t *handler, void *user)
+{
+	struct pool pool;
+	struct worker *workers = NULL;
+	size_t i, started = 0;
+	int cpus[CPU_SETSIZE], ncpus = 0, saved_errno;
+	cpu_set_t set;
+
+	if (!sched_getaffinity(0, sizeof(set), &set))
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &set))
+				cpus[ncpus++] = (int)i;
+
+	if (!threads)
+		threads = ncpus > 0 ? (size_t)ncpus : 1;
+	if (threads > ring_count)
+		threads = ring_count ? ring_count : 1;
+
+	pool.rings = rings;
+	pool.ring_count = ring_count;
+	pool.threads = threads;
+	pool.flags = flags;
+	pool.handler = handler;
+	pool.user = user;
+	atomic_init(&pool.open_rings, ring_count);
+	atomic_init(&pool.error, 0);
+	pool.locks = malloc(ring_count * sizeof(*pool.locks) + 1);
+	pool.closed = malloc(ring_count * sizeof(*pool.closed) + 1);
+	workers = malloc(threads * sizeof(*workers));
+	if (!pool.locks || !pool.closed || !workers)
+		goto fail;
+	for (i = 0; i < ring_count; i++) {
+		atomic_flag_clear(pool.locks + i);
+		atomic_init(pool.closed + i, 0);
+	}
+
+	for (; started < threads; started++) {
+		workers[started].pool = &pool;
+		workers[started].index = started;
+		workers[started].cpu = (flags & SHR_POOL_PIN) && ncpus ? cpus[started % (size_t)ncpus] : -1;
+		errno = pthread_create(&workers[started].thread, NULL, work, workers + started);
+		if (errno) {
+			fail(&pool, errno);
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	free(pool.locks);
+	free(pool.closed);
+	free(workers);
+	if (atomic_load(&pool.error))
+		return errno = atomic_load(&pool.error), -1;
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	free(pool.locks);
+	free(pool.closed);
+	free(workers);
+	return errno = saved_errno, -1;
+}
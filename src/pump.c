@@ -0,0 +1,351 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+
+/**
+ * Acquire the current buffer, waiting if necessary, and
+ * as many of the following buffers as are immediately
+ * available, up to a limit
+ * 
+ * @param   shr    The shared ring buffer
+ * @param   write  Non-zero to acquire buffers for writing,
+ *                 zero to acquire buffers for reading
+ * @param   max    The maximum number of buffers to acquire
+ * @return         The number of acquired buffers, 0 on error
+ */
+size_t
+shr_acquire_(shr_t *restrict shr, int write, size_t max)
+{
+	struct sembuf op;
+	size_t n, i;
+
+	/* Batches rely on buffers being handed over, which a writer that overwrites does not do. */
+	if (OVERWRITE(shr))
+		return errno = EINVAL, 0;
+
+	if (max > shr->key.buffer_count)  max = shr->key.buffer_count;
+	if (max > SHR_BATCH_MAX)          max = SHR_BATCH_MAX;
+	if (max > IOV_MAX)                max = IOV_MAX;
+	if (!max)                         max = 1;
+
+	if (shr_wait_(shr, write, 0, NULL))
+		return 0;
+
+	if (LOCAL(shr)) {
+		n = shr_local_available_(shr);
+		if (n > max)
+			n = max;
+	} else {
+		for (n = 1; n < max; n++) {
+			i = next_buffer(shr, n);
+			op.sem_num = (unsigned short)(write ? WRITE_SEM(i) : READ_SEM(i));
+			op.sem_op = -1;
+			op.sem_flg = IPC_NOWAIT;
+			if (semop(shr->sem, &op, (size_t)1))
+				break;
+		}
+	}
+
+	if (write)
+		for (i = 0; i < n; i++)
+			observe_begin(shr, next_buffer(shr, i));
+	if (PROBE_ENABLED(acquire))
+		for (i = 0; i < n; i++)
+			PROBE(acquire, probe_ring(shr), next_buffer(shr, i), write,
+			      write ? shr->key.buffer_size : *LENGTH(shr, next_buffer(shr, i)));
+	return n;
+}
+
+
+/**
+ * Acquire the current buffer and the buffers
+ * following it, for writing, all at once
+ * 
+ * @param   shr     The shared ring buffer
+ * @param   n       The number of buffers
+ * @param   nowait  Whether to fail with EAGAIN instead of waiting
+ * @return          Zero on success, -1 on error
+ */
+int
+shr_acquire_all_(shr_t *restrict shr, size_t n, int nowait)
+{
+	struct sembuf ops[SHR_BATCH_MAX];
+	size_t i;
+	int r;
+
+	if (OVERWRITE(shr))
+		return errno = EINVAL, -1;
+
+	if (LOCAL(shr)) {
+		r = shr_local_wait_(shr, n, nowait, NULL);
+	} else {
+		/* A single semop takes all of the buffers or none of them, so no buffer is held while waiting. */
+		for (i = 0; i < n; i++) {
+			ops[i].sem_num = (unsigned short)WRITE_SEM(next_buffer(shr, i));
+			ops[i].sem_op = -1;
+			ops[i].sem_flg = nowait ? IPC_NOWAIT : 0;
+		}
+		r = semop(shr->sem, ops, n);
+	}
+	if (r)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		observe_begin(shr, next_buffer(shr, i));
+	if (PROBE_ENABLED(acquire))
+		for (i = 0; i < n; i++)
+			PROBE(acquire, probe_ring(shr), next_buffer(shr, i), 1, shr->key.buffer_size);
+	return 0;
+}
+
+
+/**
+ * Give back buffers, that have been acquired for writing
+ * with `shr_acquire_`, without publishing them
+ * 
+ * @param   shr    The shared ring buffer
+ * @param   first  The number of buffers after the current buffer to start at
+ * @param   n      The number of buffers
+ * @return         Zero on success, -1 on error
+ */
+int
+shr_give_back_(shr_t *restrict shr, size_t first, size_t n)
+{
+	size_t i;
+	/* Observers must not take what was read into the buffers for published data. */
+	for (i = 0; i < n; i++)
+		cancel_sequence(shr, next_buffer(shr, first + i));
+	return shr_batch_op_(shr, 1, first, n, +1);
+}
+
+
+/**
+ * Advance the current buffer
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  n    The number of buffers to advance
+ */
+static void
+advance(shr_t *restrict shr, size_t n)
+{
+	shr->current_buffer = next_buffer(shr, n);
+}
+
+
+
+/**
+ * Fill buffers of a shared ring buffer with data read from a file,
+ * with a single read, and publish them atomically
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The file descriptor to read from
+ * @param   max_buffers  The maximum number of buffers to fill
+ * @return               The number of read bytes, 0 at end of file, in
+ *                       which case an empty buffer is published, -1 on
+ *                       error; on error, `errno` will be set to describe
+ *                       the error
+ * 
+ * @throws  EINVAL  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for readv(3)
+ */
+ssize_t
+shr_pump_in(shr_t *restrict shr, int fd, size_t max_buffers)
+{
+	struct iovec iov[SHR_BATCH_MAX];
+	size_t i, n, held, used, size = shr->key.buffer_size;
+	ssize_t got;
+	int saved_errno;
+
+	n = held = shr_acquire_(shr, 1, max_buffers);
+	if (!n)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = BUFFER(shr, next_buffer(shr, i));
+		iov[i].iov_len = size;
+	}
+
+	while ((got = readv(fd, iov, (int)n)) < 0)
+		if (errno != EINTR)
+			goto fail;
+
+	used = size ? ((size_t)got + size - 1) / size : 0;
+	if (!used)
+		used = 1;
+	for (i = 0; i < used; i++) {
+		*LENGTH(shr, next_buffer(shr, i)) = i + 1 < used ? size : (size_t)got - i * size;
+		shr_stamp_(shr, next_buffer(shr, i));
+	}
+
+	if (shr_give_back_(shr, used, n - used))        goto fail;
+	held = used;
+	if (shr_batch_op_(shr, 0, 0, used, +1))         goto fail;
+	advance(shr, used);
+	return got;
+
+ fail:
+	/* Only the buffers that have not already been given back are given back. */
+	saved_errno = errno;
+	shr_give_back_(shr, 0, held);
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Write the data in as many readable buffers of a shared ring buffer
+ * as are available, with a single write if possible, and mark them
+ * as fully read
+ * 
+ * An empty buffer is only taken if it is the current buffer,
+ * so that 0 is returned when end of file has been reached
+ * 
+ * A buffer is never written partially: if the file would block
+ * after part of a buffer has been written, the function waits
+ * until the rest of it can be written, and if an error occurs
+ * after some data has been written, the buffer is marked as fully
+ * read and the number of written bytes is returned, so that no
+ * data is written twice; the error is then reported by the next call
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The file descriptor to write to
+ * @param   max_buffers  The maximum number of buffers to write
+ * @param   closed       Output parameter for whether the write end has
+ *                       closed and all data has been read, ignored if `NULL`
+ * @return               The number of written bytes, -1 on error; on
+ *                       error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and
+ *                   the checksum of the current buffer does not match its
+ *                   content, the buffer is discarded
+ * @throws  EINVAL   The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for writev(3)
+ */
+ssize_t
+shr_pump_out(shr_t *restrict shr, int fd, size_t max_buffers, int *restrict closed)
+{
+	struct iovec iov[SHR_BATCH_MAX];
+	struct pollfd pfd;
+	size_t i, n, first = 0, total = 0, partial = 0;
+	ssize_t wrote;
+	int saved_errno;
+
+	n = shr_acquire_(shr, 0, max_buffers);
+	if (!n)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = BUFFER(shr, next_buffer(shr, i));
+		iov[i].iov_len = *LENGTH(shr, next_buffer(shr, i));
+		if (shr_verify_(shr, next_buffer(shr, i))) {
+			if (i) {
+				/* Leave the corrupt buffer to the next call. */
+				if (shr_batch_op_(shr, 0, i, n - i, +1))
+					goto fail;
+				n = i;
+				break;
+			}
+			/* Discard the corrupt buffer and report it. */
+			saved_errno = errno;
+			shr_batch_op_(shr, 0, 1, n - 1, +1);
+			if (!shr_batch_op_(shr, 1, 0, 1, +1))
+				advance(shr, 1);
+			return errno = saved_errno, -1;
+		}
+		if (i && !iov[i].iov_len) {
+			/* Leave empty buffers, that mark end of file, to the next call. */
+			if (shr_batch_op_(shr, 0, i, n - i, +1))
+				goto fail;
+			n = i;
+			break;
+		}
+	}
+
+	while (first < n) {
+		if (!iov[first].iov_len) {
+			first++;
+			continue;
+		}
+		wrote = writev(fd, iov + first, (int)(n - first));
+		if (wrote < 0) {
+			if (errno == EINTR)
+				continue;
+			if (partial && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				/* The rest of a partially written buffer cannot be left to the next call. */
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				if (poll(&pfd, (nfds_t)1, -1) >= 0 || errno == EINTR)
+					continue;
+			}
+			goto fail;
+		}
+		total += (size_t)wrote;
+		for (; first < n && (size_t)wrote >= iov[first].iov_len; first++, partial = 0)
+			wrote -= (ssize_t)iov[first].iov_len;
+		if (first < n && wrote) {
+			iov[first].iov_base = (char *)iov[first].iov_base + wrote;
+			iov[first].iov_len -= (size_t)wrote;
+			partial = 1;
+		}
+	}
+
+	if (shr_batch_op_(shr, 1, 0, n, +1))
+		goto fail;
+	advance(shr, n);
+	if (closed)
+		*closed = HEADER(shr)->closed == shr->current_buffer + 1;
+	return (ssize_t)total;
+
+ fail:
+	/*
+	 * Completely written buffers are consumed, and so is a partially
+	 * written buffer, since writing it again would duplicate its
+	 * beginning; the rest are given back. If anything was written,
+	 * that is reported instead of the error.
+	 */
+	saved_errno = errno;
+	first += partial;
+	if (!shr_batch_op_(shr, 1, 0, first, +1)) {
+		shr_batch_op_(shr, 0, first, n - first, +1);
+		advance(shr, first);
+		if (total)
+			return (ssize_t)total;
+	}
+	return errno = saved_errno, -1;
+}
@@ -0,0 +1,391 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_records.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+# include <immintrin.h>
+# define HAVE_X86_SCAN
+#elif defined(__GNUC__) && defined(__aarch64__)
+# include <arm_neon.h>
+# define HAVE_NEON_SCAN
+#endif
+
+
+
+/**
+ * Find the occurrences of a byte in consecutive 64-byte blocks
+ * 
+ * @param  masks   Output parameter for one mask per block, bit i of
+ *                 mask j is set if and only if `data[64 * j + i] == c`
+ * @param  data    The blocks, need not be aligned
+ * @param  blocks  The number of blocks
+ * @param  c       The byte
+ */
+typedef void scan_func(uint64_t *restrict, const char *restrict, size_t, unsigned char);
+
+
+#if defined(HAVE_X86_SCAN)
+__attribute__((target("avx512bw")))
+static void
+scan_avx512(uint64_t *restrict masks, const char *restrict data, size_t blocks, unsigned char c)
+{
+	__m512i d = _mm512_set1_epi8((char)c);
+	size_t j;
+	for (j = 0; j < blocks; j++, data += 64)
+		masks[j] = (uint64_t)_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)data), d);
+}
+
+__attribute__((target("avx2")))
+static void
+scan_avx2(uint64_t *restrict masks, const char *restrict data, size_t blocks, unsigned char c)
+{
+	__m256i d = _mm256_set1_epi8((char)c);
+	uint32_t lo, hi;
+	size_t j;
+	for (j = 0; j < blocks; j++, data += 64) {
+		lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(const void *)(data +  0)), d));
+		hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(const void *)(data + 32)), d));
+		masks[j] = (uint64_t)hi << 32 | lo;
+	}
+}
+
+static void
+scan_sse2(uint64_t *restrict masks, const char *restrict data, size_t blocks, unsigned char c)
+{
+	__m128i d = _mm_set1_epi8((char)c);
+	uint64_t mask;
+	size_t j;
+	int i;
+	for (j = 0; j < blocks; j++, data += 64) {
+		for (mask = 0, i = 0; i < 4; i++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + 16 * i));
+			mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, d)) << (16 * i);
+		}
+		masks[j] = mask;
+	}
+}
+#elif defined(HAVE_NEON_SCAN)
+static void
+scan_neon(uint64_t *restrict masks, const char *restrict data, size_t blocks, unsigned char c)
+{
+	static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	const uint8_t *p = (const uint8_t *)data;
+	uint8x16_t d = vdupq_n_u8(c), w = vld1q_u8(weights), a, b, e, f, s;
+	size_t j;
+	for (j = 0; j < blocks; j++, p += 64) {
+		a = vandq_u8(vceqq_u8(vld1q_u8(p +  0), d), w);
+		b = vandq_u8(vceqq_u8(vld1q_u8(p + 16), d), w);
+		e = vandq_u8(vceqq_u8(vld1q_u8(p + 32), d), w);
+		f = vandq_u8(vceqq_u8(vld1q_u8(p + 48), d), w);
+		/* Each pairwise addition halves the bytes per input vector, until each vector is 2 bytes. */
+		s = vpaddq_u8(vpaddq_u8(a, b), vpaddq_u8(e, f));
+		s = vpaddq_u8(s, s);
+		masks[j] = vgetq_lane_u64(vreinterpretq_u64_u8(s), 0);
+	}
+}
+#else
+static void
+scan_generic(uint64_t *restrict masks, const char *restrict data, size_t blocks, unsigned char c)
+{
+	uint64_t mask;
+	size_t j;
+	int i;
+	for (j = 0; j < blocks; j++, data += 64) {
+		for (mask = 0, i = 0; i < 64; i++)
+			mask |= (uint64_t)((unsigned char)data[i] == c) << i;
+		masks[j] = mask;
+	}
+}
+#endif
+
+
+/**
+ * The scanning function selected for the CPU
+ */
+static scan_func *scan;
+
+
+/**
+ * Select the best scanning function supported by the CPU
+ */
+SHR_COMPILER_GCC(__attribute__((constructor)))
+static void
+records_init(void)
+{
+#if defined(HAVE_X86_SCAN)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw"))
+		scan = scan_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		scan = scan_avx2;
+	else
+		scan = scan_sse2;
+#elif defined(HAVE_NEON_SCAN)
+	scan = scan_neon;
+#else
+	scan = scan_generic;
+#endif
+}
+
+
+/**
+ * Find the delimiters in the next window of the buffer an
+ * iterator holds, and make its first block the current block
+ * 
+ * @param  it     The iterator
+ * @param  first  The index of the first block in the window
+ */
+static void
+scan_window(shr_records_t *restrict it, size_t first)
+{
+	size_t offset = 64 * first, n = it->length - offset;
+	size_t full = n / 64, rest = n % 64, i;
+	char tail[64];
+
+	if (full >= SHR_RECORDS_WINDOW)
+		full = SHR_RECORDS_WINDOW, rest = 0;
+	scan(it->masks, it->buffer + offset, full, it->delimiter);
+	if (rest) {
+		/* Reading past the data could cross the end of the shared memory. */
+		memcpy(tail, it->buffer + offset + 64 * full, rest);
+		scan(&it->masks[full], tail, 1, it->delimiter);
+		it->masks[full] &= (UINT64_C(1) << rest) - 1;
+	}
+
+	it->first = first;
+	it->blocks = first + full + !!rest;
+	it->nonempty = 0;
+	for (i = 0; i < it->blocks - first; i++)
+		it->nonempty |= (uint32_t)!!it->masks[i] << i;
+	it->block = first;
+	it->mask = it->masks[0];
+}
+
+
+/**
+ * Append data to the part of a record that straddles buffers
+ * 
+ * @param   it    The iterator
+ * @param   data  The data
+ * @param   n     The length of `data`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  ENOMEM  The memory could not be allocated
+ */
+static int
+carry(shr_records_t *restrict it, const char *data, size_t n)
+{
+	size_t size = it->carry_size ? it->carry_size : 64;
+	char *new;
+
+	if (it->carry_length + n > it->carry_size) {
+		while (size < it->carry_length + n)
+			size *= 2;
+		new = realloc(it->carry, size);
+		if (!new)
+			return -1;
+		it->carry = new;
+		it->carry_size = size;
+	}
+	memcpy(it->carry + it->carry_length, data, n);
+	it->carry_length += n;
+	return 0;
+}
+
+
+/**
+ * Release the buffer an iterator holds
+ * 
+ * @param   it  The iterator
+ * @return      Zero on success, -1 on error; on error,
+ *              `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read_done`
+ */
+static int
+release(shr_records_t *restrict it)
+{
+	int r = shr_read_done(it->shr);
+	it->buffer = NULL;
+	if (r > 0)
+		it->done = 1;
+	return r < 0 ? -1 : 0;
+}
+
+
+
+/**
+ * Initialise an iterator over the records in the
+ * data read from a shared ring buffer
+ * 
+ * @param  it         Output parameter for the iterator, must not be `NULL`
+ * @param  shr        The read end of the shared ring buffer, must not
+ *                    be `NULL`, and must not be used otherwise until
+ *                    `shr_records_destroy` has been called
+ * @param  delimiter  The byte that ends each record, such as '\n' or '\0'
+ */
+void
+shr_records_init(shr_records_t *restrict it, shr_t *restrict shr, unsigned char delimiter)
+{
+	memset(it, 0, sizeof(*it));
+	it->shr = shr;
+	it->delimiter = delimiter;
+}
+
+
+/**
+ * Get the next record from a shared ring buffer, waiting
+ * for the writer to publish more data if necessary
+ * 
+ * The data ends when the writer publishes an empty buffer,
+ * or when it has closed and all data has been read; if the
+ * data does not end with a delimiter, the remainder is
+ * returned as the last record
+ * 
+ * The delimiters are found with vector instructions,
+ * selected for the CPU at runtime, that scan 64 bytes
+ * at a time
+ * 
+ * @param   it      The iterator, must not be `NULL`
+ * @param   record  Output parameter for the record, without its delimiter,
+ *                  valid until the next call with `it`; it is in the
+ *                  shared ring buffer unless the record straddles buffers
+ * @param   length  Output parameter for the length of the record
+ * @return          1 if a record was returned, 0 at the end of the data,
+ *                  -1 on error; on error, `errno` will be set to describe
+ *                  the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and
+ *                   the checksum of a buffer does not match its content; the
+ *                   buffer, and the part of a record read before it, is discarded
+ * @throws  ENOMEM   Memory for reassembling a record could not be allocated
+ * @throws  Any error specified for `shr_read` and `shr_read_done`
+ */
+int
+shr_records_next(shr_records_t *restrict it, const char **restrict record, size_t *restrict length)
+{
+	uint32_t next;
+	size_t end;
+
+	if (it->carried)
+		it->carried = 0, it->carry_length = 0;
+
+	for (;;) {
+		if (!it->buffer) {
+			if (it->done)
+				goto end_of_data;
+			if (shr_read(it->shr, &it->buffer, &it->length)) {
+				if (errno == EBADMSG) {
+					it->carry_length = 0;
+					release(it);
+					errno = EBADMSG;
+				} else if (errno == ESTALE) {
+					it->carry_length = 0;
+				}
+				it->buffer = NULL;
+				return -1;
+			}
+			if (!it->length) {
+				if (release(it))
+					return -1;
+				it->done = 1;
+				goto end_of_data;
+			}
+			if (it->length > it->shr->key.buffer_size)
+				it->length = it->shr->key.buffer_size;
+			it->start = 0;
+			scan_window(it, 0);
+		}
+
+		while (!it->mask) {
+			/* Skip the blocks without delimiters. */
+			next = it->nonempty & ~(uint32_t)0 << (it->block - it->first) << 1;
+			if (next) {
+				it->block = it->first + (size_t)__builtin_ctz(next);
+				it->mask = it->masks[it->block - it->first];
+			} else if (64 * it->blocks < it->length) {
+				scan_window(it, it->blocks);
+			} else {
+				break;
+			}
+		}
+
+		if (!it->mask) {
+			/* The record straddles buffers, or the buffer has been consumed. */
+			if (carry(it, it->buffer + it->start, it->length - it->start))
+				return -1;
+			if (release(it))
+				return -1;
+			continue;
+		}
+
+		end = 64 * it->block + (size_t)__builtin_ctzll(it->mask);
+		it->mask &= it->mask - 1;
+		if (it->carry_length) {
+			if (carry(it, it->buffer + it->start, end - it->start))
+				return -1;
+			*record = it->carry;
+			*length = it->carry_length;
+			it->carried = 1;
+		} else {
+			*record = it->buffer + it->start;
+			*length = end - it->start;
+		}
+		it->start = end + 1;
+		return 1;
+	}
+
+end_of_data:
+	if (!it->carry_length)
+		return 0;
+	*record = it->carry;
+	*length = it->carry_length;
+	it->carried = 1;
+	return 1;
+}
+
+
+/**
+ * Release the buffer an iterator holds, if any,
+ * and the memory it has allocated; the shared ring
+ * buffer itself is not closed
+ * 
+ * @param  it  The iterator, nothing will happen if this is `NULL`
+ */
+void
+shr_records_destroy(shr_records_t *restrict it)
+{
+	if (!it)
+		return;
+	if (it->buffer)
+		release(it);
+	free(it->carry);
+	it->carry = NULL;
+	it->carry_length = it->carry_size = 0;
+}
@@ -0,0 +1,778 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_rpc.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * The number of low bits of a request identifier that hold
+ * the index of its entry in the table of outstanding requests,
+ * which has one entry per buffer, so channels with more than
+ * `SLOT_MASK + 1` buffers per ring are rejected
+ */
+#define SLOT_BITS  16
+
+/**
+ * Mask for the bits of a request identifier
+ * that hold the index of its entry
+ */
+#define SLOT_MASK  (((uint64_t)1 << SLOT_BITS) - 1)
+
+/**
+ * The tag of the empty request that marks that
+ * the client has closed, no request has this identifier
+ */
+#define END_TAG  0
+
+
+
+/**
+ * An outstanding request
+ */
+struct call
+{
+	/**
+	 * The identifier of the request, 0 if the entry is free
+	 */
+	uint64_t id;
+
+	/**
+	 * The function to call with the reply,
+	 * `NULL` for the request `shr_rpc_call` waits for
+	 */
+	shr_rpc_callback_t *callback;
+
+	/**
+	 * The first argument for `callback`
+	 */
+	void *user;
+};
+
+
+/**
+ * An end of a request/reply channel
+ */
+struct shr_rpc
+{
+	/**
+	 * The ring the end writes to: requests
+	 * for the client, replies for the server
+	 */
+	shr_t out;
+
+	/**
+	 * The ring the end reads from
+	 */
+	shr_t in;
+
+	/**
+	 * Only used by the client: the outstanding
+	 * requests, indexed by the low bits of their
+	 * identifiers
+	 */
+	struct call *calls;
+
+	/**
+	 * Only used by the client: the indices
+	 * of the free entries in `calls`
+	 */
+	size_t *free;
+
+	/**
+	 * Only used by the client: the number of elements in `free`
+	 */
+	size_t free_count;
+
+	/**
+	 * Only used by the client: the number of elements in `calls`,
+	 * which is the number of buffers in the ring of replies
+	 */
+	size_t capacity;
+
+	/**
+	 * Only used by the client: the number of requests sent
+	 */
+	uint64_t sequence;
+
+	/**
+	 * Only used by the client: the output buffer of `shr_rpc_call`
+	 */
+	void *sync_reply;
+
+	/**
+	 * Only used by the client: the size of `sync_reply`
+	 */
+	size_t sync_size;
+
+	/**
+	 * Only used by the client: the length of the
+	 * reply `shr_rpc_call` waits for, once received
+	 */
+	size_t sync_length;
+
+	/**
+	 * Only used by the client: whether the reply
+	 * `shr_rpc_call` waits for has been received
+	 */
+	int sync_done;
+
+	/**
+	 * Only used by the client: the error to report
+	 * for the reply `shr_rpc_call` waits for, 0 if none
+	 */
+	int sync_error;
+
+	/**
+	 * Whether the other end has closed, and all
+	 * data it wrote has been read
+	 */
+	int eof;
+
+	/**
+	 * Whether this is the server
+	 */
+	int server;
+};
+
+
+
+/**
+ * Store a tag with the buffer acquired for writing
+ * 
+ * @param   shr  The shared ring buffer
+ * @param   tag  The tag
+ * @return       Zero on success, -1 on error
+ */
+int
+shr_write_tag(shr_t *restrict shr, uint64_t tag)
+{
+	if (!(shr->key.flags & SHR_TAGGED))
+		return errno = EINVAL, -1;
+	*META(shr, shr->current_buffer, SHR_TAGGED) = tag;
+	return 0;
+}
+
+
+/**
+ * Get the tag stored with the buffer acquired for reading
+ * 
+ * @param   shr  The shared ring buffer
+ * @param   tag  Output parameter for the tag
+ * @return       Zero on success, -1 on error
+ */
+int
+shr_read_tag(const shr_t *restrict shr, uint64_t *restrict tag)
+{
+	if (!(shr->key.flags & SHR_TAGGED))
+		return errno = EINVAL, -1;
+	*tag = *META(shr, shr->current_buffer, SHR_TAGGED);
+	return 0;
+}
+
+
+/**
+ * Check the flags and buffer count of a request/reply channel
+ * 
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @param   buffer_count  The number of buffers in each shared ring buffer
+ * @return                Zero if the channel is allowed, -1 otherwise
+ */
+static int
+check_channel(int flags, size_t buffer_count)
+{
+	/* Replies must not be lost, and the server must be able to wait for requests. */
+	if (flags & (SHR_OVERWRITE | SHR_LATEST))
+		return errno = EINVAL, -1;
+	/* Each buffer can hold an outstanding request, whose entry must fit in the identifier. */
+	if (buffer_count > SLOT_MASK + 1)
+		return errno = EINVAL, -1;
+	return 0;
+}
+
+
+/**
+ * Allocate an end of a request/reply channel
+ * 
+ * @param   server    Whether the end is the server
+ * @param   capacity  The number of buffers in the ring of replies
+ * @return            The end, `NULL` on error
+ */
+static shr_rpc_t *
+new_end(int server, size_t capacity)
+{
+	shr_rpc_t *rpc;
+	size_t i;
+
+	rpc = calloc(1, sizeof(*rpc));
+	if (!rpc)
+		return NULL;
+	rpc->server = server;
+	if (server)
+		return rpc;
+
+	rpc->capacity = capacity;
+	rpc->calls = calloc(capacity, sizeof(*rpc->calls));
+	rpc->free = malloc(capacity * sizeof(*rpc->free));
+	if (!rpc->calls || !rpc->free) {
+		free(rpc->calls);
+		free(rpc);
+		return NULL;
+	}
+	/* Take the entries in order, so that identifiers are easy to follow. */
+	for (i = 0; i < capacity; i++)
+		rpc->free[i] = capacity - 1 - i;
+	rpc->free_count = capacity;
+	return rpc;
+}
+
+
+/**
+ * Free an end of a request/reply channel
+ * 
+ * @param  rpc  The end
+ */
+static void
+free_end(shr_rpc_t *rpc)
+{
+	free(rpc->calls);
+	free(rpc->free);
+	free(rpc);
+}
+
+
+/**
+ * Create the shared ring buffers of a request/reply channel
+ * 
+ * @param   key           Output parameter for the keys
+ * @param   buffer_size   The size of each buffer
+ * @param   buffer_count  The number of buffers in each shared ring buffer
+ * @param   permissions   The permissions of the shared ring buffers
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error
+ */
+int
+shr_rpc_create(struct shr_rpc_key *restrict key, size_t buffer_size, size_t buffer_count, mode_t permissions, int flags)
+{
+	int saved_errno;
+
+	if (check_channel(flags, buffer_count))
+		return -1;
+
+	if (shr_create_flags(&key->request, buffer_size, buffer_count, permissions, flags | SHR_TAGGED))
+		return -1;
+	if (shr_create_flags(&key->reply, buffer_size, buffer_count, permissions, flags | SHR_TAGGED)) {
+		saved_errno = errno;
+		shr_remove_by_key(&key->request);
+		return errno = saved_errno, -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Open an end of a request/reply channel
+ * 
+ * @param   key   The keys of the channel
+ * @param   role  `SHR_RPC_CLIENT` or `SHR_RPC_SERVER`
+ * @return        The end, `NULL` on error
+ */
+shr_rpc_t *
+shr_rpc_open(const struct shr_rpc_key *restrict key, enum shr_rpc_role role)
+{
+	shr_rpc_t *rpc;
+	int server = role == SHR_RPC_SERVER, saved_errno;
+
+	if ((role != SHR_RPC_CLIENT && !server) ||
+	    !(key->request.flags & key->reply.flags & SHR_TAGGED) ||
+	    check_channel(key->request.flags | key->reply.flags, key->request.buffer_count) ||
+	    check_channel(0, key->reply.buffer_count))
+		return errno = EINVAL, NULL;
+
+	rpc = new_end(server, key->reply.buffer_count);
+	if (!rpc)
+		return NULL;
+	if (shr_open(&rpc->out, server ? &key->reply : &key->request, SHR_WRITE))
+		goto fail;
+	if (shr_open(&rpc->in, server ? &key->request : &key->reply, SHR_READ)) {
+		saved_errno = errno;
+		shr_close(&rpc->out);
+		errno = saved_errno;
+		goto fail;
+	}
+	return rpc;
+
+ fail:
+	saved_errno = errno;
+	free_end(rpc);
+	return errno = saved_errno, NULL;
+}
+
+
+/**
+ * Create a request/reply channel of local shared
+ * ring buffers, and open both of its ends
+ * 
+ * @param   client        Output parameter for the client end
+ * @param   server        Output parameter for the server end
+ * @param   buffer_size   The size of each buffer
+ * @param   buffer_count  The number of buffers in each shared ring buffer
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error
+ */
+int
+shr_rpc_open_local(shr_rpc_t **restrict client, shr_rpc_t **restrict server,
+		   size_t buffer_size, size_t buffer_count, int flags)
+{
+	shr_rpc_t *c = NULL, *s = NULL;
+	int saved_errno, requests = 0, replies = 0;
+
+	if (check_channel(flags, buffer_count))
+		return -1;
+	flags |= SHR_TAGGED;
+
+	c = new_end(0, buffer_count);
+	s = new_end(1, buffer_count);
+	if (!c || !s)
+		goto fail;
+
+	if (shr_open_local(&c->out, NULL, buffer_size, buffer_count, flags))
+		goto fail;
+	requests = 1;
+	if (shr_reverse_dup(&c->out, &s->in))
+		goto fail;
+	if (shr_open_local(&s->out, NULL, buffer_size, buffer_count, flags))
+		goto fail;
+	replies = 1;
+	if (shr_reverse_dup(&s->out, &c->in))
+		goto fail;
+
+	*client = c;
+	*server = s;
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	if (requests)  shr_remove(&c->out);
+	if (replies)   shr_remove(&s->out);
+	if (c)         free_end(c);
+	if (s)         free_end(s);
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Mark, if this is the client, that no more requests
+ * will be sent, so that the server can stop
+ * 
+ * @param   rpc  The end
+ * @return       Zero on success, -1 on error
+ */
+static int
+end_stream(shr_rpc_t *restrict rpc)
+{
+	char *buffer;
+	if (rpc->server)
+		return 0;
+	/* If the ring is full, the server instead sees that the client has closed when it has read it. */
+	if (shr_write_try(&rpc->out, &buffer))
+		return -1;
+	*META(&rpc->out, rpc->out.current_buffer, SHR_TAGGED) = END_TAG;
+	return shr_write_done(&rpc->out, 0);
+}
+
+
+/**
+ * Close an end of a request/reply channel
+ * 
+ * @param  rpc  The end
+ */
+void
+shr_rpc_close(shr_rpc_t *rpc)
+{
+	if (!rpc)
+		return;
+	end_stream(rpc);
+	shr_close(&rpc->out);
+	shr_close(&rpc->in);
+	free_end(rpc);
+}
+
+
+/**
+ * Close an end of a request/reply channel, and
+ * remove the shared ring buffers of the channel
+ * 
+ * @param  rpc  The end
+ */
+void
+shr_rpc_remove(shr_rpc_t *rpc)
+{
+	if (!rpc)
+		return;
+	end_stream(rpc);
+	shr_remove(&rpc->out);
+	shr_remove(&rpc->in);
+	free_end(rpc);
+}
+
+
+/**
+ * Receive a reply, and pass it to its callback, or
+ * to `shr_rpc_call` if it is the reply it waits for
+ * 
+ * @param   rpc     The client
+ * @param   nowait  Whether to return 0 instead of waiting
+ * @return          1 if a reply was received, 0 if none was
+ *                  available and `nowait` is non-zero, -1 on error
+ */
+static int
+receive(shr_rpc_t *restrict rpc, int nowait)
+{
+	const char *reply;
+	size_t length, slot;
+	struct call call;
+	uint64_t id;
+	int r, bad = 0;
+
+	if (rpc->eof)
+		return errno = EPIPE, -1;
+
+	if (nowait ? shr_read_try(&rpc->in, &reply, &length) : shr_read(&rpc->in, &reply, &length)) {
+		if (errno == EAGAIN && nowait)
+			return 0;
+		if (errno != EBADMSG)
+			return -1;
+		bad = 1;
+	}
+
+	id = *META(&rpc->in, rpc->in.current_buffer, SHR_TAGGED);
+	slot = (size_t)(id & SLOT_MASK);
+	if (slot >= rpc->capacity || !id || rpc->calls[slot].id != id) {
+		if (shr_read_done(&rpc->in) < 0)
+			return -1;
+		return errno = EPROTO, -1;
+	}
+
+	call = rpc->calls[slot];
+	rpc->calls[slot].id = 0;
+	rpc->free[rpc->free_count++] = slot;
+
+	if (call.callback) {
+		call.callback(call.user, id, bad ? NULL : reply, bad ? 0 : length);
+	} else {
+		if (bad)
+			rpc->sync_error = EBADMSG;
+		else
+			memcpy(rpc->sync_reply, reply, length < rpc->sync_size ? length : rpc->sync_size);
+		rpc->sync_length = length;
+		rpc->sync_done = 1;
+	}
+
+	if ((r = shr_read_done(&rpc->in)) < 0)
+		return -1;
+	rpc->eof = r;
+	return 1;
+}
+
+
+/**
+ * Send a request
+ * 
+ * @param   rpc       The client
+ * @param   request   The request
+ * @param   length    The length of `request`
+ * @param   callback  The function to call with the reply, `NULL` for `shr_rpc_call`
+ * @param   user      The first argument for `callback`
+ * @param   id        Output parameter for the identifier of the request
+ * @return            Zero on success, -1 on error
+ */
+static int
+submit(shr_rpc_t *restrict rpc, const void *restrict request, size_t length,
+       shr_rpc_callback_t *callback, void *user, uint64_t *restrict id)
+{
+	char *buffer;
+	size_t slot;
+
+	if (rpc->server)
+		return errno = EBADF, -1;
+	if (length > rpc->out.key.buffer_size)
+		return errno = EMSGSIZE, -1;
+
+	/*
+	 * With no more outstanding requests than there are buffers for replies,
+	 * the server never waits for the client, so the requests always drain.
+	 */
+	while (!rpc->free_count)
+		if (receive(rpc, 0) < 0)
+			return -1;
+
+	if (shr_write(&rpc->out, &buffer))
+		return -1;
+	slot = rpc->free[--rpc->free_count];
+	*id = (++rpc->sequence << SLOT_BITS) | slot;
+	rpc->calls[slot].id = *id;
+	rpc->calls[slot].callback = callback;
+	rpc->calls[slot].user = user;
+
+	memcpy(buffer, request, length);
+	*META(&rpc->out, rpc->out.current_buffer, SHR_TAGGED) = *id;
+	if (shr_write_done(&rpc->out, length)) {
+		rpc->calls[slot].id = 0;
+		rpc->free[rpc->free_count++] = slot;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Send a request, and wait for its reply
+ * 
+ * @param   rpc      The client
+ * @param   request  The request
+ * @param   length   The length of `request`
+ * @param   reply    Output buffer for the reply
+ * @param   size     The size of `reply`
+ * @return           The length of the reply, -1 on error
+ */
+ssize_t
+shr_rpc_call(shr_rpc_t *restrict rpc, const void *restrict request, size_t length, void *restrict reply, size_t size)
+{
+	uint64_t id;
+
+	if (submit(rpc, request, length, NULL, NULL, &id))
+		return -1;
+
+	rpc->sync_reply = reply;
+	rpc->sync_size = size;
+	rpc->sync_done = 0;
+	rpc->sync_error = 0;
+	while (!rpc->sync_done)
+		if (receive(rpc, 0) < 0)
+			return -1;
+
+	if (rpc->sync_error)
+		return errno = rpc->sync_error, -1;
+	return (ssize_t)rpc->sync_length;
+}
+
+
+/**
+ * Send a request without waiting for its reply
+ * 
+ * @param   rpc       The client
+ * @param   request   The request
+ * @param   length    The length of `request`
+ * @param   callback  The function to call with the reply
+ * @param   user      The first argument for `callback`
+ * @param   id        Output parameter for the identifier of the request
+ * @return            Zero on success, -1 on error
+ */
+int
+shr_rpc_send(shr_rpc_t *restrict rpc, const void *restrict request, size_t length,
+	     shr_rpc_callback_t *callback, void *user, uint64_t *restrict id)
+{
+	uint64_t id_;
+	return submit(rpc, request, length, callback, user, id ? id : &id_);
+}
+
+
+/**
+ * Receive replies, and pass them to their callbacks
+ * 
+ * @param   rpc     The client
+ * @param   nowait  Whether to only take the replies already received
+ * @return          The number of replies, -1 on error
+ */
+ssize_t
+shr_rpc_complete(shr_rpc_t *restrict rpc, int nowait)
+{
+	ssize_t n = 0;
+	int r;
+
+	if (rpc->server)
+		return errno = EBADF, -1;
+
+	/* Once a reply has been received, take the others that are ready without waiting. */
+	while (rpc->free_count < rpc->capacity) {
+		r = receive(rpc, nowait || n);
+		if (r < 0)
+			return -1;
+		if (!r)
+			break;
+		n++;
+	}
+	return n;
+}
+
+
+/**
+ * Get the number of outstanding requests of a client
+ * 
+ * @param   rpc  The client
+ * @return       The number of outstanding requests
+ */
+size_t
+shr_rpc_pending(const shr_rpc_t *restrict rpc)
+{
+	return rpc->capacity - rpc->free_count;
+}
+
+
+/**
+ * Wait for a request
+ * 
+ * @param   rpc      The server
+ * @param   id       Output parameter for the identifier of the request
+ * @param   request  Output parameter for the request
+ * @param   length   Output parameter for the length of `*request`
+ * @return           Zero on success, 1 at the end, -1 on error
+ */
+int
+shr_rpc_recv(shr_rpc_t *restrict rpc, uint64_t *restrict id, const char **restrict request, size_t *restrict length)
+{
+	int r;
+
+	if (!rpc->server)
+		return errno = EBADF, -1;
+	if (rpc->eof)
+		return 1;
+
+	r = shr_read(&rpc->in, request, length);
+	if (r && errno != EBADMSG)
+		return -1;
+	*id = *META(&rpc->in, rpc->in.current_buffer, SHR_TAGGED);
+	if (r)
+		return -1;
+
+	if (!*length && *id == END_TAG) {
+		rpc->eof = 1;
+		if (shr_read_done(&rpc->in) < 0)
+			return -1;
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Mark the request returned by `shr_rpc_recv` as fully read
+ * 
+ * @param   rpc  The server
+ * @return       Zero on success, -1 on error
+ */
+int
+shr_rpc_recv_done(shr_rpc_t *restrict rpc)
+{
+	int r = shr_read_done(&rpc->in);
+	if (r < 0)
+		return -1;
+	/* The client may have closed without marking the end, if the ring was full. */
+	rpc->eof |= r;
+	return 0;
+}
+
+
+/**
+ * Send the reply to a request
+ * 
+ * @param   rpc     The server
+ * @param   id      The identifier of the request
+ * @param   reply   The reply
+ * @param   length  The length of `reply`
+ * @return          Zero on success, -1 on error
+ */
+int
+shr_rpc_reply(shr_rpc_t *restrict rpc, uint64_t id, const void *restrict reply, size_t length)
+{
+	char *buffer;
+
+	if (!rpc->server)
+		return errno = EBADF, -1;
+	if (length > rpc->out.key.buffer_size)
+		return errno = EMSGSIZE, -1;
+
+	if (shr_write(&rpc->out, &buffer))
+		return -1;
+	memcpy(buffer, reply, length);
+	*META(&rpc->out, rpc->out.current_buffer, SHR_TAGGED) = id;
+	return shr_write_done(&rpc->out, length);
+}
+
+
+/**
+ * Reply to requests, in order, with a handler
+ * 
+ * @param   rpc      The server
+ * @param   handler  The handler
+ * @param   user     The first argument for `handler`
+ * @return           Zero on success, -1 on error
+ */
+int
+shr_rpc_serve(shr_rpc_t *restrict rpc, shr_rpc_handler_t *handler, void *user)
+{
+	const char *request;
+	char *reply;
+	size_t length;
+	ssize_t n;
+	uint64_t id;
+	int r, saved_errno;
+
+	for (;;) {
+		if ((r = shr_rpc_recv(rpc, &id, &request, &length))) {
+			if (r > 0)
+				return 0;
+			if (errno != EBADMSG)
+				return -1;
+			/* The client must not wait forever for the reply to a corrupt request. */
+			if (shr_rpc_reply(rpc, id, "", 0) || shr_rpc_recv_done(rpc))
+				return -1;
+			continue;
+		}
+
+		/* The request is held while the reply is written into the ring, so neither is copied. */
+		if (shr_write(&rpc->out, &reply))
+			return -1;
+		n = handler(user, id, request, length, reply, rpc->out.key.buffer_size);
+		if (n < 0 || (size_t)n > rpc->out.key.buffer_size) {
+			/* Whatever the handler wrote is discarded, and the client gets an empty reply. */
+			saved_errno = n < 0 ? errno : EMSGSIZE;
+			shr_write_cancel(&rpc->out);
+			if (shr_rpc_reply(rpc, id, "", 0) || shr_rpc_recv_done(rpc))
+				return -1;
+			return errno = saved_errno, -1;
+		}
+		*META(&rpc->out, rpc->out.current_buffer, SHR_TAGGED) = id;
+		if (shr_write_done(&rpc->out, (size_t)n))
+			return -1;
+
+		if (shr_rpc_recv_done(rpc))
+			return -1;
+	}
+}
@@ -0,0 +1,556 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_shard.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+/**
+ * The longest time, in nanoseconds, a reader that owns
+ * multiple shards sleeps before it polls them again
+ */
+#define MAX_BACKOFF  1000000L
+
+
+
+/**
+ * An end of a sharded channel
+ */
+struct shr_shard
+{
+	/**
+	 * The shards, only those the end uses are open
+	 */
+	shr_t *rings;
+
+	/**
+	 * The metrics of each shard
+	 */
+	struct shr_shard_stats *stats;
+
+	/**
+	 * For each shard, whether the end uses it
+	 */
+	char *used;
+
+	/**
+	 * For each shard, whether the end of the stream has been read
+	 */
+	char *eof;
+
+	/**
+	 * The indices of the shards the end uses
+	 */
+	size_t *owned;
+
+	/**
+	 * The number of elements in `owned`
+	 */
+	size_t owned_count;
+
+	/**
+	 * The number of shards
+	 */
+	size_t count;
+
+	/**
+	 * The number of shards in `owned` whose
+	 * end of the stream has not been read
+	 */
+	size_t live;
+
+	/**
+	 * The position in `owned` of the shard
+	 * the reader tries first the next time
+	 */
+	size_t next;
+
+	/**
+	 * The shard with the acquired buffer
+	 */
+	size_t current;
+
+	/**
+	 * Whether this is the write end
+	 */
+	int write;
+};
+
+
+
+/**
+ * Create the shared ring buffers of a sharded channel
+ * 
+ * @param   keys          Output parameter for the keys of the shards
+ * @param   count         The number of shards
+ * @param   buffer_size   The size of each buffer
+ * @param   buffer_count  The number of buffers in each shard
+ * @param   permissions   The permissions for the shards
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error
+ */
+int
+shr_shard_create(shr_key_t *restrict keys, size_t count, size_t buffer_size,
+		 size_t buffer_count, mode_t permissions, int flags)
+{
+	size_t i;
+	int saved_errno;
+
+	if (!count)
+		return errno = EINVAL, -1;
+
+	for (i = 0; i < count; i++)
+		if (shr_create_flags(keys + i, buffer_size, buffer_count, permissions, flags))
+			goto fail;
+	return 0;
+
+ fail:
+	saved_errno = errno;
+	shr_shard_remove(keys, i);
+	return errno = saved_errno, -1;
+}
+
+
+/**
+ * Remove the shared ring buffers of a sharded channel
+ * 
+ * @param  keys   The keys of the shards
+ * @param  count  The number of shards
+ */
+void
+shr_shard_remove(const shr_key_t *restrict keys, size_t count)
+{
+	while (count--)
+		shr_remove_by_key(keys + count);
+}
+
+
+/**
+ * Open an end of a sharded channel
+ * 
+ * @param   keys     The keys of the shards
+ * @param   count    The number of shards
+ * @param   write    Whether to open the write end
+ * @param   member   The index of the member of the consumer group
+ * @param   members  The number of members in the consumer group
+ * @return           The end, `NULL` on error
+ */
+static shr_shard_t *
+open_end(const shr_key_t *restrict keys, size_t count, int write, size_t member, size_t members)
+{
+	shr_shard_t *shard;
+	size_t i;
+	int saved_errno;
+
+	if (!count || !members || members > count || member >= members)
+		return errno = EINVAL, NULL;
+
+	shard = calloc(1, sizeof(*shard));
+	if (!shard)
+		return NULL;
+	shard->count = count;
+	shard->write = write;
+	shard->rings = calloc(count, sizeof(*shard->rings));
+	shard->stats = calloc(count, sizeof(*shard->stats));
+	shard->used  = calloc(count, sizeof(*shard->used));
+	shard->eof   = calloc(count, sizeof(*shard->eof));
+	shard->owned = calloc(count, sizeof(*shard->owned));
+	if (!shard->rings || !shard->stats || !shard->used || !shard->eof || !shard->owned)
+		goto fail;
+
+	for (i = member; i < count; i += members) {
+		if (shr_open(shard->rings + i, keys + i, write ? SHR_WRITE : SHR_READ))
+			goto fail;
+		shard->used[i] = 1;
+		shard->owned[shard->owned_count++] = i;
+	}
+	shard->live = shard->owned_count;
+	return shard;
+
+ fail:
+	saved_errno = errno;
+	shr_shard_close(shard);
+	return errno = saved_errno, NULL;
+}
+
+
+/**
+ * Open the write end of every shard of a sharded channel
+ * 
+ * @param   keys   The keys of the shards
+ * @param   count  The number of shards
+ * @return         The write end, `NULL` on error
+ */
+shr_shard_t *
+shr_shard_open(const shr_key_t *restrict keys, size_t count)
+{
+	return open_end(keys, count, 1, 0, 1);
+}
+
+
+/**
+ * Join the consumer group of a sharded channel
+ * 
+ * @param   keys     The keys of the shards
+ * @param   count    The number of shards
+ * @param   member   The index of the member
+ * @param   members  The number of members in the group
+ * @return           The read end, `NULL` on error
+ */
+shr_shard_t *
+shr_shard_join(const shr_key_t *restrict keys, size_t count, size_t member, size_t members)
+{
+	return open_end(keys, count, 0, member, members);
+}
+
+
+/**
+ * Close an end of a sharded channel
+ * 
+ * @param  shard  The end
+ */
+void
+shr_shard_close(shr_shard_t *shard)
+{
+	size_t i;
+	if (!shard)
+		return;
+	if (shard->used)
+		for (i = 0; i < shard->count; i++)
+			if (shard->used[i])
+				shr_close(shard->rings + i);
+	free(shard->rings);
+	free(shard->stats);
+	free(shard->used);
+	free(shard->eof);
+	free(shard->owned);
+	free(shard);
+}
+
+
+/**
+ * Get the number of shards in a sharded channel
+ * 
+ * @param   shard  The end
+ * @return         The number of shards
+ */
+size_t
+shr_shard_count(const shr_shard_t *restrict shard)
+{
+	return shard->count;
+}
+
+
+/**
+ * Get the shared ring buffer of a shard
+ * 
+ * @param   shard  The end
+ * @param   i      The index of the shard
+ * @return         The shared ring buffer, `NULL` if not used
+ */
+shr_t *
+shr_shard_ring(shr_shard_t *restrict shard, size_t i)
+{
+	return i < shard->count && shard->used[i] ? shard->rings + i : NULL;
+}
+
+
+/**
+ * Get the shard data with a key is routed to
+ * 
+ * @param   shard   The end
+ * @param   key     The key
+ * @param   length  The length of `key`
+ * @return          The index of the shard
+ */
+size_t
+shr_shard_of(const shr_shard_t *restrict shard, const void *restrict key, size_t length)
+{
+	uint32_t h = shr_crc32c_(key, length);
+
+	/* CRC32C is linear, mix it so that similar keys spread over the shards. */
+	h ^= h >> 16;
+	h *= UINT32_C(0x85ebca6b);
+	h ^= h >> 13;
+	h *= UINT32_C(0xc2b2ae35);
+	h ^= h >> 16;
+
+	return (size_t)(((uint64_t)h * shard->count) >> 32);
+}
+
+
+/**
+ * Wait for a buffer in a shard to be ready for writing,
+ * and record the time spent waiting
+ * 
+ * @param   shard   The write end
+ * @param   i       The index of the shard
+ * @param   buffer  Output parameter for the buffer to write
+ * @return          Zero on success, -1 on error
+ */
+static int
+acquire(shr_shard_t *restrict shard, size_t i, char **restrict buffer)
+{
+	uint64_t start;
+	int r;
+
+	if (!shr_write_try(shard->rings + i, buffer))
+		return 0;
+	if (errno != EAGAIN)
+		return -1;
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	r = shr_write(shard->rings + i, buffer);
+	shard->stats[i].blocked_ns += clock_ns(CLOCK_MONOTONIC) - start;
+	return r;
+}
+
+
+/**
+ * Wait for a buffer, in the shard data with a key
+ * is routed to, to be ready for writing
+ * 
+ * @param   shard   The write end
+ * @param   key     The key
+ * @param   length  The length of `key`
+ * @param   buffer  Output parameter for the buffer to write
+ * @return          The index of the shard, -1 on error
+ */
+ssize_t
+shr_shard_write(shr_shard_t *restrict shard, const void *restrict key, size_t length, char **restrict buffer)
+{
+	size_t i;
+
+	if (!shard->write)
+		return errno = EBADF, -1;
+
+	i = shr_shard_of(shard, key, length);
+	if (acquire(shard, i, buffer))
+		return -1;
+	shard->current = i;
+	return (ssize_t)i;
+}
+
+
+/**
+ * Publish the buffer acquired with `shr_shard_write`
+ * 
+ * @param   shard   The write end
+ * @param   length  The number of written bytes
+ * @return          Zero on success, -1 on error
+ */
+int
+shr_shard_write_done(shr_shard_t *restrict shard, size_t length)
+{
+	size_t i = shard->current;
+
+	if (!shard->write)
+		return errno = EBADF, -1;
+	if (!length) {
+		/* The buffer is given back, so that the writer stays in step with the shard. */
+		shr_write_cancel(shard->rings + i);
+		return errno = EINVAL, -1;
+	}
+
+	if (shr_write_done(shard->rings + i, length))
+		return -1;
+	shard->stats[i].messages += 1;
+	shard->stats[i].bytes += length;
+	return 0;
+}
+
+
+/**
+ * Mark the end of the stream in every shard
+ * 
+ * @param   shard  The write end
+ * @return         Zero on success, -1 on error
+ */
+int
+shr_shard_finish(shr_shard_t *restrict shard)
+{
+	char *buffer;
+	size_t i;
+
+	if (!shard->write)
+		return errno = EBADF, -1;
+
+	for (i = 0; i < shard->count; i++)
+		if (acquire(shard, i, &buffer) || shr_write_done(shard->rings + i, 0))
+			return -1;
+	return 0;
+}
+
+
+/**
+ * Mark a shard as having reached the end of the stream
+ * 
+ * @param  shard  The read end
+ * @param  i      The index of the shard
+ */
+static void
+end_shard(shr_shard_t *restrict shard, size_t i)
+{
+	shard->eof[i] = 1;
+	shard->live -= 1;
+}
+
+
+/**
+ * Wait for a buffer in any of the shards a member
+ * of a consumer group owns to be readable
+ * 
+ * @param   shard   The read end
+ * @param   index   Output parameter for the index of the shard
+ * @param   buffer  Output parameter for the buffer to read
+ * @param   length  Output parameter for the length of `*buffer`
+ * @return          Zero on success, 1 at the end of the stream, -1 on error
+ */
+int
+shr_shard_read(shr_shard_t *restrict shard, size_t *restrict index, const char **restrict buffer, size_t *restrict length)
+{
+	struct timespec backoff = {0, 1000};
+	uint64_t start = 0;
+	size_t tried, i = 0;
+	int r;
+
+	if (shard->write)
+		return errno = EBADF, -1;
+
+	for (;;) {
+		for (tried = 0; shard->live && tried < shard->owned_count; tried++) {
+			i = shard->owned[shard->next];
+			shard->next = (shard->next + 1) % shard->owned_count;
+			if (shard->eof[i])
+				continue;
+
+			r = shr_read_try(shard->rings + i, buffer, length);
+			if (r && errno == EAGAIN) {
+				if (shard->live > 1)
+					continue;
+				/* Only one shard can have data, so there is nothing to poll. */
+				if (!start)
+					start = clock_ns(CLOCK_MONOTONIC);
+				r = shr_read(shard->rings + i, buffer, length);
+			}
+			if (start) {
+				/* The wait is charged to the shard that ended it. */
+				shard->stats[i].blocked_ns += clock_ns(CLOCK_MONOTONIC) - start;
+				start = 0;
+			}
+
+			shard->current = i;
+			if (index)
+				*index = i;
+			if (r)
+				return -1;
+
+			if (!*length) {
+				end_shard(shard, i);
+				if (shr_read_done(shard->rings + i) < 0)
+					return -1;
+				continue;
+			}
+			shard->stats[i].messages += 1;
+			shard->stats[i].bytes += *length;
+			return 0;
+		}
+
+		if (!shard->live)
+			return 1;
+
+		if (!start)
+			start = clock_ns(CLOCK_MONOTONIC);
+		if (nanosleep(&backoff, NULL))
+			return -1;
+		if ((backoff.tv_nsec *= 2) > MAX_BACKOFF)
+			backoff.tv_nsec = MAX_BACKOFF;
+	}
+}
+
+
+/**
+ * Mark the buffer returned by `shr_shard_read` as fully read
+ * 
+ * @param   shard  The read end
+ * @return         Zero on success, -1 on error
+ */
+int
+shr_shard_read_done(shr_shard_t *restrict shard)
+{
+	size_t i = shard->current;
+	int r;
+
+	r = shr_read_done(shard->rings + i);
+	if (r < 0)
+		return -1;
+	/* The writer closed without marking the end of the stream. */
+	if (r && !shard->eof[i])
+		end_shard(shard, i);
+	return 0;
+}
+
+
+/**
+ * Get the metrics of a shard, as seen by an end
+ * 
+ * @param   shard  The end
+ * @param   i      The index of the shard
+ * @param   stats  Output parameter for the metrics
+ * @return         Zero on success, -1 on error
+ */
+int
+shr_shard_stats(const shr_shard_t *restrict shard, size_t i, struct shr_shard_stats *restrict stats)
+{
+	if (i >= shard->count || !shard->used[i])
+		return errno = EINVAL, -1;
+	*stats = shard->stats[i];
+	return 0;
+}
+
+
+/**
+ * Measure how unevenly data is spread over the shards an end uses
+ * 
+ * @param   shard  The end
+ * @return         The skew
+ */
+double
+shr_shard_skew(const shr_shard_t *restrict shard)
+{
+	uint64_t total = 0, max = 0, n;
+	size_t i;
+
+	for (i = 0; i < shard->owned_count; i++) {
+		n = shard->stats[shard->owned[i]].messages;
+		total += n;
+		if (n > max)
+			max = n;
+	}
+	return total ? (double)max * (double)shard->owned_count / (double)total : 0;
+}
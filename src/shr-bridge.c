@@ -0,0 +1,225 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "shr_bridge.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+
+/**
+ * The name of the process
+ */
+static const char *argv0 = "shr-bridge";
+
+
+
+/**
+ * Print usage information and exit
+ */
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-v] [-z] [-b batch] send key address\n"
+	                "       %s [-v] recv key address\n", argv0, argv0);
+	exit(2);
+}
+
+
+/**
+ * Create a socket for an address, and connect it or accept
+ * one connection on it, a UNIX socket is unlinked after it
+ * has accepted the connection
+ * 
+ * @param   address  "unix:PATH" or "HOST:PORT"
+ * @param   listen_  Whether to accept rather than connect
+ * @return           The connected socket, -1 on error
+ */
+static int
+open_socket(const char *address, int listen_)
+{
+	struct sockaddr_un sun;
+	struct addrinfo hints, *ai, *p;
+	char *copy, *host, *port;
+	int fd = -1, conn, one = 1, r;
+
+	if (!strncmp(address, "unix:", 5)) {
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(address + 5) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "%s: %s: path too long\n", argv0, address);
+			return -1;
+		}
+		strcpy(sun.sun_path, address + 5);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			goto fail;
+		if (!listen_) {
+			if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)))
+				goto fail;
+			return fd;
+		}
+		if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(fd, 1))
+			goto fail;
+		conn = accept(fd, NULL, NULL);
+		unlink(sun.sun_path);
+		close(fd);
+		if (conn < 0)
+			perror(argv0);
+		return conn;
+	}
+
+	host = copy = strdup(address);
+	if (!copy)
+		goto fail;
+	port = strrchr(host, ':');
+	if (!port) {
+		fprintf(stderr, "%s: %s: port missing\n", argv0, address);
+		free(copy);
+		return -1;
+	}
+	*port++ = '\0';
+	if (*host == '[' && port[-2] == ']')
+		*host++ = '\0', port[-2] = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listen_ ? AI_PASSIVE : 0;
+	r = getaddrinfo(*host ? host : NULL, port, &hints, &ai);
+	if (r) {
+		fprintf(stderr, "%s: %s: %s\n", argv0, address, gai_strerror(r));
+		free(copy);
+		return -1;
+	}
+	free(copy);
+
+	for (p = ai; p; p = p->ai_next) {
+		fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (listen_) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (!bind(fd, p->ai_addr, p->ai_addrlen) && !listen(fd, 1))
+				break;
+		} else if (!connect(fd, p->ai_addr, p->ai_addrlen)) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+	if (fd < 0)
+		goto fail;
+	if (listen_) {
+		conn = accept(fd, NULL, NULL);
+		close(fd);
+		if ((fd = conn) < 0)
+			goto fail;
+	}
+	/* Batching is done by the bridge, do not delay small batches. */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+
+fail:
+	fprintf(stderr, "%s: %s: %s\n", argv0, address, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	struct shr_bridge_stats stats;
+	shr_key_t key;
+	shr_t shr;
+	size_t batch = 0;
+	int sending, verbose = 0, flags = 0, fd, r, c;
+
+	if (argc)
+		argv0 = argv[0];
+	while ((c = getopt(argc, argv, "b:vz")) != -1) {
+		switch (c) {
+		case 'b':
+			batch = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'z':
+			flags |= SHR_BRIDGE_COMPRESS;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 3)
+		usage();
+	if (!strcmp(argv[optind], "send"))
+		sending = 1;
+	else if (!strcmp(argv[optind], "recv"))
+		sending = 0;
+	else
+		usage();
+	if (!sending && (flags || batch))
+		usage();
+
+	shr_str_to_key(argv[optind + 1], &key);
+	if (shr_open(&shr, &key, sending ? SHR_READ : SHR_WRITE)) {
+		fprintf(stderr, "%s: shr_open: %s\n", argv0, strerror(errno));
+		return 1;
+	}
+	fd = open_socket(argv[optind + 2], !sending);
+	if (fd < 0) {
+		shr_close(&shr);
+		return 1;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	if (sending)
+		r = shr_bridge_send(&shr, fd, batch, flags, &stats);
+	else
+		r = shr_bridge_recv(&shr, fd, &stats);
+	if (r)
+		fprintf(stderr, "%s: %s: %s\n", argv0, sending ? "shr_bridge_send" : "shr_bridge_recv", strerror(errno));
+	close(fd);
+	shr_close(&shr);
+
+	if (verbose)
+		fprintf(stderr, "%s: %llu buffers, %llu bytes, %llu bytes on the wire, %llu %s, %llu stalls, %llu dropped\n",
+		        argv0, (unsigned long long)stats.buffers, (unsigned long long)stats.bytes,
+		        (unsigned long long)stats.wire_bytes, (unsigned long long)stats.batches,
+		        sending ? "batches" : "credit messages",
+		        (unsigned long long)stats.stalls, (unsigned long long)stats.dropped);
+	return !!r;
+}
@@ -21,37 +21,120 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
  * DEALINGS IN THE SOFTWARE.
  */
-#define _GNU_SOURCE
-#include "shr.h"
+#include "common.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <sys/sem.h>
 #include <sys/stat.h>
 
 
 
+#ifdef SHR_HAVE_PROBES
+# define X(NAME)  unsigned short shr_##NAME##_semaphore __attribute__((section(".probes")));
+X(create)
+X(close)
+X(acquire)
+X(release)
+X(block_start)
+X(block_end)
+# undef X
+#endif
+
+
+
 /**
- * Get the index of the semaphore for flagging
- * a buffer as being writeable
+ * Initialise the header of a shared ring buffer
  * 
- * @param   i  The index of the buffer
- * @return     The index of the semaphore
+ * @param  address  The address of the shared memory
+ * @param  key      The key of the shared ring buffer
  */
-#define WRITE_SEM(i)  (2 * (i) + 0)
+void
+shr_init_header_(void *address, const shr_key_t *restrict key)
+{
+	struct shr_header *header = address;
+	memset(header, 0, SHR_HEADER_SIZE);
+	header->magic = SHR_MAGIC;
+	header->version = SHR_VERSION;
+	header->flags = (uint32_t)key->flags;
+	header->buffer_size = key->buffer_size;
+	header->buffer_count = key->buffer_count;
+}
+
 
 /**
- * Get the index of the semaphore for flagging
- * a buffer as being readable
+ * Check that the header of a shared ring buffer
+ * matches the key it was opened with
  * 
- * @param   i  The index of the buffer
- * @return     The index of the semaphore
+ * @param   address  The address of the shared memory
+ * @param   key      The key of the shared ring buffer
+ * @return           Whether the header matches
  */
-#define READ_SEM(i)   (2 * (i) + 1)
+static int
+check_header(const void *address, const shr_key_t *restrict key)
+{
+	const struct shr_header *header = address;
+	return header->magic == SHR_MAGIC &&
+	       header->version == SHR_VERSION &&
+	       header->flags == (uint32_t)key->flags &&
+	       header->buffer_size == key->buffer_size &&
+	       header->buffer_count == key->buffer_count;
+}
 
 
+/**
+ * Wait for the current buffer of a shared ring buffer,
+ * that does not overwrite, to be ready for an end
+ * 
+ * If a tracer is attached to the probe `block_start` or
+ * `block_end`, the semaphore is first tried without
+ * waiting, so that the probes are only fired if the
+ * call actually blocks
+ * 
+ * @param   shr      The shared ring buffer
+ * @param   write    Non-zero to wait for the buffer to be ready
+ *                   for writing, zero to wait for it to be readable
+ * @param   nowait   Whether to fail with EAGAIN instead of waiting
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EAGAIN, EFAULT, EIDRM, EINTR and EINVAL,
+ *          as specified for semtimedop(3)
+ */
+int
+shr_wait_(shr_t *restrict shr, int write, int nowait, const struct timespec *timeout)
+{
+	struct sembuf op;
+	uint64_t start;
+	int r;
+
+	if (LOCAL(shr))
+		return shr_local_wait_(shr, 1, nowait, timeout);
+
+	op.sem_num = (unsigned short)(write ? WRITE_SEM(shr->current_buffer) : READ_SEM(shr->current_buffer));
+	op.sem_op = -1;
+	op.sem_flg = nowait ? IPC_NOWAIT : 0;
+
+	if (SHR_LIKELY(nowait || !(PROBE_ENABLED(block_start) || PROBE_ENABLED(block_end))))
+		return timeout ? semtimedop(shr->sem, &op, (size_t)1, timeout) : semop(shr->sem, &op, (size_t)1);
+
+	op.sem_flg = IPC_NOWAIT;
+	if (!semop(shr->sem, &op, (size_t)1))
+		return 0;
+	if (errno != EAGAIN)
+		return -1;
+	op.sem_flg = 0;
+
+	PROBE(block_start, probe_ring(shr), shr->current_buffer, write);
+	start = clock_ns(CLOCK_MONOTONIC);
+	r = timeout ? semtimedop(shr->sem, &op, (size_t)1, timeout) : semop(shr->sem, &op, (size_t)1);
+	PROBE(block_end, probe_ring(shr), shr->current_buffer, write, clock_ns(CLOCK_MONOTONIC) - start);
+	(void) start;
+	return r;
+}
+
 
 /**
  * Create a shared ring buffer
@@ -60,7 +143,7 @@
  * process's effective user and effective group
  * 
  * Undefined behaviour will be invoked if
- * `sizeof(size_t) + buffer_count * (buffer_size + sizeof(size_t)) > SIZE_MAX`,
+ * `SHR_RING_SIZE(buffer_size, 0, buffer_count) > SIZE_MAX`,
  * if `buffer_count == 0` or if `(permissions & ~(S_IRWXU | S_IRWXG | S_IRWXO))`,
  * or if `buffer_count > SHORT_MAX`
  * 
@@ -78,7 +161,37 @@
 int
 shr_create(shr_key_t *restrict key, size_t buffer_size, size_t buffer_count, mode_t permissions)
 {
-	size_t ring_size = sizeof(size_t) + buffer_count * (buffer_size + sizeof(size_t));
+	return shr_create_flags(key, buffer_size, buffer_count, permissions, 0);
+}
+
+
+/**
+ * Variant of `shr_create` that also selects
+ * the features of the shared ring buffer
+ * 
+ * Undefined behaviour will be invoked if
+ * `SHR_RING_SIZE(buffer_size, flags, buffer_count) > SIZE_MAX`,
+ * if `buffer_count == 0` or if `(permissions & ~(S_IRWXU | S_IRWXG | S_IRWXO))`,
+ * or if `buffer_count > SHORT_MAX`
+ * 
+ * @param   key           Output parameter for the key, must not be `NULL`
+ * @param   buffer_size   The size of each buffer, in bytes
+ * @param   buffer_count  The number of buffers, most be positive, 3 is recommended
+ * @param   permissions   The permissions of the shared ring buffer,
+ *                        any access for a user means full access
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL        `flags` contains an unsupported flag, or both
+ *                        `SHR_OVERWRITE` and `SHR_LATEST`
+ * @throws  The errors EINVAL, ENOMEM and ENOSPC, as specified for shmget(3) and semget(3)
+ * @throws  Any error specified for shmat(3), semctl(3) and malloc(3)
+ */
+int
+shr_create_flags(shr_key_t *restrict key, size_t buffer_size, size_t buffer_count, mode_t permissions, int flags)
+{
+	size_t ring_size = SHR_RING_SIZE(buffer_size, flags, buffer_count);
 	size_t sem_count = 2 * buffer_count;
 	void *address = NULL;
 	unsigned short *values = NULL;
@@ -88,8 +201,13 @@ shr_create(shr_key_t *restrict key, size_t buffer_size, size_t buffer_count, mod
 	size_t i;
 	int saved_errno;
 
+	key->shm = key->sem = IPC_PRIVATE;
 	key->buffer_size  = buffer_size;
 	key->buffer_count = buffer_count;
+	key->flags        = flags;
+
+	if (!VALID_FLAGS(flags))
+		return errno = EINVAL, -1;
 
 	permissions |= (permissions & S_IRWXU) ? S_IRWXU : 0;
 	permissions |= (permissions & S_IRWXG) ? S_IRWXG : 0;
@@ -125,7 +243,7 @@ shr_create(shr_key_t *restrict key, size_t buffer_size, size_t buffer_count, mod
 	}
 
 	/* Initialise shared memory. */
-	*(size_t*)address = 0;
+	shr_init_header_(address, key);
 
 	/* Create semaphore array. */
 	for (;;) {
@@ -158,7 +276,9 @@ shr_create(shr_key_t *restrict key, size_t buffer_size, size_t buffer_count, mod
 	}
 	if (semctl(sem_id, 0, SETALL, values) == -1)
 		goto fail;
+	((struct shr_header *)address)->semaphores = (uint32_t)sem_id + 1;
 
+	PROBE(create, shm_id, buffer_size, buffer_count, flags);
 	free(values);
 	shmdt(address);
 	return 0;
@@ -187,6 +307,12 @@ shr_remove(const shr_t *restrict shr)
 	shr_t shr_ = *shr;
 	if (!shr)
 		return;
+	if (LOCAL(shr)) {
+		shr_close(&shr_);
+		if (HEADER(shr)->local == SHR_LOCAL_ALLOCATED)
+			free(shr->address);
+		return;
+	}
 	shr_close(&shr_);
 	if (shr->shm != -1)  shmctl(shr->shm, IPC_RMID, &_info);
 	if (shr->sem != -1)  semctl(shr->sem, 0, IPC_RMID);
@@ -227,17 +353,23 @@ shr_remove_by_key(const shr_key_t *restrict key)
  *                     key before passing it to this function, to create and open a
  *                     private shared ring buffer
  * @param   direction  Whether the shared ring buffer should be opened
- *                     for reading or writting, only one is allowed
+ *                     for reading or writting, only one is allowed,
+ *                     or `SHR_OBSERVE` to open it as an observer
  * @return             Zero on success, -1 on error; on error,
  *                     `errno` will be set to describe the error
  * 
+ * @throws  EINVAL  The shared memory is not a shared ring buffer, or
+ *                  its geometry or flags does not match the key
+ * @throws  EINVAL  `direction` is `SHR_OBSERVE`, and the shared ring buffer
+ *                  is private, or it has neither of the flags `SHR_OBSERVABLE`,
+ *                  `SHR_OVERWRITE` and `SHR_LATEST`
  * @throws  Any error specified for shmget(3), shmat(3) and semget(3) except EINTR
  * @throws  Any error semctl(3) and malloc(3) if creating a private shared ring buffer
  */
 int
 shr_open(shr_t *restrict shr, const shr_key_t *restrict key, shr_direction_t direction)
 {
-	size_t ring_size = sizeof(size_t) + key->buffer_count * (key->buffer_size + sizeof(size_t));
+	size_t ring_size = SHR_RING_SIZE(key->buffer_size, key->flags, key->buffer_count);
 	size_t sem_count = 2 * key->buffer_count;
 	size_t permissions = IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR;
 	void *address = NULL;
@@ -250,9 +382,15 @@ shr_open(shr_t *restrict shr, const shr_key_t *restrict key, shr_direction_t dir
 	shr->direction = direction;
 	shr->current_buffer = 0;
 	shr->address = NULL;
+	shr->sequence = shr->lost = 0;
+	shr->ttl = shr->skipped = 0;
 
 	if (key->shm != IPC_PRIVATE)
 		permissions = 0;
+	else if (direction == SHR_OBSERVE)
+		return errno = EINVAL, -1;
+	if (direction == SHR_OBSERVE && !SEQUENCE_FLAGS(key->flags))
+		return errno = EINVAL, -1;
 
 	/* Get shared memory. */
  retry_shm:
@@ -264,14 +402,21 @@ shr_open(shr_t *restrict shr, const shr_key_t *restrict key, shr_direction_t dir
 	}
 	shr->address = NULL;
  retry_mem:
-	address = shmat(shr->shm, NULL, direction);
+	address = shmat(shr->shm, NULL, ATTACH_FLAGS(key, direction));
 	if (!(address) || (address == (void*)-1)) {
 		if (errno == EINTR)
 			goto retry_mem;
 		address = NULL;
 		goto fail;
 	}
+	if (key->shm != IPC_PRIVATE && !check_header(address, key)) {
+		shmdt(address);
+		errno = EINVAL;
+		goto fail;
+	}
 	shr->address = address;
+	if (key->shm != IPC_PRIVATE && ((key->flags & SHR_OVERWRITE) || direction == SHR_OBSERVE))
+		shr_overwrite_reset_(shr);
 
 	/* Get semaphore array. */
  retry_sem:
@@ -286,7 +431,12 @@ shr_open(shr_t *restrict shr, const shr_key_t *restrict key, shr_direction_t dir
 		return 0;
 	  
 	/* Initialise. */
-	*(size_t*)address = 0;
+	if (!VALID_FLAGS(key->flags)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	shr_init_header_(address, key);
+	HEADER(shr)->semaphores = (uint32_t)shr->sem + 1;
 	values = malloc(sem_count * sizeof(unsigned short));
 	if (!values)
 		goto fail;
@@ -314,7 +464,8 @@ shr_open(shr_t *restrict shr, const shr_key_t *restrict key, shr_direction_t dir
  * have one for reading, or vice versa
  * 
  * This is only useful if you have used `shr_open` to
- * create a private shared ring buffer
+ * create a private shared ring buffer, or `shr_open_local`
+ * to create a local shared ring buffer
  * 
  * This function will reopen the shared ring buffer, thus,
  * according to `shr_open`, the behaviour is unspecified if
@@ -328,20 +479,31 @@ shr_open(shr_t *restrict shr, const shr_key_t *restrict key, shr_direction_t dir
  * @return       Zero on success, -1 on error; on error,
  *               `errno` will be set to describe the error
  * 
+ * @throws  EINVAL  `shr` is an observer
  * @throws  Any error specified for shmat(3)
  */
 int
 shr_reverse_dup(const shr_t *restrict old, shr_t *restrict new)
 {
+	if (old->direction == SHR_OBSERVE)
+		return errno = EINVAL, -1;
 	*new = *old;
 	new->direction ^= SHM_RDONLY;
+	new->ttl = new->skipped = 0;
+	if (LOCAL(old)) {
+		shr_local_reset_(new);
+		goto done;
+	}
  retry_mem:
-	new->address = shmat(new->shm, NULL, new->direction);
+	new->address = shmat(new->shm, NULL, ATTACH_FLAGS(&new->key, new->direction));
 	if (!(new->address) || (new->address == (void*)-1)) {
 		if (errno == EINTR)
 			goto retry_mem;
 		goto fail;
 	}
+ done:
+	if (OVERWRITE(new))
+		shr_overwrite_reset_(new);
 	return 0;
 
  fail:
@@ -364,9 +526,12 @@ void
 shr_close(shr_t *restrict shr)
 {
 	if (shr->address) {
+		PROBE(close, probe_ring(shr), shr->direction == SHR_WRITE);
 		if (shr->direction == SHR_WRITE)
-			*(size_t*)(shr->address) = shr->current_buffer + 1;
-		shmdt(shr->address), shr->address = NULL;
+			HEADER(shr)->closed = shr->current_buffer + 1;
+		if (!LOCAL(shr))
+			shmdt(shr->address);
+		shr->address = NULL;
 	}
 }
 
@@ -484,9 +649,11 @@ shr_stat(const shr_t *restrict shr, uid_t *restrict owner, gid_t *restrict group
 void
 shr_key_to_str(const shr_key_t *restrict key, char *restrict str)
 {
-	sprintf(str, "%zu.%zu.%zu.%zu",
-	        (size_t)(key->shm), (size_t)(key->sem),
-	        key->buffer_size, key->buffer_count);
+	str += sprintf(str, "%zu.%zu.%zu.%zu",
+	               (size_t)(key->shm), (size_t)(key->sem),
+	               key->buffer_size, key->buffer_count);
+	if (key->flags)
+		sprintf(str, ".%i", key->flags);
 }
 
 
@@ -510,10 +677,11 @@ shr_str_to_key(const char *restrict str, shr_key_t *restrict key)
 {
 	char c;
 	memset(key, 0, sizeof(*key));
-	while ('.' != (c = *str++))  key->shm *= 10,          key->shm += c & 15;
-	while ('.' != (c = *str++))  key->sem *= 10,          key->sem += c & 15;
-	while ('.' != (c = *str++))  key->buffer_size *= 10,  key->buffer_size += c & 15;
-	while ((c = *str++))         key->buffer_count *= 10, key->buffer_count += c & 15;
+	while ('.' != (c = *str++))         key->shm *= 10,          key->shm += c & 15;
+	while ('.' != (c = *str++))         key->sem *= 10,          key->sem += c & 15;
+	while ('.' != (c = *str++))         key->buffer_size *= 10,  key->buffer_size += c & 15;
+	while ((c = *str++) && (c != '.'))  key->buffer_count *= 10, key->buffer_count += c & 15;
+	while (c && (c = *str++))           key->flags *= 10,        key->flags += c & 15;
 }
 
 
@@ -532,23 +700,28 @@ shr_str_to_key(const char *restrict str, shr_key_t *restrict key)
  *                  `errno` will be set to describe the error
  * 
  * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, `*buffer`
+ *                   and `*length` are set and the buffer must be released with
+ *                   `shr_read_done` as usual
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE`, and the
+ *                   writer has overwritten the current buffer before it was read;
+ *                   the reader has skipped to the newest buffer, and `SHR_LOST(shr)`
+ *                   has been increased by the number of skipped buffers
  */
 int
 shr_read(shr_t *restrict shr, const char **restrict buffer, size_t *restrict length)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
-	struct sembuf op;
+	if (OVERWRITE(shr))
+		return shr_overwrite_read_(shr, buffer, length, 0, NULL);
 
-	op.sem_num = (unsigned short)READ_SEM(shr->current_buffer);
-	op.sem_op = -1;
-	op.sem_flg = 0;
-
-	if (semop(shr->sem, &op, (size_t)1))
+	if (shr_wait_(shr, 0, 0, NULL))
 		return -1;
 
-	*buffer = shr->address + offset;
-	*length = *(size_t*)(shr->address + offset + shr->key.buffer_size);
-	return 0;
+	*buffer = BUFFER(shr, shr->current_buffer);
+	*length = *LENGTH(shr, shr->current_buffer);
+	PROBE(acquire, probe_ring(shr), shr->current_buffer, 0, *length);
+	return shr_verify_(shr, shr->current_buffer);
 }
 
 
@@ -567,23 +740,28 @@ shr_read(shr_t *restrict shr, const char **restrict buffer, size_t *restrict len
  * 
  * @throws  The errors EACCES, EAGAIN, EIDRM, EINTR and EINVAL,
  *          as specified for semop(3)
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, `*buffer`
+ *                   and `*length` are set and the buffer must be released with
+ *                   `shr_read_done` as usual
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE`, and the
+ *                   writer has overwritten the current buffer before it was read;
+ *                   the reader has skipped to the newest buffer, and `SHR_LOST(shr)`
+ *                   has been increased by the number of skipped buffers
  */
 int
 shr_read_try(shr_t *restrict shr, const char **restrict buffer, size_t *restrict length)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
-	struct sembuf op;
+	if (OVERWRITE(shr))
+		return shr_overwrite_read_(shr, buffer, length, 1, NULL);
 
-	op.sem_num = (unsigned short)READ_SEM(shr->current_buffer);
-	op.sem_op = -1;
-	op.sem_flg = IPC_NOWAIT;
-
-	if (semop(shr->sem, &op, (size_t)1))
+	if (shr_wait_(shr, 0, 1, NULL))
 		return -1;
 
-	*buffer = shr->address + offset;
-	*length = *(size_t*)(shr->address + offset + shr->key.buffer_size);
-	return 0;
+	*buffer = BUFFER(shr, shr->current_buffer);
+	*length = *LENGTH(shr, shr->current_buffer);
+	PROBE(acquire, probe_ring(shr), shr->current_buffer, 0, *length);
+	return shr_verify_(shr, shr->current_buffer);
 }
 
 
@@ -603,24 +781,29 @@ shr_read_try(shr_t *restrict shr, const char **restrict buffer, size_t *restrict
  * 
  * @throws  The errors EACCES, EAGAIN, EFAULT, EIDRM, EINTR and EINVAL,
  *          as specified for semtimedop(3)
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, `*buffer`
+ *                   and `*length` are set and the buffer must be released with
+ *                   `shr_read_done` as usual
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE`, and the
+ *                   writer has overwritten the current buffer before it was read;
+ *                   the reader has skipped to the newest buffer, and `SHR_LOST(shr)`
+ *                   has been increased by the number of skipped buffers
  */
 int
 shr_read_timed(shr_t *restrict shr, const char **restrict buffer,
 	       size_t *restrict length, const struct timespec *timeout)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
-	struct sembuf op;
-
-	op.sem_num = (unsigned short)READ_SEM(shr->current_buffer);
-	op.sem_op = -1;
-	op.sem_flg = 0;
+	if (OVERWRITE(shr))
+		return shr_overwrite_read_(shr, buffer, length, 0, timeout);
 
-	if (semtimedop(shr->sem, &op, (size_t)1, timeout))
+	if (shr_wait_(shr, 0, 0, timeout))
 		return -1;
 
-	*buffer = shr->address + offset;
-	*length = *(size_t*)(shr->address + offset + shr->key.buffer_size);
-	return 0;
+	*buffer = BUFFER(shr, shr->current_buffer);
+	*length = *LENGTH(shr, shr->current_buffer);
+	PROBE(acquire, probe_ring(shr), shr->current_buffer, 0, *length);
+	return shr_verify_(shr, shr->current_buffer);
 }
 
 
@@ -637,21 +820,31 @@ shr_read_timed(shr_t *restrict shr, const char **restrict buffer,
  *               error, `errno` will be set to describe the error
  * 
  * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  ESTALE  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`,
+ *                  and the buffer was overwritten while it was read, the data
+ *                  that was read must be discarded
  */
 int
 shr_read_done(shr_t *restrict shr)
 {
 	struct sembuf op;
 
+	if (OVERWRITE(shr))
+		return shr_overwrite_read_done_(shr);
+
 	op.sem_num = (unsigned short)WRITE_SEM(shr->current_buffer);
 	op.sem_op = +1;
 	op.sem_flg = 0;
 
-	if (semop(shr->sem, &op, (size_t)1))
+	PROBE(release, probe_ring(shr), shr->current_buffer, 0, *LENGTH(shr, shr->current_buffer));
+	if (LOCAL(shr))
+		shr_local_release_(shr, 1);
+	else if (semop(shr->sem, &op, (size_t)1))
 		return -1;
 
-	shr->current_buffer = (shr->current_buffer + 1) % shr->key.buffer_count;
-	return *(size_t*)(shr->address) == shr->current_buffer + 1;
+	if (++(shr->current_buffer) == shr->key.buffer_count)
+		shr->current_buffer = 0;
+	return HEADER(shr)->closed == shr->current_buffer + 1;
 }
 
 
@@ -675,17 +868,15 @@ shr_read_done(shr_t *restrict shr)
 int
 shr_write(shr_t *restrict shr, char **restrict buffer)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
-	struct sembuf op;
+	if (OVERWRITE(shr))
+		return shr_overwrite_write_(shr, buffer);
 
-	op.sem_num = (unsigned short)WRITE_SEM(shr->current_buffer);
-	op.sem_op = -1;
-	op.sem_flg = 0;
-
-	if (semop(shr->sem, &op, (size_t)1))
+	if (shr_wait_(shr, 1, 0, NULL))
 		return -1;
 
-	*buffer = shr->address + offset;
+	*buffer = BUFFER(shr, shr->current_buffer);
+	observe_begin(shr, shr->current_buffer);
+	PROBE(acquire, probe_ring(shr), shr->current_buffer, 1, shr->key.buffer_size);
 	return 0;
 }
 
@@ -710,17 +901,15 @@ shr_write(shr_t *restrict shr, char **restrict buffer)
 int
 shr_write_try(shr_t *restrict shr, char **restrict buffer)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
-	struct sembuf op;
+	if (OVERWRITE(shr))
+		return shr_overwrite_write_(shr, buffer);
 
-	op.sem_num = (unsigned short)WRITE_SEM(shr->current_buffer);
-	op.sem_op = -1;
-	op.sem_flg = IPC_NOWAIT;
-
-	if (semop(shr->sem, &op, (size_t)1))
+	if (shr_wait_(shr, 1, 1, NULL))
 		return -1;
 
-	*buffer = shr->address + offset;
+	*buffer = BUFFER(shr, shr->current_buffer);
+	observe_begin(shr, shr->current_buffer);
+	PROBE(acquire, probe_ring(shr), shr->current_buffer, 1, shr->key.buffer_size);
 	return 0;
 }
 
@@ -747,17 +936,15 @@ shr_write_try(shr_t *restrict shr, char **restrict buffer)
 int
 shr_write_timed(shr_t *restrict shr, char **restrict buffer, const struct timespec *timeout)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
-	struct sembuf op;
-
-	op.sem_num = (unsigned short)WRITE_SEM(shr->current_buffer);
-	op.sem_op = -1;
-	op.sem_flg = 0;
+	if (OVERWRITE(shr))
+		return shr_overwrite_write_(shr, buffer);
 
-	if (semtimedop(shr->sem, &op, (size_t)1, timeout))
+	if (shr_wait_(shr, 1, 0, timeout))
 		return -1;
 
-	*buffer = shr->address + offset;
+	*buffer = BUFFER(shr, shr->current_buffer);
+	observe_begin(shr, shr->current_buffer);
+	PROBE(acquire, probe_ring(shr), shr->current_buffer, 1, shr->key.buffer_size);
 	return 0;
 }
 
@@ -780,19 +967,172 @@ shr_write_timed(shr_t *restrict shr, char **restrict buffer, const struct timesp
 int
 shr_write_done(shr_t *restrict shr, size_t length)
 {
-	size_t offset = sizeof(size_t) + shr->current_buffer * (shr->key.buffer_size + sizeof(size_t));
 	struct sembuf op;
 
-	*(size_t*)(shr->address + offset + shr->key.buffer_size) = length;
+	if (OVERWRITE(shr))
+		return shr_overwrite_write_done_(shr, length);
+
+	*LENGTH(shr, shr->current_buffer) = length;
+	shr_stamp_(shr, shr->current_buffer);
 
 	op.sem_num = (unsigned short)READ_SEM(shr->current_buffer);
 	op.sem_op = +1;
 	op.sem_flg = 0;
 
-	if (semop(shr->sem, &op, (size_t)1))
+	PROBE(release, probe_ring(shr), shr->current_buffer, 1, length);
+	if (LOCAL(shr))
+		shr_local_release_(shr, 1);
+	else if (semop(shr->sem, &op, (size_t)1))
 		return -1;
 
-	shr->current_buffer = (shr->current_buffer + 1) % shr->key.buffer_count;
+	if (++(shr->current_buffer) == shr->key.buffer_count)
+		shr->current_buffer = 0;
 	return 0;
 }
 
+
+
+/**
+ * Give back the, by `shr_write`, `shr_write_try` or `shr_write_timed`,
+ * retrieved buffer without publishing it, the next call to any of
+ * those functions will retrieve the same buffer
+ * 
+ * If the shared ring buffer has the flag `SHR_OVERWRITE`, `SHR_LATEST`
+ * or `SHR_OBSERVABLE`, the buffer may have been modified, so readers
+ * and observers will consider the data it held before lost, unless it
+ * has not held any data; with only one buffer, readers will not get
+ * any data until the next buffer is published
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr  The shared ring buffer, must not be `NULL`
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ */
+int
+shr_write_cancel(shr_t *restrict shr)
+{
+	struct sembuf op;
+
+	cancel_sequence(shr, shr->current_buffer);
+
+	/* The writer of a local shared ring buffer only counts the buffers it publishes. */
+	if (OVERWRITE(shr) || LOCAL(shr))
+		return 0;
+
+	op.sem_num = (unsigned short)WRITE_SEM(shr->current_buffer);
+	op.sem_op = +1;
+	op.sem_flg = 0;
+
+	while (semop(shr->sem, &op, (size_t)1))
+		if (errno != EINTR)
+			return -1;
+	return 0;
+}
+
+
+
+/**
+ * Add the same value to the semaphores, of a number of consecutive
+ * buffers, that flag them as writable or readable, atomically
+ * 
+ * @param   shr    The shared ring buffer
+ * @param   write  Non-zero to use the semaphores that flag buffers as
+ *                 writeable, zero to use those that flag them as readable
+ * @param   first  The number of buffers after the current buffer to start at,
+ *                 must be 0 if the buffers are handed over to the other end
+ *                 of a local shared ring buffer
+ * @param   n      The number of buffers, at most `SHR_BATCH_MAX`
+ * @param   value  The value to add to each semaphore
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ */
+int
+shr_batch_op_(shr_t *restrict shr, int write, size_t first, size_t n, short value)
+{
+	struct sembuf ops[SHR_BATCH_MAX];
+	size_t i, j;
+
+	if (!n)
+		return 0;
+
+	if (LOCAL(shr)) {
+		/* Buffers are only counted when handed over, giving them back is implicit. */
+		if (!write == (shr->direction == SHR_WRITE))
+			shr_local_release_(shr, n * (size_t)value);
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		j = next_buffer(shr, first + i);
+		ops[i].sem_num = (unsigned short)(write ? WRITE_SEM(j) : READ_SEM(j));
+		ops[i].sem_op = value;
+		ops[i].sem_flg = 0;
+	}
+
+	while (semop(shr->sem, ops, n))
+		if (errno != EINTR)
+			return -1;
+	return 0;
+}
+
+
+/**
+ * Fill in the metadata of a buffer, that is
+ * about to be published, other than its length
+ * 
+ * @param  shr  The shared ring buffer
+ * @param  i    The index of the buffer
+ */
+void
+shr_stamp_(const shr_t *restrict shr, size_t i)
+{
+	uint64_t n;
+	if (shr->key.flags & SHR_CHECKSUM)
+		*META(shr, i, SHR_CHECKSUM) = shr_crc32c_(BUFFER(shr, i), *LENGTH(shr, i));
+	if (shr->key.flags & SHR_ELASTIC)
+		*META(shr, i, SHR_ELASTIC) = clock_ns(CLOCK_MONOTONIC_COARSE);
+	if (shr->key.flags & SHR_DEADLINE)
+		*META(shr, i, SHR_DEADLINE) = shr->ttl ? clock_ns(CLOCK_MONOTONIC) + shr->ttl : 0;
+	if (shr->key.flags & SHR_OBSERVABLE) {
+		/* `observe_begin` has stored 2n + 1 when the buffer was acquired. */
+		n = atomic_load_explicit(SEQUENCE(shr, i), memory_order_relaxed) / 2;
+		atomic_store_explicit(SEQUENCE(shr, i), 2 * n + 2, memory_order_release);
+		atomic_store_explicit(&HEADER(shr)->head, n + 1, memory_order_release);
+	}
+	if (!LOCAL(shr)) {
+		/* Only the writer stores it, so it need not be incremented atomically. */
+		n = atomic_load_explicit(&HEADER(shr)->published, memory_order_relaxed);
+		atomic_store_explicit(&HEADER(shr)->published, n + 1, memory_order_relaxed);
+	}
+}
+
+
+/**
+ * Verify the metadata of a buffer that has been acquired for reading
+ * 
+ * @param   shr  The shared ring buffer
+ * @param   i    The index of the buffer
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The checksum does not match the content of the buffer
+ */
+int
+shr_verify_(const shr_t *restrict shr, size_t i)
+{
+	size_t length;
+	if (SHR_LIKELY(!(shr->key.flags & SHR_CHECKSUM)))
+		return 0;
+	length = *LENGTH(shr, i);
+	if (length > shr->key.buffer_size)
+		return errno = EBADMSG, -1;
+	if (*META(shr, i, SHR_CHECKSUM) != shr_crc32c_(BUFFER(shr, i), length))
+		return errno = EBADMSG, -1;
+	return 0;
+}
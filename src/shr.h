@@ -29,17 +29,24 @@
 # define _DEFAULT_SOURCE
 #endif
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 
 
 
 #if defined(__GNUC__)
 # define SHR_COMPILER_GCC(X)  X
+# define SHR_LIKELY(X)        __builtin_expect(!!(X), 1)
+# define SHR_UNLIKELY(X)      __builtin_expect(!!(X), 0)
 #else
 # define SHR_COMPILER_GCC(X)  /* ignore */
+# define SHR_LIKELY(X)        (X)
+# define SHR_UNLIKELY(X)      (X)
 #endif
 
 
@@ -55,7 +62,7 @@
  * an instruction to create a private shared ring buffer
  * 
  * Undefined behaviour will be invoked if
- * `sizeof(size_t) + BUFFER_COUNT * (BUFFER_SIZE + sizeof(size_t)) > SIZE_MAX`,
+ * `SHR_RING_SIZE(BUFFER_SIZE, 0, BUFFER_COUNT) > SIZE_MAX`,
  * or if `BUFFER_COUNT > SHORT_MAX`
  * 
  * @param  KEY:struct shr_key *  Output parameter for the psuedo-key
@@ -63,9 +70,35 @@
  * @param  BUFFER_COUNT:size_t   The number of buffers
  */
 #define SHR_PRIVATE(KEY, BUFFER_SIZE, BUFFER_COUNT)  \
-	((KEY)->shm = (KEY)->sem = IPC_PRIVATE,	     \
-	 (KEY)->buffer_size = BUFFER_SIZE,	     \
-	 (KEY)->buffer_count = BUFFER_COUNT)
+	SHR_PRIVATE_FLAGS(KEY, BUFFER_SIZE, BUFFER_COUNT, 0)
+
+/**
+ * Variant of `SHR_PRIVATE` that also
+ * selects the features of the buffer
+ * 
+ * Undefined behaviour will be invoked if
+ * `SHR_RING_SIZE(BUFFER_SIZE, FLAGS, BUFFER_COUNT) > SIZE_MAX`,
+ * or if `BUFFER_COUNT > SHORT_MAX`
+ * 
+ * @param  KEY:struct shr_key *  Output parameter for the psuedo-key
+ * @param  BUFFER_SIZE:size_t    The size of each buffer
+ * @param  BUFFER_COUNT:size_t   The number of buffers
+ * @param  FLAGS:int             Bitwise-OR of `enum shr_flags` values
+ */
+#define SHR_PRIVATE_FLAGS(KEY, BUFFER_SIZE, BUFFER_COUNT, FLAGS)  \
+	((KEY)->shm = (KEY)->sem = IPC_PRIVATE,	                  \
+	 (KEY)->buffer_size = BUFFER_SIZE,	                  \
+	 (KEY)->buffer_count = BUFFER_COUNT,	                  \
+	 (KEY)->flags = FLAGS)
+
+/**
+ * Check whether a shared ring buffer is a local shared ring
+ * buffer, that is, one opened with `shr_open_local`
+ * 
+ * @param   shr:const struct shr *  The shared ring buffer
+ * @return  :int                    Whether the shared ring buffer is local
+ */
+#define SHR_IS_LOCAL(SHR)  ((SHR)->sem == -1 && (SHR)->address)
 
 /**
  * Get the buffer size of a shared ring buffer
@@ -83,6 +116,248 @@
  */
 #define SHR_BUFFER_COUNT(SHR)  ((SHR)->key.buffer_count)
 
+/**
+ * Get the number of buffers the read end of a shared
+ * ring buffer with the flag `SHR_OVERWRITE`, or an
+ * observer of a shared ring buffer, has lost
+ * 
+ * @param   shr:struct shr *  The shared ring buffer
+ * @return  :uint64_t         The number of lost buffers
+ */
+#define SHR_LOST(SHR)  ((SHR)->lost)
+
+/**
+ * Get the number of stale buffers the read end of a shared
+ * ring buffer with the flag `SHR_DEADLINE` has skipped
+ * 
+ * @param   shr:struct shr *  The shared ring buffer
+ * @return  :uint64_t         The number of skipped buffers
+ */
+#define SHR_SKIPPED(SHR)  ((SHR)->skipped)
+
+/**
+ * Get the sequence number of the snapshot last read from
+ * a shared ring buffer with the flag `SHR_LATEST`, it only
+ * changes when a newer snapshot is read
+ * 
+ * @param   shr:struct shr *  The shared ring buffer
+ * @return  :uint64_t         The sequence number of the snapshot
+ */
+#define SHR_SEQUENCE(SHR)  ((SHR)->sequence)
+
+/**
+ * The number of bytes at the beginning of the shared
+ * memory of a shared ring buffer, before the first buffer
+ */
+#define SHR_HEADER_SIZE  256
+
+/**
+ * The offset, in the shared memory of a shared ring buffer
+ * that is not local, of the number of published buffers,
+ * a `uint64_t` that only the writer updates, for monitors
+ */
+#define SHR_PUBLISHED_OFFSET  72
+
+/**
+ * The offsets, in the shared memory of a local shared
+ * ring buffer, of the number of published buffers and
+ * of the number of fully read buffers, modulo 2 to the
+ * power of 32; each is a `uint32_t`, followed by the
+ * `uint32_t` number of threads sleeping on it in futex(2)
+ */
+#define SHR_WRITTEN_OFFSET  64
+#define SHR_READ_OFFSET     128
+
+/**
+ * The offsets, in the shared memory of a local shared ring
+ * buffer, of the index of the writer's current buffer and
+ * of the index of the reader's current buffer; each is a
+ * `uint32_t` that only its end updates, so that an end that
+ * is opened later can continue where the last one stopped
+ */
+#define SHR_WRITTEN_INDEX_OFFSET  80
+#define SHR_READ_INDEX_OFFSET     136
+
+/**
+ * The offset, in the shared memory of a shared ring buffer,
+ * of the `uint32_t` that is nonzero if the shared ring
+ * buffer is local, and `SHR_LOCAL_KIND_ARENA` if it is
+ * in an arena and may be shared between processes
+ */
+#define SHR_LOCAL_KIND_OFFSET  20
+#define SHR_LOCAL_KIND_ARENA   3
+
+/**
+ * Get the size of the metadata stored after each
+ * buffer in the shared memory of a shared ring buffer
+ * 
+ * The metadata begins with the length of the data in
+ * the buffer, as a `size_t`, and is followed by one
+ * field for each feature that requires one, 8 bytes
+ * each, except the 32-byte field of `SHR_ADDRESS`
+ * 
+ * @param   FLAGS:int  The flags of the shared ring buffer
+ * @return  :size_t    The size of the metadata of each buffer
+ */
+#define SHR_TRAILER_SIZE(FLAGS)  \
+	(sizeof(size_t) + (((FLAGS) & SHR_CHECKSUM) ? 8 : 0) + (((FLAGS) & (SHR_OVERWRITE | SHR_LATEST)) ? 8 : 0) +\
+	 (((FLAGS) & SHR_ADDRESS) ? 32 : 0) + (((FLAGS) & SHR_ELASTIC) ? 8 : 0) +\
+	 (((FLAGS) & SHR_DEADLINE) ? 8 : 0) + (((FLAGS) & SHR_OBSERVABLE) ? 8 : 0) +\
+	 (((FLAGS) & SHR_TAGGED) ? 8 : 0))
+
+/**
+ * Get the distance between two consecutive buffers in
+ * the shared memory of a shared ring buffer
+ * 
+ * @param   BUFFER_SIZE:size_t  The buffer size of the shared ring buffer
+ * @param   FLAGS:int           The flags of the shared ring buffer
+ * @return  :size_t             The distance between two buffers
+ */
+#define SHR_BUFFER_STRIDE(BUFFER_SIZE, FLAGS)  \
+	((((BUFFER_SIZE) + 7) & ~(size_t)7) + SHR_TRAILER_SIZE(FLAGS))
+
+/**
+ * Get the offset of a buffer in the shared memory of
+ * a shared ring buffer, the metadata of the buffer is
+ * stored `(BUFFER_SIZE + 7) & ~7` bytes after the buffer
+ * 
+ * @param   BUFFER_SIZE:size_t  The buffer size of the shared ring buffer
+ * @param   FLAGS:int           The flags of the shared ring buffer
+ * @param   I:size_t            The index of the buffer
+ * @return  :size_t             The offset of the buffer
+ */
+#define SHR_BUFFER_OFFSET(BUFFER_SIZE, FLAGS, I)  \
+	(SHR_HEADER_SIZE + (I) * SHR_BUFFER_STRIDE(BUFFER_SIZE, FLAGS))
+
+/**
+ * Get the offset of the length of the data in a buffer in
+ * the shared memory of a shared ring buffer
+ * 
+ * @param   BUFFER_SIZE:size_t  The buffer size of the shared ring buffer
+ * @param   FLAGS:int           The flags of the shared ring buffer
+ * @param   I:size_t            The index of the buffer
+ * @return  :size_t             The offset of the length
+ */
+#define SHR_LENGTH_OFFSET(BUFFER_SIZE, FLAGS, I)  \
+	(SHR_BUFFER_OFFSET(BUFFER_SIZE, FLAGS, I) + (((BUFFER_SIZE) + 7) & ~(size_t)7))
+
+/**
+ * Get the size of the shared memory of a shared ring buffer
+ * 
+ * @param   BUFFER_SIZE:size_t   The buffer size of the shared ring buffer
+ * @param   FLAGS:int            The flags of the shared ring buffer
+ * @param   BUFFER_COUNT:size_t  The buffer count of the shared ring buffer
+ * @return  :size_t              The size of the shared memory
+ */
+#define SHR_RING_SIZE(BUFFER_SIZE, FLAGS, BUFFER_COUNT)  \
+	SHR_BUFFER_OFFSET(BUFFER_SIZE, FLAGS, BUFFER_COUNT)
+
+
+
+/**
+ * Optional features of a shared ring buffer
+ */
+enum shr_flags
+{
+	/**
+	 * Store a CRC32C checksum of the data in each buffer
+	 * when it is written, and verify it when it is read
+	 */
+	SHR_CHECKSUM = 0x0001,
+
+	/**
+	 * Never block the writer: when all buffers are
+	 * full, the oldest buffer is overwritten, and
+	 * a reader that falls behind loses data
+	 * 
+	 * Each buffer has a sequence number, with which
+	 * readers detect that they have been lapped, or
+	 * that a buffer was overwritten while it was read
+	 */
+	SHR_OVERWRITE = 0x0002,
+
+	/**
+	 * Conflate the buffers: readers always take the
+	 * most recently published buffer, a snapshot, and
+	 * never see a backlog; the writer never blocks and
+	 * never makes a system call
+	 * 
+	 * Like `SHR_OVERWRITE`, each buffer has a sequence
+	 * number, with which readers detect that the writer
+	 * overwrote the snapshot while it was read; the two
+	 * flags cannot be combined
+	 */
+	SHR_LATEST = 0x0004,
+
+	/**
+	 * Store a socket address, of at most `SHR_ADDRESS_MAX`
+	 * bytes, with each buffer, so that datagrams can be
+	 * passed through the shared ring buffer together with
+	 * their source or destination address
+	 */
+	SHR_ADDRESS = 0x0008,
+
+	/**
+	 * Record when each buffer was last published, so that
+	 * `shr_trim` can release the memory of buffers that
+	 * have not been used for a while, the memory is
+	 * faulted back in when the buffer is written again
+	 */
+	SHR_ELASTIC = 0x0010,
+
+	/**
+	 * Give each buffer a deadline, after which its data
+	 * is stale, so that a reader that has fallen behind
+	 * can skip stale buffers with `shr_skip_stale`; the
+	 * writer selects the time to live with `shr_set_ttl`
+	 */
+	SHR_DEADLINE = 0x0020,
+
+	/**
+	 * Give each buffer a sequence number, so that the
+	 * shared ring buffer can be opened with `SHR_OBSERVE`;
+	 * shared ring buffers with `SHR_OVERWRITE` or
+	 * `SHR_LATEST` already have sequence numbers, and
+	 * cannot be combined with this flag
+	 */
+	SHR_OBSERVABLE = 0x0040,
+
+	/**
+	 * Store a 64-bit tag with each buffer, such as an identifier
+	 * that correlates a reply with its request, that the writer
+	 * sets with `shr_write_tag`, and the reader gets with
+	 * `shr_read_tag`, without the data having to carry it
+	 */
+	SHR_TAGGED = 0x0080,
+
+};
+
+/**
+ * The maximum length of the address stored with
+ * each buffer of a shared ring buffer with the
+ * flag `SHR_ADDRESS`, large enough for IPv4 and
+ * IPv6 addresses, but not for UNIX socket paths
+ */
+#define SHR_ADDRESS_MAX  28
+
+
+/**
+ * Flags for `shr_pool_run`
+ */
+enum shr_pool_flags
+{
+	/**
+	 * Pin each worker thread to its own CPU
+	 */
+	SHR_POOL_PIN = 0x0001,
+
+	/**
+	 * Do not let idle workers steal buffers
+	 * from other workers' shared ring buffers
+	 */
+	SHR_POOL_NO_STEAL = 0x0002,
+
+};
 
 
 /**
@@ -103,6 +378,16 @@ typedef enum shr_direction
 	 */
 	SHR_WRITE = 0,
 
+	/**
+	 * The shared ring buffer should be or is opened
+	 * for observing the data the writer publishes,
+	 * without taking part in the flow control; an
+	 * observer attaches the shared memory read-only,
+	 * and can only be used with `shr_observe`,
+	 * `shr_observe_try` and `shr_close`
+	 */
+	SHR_OBSERVE = 1,
+
 } shr_direction_t;
 
 
@@ -133,6 +418,11 @@ typedef struct shr_key
 	 */
 	size_t buffer_count;
 
+	/**
+	 * Bitwise-OR of `enum shr_flags` values
+	 */
+	int flags;
+
 } shr_key_t;
 
 
@@ -174,9 +464,66 @@ typedef struct shr
 	 */
 	char *address;
 
+	/**
+	 * Only used by local shared ring buffers: the number
+	 * of buffers this end has handed over to the other
+	 * end, modulo 2 to the power of 32
+	 */
+	unsigned int released;
+
+	/**
+	 * Only used by local shared ring buffers: the number
+	 * of buffers the other end had handed over to this
+	 * end, when last checked
+	 */
+	unsigned int peer_released;
+
+	/**
+	 * Only used by shared ring buffers with `SHR_OVERWRITE`
+	 * or `SHR_LATEST`, and by observers: the sequence
+	 * number of the current buffer
+	 */
+	uint64_t sequence;
+
+	/**
+	 * Only used by shared ring buffers with `SHR_OVERWRITE`,
+	 * and by observers: the number of buffers this end has
+	 * lost because the writer overwrote them before they
+	 * were read
+	 */
+	uint64_t lost;
+
+	/**
+	 * Only used by the write end of shared ring buffers
+	 * with `SHR_DEADLINE`: the time to live, in nanoseconds,
+	 * of the buffers it publishes, 0 for no deadline
+	 */
+	uint64_t ttl;
+
+	/**
+	 * Only used by the read end of shared ring buffers
+	 * with `SHR_DEADLINE`: the number of stale buffers
+	 * `shr_skip_stale` has skipped
+	 */
+	uint64_t skipped;
+
 } shr_t;
 
 
+/**
+ * Function that processes a buffer read by `shr_pool_run`
+ * 
+ * @param   user    The user-supplied argument
+ * @param   ring    The index of the shared ring buffer
+ * @param   buffer  The buffer
+ * @param   length  The length of the buffer
+ * @return          Zero on success, -1 on error to stop the
+ *                  pool; on error, `errno` shall be set to
+ *                  describe the error
+ */
+typedef int shr_pool_handler_t(void *, size_t, const char *, size_t);
+
+
 
 /**
  * Create a shared ring buffer
@@ -185,7 +532,7 @@ typedef struct shr
  * process's effective user and effective group
  * 
  * Undefined behaviour will be invoked if
- * `sizeof(size_t) + buffer_count * (buffer_size + sizeof(size_t)) > SIZE_MAX`,
+ * `SHR_RING_SIZE(buffer_size, 0, buffer_count) > SIZE_MAX`,
  * if `buffer_count == 0` or if `(permissions & ~(S_IRWXU | S_IRWXG | S_IRWXO))`,
  * or if `buffer_count > SHORT_MAX`
  * 
@@ -203,6 +550,32 @@ typedef struct shr
 int shr_create(shr_key_t *restrict, size_t, size_t, mode_t)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
 
+/**
+ * Variant of `shr_create` that also selects
+ * the features of the shared ring buffer
+ * 
+ * Undefined behaviour will be invoked if
+ * `SHR_RING_SIZE(buffer_size, flags, buffer_count) > SIZE_MAX`,
+ * if `buffer_count == 0` or if `(permissions & ~(S_IRWXU | S_IRWXG | S_IRWXO))`,
+ * or if `buffer_count > SHORT_MAX`
+ * 
+ * @param   key           Output parameter for the key, must not be `NULL`
+ * @param   buffer_size   The size of each buffer, in bytes
+ * @param   buffer_count  The number of buffers, most be positive, 3 is recommended
+ * @param   permissions   The permissions of the shared ring buffer,
+ *                        any access for a user means full access
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL        `flags` contains an unsupported flag, or both
+ *                        `SHR_OVERWRITE` and `SHR_LATEST`
+ * @throws  The errors EINVAL, ENOMEM, ENOSPC, as specified for shmget(3) and semget(3)
+ * @throws  Any error specified for shmat(3), semctl(3) and malloc(3)
+ */
+int shr_create_flags(shr_key_t *restrict, size_t, size_t, mode_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
 /**
  * Remove a shared ring buffer
  * 
@@ -238,23 +611,64 @@ void shr_remove_by_key(const shr_key_t *restrict)
  *                     key before passing it to this function, to create and open a
  *                     private shared ring buffer
  * @param   direction  Whether the shared ring buffer should be opened
- *                     for reading or writting, only one is allowed
+ *                     for reading or writting, only one is allowed,
+ *                     or `SHR_OBSERVE` to open it as an observer
  * @return             Zero on success, -1 on error; on error,
  *                     `errno` will be set to describe the error
  * 
+ * @throws  EINVAL  The shared memory is not a shared ring buffer, or
+ *                  its geometry or flags does not match the key
+ * @throws  EINVAL  `direction` is `SHR_OBSERVE`, and the shared ring buffer
+ *                  is private, or it has neither of the flags `SHR_OBSERVABLE`,
+ *                  `SHR_OVERWRITE` and `SHR_LATEST`
  * @throws  Any error specified for shmget(3), shmat(3) and semget(3) except EINTR
  * @throws  Any error semctl(3) and malloc(3) if creating a private shared ring buffer
  */
 int shr_open(shr_t *restrict, const shr_key_t *restrict, shr_direction_t)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
 
+/**
+ * Create and open the write end of a local shared ring buffer,
+ * use `shr_reverse_dup` to get the read end
+ * 
+ * A local shared ring buffer can only be used between threads
+ * in the same process; it does not use any XSI IPC objects,
+ * instead it is synchronised with atomic operations, and the
+ * threads only call futex(2) when they have to sleep or wake
+ * the other end
+ * 
+ * `shr_remove` releases the memory if it was allocated by this
+ * function, `shr_chown`, `shr_chmod` and `shr_stat` fail with
+ * EINVAL, and the key of the shared ring buffer is meaningless
+ * 
+ * Undefined behaviour will be invoked if
+ * `SHR_RING_SIZE(buffer_size, flags, buffer_count) > SIZE_MAX`
+ * 
+ * @param   shr           Output parameter for the shared ring buffer, must not be `NULL`
+ * @param   memory        Memory of at least `SHR_RING_SIZE(buffer_size, flags, buffer_count)`
+ *                        bytes, aligned to 64 bytes, for the shared ring buffer, or `NULL`
+ *                        to allocate it
+ * @param   buffer_size   The size of each buffer, in bytes
+ * @param   buffer_count  The number of buffers, most be positive
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `buffer_count` is 0, or `flags` contains an unsupported
+ *                  flag, or both `SHR_OVERWRITE` and `SHR_LATEST`
+ * @throws  ENOMEM  `memory` is `NULL` and the memory could not be allocated
+ */
+int shr_open_local(shr_t *restrict, void *, size_t, size_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
 /**
  * Duplicate a sharing ring buffer but reverse the direction,
  * so that you get an instance for writting if you already
  * have one for reading, or vice versa
  * 
  * This is only useful if you have used `shr_open` to
- * create a private shared ring buffer
+ * create a private shared ring buffer, or `shr_open_local`
+ * to create a local shared ring buffer
  * 
  * This function will reopen the shared ring buffer, thus,
  * according to `shr_open`, the behaviour is unspecified if
@@ -268,6 +682,7 @@ int shr_open(shr_t *restrict, const shr_key_t *restrict, shr_direction_t)
  * @return       Zero on success, -1 on error; on error,
  *               `errno` will be set to describe the error
  * 
+ * @throws  EINVAL  `shr` is an observer
  * @throws  Any error specified for shmat(3)
  */
 int shr_reverse_dup(const shr_t *restrict, shr_t *restrict)
@@ -328,6 +743,91 @@ int shr_chmod(const shr_t *restrict, mode_t)
 int shr_stat(const shr_t *restrict, uid_t *restrict, gid_t *restrict, mode_t *restrict)
 	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
 
+/**
+ * Get the amount of memory a shared ring buffer
+ * uses, and how much of it is resident
+ * 
+ * @param   shr       The shared ring buffer, must not be `NULL`
+ * @param   resident  Output parameter for the number of bytes that
+ *                    are resident in memory, ignored if `NULL`
+ * @param   total     Output parameter for the size of the shared
+ *                    ring buffer, in bytes, ignored if `NULL`
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for mincore(2)
+ */
+int shr_stat_memory(const shr_t *restrict, size_t *restrict, size_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Release the memory of the buffers of a shared ring buffer with
+ * the flag `SHR_ELASTIC` that are free for writing and have not
+ * been published for a period of time
+ * 
+ * Only whole pages in a buffer are released, the metadata of the
+ * buffers is kept; a released buffer is faulted back in, zeroed,
+ * when it is written again
+ * 
+ * The buffers that are free for writing are temporarily acquired,
+ * so this function must not be called between `shr_write` and
+ * `shr_write_done`, and undefined behaviour is invoked if it is
+ * called concurrently with any other function on the write end
+ * 
+ * @param   shr   The write end of the shared ring buffer, must not be `NULL`
+ * @param   idle  The time, relative, a buffer must have been unused to
+ *                be released, `NULL` to release all free buffers
+ * @return        The number of released buffers, -1 on error; on
+ *                error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_ELASTIC`,
+ *                  or it has the flag `SHR_OVERWRITE` or `SHR_LATEST`, or
+ *                  `shr` is not the write end
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for madvise(2)
+ */
+ssize_t shr_trim(shr_t *restrict, const struct timespec *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Select the time to live of the buffers the write end of a shared
+ * ring buffer with the flag `SHR_DEADLINE` publishes from now on
+ * 
+ * The deadline of a buffer is set when it is published,
+ * to the current time plus the time to live
+ * 
+ * @param   shr  The write end of the shared ring buffer, must not be `NULL`
+ * @param   ttl  The time to live, relative, `NULL` or zero for no deadline
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_DEADLINE`
+ */
+int shr_set_ttl(shr_t *restrict, const struct timespec *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1))));
+
+/**
+ * Skip, and mark as fully read, all readable buffers of a shared
+ * ring buffer with the flag `SHR_DEADLINE`, up to the first buffer
+ * whose deadline has not passed, and add them to `SHR_SKIPPED(shr)`
+ * 
+ * Buffers without a deadline, and empty buffers, are never
+ * stale; the function never waits
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr  The read end of the shared ring buffer, must not be `NULL`
+ * @return       The number of skipped buffers, -1 on error; on
+ *               error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_DEADLINE`,
+ *                  or it has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+ssize_t shr_skip_stale(shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
 
 /**
  * Convert a shared ring buffer key to a string
@@ -378,6 +878,14 @@ void shr_str_to_key(const char *restrict, shr_key_t *restrict)
  *                  `errno` will be set to describe the error
  * 
  * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, `*buffer`
+ *                   and `*length` are set and the buffer must be released with
+ *                   `shr_read_done` as usual
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE`, and the
+ *                   writer has overwritten the current buffer before it was read;
+ *                   the reader has skipped to the newest buffer, and `SHR_LOST(shr)`
+ *                   has been increased by the number of skipped buffers
  */
 int shr_read(shr_t *restrict, const char **restrict, size_t *restrict)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
@@ -397,6 +905,14 @@ int shr_read(shr_t *restrict, const char **restrict, size_t *restrict)
  * 
  * @throws  The errors EACCES, EAGAIN, EIDRM, EINTR and EINVAL,
  *          as specified for semop(3)
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, `*buffer`
+ *                   and `*length` are set and the buffer must be released with
+ *                   `shr_read_done` as usual
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE`, and the
+ *                   writer has overwritten the current buffer before it was read;
+ *                   the reader has skipped to the newest buffer, and `SHR_LOST(shr)`
+ *                   has been increased by the number of skipped buffers
  */
 int shr_read_try(shr_t *restrict, const char **restrict, size_t *restrict)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
@@ -417,6 +933,14 @@ int shr_read_try(shr_t *restrict, const char **restrict, size_t *restrict)
  * 
  * @throws  The errors EACCES, EAGAIN, EFAULT, EIDRM, EINTR and EINVAL,
  *          as specified for semtimedop(3)
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, `*buffer`
+ *                   and `*length` are set and the buffer must be released with
+ *                   `shr_read_done` as usual
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE`, and the
+ *                   writer has overwritten the current buffer before it was read;
+ *                   the reader has skipped to the newest buffer, and `SHR_LOST(shr)`
+ *                   has been increased by the number of skipped buffers
  */
 int shr_read_timed(shr_t *restrict, const char **restrict, size_t *restrict, const struct timespec *)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
@@ -434,6 +958,9 @@ int shr_read_timed(shr_t *restrict, const char **restrict, size_t *restrict, con
  *               error, `errno` will be set to describe the error
  * 
  * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  ESTALE  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`,
+ *                  and the buffer was overwritten while it was read, the data
+ *                  that was read must be discarded
  */
 int shr_read_done(shr_t *restrict)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
@@ -518,7 +1045,407 @@ int shr_write_timed(shr_t *restrict, char **restrict, const struct timespec *)
 int shr_write_done(shr_t *restrict, size_t)
 	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
 
+/**
+ * Give back the, by `shr_write`, `shr_write_try` or `shr_write_timed`,
+ * retrieved buffer without publishing it, the next call to any of
+ * those functions will retrieve the same buffer
+ * 
+ * If the shared ring buffer has the flag `SHR_OVERWRITE`, `SHR_LATEST`
+ * or `SHR_OBSERVABLE`, the buffer may have been modified, so readers
+ * and observers will consider the data it held before lost, unless it
+ * has not held any data; with only one buffer, readers will not get
+ * any data until the next buffer is published
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr  The shared ring buffer, must not be `NULL`
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ */
+int shr_write_cancel(shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
 
 
-#endif
+/**
+ * Fill buffers of a shared ring buffer with data read from a file,
+ * with a single read, and publish them atomically
+ * 
+ * The current buffer is waited for, the following buffers
+ * are used only if they are immediately available
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The file descriptor to read from
+ * @param   max_buffers  The maximum number of buffers to fill
+ * @return               The number of read bytes, 0 at end of file, in
+ *                       which case an empty buffer is published, -1 on
+ *                       error; on error, `errno` will be set to describe
+ *                       the error
+ * 
+ * @throws  EINVAL  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for readv(3)
+ */
+ssize_t shr_pump_in(shr_t *restrict, int, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Write the data in as many readable buffers of a shared ring buffer
+ * as are available, with a single write if possible, and mark them
+ * as fully read
+ * 
+ * An empty buffer is only taken if it is the current buffer,
+ * so that 0 is returned when end of file has been reached
+ * 
+ * The current buffer is waited for, the following buffers
+ * are used only if they are immediately available
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The file descriptor to write to
+ * @param   max_buffers  The maximum number of buffers to write
+ * @param   closed       Output parameter for whether the write end has
+ *                       closed and all data has been read, ignored if `NULL`
+ * @return               The number of written bytes, -1 on error; on
+ *                       error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and
+ *                   the checksum of the current buffer does not match its
+ *                   content, the buffer is discarded
+ * @throws  EINVAL   The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for writev(3)
+ */
+ssize_t shr_pump_out(shr_t *restrict, int, size_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Receive datagrams directly into as many writable buffers of
+ * a shared ring buffer as are available, with a single recvmmsg,
+ * one datagram per buffer, and publish them atomically
+ * 
+ * If the shared ring buffer has the flag `SHR_ADDRESS`, the
+ * source address of each datagram is stored with its buffer
+ * 
+ * The current buffer is waited for, the following buffers
+ * are used only if they are immediately available; the call
+ * blocks until at least one datagram has been received,
+ * unless `MSG_DONTWAIT` is in `flags` or the socket is
+ * non-blocking
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The socket to receive from
+ * @param   max_buffers  The maximum number of datagrams to receive
+ * @param   flags        Flags for recvmmsg(2), `MSG_WAITFORONE` is always added
+ * @return               The number of received datagrams, -1 on error; on
+ *                       error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for recvmmsg(2)
+ */
+ssize_t shr_dgram_in(shr_t *restrict, int, size_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
 
+/**
+ * Send the data in as many readable buffers of a shared ring buffer
+ * as are available, one datagram per buffer, with a single sendmmsg
+ * if possible, and mark them as fully read
+ * 
+ * If the shared ring buffer has the flag `SHR_ADDRESS`, each
+ * datagram is sent to the address stored with its buffer,
+ * unless no address was stored, in which case the socket
+ * must be connected
+ * 
+ * An empty buffer is only taken if it is the current buffer, it
+ * is not sent, and marks the end of the stream, so that 0 is
+ * returned when the end of the stream has been reached
+ * 
+ * The current buffer is waited for, the following buffers
+ * are used only if they are immediately available
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, must not be `NULL`
+ * @param   fd           The socket to send to
+ * @param   max_buffers  The maximum number of datagrams to send
+ * @param   closed       Output parameter for whether the write end has
+ *                       closed and all data has been read, ignored if `NULL`
+ * @return               The number of sent datagrams, -1 on error; on
+ *                       error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and
+ *                   the checksum of the current buffer does not match its
+ *                   content, the buffer is discarded
+ * @throws  EINVAL   The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for sendmmsg(2)
+ */
+ssize_t shr_dgram_out(shr_t *restrict, int, size_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Store a socket address with the buffer that has been
+ * acquired with `shr_write`, `shr_write_try` or `shr_write_timed`
+ * 
+ * The address is not cleared when the buffer is reused, so
+ * a writer that stores addresses should store one with every
+ * buffer, a `NULL` address stores the absence of an address
+ * 
+ * @param   shr      The shared ring buffer, must not be `NULL`
+ * @param   address  The address, `NULL` to store no address
+ * @param   length   The length of `address`
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_ADDRESS`
+ * @throws  EINVAL  `length` is greater than `SHR_ADDRESS_MAX`
+ */
+int shr_write_address(shr_t *restrict, const struct sockaddr *restrict, socklen_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1))));
+
+/**
+ * Get the socket address stored with the buffer that has
+ * been acquired with `shr_read`, `shr_read_try` or `shr_read_timed`
+ * 
+ * @param   shr      The shared ring buffer, must not be `NULL`
+ * @param   address  Output buffer for the address, it is truncated if it
+ *                   is too small, may be `NULL` if `*length` is 0
+ * @param   length   The size of `address`, updated to the length of the
+ *                   address, which is 0 if no address was stored
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_ADDRESS`
+ */
+int shr_read_address(const shr_t *restrict, struct sockaddr *restrict, socklen_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 3))));
+
+/**
+ * Store a tag with the buffer that has been acquired with
+ * `shr_write`, `shr_write_try` or `shr_write_timed`
+ * 
+ * The tag is not cleared when the buffer is reused, so it
+ * should be stored with every buffer that is published
+ * 
+ * @param   shr  The shared ring buffer, must not be `NULL`
+ * @param   tag  The tag
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_TAGGED`
+ */
+int shr_write_tag(shr_t *restrict, uint64_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Get the tag stored with the buffer that has been acquired
+ * with `shr_read`, `shr_read_try` or `shr_read_timed`
+ * 
+ * @param   shr  The shared ring buffer, must not be `NULL`
+ * @param   tag  Output parameter for the tag, must not be `NULL`
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer does not have the flag `SHR_TAGGED`
+ */
+int shr_read_tag(const shr_t *restrict, uint64_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+
+/**
+ * Wait for a buffer in a shared ring buffer to be ready
+ * for writing, copy data into it, and publish it
+ * 
+ * Large copies use non-temporal stores, if supported by
+ * the CPU, so that the data, which the writer will not
+ * read again, does not evict the writer's cache
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   data    The data to write, must not be `NULL` unless `length` is 0
+ * @param   length  The number of bytes to write
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EMSGSIZE  `length` is greater than `SHR_BUFFER_SIZE(shr)`
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+int shr_write_copy(shr_t *restrict, const void *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Wait for enough consecutive buffers in a shared ring buffer to be
+ * ready for writing, gather pieces of data into them, and publish
+ * the buffers atomically
+ * 
+ * The data is split over as few buffers as possible, each
+ * buffer but the last is filled completely; the reader either
+ * sees all of the buffers or none of them, but receives them
+ * as separate buffers, so the data should carry its own
+ * framing, such as a length in the first piece
+ * 
+ * Large copies use non-temporal stores, if supported by the CPU
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   iov     The pieces of data, must not be `NULL` unless `iovcnt` is 0
+ * @param   iovcnt  The number of elements in `iov`
+ * @return          The number of bytes written, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL    `iovcnt` is negative or greater than `IOV_MAX`, the
+ *                    total length overflows `ssize_t`, or the shared ring
+ *                    buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  EMSGSIZE  The data needs more buffers than the shared ring
+ *                    buffer has, or more than 64 buffers
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+ssize_t shr_writev(shr_t *restrict, const struct iovec *restrict, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Like `shr_writev`, but fail with EAGAIN instead of
+ * waiting if the buffers are not ready for writing
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   iov     The pieces of data, must not be `NULL` unless `iovcnt` is 0
+ * @param   iovcnt  The number of elements in `iov`
+ * @return          The number of bytes written, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  The buffers were not ready for writing
+ * @throws  Any error specified for `shr_writev`
+ */
+ssize_t shr_writev_try(shr_t *restrict, const struct iovec *restrict, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Wait for a buffer in a shared ring buffer to be filled with
+ * readable data, copy the data out of it, and mark it as fully read
+ * 
+ * The beginning of the next buffer is prefetched, so that
+ * it is likely to be cached by the next call
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   data    Output buffer for the data, must not be `NULL` unless `size` is 0
+ * @param   size    The size of `data`, if the data is longer, it is truncated
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been read, ignored if `NULL`
+ * @return          The length of the data in the buffer, which may be greater
+ *                  than `size`, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and the
+ *                   checksum of the buffer does not match its content, the data
+ *                   is copied and the buffer is discarded
+ * @throws  ESTALE   The shared ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`,
+ *                   and the writer overwrote the buffer before or while it was copied
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+ssize_t shr_read_copy(shr_t *restrict, void *restrict, size_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Copy the data out of the next buffer the writer of a shared
+ * ring buffer publishes, without taking part in the flow control
+ * 
+ * The observer follows the writer on a best-effort basis: the
+ * writer does not wait for it, and does not wake it, so until
+ * a new buffer has been published, the observer polls with
+ * exponential backoff; the data is copied, and the sequence
+ * number of the buffer checked again, so a buffer the writer
+ * reused while it was copied is never returned. Buffers the
+ * writer reused before they were copied are counted in
+ * `SHR_LOST(shr)` and skipped
+ * 
+ * @param   shr     The observer, opened with `SHR_OBSERVE`, must not be `NULL`
+ * @param   data    Output buffer for the data, must not be `NULL` unless `size` is 0
+ * @param   size    The size of `data`, if the data is longer, it is truncated
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been observed, ignored if `NULL`
+ * @return          The length of the data in the buffer, which may be greater
+ *                  than `size`, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EINVAL  `shr` was not opened with `SHR_OBSERVE`
+ * @throws  EPIPE   The write end has closed, and all data has been observed
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+ssize_t shr_observe(shr_t *restrict, void *restrict, size_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Variant of `shr_observe` that fails
+ * if no new buffer has been published
+ * 
+ * @param   shr     The observer, opened with `SHR_OBSERVE`, must not be `NULL`
+ * @param   data    Output buffer for the data, must not be `NULL` unless `size` is 0
+ * @param   size    The size of `data`, if the data is longer, it is truncated
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been observed, ignored if `NULL`
+ * @return          The length of the data in the buffer, which may be greater
+ *                  than `size`, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EAGAIN  No new buffer has been published
+ * @throws  EINVAL  `shr` was not opened with `SHR_OBSERVE`
+ * @throws  EPIPE   The write end has closed, and all data has been observed
+ */
+ssize_t shr_observe_try(shr_t *restrict, void *restrict, size_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+
+/**
+ * Read from a set of shared ring buffers, with a pool of worker threads,
+ * until all of them have been closed and all data has been read
+ * 
+ * Each worker owns a subset of the shared ring buffers, and when none
+ * of them has readable data, it steals buffers from the other workers'
+ * shared ring buffers. Each shared ring buffer is only read by one
+ * worker at a time, so the buffers in a shared ring buffer are processed
+ * in order, but buffers from different shared ring buffers are processed
+ * concurrently
+ * 
+ * The shared ring buffers must not be used by any other thread
+ * until this function returns
+ * 
+ * @param   rings       The read ends of the shared ring buffers, must not be `NULL`
+ * @param   ring_count  The number of shared ring buffers
+ * @param   threads     The number of worker threads, 0 for one per
+ *                      CPU the process may run on
+ * @param   flags       Bitwise-OR of `enum shr_pool_flags` values
+ * @param   handler     Function that processes a buffer, must not be `NULL`
+ * @param   user        The first argument for `handler`
+ * @return              Zero on success, -1 on error; on error,
+ *                      `errno` will be set to describe the error
+ * 
+ * @throws  Any error returned by `handler`
+ * @throws  Any error specified for `shr_read_try` except EAGAIN, and
+ *          for `shr_read_done`
+ * @throws  Any error specified for malloc(3) and pthread_create(3)
+ */
+int shr_pool_run(shr_t *restrict, size_t, size_t, int, shr_pool_handler_t *, void *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 5), warn_unused_result)));
+
+
+
+#endif
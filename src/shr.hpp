@@ -0,0 +1,753 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_HPP
+#define SHR_HPP
+
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#pragma push_macro("restrict")
+#undef restrict
+#define restrict __restrict__
+extern "C" {
+#include "shr.h"
+}
+#pragma pop_macro("restrict")
+
+#include <sys/sem.h>
+
+
+
+namespace libshr {
+
+
+/**
+ * Throw an exception describing `errno`
+ * 
+ * @param  what  The name of the failed function
+ */
+[[noreturn]] inline void
+throw_errno(const char *what)
+{
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+
+/**
+ * Add a value to a semaphore in the semaphore array
+ * of a shared ring buffer
+ * 
+ * @param   sem    The ID of the semaphore array
+ * @param   index  The index of the semaphore
+ * @param   value  The value to add
+ * @param   flags  `IPC_NOWAIT` or zero
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ */
+inline int
+semop_(int sem, std::size_t index, short value, short flags) noexcept
+{
+	struct sembuf op;
+	op.sem_num = static_cast<unsigned short>(index);
+	op.sem_op = value;
+	op.sem_flg = flags;
+	return ::semop(sem, &op, 1);
+}
+
+
+/**
+ * Create a shared ring buffer
+ * 
+ * @param   buffer_size   The size of each buffer, in bytes
+ * @param   buffer_count  The number of buffers, most be positive
+ * @param   permissions   The permissions of the shared ring buffer
+ * @return                The key of the shared ring buffer
+ * 
+ * @throws  std::system_error  On failure, see shr_create(3)
+ */
+inline shr_key_t
+create(std::size_t buffer_size, std::size_t buffer_count, mode_t permissions = 0600)
+{
+	shr_key_t key;
+	if (shr_create(&key, buffer_size, buffer_count, permissions))
+		throw_errno("shr_create");
+	return key;
+}
+
+
+/**
+ * Create a pseudo-key that makes `ring` create
+ * a private shared ring buffer
+ * 
+ * @param   buffer_size   The size of each buffer, in bytes
+ * @param   buffer_count  The number of buffers, most be positive
+ * @return                The pseudo-key
+ */
+inline shr_key_t
+private_key(std::size_t buffer_size, std::size_t buffer_count) noexcept
+{
+	shr_key_t key;
+	SHR_PRIVATE(&key, buffer_size, buffer_count);
+	return key;
+}
+
+
+/**
+ * Convert a shared ring buffer key to a string
+ * 
+ * @param   key  The key of the shared ring buffer
+ * @return       The string representation of the key
+ */
+inline std::string
+to_string(const shr_key_t &key)
+{
+	char str[SHR_KEY_STR_MAX];
+	shr_key_to_str(&key, str);
+	return str;
+}
+
+
+/**
+ * Convert a string to a shared ring buffer key
+ * 
+ * @param   str  The string representation of the key
+ * @return       The key of the shared ring buffer
+ */
+inline shr_key_t
+key_from_string(const std::string &str)
+{
+	shr_key_t key;
+	shr_str_to_key(str.c_str(), &key);
+	return key;
+}
+
+
+class ring;
+
+
+/**
+ * A buffer that has been retrieved for reading, the
+ * buffer is marked as fully read when the guard is
+ * destroyed, unless it has already been released
+ */
+class read_guard
+{
+public:
+	read_guard(ring &r, const char *buffer, std::size_t length) noexcept
+		: r_(&r), buffer_(buffer), length_(length) {}
+
+	read_guard(read_guard &&other) noexcept
+		: r_(std::exchange(other.r_, nullptr)), buffer_(other.buffer_), length_(other.length_) {}
+
+	read_guard(const read_guard &) = delete;
+	read_guard &operator=(const read_guard &) = delete;
+	read_guard &operator=(read_guard &&) = delete;
+
+	~read_guard();
+
+	/**
+	 * Get the data in the buffer
+	 * 
+	 * @return  The data in the buffer
+	 */
+	std::span<const std::byte>
+	data() const noexcept
+	{
+		return {reinterpret_cast<const std::byte *>(buffer_), length_};
+	}
+
+	/**
+	 * Mark the buffer as fully read
+	 * 
+	 * @return  Whether the write end has closed
+	 *          and all data has been read
+	 * 
+	 * @throws  std::system_error  On failure, see shr_read_done(3)
+	 */
+	bool release();
+
+private:
+	ring *r_;
+	const char *buffer_;
+	std::size_t length_;
+};
+
+
+/**
+ * A buffer that has been retrieved for writing, if the
+ * guard is destroyed before it is committed, the buffer
+ * is given back unpublished
+ */
+class write_guard
+{
+public:
+	write_guard(ring &r, char *buffer, std::size_t size) noexcept
+		: r_(&r), buffer_(buffer), size_(size) {}
+
+	write_guard(write_guard &&other) noexcept
+		: r_(std::exchange(other.r_, nullptr)), buffer_(other.buffer_), size_(other.size_) {}
+
+	write_guard(const write_guard &) = delete;
+	write_guard &operator=(const write_guard &) = delete;
+	write_guard &operator=(write_guard &&) = delete;
+
+	~write_guard();
+
+	/**
+	 * Get the buffer to write the data to
+	 * 
+	 * @return  The buffer, its size is the buffer size
+	 *          of the shared ring buffer
+	 */
+	std::span<std::byte>
+	data() const noexcept
+	{
+		return {reinterpret_cast<std::byte *>(buffer_), size_};
+	}
+
+	/**
+	 * Publish the buffer
+	 * 
+	 * @param  length  The number of written bytes
+	 * 
+	 * @throws  std::system_error  On failure, see shr_write_done(3)
+	 */
+	void commit(std::size_t length);
+
+private:
+	ring *r_;
+	char *buffer_;
+	std::size_t size_;
+};
+
+
+/**
+ * An opened shared ring buffer, it is closed
+ * when the object is destroyed
+ */
+class ring
+{
+public:
+	ring() noexcept
+	{
+		shr_.address = nullptr;
+		shr_.shm = shr_.sem = -1;
+	}
+
+	/**
+	 * Open a shared ring buffer
+	 * 
+	 * @param  key        The key of the shared ring buffer
+	 * @param  direction  `SHR_READ` or `SHR_WRITE`
+	 * 
+	 * @throws  std::system_error  On failure, see shr_open(3)
+	 */
+	ring(const shr_key_t &key, shr_direction_t direction)
+	{
+		if (shr_open(&shr_, &key, direction))
+			throw_errno("shr_open");
+	}
+
+	/**
+	 * Create and open the write end of a local shared ring buffer,
+	 * use `reverse_dup` to get the read end
+	 * 
+	 * @param   buffer_size   The size of each buffer, in bytes
+	 * @param   buffer_count  The number of buffers
+	 * @param   flags         Bitwise-OR of `enum shr_flags` values
+	 * @param   memory        Memory for the shared ring buffer, see
+	 *                        shr_open_local(3), or `nullptr` to allocate it
+	 * @return                The write end of the shared ring buffer
+	 * 
+	 * @throws  std::system_error  On failure, see shr_open_local(3)
+	 */
+	static ring
+	local(std::size_t buffer_size, std::size_t buffer_count, int flags = 0, void *memory = nullptr)
+	{
+		ring r;
+		if (shr_open_local(&r.shr_, memory, buffer_size, buffer_count, flags))
+			throw_errno("shr_open_local");
+		return r;
+	}
+
+	ring(ring &&other) noexcept
+		: shr_(other.shr_)
+	{
+		other.shr_.address = nullptr;
+		other.shr_.shm = other.shr_.sem = -1;
+	}
+
+	ring &
+	operator=(ring &&other) noexcept
+	{
+		if (this != &other) {
+			shr_close(&shr_);
+			shr_ = other.shr_;
+			other.shr_.address = nullptr;
+			other.shr_.shm = other.shr_.sem = -1;
+		}
+		return *this;
+	}
+
+	ring(const ring &) = delete;
+	ring &operator=(const ring &) = delete;
+
+	~ring()
+	{
+		shr_close(&shr_);
+	}
+
+	/**
+	 * Open the shared ring buffer for the other direction
+	 * 
+	 * @return  The shared ring buffer opened in the reverse direction
+	 * 
+	 * @throws  std::system_error  On failure, see shr_reverse_dup(3)
+	 */
+	ring
+	reverse_dup() const
+	{
+		ring r;
+		if (shr_reverse_dup(&shr_, &r.shr_))
+			throw_errno("shr_reverse_dup");
+		return r;
+	}
+
+	/**
+	 * Close and remove the shared ring buffer
+	 */
+	void
+	remove() noexcept
+	{
+		shr_remove(&shr_);
+		shr_.address = nullptr;
+		shr_.shm = shr_.sem = -1;
+	}
+
+	shr_t &native() noexcept { return shr_; }
+	const shr_t &native() const noexcept { return shr_; }
+	const shr_key_t &key() const noexcept { return shr_.key; }
+	std::size_t buffer_size() const noexcept { return SHR_BUFFER_SIZE(&shr_); }
+	std::size_t buffer_count() const noexcept { return SHR_BUFFER_COUNT(&shr_); }
+	explicit operator bool() const noexcept { return shr_.address != nullptr; }
+
+	/**
+	 * Wait for readable data
+	 * 
+	 * @throws  std::system_error  On failure, see shr_read(3); on EBADMSG,
+	 *                             the corrupt buffer has been marked as
+	 *                             fully read
+	 */
+	read_guard
+	read()
+	{
+		const char *buffer;
+		std::size_t length;
+		if (shr_read(&shr_, &buffer, &length))
+			throw_read_("shr_read");
+		return {*this, buffer, length};
+	}
+
+	/**
+	 * Get readable data, if there is any
+	 * 
+	 * @throws  std::system_error  On failure, other than EAGAIN, see shr_read_try(3);
+	 *                             on EBADMSG, the corrupt buffer has been
+	 *                             marked as fully read
+	 */
+	std::optional<read_guard>
+	try_read()
+	{
+		const char *buffer;
+		std::size_t length;
+		if (shr_read_try(&shr_, &buffer, &length)) {
+			if (errno == EAGAIN)
+				return std::nullopt;
+			throw_read_("shr_read_try");
+		}
+		return std::optional<read_guard>(std::in_place, *this, buffer, length);
+	}
+
+	/**
+	 * Wait, for a limited time, for readable data
+	 * 
+	 * @param  timeout  The time limit, relative to now
+	 * 
+	 * @throws  std::system_error  On failure, other than EAGAIN, see shr_read_timed(3);
+	 *                             on EBADMSG, the corrupt buffer has been
+	 *                             marked as fully read
+	 */
+	std::optional<read_guard>
+	read_for(const struct timespec &timeout)
+	{
+		const char *buffer;
+		std::size_t length;
+		if (shr_read_timed(&shr_, &buffer, &length, &timeout)) {
+			if (errno == EAGAIN)
+				return std::nullopt;
+			throw_read_("shr_read_timed");
+		}
+		return std::optional<read_guard>(std::in_place, *this, buffer, length);
+	}
+
+	/**
+	 * Wait for a writable buffer
+	 * 
+	 * @throws  std::system_error  On failure, see shr_write(3)
+	 */
+	write_guard
+	write()
+	{
+		char *buffer;
+		if (shr_write(&shr_, &buffer))
+			throw_errno("shr_write");
+		return {*this, buffer, buffer_size()};
+	}
+
+	/**
+	 * Get a writable buffer, if there is any
+	 * 
+	 * @throws  std::system_error  On failure, other than EAGAIN, see shr_write_try(3)
+	 */
+	std::optional<write_guard>
+	try_write()
+	{
+		char *buffer;
+		if (shr_write_try(&shr_, &buffer)) {
+			if (errno == EAGAIN)
+				return std::nullopt;
+			throw_errno("shr_write_try");
+		}
+		return std::optional<write_guard>(std::in_place, *this, buffer, buffer_size());
+	}
+
+	/**
+	 * Wait, for a limited time, for a writable buffer
+	 * 
+	 * @param  timeout  The time limit, relative to now
+	 * 
+	 * @throws  std::system_error  On failure, other than EAGAIN, see shr_write_timed(3)
+	 */
+	std::optional<write_guard>
+	write_for(const struct timespec &timeout)
+	{
+		char *buffer;
+		if (shr_write_timed(&shr_, &buffer, &timeout)) {
+			if (errno == EAGAIN)
+				return std::nullopt;
+			throw_errno("shr_write_timed");
+		}
+		return std::optional<write_guard>(std::in_place, *this, buffer, buffer_size());
+	}
+
+	/**
+	 * Give back the current buffer, that has been retrieved
+	 * for writing, without publishing it
+	 */
+	void
+	abandon_write() noexcept
+	{
+		shr_write_cancel(&shr_);
+	}
+
+protected:
+	shr_t shr_;
+
+private:
+	/**
+	 * Throw an exception describing `errno` after a failed read,
+	 * a buffer that failed its checksum has been retrieved, and
+	 * is marked as fully read so that the ring is not stuck on it
+	 * 
+	 * @param  what  The name of the failed function
+	 */
+	[[noreturn]] void
+	throw_read_(const char *what)
+	{
+		int saved_errno = errno;
+		if (saved_errno == EBADMSG)
+			while (shr_read_done(&shr_) < 0 && errno == EINTR);
+		errno = saved_errno;
+		throw_errno(what);
+	}
+};
+
+
+inline
+read_guard::~read_guard()
+{
+	if (r_)
+		while (shr_read_done(&r_->native()) < 0 && errno == EINTR);
+}
+
+inline bool
+read_guard::release()
+{
+	int r = shr_read_done(&r_->native());
+	if (r < 0)
+		throw_errno("shr_read_done");
+	r_ = nullptr;
+	return r;
+}
+
+inline
+write_guard::~write_guard()
+{
+	if (r_)
+		r_->abandon_write();
+}
+
+inline void
+write_guard::commit(std::size_t length)
+{
+	if (shr_write_done(&r_->native(), length))
+		throw_errno("shr_write_done");
+	r_ = nullptr;
+}
+
+
+/**
+ * A shared ring buffer of objects of a trivially
+ * copyable type and a geometry known at compile time
+ * 
+ * @tparam  T         The type of the objects
+ * @tparam  N         The number of buffers
+ * @tparam  SlotSize  The size of each buffer
+ */
+template <typename T, std::size_t N, std::size_t SlotSize = sizeof(T)>
+class typed_ring : private ring
+{
+	static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+	static_assert(sizeof(T) <= SlotSize, "T does not fit in a buffer");
+	static_assert(N > 0, "the buffer count must be positive");
+
+public:
+	static constexpr std::size_t buffer_size = SlotSize;
+	static constexpr std::size_t buffer_count = N;
+
+	/**
+	 * Create a shared ring buffer with matching geometry
+	 * 
+	 * @param   permissions  The permissions of the shared ring buffer
+	 * @return               The key of the shared ring buffer
+	 * 
+	 * @throws  std::system_error  On failure, see shr_create(3)
+	 */
+	static shr_key_t
+	create(mode_t permissions = 0600)
+	{
+		return libshr::create(SlotSize, N, permissions);
+	}
+
+	/**
+	 * Create a pseudo-key, with matching geometry, for
+	 * creating a private shared ring buffer
+	 */
+	static shr_key_t
+	private_key() noexcept
+	{
+		return libshr::private_key(SlotSize, N);
+	}
+
+	typed_ring() noexcept = default;
+
+	/**
+	 * Open a shared ring buffer
+	 * 
+	 * @param  key        The key of the shared ring buffer
+	 * @param  direction  `SHR_READ` or `SHR_WRITE`
+	 * 
+	 * @throws  std::system_error  On failure, see shr_open(3); EINVAL if the
+	 *                             geometry of the key does not match, or
+	 *                             if the key has any flags
+	 */
+	typed_ring(const shr_key_t &key, shr_direction_t direction)
+		: ring(check_(key), direction) {}
+
+	typed_ring(typed_ring &&) noexcept = default;
+	typed_ring &operator=(typed_ring &&) noexcept = default;
+
+	using ring::native;
+	using ring::key;
+	using ring::remove;
+	using ring::operator bool;
+
+	typed_ring
+	reverse_dup() const
+	{
+		typed_ring r;
+		static_cast<ring &>(r) = ring::reverse_dup();
+		return r;
+	}
+
+	/**
+	 * Whether the write end has closed and all data has been read
+	 */
+	bool eof() const noexcept { return eof_; }
+
+	/**
+	 * Wait for a free buffer and publish an object in it
+	 * 
+	 * @param  value  The object
+	 * 
+	 * @throws  std::system_error  On failure, see shr_write(3)
+	 */
+	void
+	push(const T &value)
+	{
+		if (semop_(shr_.sem, write_sem_(), -1, 0))
+			throw_errno("shr_write");
+		publish_(value);
+	}
+
+	/**
+	 * Publish an object if there is a free buffer
+	 * 
+	 * @param   value  The object
+	 * @return         Whether the object was published
+	 * 
+	 * @throws  std::system_error  On failure, other than EAGAIN, see shr_write_try(3)
+	 */
+	bool
+	try_push(const T &value)
+	{
+		if (semop_(shr_.sem, write_sem_(), -1, IPC_NOWAIT)) {
+			if (errno == EAGAIN)
+				return false;
+			throw_errno("shr_write_try");
+		}
+		publish_(value);
+		return true;
+	}
+
+	/**
+	 * Wait for an object and consume it
+	 * 
+	 * @return  The object
+	 * 
+	 * @throws  std::system_error  On failure, see shr_read(3)
+	 */
+	T
+	pop()
+	{
+		if (semop_(shr_.sem, read_sem_(), -1, 0))
+			throw_errno("shr_read");
+		return consume_();
+	}
+
+	/**
+	 * Consume an object, if there is any
+	 * 
+	 * @return  The object, or nothing if there was none
+	 * 
+	 * @throws  std::system_error  On failure, other than EAGAIN, see shr_read_try(3)
+	 */
+	std::optional<T>
+	try_pop()
+	{
+		if (semop_(shr_.sem, read_sem_(), -1, IPC_NOWAIT)) {
+			if (errno == EAGAIN)
+				return std::nullopt;
+			throw_errno("shr_read_try");
+		}
+		return consume_();
+	}
+
+private:
+	static constexpr std::size_t
+	offset_(std::size_t i) noexcept
+	{
+		return SHR_BUFFER_OFFSET(SlotSize, 0, i);
+	}
+
+	static constexpr std::size_t
+	length_offset_(std::size_t i) noexcept
+	{
+		return SHR_LENGTH_OFFSET(SlotSize, 0, i);
+	}
+
+	static const shr_key_t &
+	check_(const shr_key_t &key)
+	{
+		if (key.buffer_size != SlotSize || key.buffer_count != N || key.flags)
+			throw std::system_error(EINVAL, std::generic_category(), "shr::typed_ring");
+		return key;
+	}
+
+	std::size_t write_sem_() const noexcept { return 2 * shr_.current_buffer + 0; }
+	std::size_t read_sem_() const noexcept { return 2 * shr_.current_buffer + 1; }
+
+	void
+	advance_() noexcept
+	{
+		shr_.current_buffer = (shr_.current_buffer + 1) % N;
+	}
+
+	void
+	publish_(const T &value)
+	{
+		char *buffer = shr_.address + offset_(shr_.current_buffer);
+		std::size_t length = sizeof(T);
+		std::memcpy(buffer, &value, sizeof(T));
+		std::memcpy(shr_.address + length_offset_(shr_.current_buffer), &length, sizeof(length));
+		/* Only the writer stores it, so it need not be incremented atomically. */
+		auto published = reinterpret_cast<std::uint64_t *>(shr_.address + SHR_PUBLISHED_OFFSET);
+		__atomic_store_n(published, __atomic_load_n(published, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+		if (semop_(shr_.sem, read_sem_(), +1, 0))
+			throw_errno("shr_write_done");
+		advance_();
+	}
+
+	T
+	consume_()
+	{
+		T value;
+		std::memcpy(&value, shr_.address + offset_(shr_.current_buffer), sizeof(T));
+		while (semop_(shr_.sem, write_sem_(), +1, 0))
+			if (errno != EINTR)
+				throw_errno("shr_read_done");
+		advance_();
+		std::size_t closed;
+		std::memcpy(&closed, shr_.address, sizeof(closed));
+		eof_ = closed == shr_.current_buffer + 1;
+		return value;
+	}
+
+	bool eof_ = false;
+};
+
+
+}
+
+
+#endif
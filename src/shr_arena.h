@@ -0,0 +1,155 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_ARENA_H
+#define SHR_ARENA_H
+
+
+#include "shr.h"
+
+
+
+/**
+ * A set of shared ring buffers that live in one
+ * segment of XSI shared memory, as opened by a process
+ */
+typedef struct shr_arena shr_arena_t;
+
+
+/**
+ * The geometry of a shared ring buffer in an arena
+ */
+struct shr_arena_ring
+{
+	/**
+	 * The size of each buffer, in bytes
+	 */
+	size_t buffer_size;
+
+	/**
+	 * The number of buffers, must be positive
+	 */
+	size_t buffer_count;
+
+	/**
+	 * Bitwise-OR of `enum shr_flags` values
+	 */
+	int flags;
+};
+
+
+
+/**
+ * Create an arena of shared ring buffers
+ * 
+ * An arena uses a single XSI shared memory segment, and no
+ * semaphores, for all of its shared ring buffers, so creating,
+ * opening and removing it costs a few system calls no matter
+ * how many shared ring buffers it holds; the shared ring
+ * buffers are synchronised like local shared ring buffers,
+ * with atomic operations and futex(2), but may be used
+ * between processes
+ * 
+ * @param   key          Output parameter for the key of the arena, must not be `NULL`
+ * @param   rings        The geometry of each shared ring buffer, must not be `NULL`
+ * @param   count        The number of shared ring buffers, at least 1
+ * @param   permissions  The permissions for the arena
+ * @return               Zero on success, -1 on error; on error,
+ *                       `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `count` is 0, a shared ring buffer has no buffers
+ *                  or invalid flags, or the arena is too large
+ * @throws  Any error specified for shmget(3) and shmat(3)
+ */
+int shr_arena_create(key_t *restrict, const struct shr_arena_ring *restrict, size_t, mode_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Remove an arena, processes that have it
+ * open can continue to use it until they close it
+ * 
+ * @param   key  The key of the arena
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for shmget(3) and shmctl(3)
+ */
+int shr_arena_remove(key_t);
+
+/**
+ * Open an arena, this attaches every shared
+ * ring buffer in it, but opens no end of them
+ * 
+ * @param   key  The key of the arena
+ * @return       The arena, `NULL` on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared memory is not an arena
+ * @throws  Any error specified for shmget(3), shmat(3) and malloc(3)
+ */
+shr_arena_t *shr_arena_open(key_t)
+	SHR_COMPILER_GCC(__attribute__((warn_unused_result, malloc)));
+
+/**
+ * Close an arena, the shared ring buffers opened
+ * from the arena must not be used afterwards
+ * 
+ * @param  arena  The arena, nothing will happen if this is `NULL`
+ */
+void shr_arena_close(shr_arena_t *);
+
+/**
+ * Get the number of shared ring buffers in an arena
+ * 
+ * @param   arena  The arena, must not be `NULL`
+ * @return         The number of shared ring buffers
+ */
+size_t shr_arena_count(const shr_arena_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Open an end of a shared ring buffer in an arena,
+ * this does not make any system call
+ * 
+ * The shared ring buffer shall be closed with `shr_close`,
+ * which marks the end of the stream if it is the write end,
+ * before the arena is closed; `shr_remove` only closes it,
+ * and `shr_chown`, `shr_chmod` and `shr_stat` fail with
+ * EINVAL. Undefined behaviour is invoked if an end is
+ * opened more than once, and not closed in between
+ * 
+ * @param   arena      The arena, must not be `NULL`
+ * @param   i          The index of the shared ring buffer
+ * @param   direction  `SHR_READ` or `SHR_WRITE`
+ * @param   shr        Output parameter for the shared ring buffer, must not be `NULL`
+ * @return             Zero on success, -1 on error; on error,
+ *                     `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `i` is not less than the number of shared ring
+ *                  buffers, or `direction` is `SHR_OBSERVE`
+ */
+int shr_arena_ring(shr_arena_t *restrict, size_t, shr_direction_t, shr_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+
+#endif
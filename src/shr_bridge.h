@@ -0,0 +1,150 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_BRIDGE_H
+#define SHR_BRIDGE_H
+
+
+#include "shr.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * Flags for `shr_bridge_send`
+ */
+enum shr_bridge_flags
+{
+	/**
+	 * Compress each buffer, unless that does
+	 * not make it smaller, before it is sent
+	 */
+	SHR_BRIDGE_COMPRESS = 0x0001,
+
+};
+
+
+/**
+ * Metrics for one end of a bridge
+ */
+struct shr_bridge_stats
+{
+	/**
+	 * The number of buffers forwarded
+	 */
+	uint64_t buffers;
+
+	/**
+	 * The number of bytes of data forwarded
+	 */
+	uint64_t bytes;
+
+	/**
+	 * The number of bytes sent or received over the
+	 * socket, including framing and flow control
+	 */
+	uint64_t wire_bytes;
+
+	/**
+	 * The number of batches sent or received, each sent
+	 * with one call to sendmsg(3), or, for the receiving
+	 * end, the number of credit messages sent
+	 */
+	uint64_t batches;
+
+	/**
+	 * The number of times the sending end ran out
+	 * of credits and had to wait for the receiving end
+	 */
+	uint64_t stalls;
+
+	/**
+	 * The number of buffers dropped because
+	 * their checksums did not match
+	 */
+	uint64_t dropped;
+};
+
+
+
+/**
+ * Forward the data in a shared ring buffer, over a stream socket, to
+ * another shared ring buffer, filled by `shr_bridge_recv` at the other
+ * end of the socket, until an empty buffer, which marks the end of the
+ * stream and is forwarded too, has been read, or the write end has
+ * closed and all data has been forwarded
+ * 
+ * As many readable buffers as are available, and as the other end has
+ * granted credits for, are sent with each call to sendmsg(3); the other
+ * end grants one credit for each buffer it has been able to publish, so
+ * at most as many buffers as the receiving shared ring buffer has are in
+ * flight, and a reader of it that falls behind will in turn block the
+ * writer of `shr`
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shr          The shared ring buffer, opened for reading, must not be `NULL`
+ * @param   fd           The socket
+ * @param   max_buffers  The maximum number of buffers to send at once, 0 for no limit
+ * @param   flags        Bitwise-OR of `enum shr_bridge_flags` values
+ * @param   stats        Output parameter for metrics, that are updated
+ *                       continuously, ignored if `NULL`
+ * @return               Zero on success, -1 on error; on error,
+ *                       `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL        `flags` contains an unsupported flag, or the shared
+ *                        ring buffer has the flag `SHR_OVERWRITE` or `SHR_LATEST`
+ * @throws  EPROTO        The other end is not `shr_bridge_recv`
+ * @throws  EMSGSIZE      A buffer is larger than the buffers at the other end
+ * @throws  ECONNRESET    The other end closed the socket
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  Any error specified for sendmsg(3), recv(3) and malloc(3)
+ */
+int shr_bridge_send(shr_t *restrict, int, size_t, int, struct shr_bridge_stats *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Fill a shared ring buffer with the data `shr_bridge_send`
+ * sends over a stream socket, until it has forwarded all
+ * data, the caller should then close the shared ring buffer
+ * 
+ * @param   shr    The shared ring buffer, opened for writing, must not be `NULL`
+ * @param   fd     The socket
+ * @param   stats  Output parameter for metrics, that are updated
+ *                 continuously, ignored if `NULL`
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  EPROTO      The other end is not `shr_bridge_send`
+ * @throws  EBADMSG     A compressed buffer is malformed
+ * @throws  ECONNRESET  The other end closed the socket before all data was forwarded
+ * @throws  Any error specified for `shr_write`, send(3), recv(3) and malloc(3)
+ */
+int shr_bridge_recv(shr_t *restrict, int, struct shr_bridge_stats *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+
+
+#endif
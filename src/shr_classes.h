@@ -0,0 +1,227 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_CLASSES_H
+#define SHR_CLASSES_H
+
+
+#include "shr_arena.h"
+
+
+
+/**
+ * A stream whose buffers come in a few size classes,
+ * so that occasional large messages do not require
+ * every buffer to be large, as opened by one end
+ */
+typedef struct shr_classes shr_classes_t;
+
+
+/**
+ * The geometry of a size class
+ */
+struct shr_class
+{
+	/**
+	 * The size of each buffer in the class, in bytes
+	 */
+	size_t buffer_size;
+
+	/**
+	 * The number of buffers in the class, must be positive
+	 */
+	size_t buffer_count;
+};
+
+
+
+/**
+ * Create a stream with size classes
+ * 
+ * The stream is an arena, see <shr_arena.h>, with one
+ * shared ring buffer per class. The first class has the
+ * smallest buffers, and carries, in order, every message:
+ * those that fit in its buffers inline, and for the others,
+ * a reference to the next buffer of their class; so its
+ * buffer count limits the number of messages in the stream
+ * 
+ * @param   key          Output parameter for the key of the stream, must not be `NULL`
+ * @param   classes      The size classes, must not be `NULL`, in strictly
+ *                       increasing order of buffer size
+ * @param   count        The number of size classes, at least 1
+ * @param   permissions  The permissions for the stream
+ * @param   flags        Bitwise-OR of `SHR_CHECKSUM` and `SHR_ELASTIC`,
+ *                       applied to every class
+ * @return               Zero on success, -1 on error; on error,
+ *                       `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `count` is 0, the classes are
+ *                  not in strictly increasing order of buffer size,
+ *                  or `flags` contains an unsupported flag
+ * @throws  Any error specified for `shr_arena_create`
+ */
+int shr_classes_create(key_t *restrict, const struct shr_class *restrict, size_t, mode_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Remove a stream with size classes
+ * 
+ * @param   key  The key of the stream
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_arena_remove`
+ */
+int shr_classes_remove(key_t);
+
+/**
+ * Open an end of a stream with size classes
+ * 
+ * Undefined behaviour is invoked if an end is
+ * opened more than once, and not closed in between
+ * 
+ * @param   key        The key of the stream
+ * @param   direction  `SHR_READ` or `SHR_WRITE`
+ * @return             The end, `NULL` on error; on error,
+ *                     `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `direction` is `SHR_OBSERVE`, or the arena
+ *                  was not created by `shr_classes_create`
+ * @throws  Any error specified for `shr_arena_open` and malloc(3)
+ */
+shr_classes_t *shr_classes_open(key_t, shr_direction_t)
+	SHR_COMPILER_GCC(__attribute__((warn_unused_result, malloc)));
+
+/**
+ * Close an end of a stream with size classes
+ * 
+ * @param  classes  The end, nothing will happen if this is `NULL`
+ */
+void shr_classes_close(shr_classes_t *);
+
+/**
+ * Wait for the smallest buffer that has room for
+ * a number of bytes to be ready for writing
+ * 
+ * @param   classes   The write end, must not be `NULL`
+ * @param   capacity  The number of bytes the buffer must have room for
+ * @param   buffer    Output parameter for the buffer to write, must not be `NULL`
+ * @return            The index of the size class of the buffer, -1 on error;
+ *                    on error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADF     `classes` is not a write end
+ * @throws  EINVAL    `capacity` is 0
+ * @throws  EMSGSIZE  `capacity` is greater than the buffer size of the largest class
+ * @throws  Any error specified for `shr_write`
+ */
+ssize_t shr_classes_write(shr_classes_t *restrict, size_t, char **restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Publish the buffer acquired with `shr_classes_write`, empty
+ * buffers mark the end of the stream, and must not be written
+ * 
+ * @param   classes  The write end, must not be `NULL`
+ * @param   length   The number of written bytes, must not be 0,
+ *                   and must not exceed the size of the buffer
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EBADF   `classes` is not a write end
+ * @throws  EINVAL  `length` is 0, the buffer is given back unpublished
+ * @throws  Any error specified for `shr_write_done` and `shr_write`
+ */
+int shr_classes_write_done(shr_classes_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Mark the end of a stream with size classes
+ * 
+ * @param   classes  The write end, must not be `NULL`
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EBADF  `classes` is not a write end
+ * @throws  Any error specified for `shr_write` and `shr_write_done`
+ */
+int shr_classes_finish(shr_classes_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Wait for the next message in a stream with size
+ * classes, whatever its class, to be ready for reading
+ * 
+ * @param   classes  The read end, must not be `NULL`
+ * @param   index    Output parameter for the index of the size class
+ *                   of the buffer, may be `NULL`
+ * @param   buffer   Output parameter for the buffer, must not be `NULL`
+ * @param   length   Output parameter for the length of the data, must not be `NULL`
+ * @return           Zero on success, 1 at the end of the stream, -1 on error;
+ *                   on error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADF   `classes` is not a read end
+ * @throws  EPROTO  The message refers to a size class that does not
+ *                  exist, or whose buffer has not been published
+ * @throws  Any error specified for `shr_read`
+ */
+int shr_classes_read(shr_classes_t *restrict, size_t *restrict, const char **restrict, size_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 3, 4), warn_unused_result)));
+
+/**
+ * Mark the buffer acquired with `shr_classes_read`
+ * as fully read, so that it can be reused
+ * 
+ * @param   classes  The read end, must not be `NULL`
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EBADF  `classes` is not a read end
+ * @throws  Any error specified for `shr_read_done`
+ */
+int shr_classes_read_done(shr_classes_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Get the number of size classes in a stream
+ * 
+ * @param   classes  The end, must not be `NULL`
+ * @return           The number of size classes
+ */
+size_t shr_classes_count(const shr_classes_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Get the shared ring buffer of a size class, for
+ * use with functions in <shr.h> that do not acquire
+ * or release buffers, such as `shr_trim`
+ * 
+ * @param   classes  The end, must not be `NULL`
+ * @param   i        The index of the size class, must be less than
+ *                   the number of size classes
+ * @return           The shared ring buffer
+ */
+shr_t *shr_classes_ring(shr_classes_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+
+#endif
@@ -0,0 +1,599 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_CORO_HPP
+#define SHR_CORO_HPP
+
+
+#include "shr.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+namespace libshr {
+
+
+class executor;
+
+
+/**
+ * A coroutine that is run by an `executor`
+ * 
+ * The coroutine does not start until it is passed to
+ * `executor::spawn`, and its frame is destroyed when
+ * it returns; an exception escaping the coroutine
+ * terminates the program
+ */
+class task
+{
+public:
+	struct promise_type
+	{
+		executor *ex = nullptr;
+
+		task get_return_object() noexcept { return task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+
+		struct final_awaiter
+		{
+			bool await_ready() noexcept { return false; }
+			void await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+			void await_resume() noexcept {}
+		};
+
+		final_awaiter final_suspend() noexcept { return {}; }
+	};
+
+	task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+	task &operator=(task &&) = delete;
+
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+private:
+	friend class executor;
+
+	explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+
+	std::coroutine_handle<promise_type> h_;
+};
+
+
+/**
+ * A small executor that runs coroutines on a fixed number
+ * of threads, and parks coroutines that are waiting for a
+ * shared ring buffer
+ * 
+ * Parked coroutines are retried, with the non-blocking
+ * functions, by a single poller thread. While no parked
+ * coroutine can make progress, the poller sleeps in
+ * futex_waitv(2) on the counters of the local shared
+ * ring buffers they wait for, so it is woken as soon as
+ * the other end hands over a buffer. XSI semaphores
+ * cannot be waited upon that way, so while a coroutine
+ * waits for a shared ring buffer that is not local, the
+ * poller wakes up to retry after a time that backs off
+ * exponentially up to one millisecond; this is also the
+ * case if the kernel does not support futex_waitv(2)
+ */
+class executor
+{
+public:
+	/**
+	 * A coroutine waiting for a shared ring buffer
+	 */
+	struct waiter
+	{
+		/**
+		 * Retry the operation, return whether it completed,
+		 * in which case the coroutine shall be resumed
+		 */
+		bool (*poll)(waiter *);
+
+		/**
+		 * The coroutine to resume
+		 */
+		std::coroutine_handle<> handle;
+
+		/**
+		 * The counter, in the memory of a local shared ring
+		 * buffer, that changes when the operation may be
+		 * able to complete, followed by the number of
+		 * threads sleeping on it, or `nullptr` to poll
+		 */
+		std::uint32_t *futex = nullptr;
+
+		/**
+		 * Whether `futex` may be shared between processes
+		 */
+		bool shared = false;
+	};
+
+	/**
+	 * Start the executor
+	 * 
+	 * @param  threads  The number of worker threads
+	 */
+	explicit executor(unsigned threads = std::max(1U, std::thread::hardware_concurrency()))
+	{
+		workers_.reserve(threads);
+		for (unsigned i = 0; i < threads; i++)
+			workers_.emplace_back([this] { work_(); });
+		poller_ = std::thread([this] { poll_(); });
+	}
+
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+
+	/**
+	 * Wait for all coroutines to return and stop the executor
+	 */
+	~executor()
+	{
+		wait();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		run_cond_.notify_all();
+		park_cond_.notify_all();
+		wake_poller_();
+		for (auto &t : workers_)
+			t.join();
+		poller_.join();
+	}
+
+	/**
+	 * Start a coroutine
+	 * 
+	 * @param  t  The coroutine
+	 */
+	void
+	spawn(task t)
+	{
+		auto h = std::exchange(t.h_, nullptr);
+		h.promise().ex = this;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			tasks_++;
+		}
+		schedule(h);
+	}
+
+	/**
+	 * Wait until all spawned coroutines have returned
+	 */
+	void
+	wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		idle_cond_.wait(lock, [this] { return !tasks_; });
+	}
+
+	/**
+	 * Queue a coroutine for resumption on a worker thread
+	 * 
+	 * @param  h  The coroutine
+	 */
+	void
+	schedule(std::coroutine_handle<> h)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			runnable_.push_back(h);
+		}
+		run_cond_.notify_one();
+	}
+
+	/**
+	 * Park a coroutine until its operation can complete
+	 * 
+	 * @param  w  The waiter, must remain valid until the
+	 *            coroutine has been resumed
+	 */
+	void
+	park(waiter *w)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			parked_.push_back(w);
+		}
+		park_cond_.notify_one();
+		wake_poller_();
+	}
+
+private:
+	friend struct task::promise_type::final_awaiter;
+
+	void
+	task_done_()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!--tasks_)
+			idle_cond_.notify_all();
+	}
+
+	void
+	work_()
+	{
+		std::coroutine_handle<> h;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				run_cond_.wait(lock, [this] { return stopping_ || !runnable_.empty(); });
+				if (runnable_.empty())
+					return;
+				h = runnable_.front();
+				runnable_.pop_front();
+			}
+			h.resume();
+		}
+	}
+
+	/**
+	 * Wake the poller if it is sleeping in futex_waitv(2),
+	 * so that it picks up newly parked coroutines
+	 */
+	void
+	wake_poller_() noexcept
+	{
+		/* The sequentially consistent operations pair with those in `sleep_`. */
+		parks_.fetch_add(1);
+		if (sleeping_.load())
+			syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&parks_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	/**
+	 * Register the poller as sleeping on the counters
+	 * parked coroutines wait for, this must be done before
+	 * they are retried, so that no hand-over is missed
+	 * 
+	 * @param   polling  The parked coroutines
+	 * @param   fs       Output parameter for the futexes, the first is
+	 *                   the number of times coroutines have been parked
+	 * @param   gen      The number of times coroutines had been
+	 *                   parked, when the parked coroutines were collected
+	 * @param   timed    Output parameter for whether any parked
+	 *                   coroutine must be retried after a while
+	 * @return           The number of elements in `fs`
+	 */
+	std::size_t
+	arm_(const std::vector<waiter *> &polling, struct futex_waitv *fs, std::uint32_t gen, bool &timed) noexcept
+	{
+		std::size_t n = 0;
+		fs[n++] = {gen, reinterpret_cast<std::uintptr_t>(&parks_), FUTEX_32 | FUTEX_PRIVATE_FLAG, 0};
+		timed = false;
+		for (waiter *w : polling) {
+			if (!w->futex || n == FUTEX_WAITV_MAX) {
+				timed = true;
+				continue;
+			}
+			/* As `shr_local_wait_`, see the arena section of the protocol. */
+			__atomic_fetch_add(w->futex + 1, 1, __ATOMIC_SEQ_CST);
+			fs[n++] = {__atomic_load_n(w->futex, __ATOMIC_SEQ_CST), reinterpret_cast<std::uintptr_t>(w->futex),
+			           static_cast<std::uint32_t>(FUTEX_32 | (w->shared ? 0 : FUTEX_PRIVATE_FLAG)), 0};
+		}
+		return n;
+	}
+
+	/**
+	 * Undo `arm_`
+	 * 
+	 * @param  fs  The futexes
+	 * @param  n   The number of elements in `fs`
+	 */
+	static void
+	disarm_(const struct futex_waitv *fs, std::size_t n) noexcept
+	{
+		for (std::size_t i = 1; i < n; i++)
+			__atomic_fetch_sub(reinterpret_cast<std::uint32_t *>(fs[i].uaddr) + 1, 1, __ATOMIC_SEQ_CST);
+	}
+
+	/**
+	 * Sleep until a counter registered with `arm_` changes,
+	 * or, if `timed`, for at most a while
+	 * 
+	 * @param  fs       The futexes
+	 * @param  n        The number of elements in `fs`, 0 to just sleep
+	 * @param  timed    Whether to wake up after `backoff`
+	 * @param  backoff  The time to sleep, if `timed`
+	 */
+	void
+	sleep_(const struct futex_waitv *fs, std::size_t n, bool timed, std::chrono::microseconds backoff) noexcept
+	{
+		struct timespec ts;
+		long r;
+
+		if (n) {
+			if (timed) {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				ts.tv_nsec += static_cast<long>(backoff.count()) * 1000L;
+				if (ts.tv_nsec >= 1000000000L)
+					ts.tv_sec += 1, ts.tv_nsec -= 1000000000L;
+			}
+			sleeping_.store(true);
+			r = syscall(SYS_futex_waitv, fs, static_cast<unsigned int>(n), 0U, timed ? &ts : nullptr, CLOCK_MONOTONIC);
+			sleeping_.store(false);
+			if (r >= 0 || errno != ENOSYS)
+				return;
+			waitv_ = false;
+		}
+		std::this_thread::sleep_for(backoff);
+	}
+
+	void
+	poll_()
+	{
+		std::vector<waiter *> polling, ready;
+		std::chrono::microseconds backoff(0);
+		struct futex_waitv fs[FUTEX_WAITV_MAX];
+		std::size_t armed;
+		std::uint32_t gen;
+		bool timed;
+		for (;;) {
+			gen = parks_.load();
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (polling.empty())
+					park_cond_.wait(lock, [this] { return stopping_ || !parked_.empty(); });
+				if (stopping_)
+					return;
+				polling.insert(polling.end(), parked_.begin(), parked_.end());
+				parked_.clear();
+			}
+
+			/* Only register as sleeping if the last retry was in vain. */
+			armed = 0;
+			timed = true;
+			if (backoff.count() && waitv_)
+				armed = arm_(polling, fs, gen, timed);
+
+			auto it = std::partition(polling.begin(), polling.end(), [](waiter *w) { return !w->poll(w); });
+			ready.assign(it, polling.end());
+			polling.erase(it, polling.end());
+
+			if (!ready.empty()) {
+				/* The shared ring buffers may be closed once the coroutines are resumed. */
+				disarm_(fs, armed);
+				backoff = std::chrono::microseconds(0);
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					for (waiter *w : ready)
+						runnable_.push_back(w->handle);
+				}
+				run_cond_.notify_all();
+			} else if (backoff.count() == 0) {
+				backoff = std::chrono::microseconds(1);
+				std::this_thread::yield();
+			} else {
+				sleep_(fs, armed, timed, backoff);
+				disarm_(fs, armed);
+				if (timed)
+					backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+			}
+		}
+	}
+
+	std::mutex mutex_;
+	std::condition_variable run_cond_;
+	std::condition_variable park_cond_;
+	std::condition_variable idle_cond_;
+	std::deque<std::coroutine_handle<>> runnable_;
+	std::vector<waiter *> parked_;
+	std::vector<std::thread> workers_;
+	std::thread poller_;
+	std::size_t tasks_ = 0;
+	bool stopping_ = false;
+	std::atomic<std::uint32_t> parks_{0};
+	std::atomic<bool> sleeping_{false};
+	bool waitv_ = true;
+};
+
+
+inline void
+task::promise_type::final_awaiter::await_suspend(std::coroutine_handle<promise_type> h) noexcept
+{
+	executor *ex = h.promise().ex;
+	h.destroy();
+	ex->task_done_();
+}
+
+
+/**
+ * A shared ring buffer that can be used from coroutines
+ * run by an `executor`
+ * 
+ * At most one coroutine may use the shared ring
+ * buffer at any time
+ */
+class async_ring
+{
+public:
+	async_ring(ring &r, executor &ex) noexcept : r_(r), ex_(ex) {}
+
+	ring &native() noexcept { return r_; }
+
+	struct read_awaiter : executor::waiter
+	{
+		async_ring *self;
+		std::optional<read_guard> result;
+		std::error_code error;
+
+		static bool
+		try_(executor::waiter *w)
+		{
+			read_awaiter *a = static_cast<read_awaiter *>(w);
+			try {
+				auto g = a->self->r_.try_read();
+				if (g)
+					a->result.emplace(std::move(*g));
+			} catch (const std::system_error &e) {
+				a->error = e.code();
+				return true;
+			}
+			return a->result.has_value();
+		}
+
+		bool await_ready() { return try_(this); }
+
+		void
+		await_suspend(std::coroutine_handle<> h)
+		{
+			poll = &try_;
+			handle = h;
+			self->wait_on_(this, false);
+			self->ex_.park(this);
+		}
+
+		read_guard
+		await_resume()
+		{
+			if (error)
+				throw std::system_error(error, "shr_read_try");
+			return std::move(*result);
+		}
+	};
+
+	struct write_awaiter : executor::waiter
+	{
+		async_ring *self;
+		std::optional<write_guard> result;
+		std::error_code error;
+
+		static bool
+		try_(executor::waiter *w)
+		{
+			write_awaiter *a = static_cast<write_awaiter *>(w);
+			try {
+				auto g = a->self->r_.try_write();
+				if (g)
+					a->result.emplace(std::move(*g));
+			} catch (const std::system_error &e) {
+				a->error = e.code();
+				return true;
+			}
+			return a->result.has_value();
+		}
+
+		bool await_ready() { return try_(this); }
+
+		void
+		await_suspend(std::coroutine_handle<> h)
+		{
+			poll = &try_;
+			handle = h;
+			self->wait_on_(this, true);
+			self->ex_.park(this);
+		}
+
+		write_guard
+		await_resume()
+		{
+			if (error)
+				throw std::system_error(error, "shr_write_try");
+			return std::move(*result);
+		}
+	};
+
+	/**
+	 * Wait, without blocking the thread, for readable data
+	 * 
+	 * @return  An awaitable that yields a `read_guard`, or throws
+	 *          `std::system_error` when resumed if reading fails;
+	 *          on EBADMSG, the corrupt buffer has been marked as
+	 *          fully read before the coroutine is resumed
+	 */
+	read_awaiter
+	read() noexcept
+	{
+		read_awaiter a;
+		a.self = this;
+		return a;
+	}
+
+	/**
+	 * Wait, without blocking the thread, for a writable buffer
+	 * 
+	 * @return  An awaitable that yields a `write_guard`
+	 */
+	write_awaiter
+	write() noexcept
+	{
+		write_awaiter a;
+		a.self = this;
+		return a;
+	}
+
+private:
+	/**
+	 * Let the executor sleep on the counter of the other end
+	 * of the shared ring buffer, if it is local
+	 * 
+	 * @param  w      The waiter
+	 * @param  write  Whether the waiter waits for a writable buffer
+	 */
+	void
+	wait_on_(executor::waiter *w, bool write) noexcept
+	{
+		const shr_t &shr = r_.native();
+		/* Readers of snapshots are not woken, the writer does not touch the counters. */
+		if (!SHR_IS_LOCAL(&shr) || (shr.key.flags & SHR_LATEST))
+			return;
+		w->futex = reinterpret_cast<std::uint32_t *>(shr.address + (write ? SHR_READ_OFFSET : SHR_WRITTEN_OFFSET));
+		w->shared = *reinterpret_cast<const std::uint32_t *>(shr.address + SHR_LOCAL_KIND_OFFSET) == SHR_LOCAL_KIND_ARENA;
+	}
+
+	ring &r_;
+	executor &ex_;
+};
+
+
+}
+
+
+#endif
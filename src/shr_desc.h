@@ -0,0 +1,349 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_DESC_H
+#define SHR_DESC_H
+
+
+#include "shr.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * Create key that is recogined by `shr_bufpool_open` as
+ * an instruction to create a private buffer pool
+ * 
+ * @param  KEY:struct shr_bufpool_key *  Output parameter for the psuedo-key
+ * @param  BUFFER_SIZE:size_t            The size of each buffer
+ * @param  BUFFER_COUNT:size_t           The number of buffers
+ */
+#define SHR_BUFPOOL_PRIVATE(KEY, BUFFER_SIZE, BUFFER_COUNT)  \
+	((KEY)->shm = IPC_PRIVATE,                            \
+	 (KEY)->buffer_size = BUFFER_SIZE,                    \
+	 (KEY)->buffer_count = BUFFER_COUNT)
+
+/**
+ * Get the distance between two consecutive buffers
+ * in the shared memory of a buffer pool
+ * 
+ * @param   BUFFER_SIZE:size_t  The buffer size of the buffer pool
+ * @return  :size_t             The distance between two buffers
+ */
+#define SHR_BUFPOOL_STRIDE(BUFFER_SIZE)  \
+	(((BUFFER_SIZE) + 63) & ~(size_t)63)
+
+/**
+ * Get the offset of a buffer in the shared memory of a buffer
+ * pool, the buffers follow the header and the free list
+ * 
+ * @param   BUFFER_SIZE:size_t   The buffer size of the buffer pool
+ * @param   BUFFER_COUNT:size_t  The buffer count of the buffer pool
+ * @param   I:size_t             The index of the buffer
+ * @return  :size_t              The offset of the buffer
+ */
+#define SHR_BUFPOOL_OFFSET(BUFFER_SIZE, BUFFER_COUNT, I)                    \
+	(SHR_HEADER_SIZE + (((BUFFER_COUNT) * sizeof(uint32_t) + 63) & ~(size_t)63) + \
+	 (I) * SHR_BUFPOOL_STRIDE(BUFFER_SIZE))
+
+/**
+ * Get the size of the shared memory of a buffer pool
+ * 
+ * @param   BUFFER_SIZE:size_t   The buffer size of the buffer pool
+ * @param   BUFFER_COUNT:size_t  The buffer count of the buffer pool
+ * @return  :size_t              The size of the shared memory
+ */
+#define SHR_BUFPOOL_SIZE(BUFFER_SIZE, BUFFER_COUNT)  \
+	SHR_BUFPOOL_OFFSET(BUFFER_SIZE, BUFFER_COUNT, BUFFER_COUNT)
+
+/**
+ * Get the address of the data a descriptor refers to
+ * 
+ * The descriptor is not checked, it must have been allocated
+ * from the buffer pool or received with `shr_desc_recv`
+ * 
+ * @param   POOL:shr_bufpool_t *          The buffer pool the descriptor belongs to
+ * @param   DESC:const struct shr_desc *  The descriptor
+ * @return  :char *                       The first byte of the data
+ */
+#define SHR_DESC_DATA(POOL, DESC)  \
+	((POOL)->address + SHR_BUFPOOL_OFFSET((POOL)->key.buffer_size, (POOL)->key.buffer_count, \
+	                                      (size_t)(DESC)->index) + (DESC)->offset)
+
+/**
+ * Get the maximum number of descriptors that fit
+ * in one buffer of a shared ring buffer
+ * 
+ * @param   SHR:shr_t *  The shared ring buffer
+ * @return  :size_t      The number of descriptors
+ */
+#define SHR_DESC_MAX(SHR)  (SHR_BUFFER_SIZE(SHR) / sizeof(struct shr_desc))
+
+
+
+/**
+ * A reference to data in a buffer in a buffer pool, this
+ * is what is passed over the shared ring buffers, so that
+ * the data itself is never copied
+ * 
+ * Whoever holds a descriptor owns the buffer, and may
+ * modify the data in place and change `offset` and
+ * `length`, until it passes the descriptor on with
+ * `shr_desc_send` or releases the buffer with
+ * `shr_bufpool_free`
+ */
+struct shr_desc
+{
+	/**
+	 * The index of the buffer in the buffer pool
+	 */
+	uint32_t index;
+
+	/**
+	 * The offset of the data in the buffer
+	 */
+	uint32_t offset;
+
+	/**
+	 * The length of the data, `offset + length`
+	 * must not exceed the buffer size
+	 */
+	uint64_t length;
+};
+
+
+/**
+ * Key for a buffer pool
+ */
+typedef struct shr_bufpool_key
+{
+	/**
+	 * The key of the shared memory
+	 */
+	key_t shm;
+
+	/**
+	 * The size of each buffer
+	 */
+	size_t buffer_size;
+
+	/**
+	 * The number of buffers
+	 */
+	size_t buffer_count;
+
+} shr_bufpool_key_t;
+
+
+/**
+ * A pool of buffers in one shared memory segment, from
+ * which any process that has it opened can allocate
+ * buffers, and to which any such process can release
+ * them, in any order
+ */
+typedef struct shr_bufpool
+{
+	/**
+	 * The ID of the shared memory
+	 */
+	int shm;
+
+	/**
+	 * The key of the buffer pool
+	 */
+	shr_bufpool_key_t key;
+
+	/**
+	 * The address of the shared memory
+	 */
+	char *address;
+
+} shr_bufpool_t;
+
+
+
+/**
+ * Create a buffer pool
+ * 
+ * @param   key           Output parameter for the key, must not be `NULL`
+ * @param   buffer_size   The size of each buffer, in bytes, at most `UINT32_MAX`
+ * @param   buffer_count  The number of buffers, must be positive
+ *                        and less than `UINT32_MAX`
+ * @param   permissions   The permissions of the buffer pool
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `buffer_size` or `buffer_count` is out of range
+ * @throws  The errors EINVAL, ENOMEM and ENOSPC, as specified for shmget(3)
+ * @throws  Any error specified for shmat(3)
+ */
+int shr_bufpool_create(shr_bufpool_key_t *restrict, size_t, size_t, mode_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Open a buffer pool, always for both reading and writing
+ * 
+ * @param   pool  Output parameter for the buffer pool, must not be `NULL`
+ * @param   key   The key for the buffer pool, use `SHR_BUFPOOL_PRIVATE`
+ *                on the key before passing it to this function, to create
+ *                and open a private buffer pool
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared memory is not a buffer pool, or its
+ *                  geometry does not match the key
+ * @throws  Any error specified for shmget(3) and shmat(3) except EINTR
+ */
+int shr_bufpool_open(shr_bufpool_t *restrict, const shr_bufpool_key_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Close a buffer pool, buffers allocated by
+ * this process are not released
+ * 
+ * @param  pool  The buffer pool, must not be `NULL`
+ */
+void shr_bufpool_close(shr_bufpool_t *restrict);
+
+/**
+ * Close and remove a buffer pool, the memory is
+ * freed once all processes have closed it
+ * 
+ * @param  pool  The buffer pool, must not be `NULL`
+ */
+void shr_bufpool_remove(shr_bufpool_t *restrict);
+
+/**
+ * Allocate a buffer from a buffer pool, and wait
+ * until one is released if none is free
+ * 
+ * @param   pool  The buffer pool, must not be `NULL`
+ * @param   desc  Output parameter for a descriptor of the buffer,
+ *                with `offset` and `length` set to 0, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINTR  The wait was interrupted by a signal handler
+ */
+int shr_bufpool_alloc(shr_bufpool_t *restrict, struct shr_desc *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Variant of `shr_bufpool_alloc` that fails if no buffer is free
+ * 
+ * @param   pool  The buffer pool, must not be `NULL`
+ * @param   desc  Output parameter for a descriptor of the buffer,
+ *                with `offset` and `length` set to 0, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  No buffer is free
+ */
+int shr_bufpool_alloc_try(shr_bufpool_t *restrict, struct shr_desc *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Variant of `shr_bufpool_alloc` that fails if no
+ * buffer has become free within a specified time
+ * 
+ * @param   pool     The buffer pool, must not be `NULL`
+ * @param   desc     Output parameter for a descriptor of the buffer,
+ *                   with `offset` and `length` set to 0, must not be `NULL`
+ * @param   timeout  The maximum time to wait, relative, `NULL` for no limit
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EAGAIN  No buffer became free in time
+ * @throws  EINTR   The wait was interrupted by a signal handler
+ */
+int shr_bufpool_alloc_timed(shr_bufpool_t *restrict, struct shr_desc *restrict, const struct timespec *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2), warn_unused_result)));
+
+/**
+ * Release a buffer to its buffer pool, buffers
+ * can be released in any order, by any process
+ * 
+ * @param   pool  The buffer pool, must not be `NULL`
+ * @param   desc  A descriptor of the buffer, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The descriptor does not refer to an allocated buffer
+ */
+int shr_bufpool_free(shr_bufpool_t *restrict, const struct shr_desc *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Pass descriptors to the read end of a shared ring buffer,
+ * as many as fit in one of its buffers
+ * 
+ * The buffers the descriptors refer to are passed along with them, the
+ * caller must not use them afterwards; forwarding a buffer to another
+ * shared ring buffer thus copies only its descriptor
+ * 
+ * @param   shr    The shared ring buffer, must not be `NULL`
+ * @param   descs  The descriptors, must not be `NULL` unless `n` is 0
+ * @param   n      The number of descriptors, if 0, an empty
+ *                 buffer, which can mark the end of a stream, is sent
+ * @return         The number of descriptors passed, at most `SHR_DESC_MAX(shr)`,
+ *                 -1 on error; on error, `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `SHR_DESC_MAX(shr)` is 0
+ * @throws  Any error specified for `shr_write`
+ */
+ssize_t shr_desc_send(shr_t *restrict, const struct shr_desc *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1))));
+
+/**
+ * Receive the descriptors in the next buffer of a shared ring buffer
+ * 
+ * The buffers the descriptors refer to are handed over to the caller,
+ * who may hold them for as long as it needs to, and release them in
+ * any order; the buffer in the shared ring buffer is released at once
+ * 
+ * Each descriptor is checked against the buffer pool, so that
+ * `SHR_DESC_DATA` and `shr_bufpool_free` can be used on it
+ * 
+ * @param   shr     The shared ring buffer, must not be `NULL`
+ * @param   pool    The buffer pool the descriptors belong to, must not be `NULL`
+ * @param   descs   Output buffer for the descriptors, must not be `NULL`
+ * @param   max     The size of `descs`, in descriptors, at least `SHR_DESC_MAX(shr)`
+ * @param   closed  Output parameter for whether the write end has closed
+ *                  and all data has been read, ignored if `NULL`
+ * @return          The number of descriptors received, 0 for an empty buffer,
+ *                  -1 on error; on error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADMSG  The buffer does not hold whole descriptors, or a descriptor
+ *                   refers to a buffer that is not in `pool`, or to data that
+ *                   does not fit in its buffer; the buffer is discarded, and the
+ *                   buffers of its other descriptors are not released
+ * @throws  EINVAL   `max` is less than `SHR_DESC_MAX(shr)`
+ * @throws  Any error specified for `shr_read_copy`
+ */
+ssize_t shr_desc_recv(shr_t *restrict, const shr_bufpool_t *restrict, struct shr_desc *restrict, size_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2, 3), warn_unused_result)));
+
+
+
+#endif
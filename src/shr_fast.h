@@ -0,0 +1,496 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_FAST_H
+#define SHR_FAST_H
+
+
+#include "shr.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <linux/futex.h>
+#include <sys/sem.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+/**
+ * Precomputed information about a buffer
+ * in a shared ring buffer
+ */
+typedef struct shr_fast_slot
+{
+	/**
+	 * The address of the buffer
+	 */
+	char *buffer;
+
+	/**
+	 * The address of the length of the
+	 * data stored in the buffer
+	 */
+	size_t *length;
+
+	/**
+	 * The index of the semaphore for flagging
+	 * the buffer as being writeable
+	 */
+	unsigned short write_sem;
+
+	/**
+	 * The index of the semaphore for flagging
+	 * the buffer as being readable
+	 */
+	unsigned short read_sem;
+
+} shr_fast_slot_t;
+
+
+/**
+ * Fast path descriptor for a shared ring buffer
+ * 
+ * The index of the current buffer is kept in the
+ * underlaying shared ring buffer, so this API can
+ * be mixed with the regular API
+ * 
+ * If the shared ring buffer was created with any
+ * flags, the functions call the regular API, as
+ * the metadata that the flags add is maintained
+ * by libshr
+ * 
+ * For local shared ring buffers, the functions only
+ * use atomic operations, and only call futex(2) to
+ * wake the other end if it is sleeping; when they
+ * have to wait, they call the regular API, which
+ * spins and sleeps. Other shared ring buffers are
+ * synchronised with XSI semaphores, so for them,
+ * each function still makes one semop(2) call,
+ * and only the buffer arithmetic is precomputed
+ */
+typedef struct shr_fast
+{
+	/**
+	 * The shared ring buffer
+	 */
+	shr_t *shr;
+
+	/**
+	 * Precomputed information for each buffer
+	 */
+	shr_fast_slot_t *slots;
+
+	/**
+	 * The index of the last buffer
+	 */
+	size_t last;
+
+	/**
+	 * Whether the buffer count is a power of two,
+	 * if so `last` can be used as a mask
+	 */
+	int pow2;
+
+	/**
+	 * The ID of the semaphore array
+	 */
+	int sem;
+
+	/**
+	 * Whether the regular API is used
+	 */
+	int generic;
+
+	/**
+	 * Whether the shared ring buffer is local
+	 */
+	int local;
+
+	/**
+	 * Only used by local shared ring buffers:
+	 * the futex operation that wakes the other end
+	 */
+	int wake;
+
+	/**
+	 * Only used by shared ring buffers that are not local:
+	 * the number of published buffers, in the shared memory
+	 */
+	uint64_t *published;
+
+	/**
+	 * Only used by local shared ring buffers: the counter this
+	 * end hands over buffers with, followed by the number of
+	 * threads sleeping on it, in the shared memory
+	 */
+	uint32_t *own;
+
+	/**
+	 * Only used by local shared ring buffers: the counter
+	 * the other end hands over buffers with, in the shared memory
+	 */
+	uint32_t *peer;
+
+	/**
+	 * Only used by local shared ring buffers: the index of
+	 * this end's current buffer, in the shared memory
+	 */
+	uint32_t *index;
+
+} shr_fast_t;
+
+
+
+/**
+ * Create a fast path descriptor for a shared ring buffer
+ * 
+ * The shared ring buffer must remain open, at the same
+ * address, until `shr_fast_destroy` has been called
+ * 
+ * @param   fast  Output parameter for the fast path descriptor, must not be `NULL`
+ * @param   shr   The opened shared ring buffer, must not be `NULL`
+ * @return        Zero on success, -1 on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for malloc(3)
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_init(shr_fast_t *restrict fast, shr_t *restrict shr)
+{
+	size_t i, n = shr->key.buffer_count;
+	char *buffer;
+
+	fast->shr = shr;
+	fast->sem = shr->sem;
+	fast->generic = shr->key.flags != 0;
+	fast->local = SHR_IS_LOCAL(shr);
+	fast->last = n - 1;
+	fast->pow2 = !(n & (n - 1));
+	fast->published = (uint64_t *)(void *)(shr->address + SHR_PUBLISHED_OFFSET);
+	fast->own  = (uint32_t *)(void *)(shr->address + (shr->direction == SHR_WRITE ? SHR_WRITTEN_OFFSET : SHR_READ_OFFSET));
+	fast->peer = (uint32_t *)(void *)(shr->address + (shr->direction == SHR_WRITE ? SHR_READ_OFFSET : SHR_WRITTEN_OFFSET));
+	fast->index = (uint32_t *)(void *)(shr->address + (shr->direction == SHR_WRITE ? SHR_WRITTEN_INDEX_OFFSET : SHR_READ_INDEX_OFFSET));
+	fast->wake = FUTEX_WAKE;
+	if (*(uint32_t *)(void *)(shr->address + SHR_LOCAL_KIND_OFFSET) != SHR_LOCAL_KIND_ARENA)
+		fast->wake |= FUTEX_PRIVATE_FLAG;
+	fast->slots = malloc(n * sizeof(*(fast->slots)));
+	if (!fast->slots)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		buffer = shr->address + SHR_BUFFER_OFFSET(shr->key.buffer_size, shr->key.flags, i);
+		fast->slots[i].buffer = buffer;
+		fast->slots[i].length = (size_t *)(void *)(shr->address + SHR_LENGTH_OFFSET(shr->key.buffer_size, shr->key.flags, i));
+		fast->slots[i].write_sem = (unsigned short)(2 * i + 0);
+		fast->slots[i].read_sem  = (unsigned short)(2 * i + 1);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Release the resources of a fast path descriptor,
+ * the shared ring buffer is not closed
+ * 
+ * @param  fast  The fast path descriptor, must not be `NULL`
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull)))
+static inline void
+shr_fast_destroy(shr_fast_t *restrict fast)
+{
+	free(fast->slots);
+	fast->slots = NULL;
+}
+
+
+/**
+ * Get the index of the buffer after a buffer
+ * 
+ * @param   fast  The fast path descriptor, must not be `NULL`
+ * @param   i     The index of the buffer
+ * @return        The index of the next buffer
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, pure)))
+static inline size_t
+shr_fast_next_(const shr_fast_t *restrict fast, size_t i)
+{
+	if (SHR_LIKELY(fast->pow2))
+		return (i + 1) & fast->last;
+	return SHR_UNLIKELY(i == fast->last) ? 0 : i + 1;
+}
+
+
+/**
+ * Add a value to a semaphore in the semaphore array
+ * 
+ * @param   fast   The fast path descriptor, must not be `NULL`
+ * @param   index  The index of the semaphore
+ * @param   value  The value to add
+ * @param   flags  `IPC_NOWAIT` or zero
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull)))
+static inline int
+shr_fast_semop_(const shr_fast_t *restrict fast, unsigned short index, short value, short flags)
+{
+	struct sembuf op;
+	op.sem_num = index;
+	op.sem_op = value;
+	op.sem_flg = flags;
+	return semop(fast->sem, &op, (size_t)1);
+}
+
+
+/**
+ * Check whether the current buffer of a local shared
+ * ring buffer is available to the current end
+ * 
+ * @param   fast  The fast path descriptor, must not be `NULL`
+ * @return        Whether the buffer is available
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull)))
+static inline int
+shr_fast_available_(shr_fast_t *restrict fast)
+{
+	shr_t *shr = fast->shr;
+	unsigned int used = shr->released - shr->peer_released;
+	if (shr->direction == SHR_WRITE ? (size_t)used < shr->key.buffer_count : used != 0)
+		return 1;
+	shr->peer_released = __atomic_load_n(fast->peer, __ATOMIC_ACQUIRE);
+	used = shr->released - shr->peer_released;
+	return shr->direction == SHR_WRITE ? (size_t)used < shr->key.buffer_count : used != 0;
+}
+
+
+/**
+ * Hand over the current buffer of a local shared ring
+ * buffer from the current end to the other end
+ * 
+ * The operations are sequentially consistent, to
+ * pair with those of the other end when it sleeps
+ * 
+ * @param  fast  The fast path descriptor, must not be `NULL`
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull)))
+static inline void
+shr_fast_release_(shr_fast_t *restrict fast)
+{
+	shr_t *shr = fast->shr;
+	__atomic_store_n(fast->index, (uint32_t)shr_fast_next_(fast, shr->current_buffer), __ATOMIC_RELAXED);
+	shr->released += 1;
+	__atomic_store_n(fast->own, shr->released, __ATOMIC_SEQ_CST);
+	if (SHR_UNLIKELY(__atomic_load_n(fast->own + 1, __ATOMIC_SEQ_CST)))
+		syscall(SYS_futex, fast->own, fast->wake, INT_MAX, NULL, NULL, 0);
+}
+
+
+/**
+ * Inline variant of `shr_read`
+ * 
+ * @param   fast    The fast path descriptor, must not be `NULL`
+ * @param   buffer  Output parameter for the buffer to read, must not be `NULL`
+ * @param   length  Output parameter for the length of `*buffer`, must not be `NULL`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ * @throws  EBADMSG  As specified for `shr_read`
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_read(shr_fast_t *restrict fast, const char **restrict buffer, size_t *restrict length)
+{
+	const shr_fast_slot_t *slot = fast->slots + fast->shr->current_buffer;
+	if (SHR_UNLIKELY(fast->generic))
+		return shr_read(fast->shr, buffer, length);
+	if (fast->local) {
+		if (SHR_UNLIKELY(!shr_fast_available_(fast)))
+			return shr_read(fast->shr, buffer, length);
+	} else if (SHR_UNLIKELY(shr_fast_semop_(fast, slot->read_sem, -1, 0))) {
+		return -1;
+	}
+	*buffer = slot->buffer;
+	*length = *(slot->length);
+	return 0;
+}
+
+
+/**
+ * Inline variant of `shr_read_try`
+ * 
+ * @param   fast    The fast path descriptor, must not be `NULL`
+ * @param   buffer  Output parameter for the buffer to read, must not be `NULL`
+ * @param   length  Output parameter for the length of `*buffer`, must not be `NULL`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EAGAIN, EIDRM, EINTR and EINVAL,
+ *          as specified for semop(3)
+ * @throws  EBADMSG  As specified for `shr_read`
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_read_try(shr_fast_t *restrict fast, const char **restrict buffer, size_t *restrict length)
+{
+	const shr_fast_slot_t *slot = fast->slots + fast->shr->current_buffer;
+	if (SHR_UNLIKELY(fast->generic))
+		return shr_read_try(fast->shr, buffer, length);
+	if (fast->local) {
+		if (!shr_fast_available_(fast))
+			return errno = EAGAIN, -1;
+	} else if (shr_fast_semop_(fast, slot->read_sem, -1, IPC_NOWAIT)) {
+		return -1;
+	}
+	*buffer = slot->buffer;
+	*length = *(slot->length);
+	return 0;
+}
+
+
+/**
+ * Inline variant of `shr_read_done`
+ * 
+ * @param   fast  The fast path descriptor, must not be `NULL`
+ * @return        Zero on success, -1 on error, 1 if the write
+ *                end has closed and all data has been read; on
+ *                error, `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_read_done(shr_fast_t *restrict fast)
+{
+	shr_t *shr = fast->shr;
+	if (SHR_UNLIKELY(fast->generic))
+		return shr_read_done(shr);
+	if (fast->local)
+		shr_fast_release_(fast);
+	else if (SHR_UNLIKELY(shr_fast_semop_(fast, fast->slots[shr->current_buffer].write_sem, +1, 0)))
+		return -1;
+	shr->current_buffer = shr_fast_next_(fast, shr->current_buffer);
+	return SHR_UNLIKELY(*(size_t *)(void *)(shr->address) == shr->current_buffer + 1);
+}
+
+
+/**
+ * Inline variant of `shr_write`
+ * 
+ * @param   fast    The fast path descriptor, must not be `NULL`
+ * @param   buffer  Output parameter for the buffer where the data
+ *                  should be written, must not be `NULL` and will
+ *                  have the allocation size `SHR_BUFFER_SIZE(fast->shr)`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM, EINTR and EINVAL, as specified for semop(3)
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_write(shr_fast_t *restrict fast, char **restrict buffer)
+{
+	const shr_fast_slot_t *slot = fast->slots + fast->shr->current_buffer;
+	if (SHR_UNLIKELY(fast->generic))
+		return shr_write(fast->shr, buffer);
+	if (fast->local) {
+		if (SHR_UNLIKELY(!shr_fast_available_(fast)))
+			return shr_write(fast->shr, buffer);
+	} else if (SHR_UNLIKELY(shr_fast_semop_(fast, slot->write_sem, -1, 0))) {
+		return -1;
+	}
+	*buffer = slot->buffer;
+	return 0;
+}
+
+
+/**
+ * Inline variant of `shr_write_try`
+ * 
+ * @param   fast    The fast path descriptor, must not be `NULL`
+ * @param   buffer  Output parameter for the buffer where the data
+ *                  should be written, must not be `NULL` and will
+ *                  have the allocation size `SHR_BUFFER_SIZE(fast->shr)`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EAGAIN, EIDRM, EINTR and EINVAL,
+ *          as specified for semop(3)
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_write_try(shr_fast_t *restrict fast, char **restrict buffer)
+{
+	const shr_fast_slot_t *slot = fast->slots + fast->shr->current_buffer;
+	if (SHR_UNLIKELY(fast->generic))
+		return shr_write_try(fast->shr, buffer);
+	if (fast->local) {
+		if (!shr_fast_available_(fast))
+			return errno = EAGAIN, -1;
+	} else if (shr_fast_semop_(fast, slot->write_sem, -1, IPC_NOWAIT)) {
+		return -1;
+	}
+	*buffer = slot->buffer;
+	return 0;
+}
+
+
+/**
+ * Inline variant of `shr_write_done`
+ * 
+ * @param   fast    The fast path descriptor, must not be `NULL`
+ * @param   length  The number of written bytes,
+ *                  may not exceed `SHR_BUFFER_SIZE(fast->shr)`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  The errors EACCES, EIDRM and EINVAL, as specified for semop(3)
+ */
+SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)))
+static inline int
+shr_fast_write_done(shr_fast_t *restrict fast, size_t length)
+{
+	shr_t *shr = fast->shr;
+	const shr_fast_slot_t *slot = fast->slots + shr->current_buffer;
+	if (SHR_UNLIKELY(fast->generic))
+		return shr_write_done(shr, length);
+	*(slot->length) = length;
+	if (fast->local) {
+		shr_fast_release_(fast);
+	} else {
+		/* Only the writer stores it, so it need not be incremented atomically. */
+		__atomic_store_n(fast->published, __atomic_load_n(fast->published, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+		if (SHR_UNLIKELY(shr_fast_semop_(fast, slot->read_sem, +1, 0)))
+			return -1;
+	}
+	shr->current_buffer = shr_fast_next_(fast, shr->current_buffer);
+	return 0;
+}
+
+
+
+#endif
@@ -0,0 +1,403 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_PIPELINE_H
+#define SHR_PIPELINE_H
+
+
+#include "shr.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+
+/**
+ * A graph of stages connected by shared ring buffers
+ */
+typedef struct shr_pipeline shr_pipeline_t;
+
+/**
+ * A stage in a pipeline, as seen by the stage itself
+ */
+typedef struct shr_stage shr_stage_t;
+
+/**
+ * The function run by a stage
+ * 
+ * When the function returns, an empty buffer, which marks the
+ * end of the stream, is published to each output, and the
+ * remaining data in the inputs is discarded
+ * 
+ * @param   stage  The stage
+ * @param   user   The user-supplied argument for the stage
+ * @return         Zero on success, -1 on error
+ */
+typedef int shr_stage_func_t(shr_stage_t *, void *);
+
+
+/**
+ * An entry in the table of functions that a
+ * pipeline configuration can refer to
+ */
+struct shr_stage_func
+{
+	/**
+	 * The name of the function in the configuration,
+	 * `NULL` in the last entry in the table
+	 */
+	const char *name;
+
+	/**
+	 * The function
+	 */
+	shr_stage_func_t *func;
+};
+
+
+/**
+ * Flags for `shr_pipeline_add_stage`
+ */
+enum shr_stage_flags
+{
+	/**
+	 * Run the stage in a child process
+	 * rather than in a thread
+	 */
+	SHR_STAGE_PROCESS = 0x0001,
+
+};
+
+
+/**
+ * Flags for `shr_pipeline_start`
+ */
+enum shr_pipeline_flags
+{
+	/**
+	 * Pin each stage to a CPU, such that
+	 * connected stages share a cache
+	 */
+	SHR_PIPELINE_PIN = 0x0001,
+
+};
+
+
+/**
+ * Metrics for a stage
+ */
+struct shr_stage_stats
+{
+	/**
+	 * The number of buffers read
+	 */
+	uint64_t messages_in;
+
+	/**
+	 * The number of buffers written
+	 */
+	uint64_t messages_out;
+
+	/**
+	 * The number of bytes read
+	 */
+	uint64_t bytes_in;
+
+	/**
+	 * The number of bytes written
+	 */
+	uint64_t bytes_out;
+
+	/**
+	 * The number of nanoseconds spent waiting
+	 * for data in the inputs
+	 */
+	uint64_t blocked_in_ns;
+
+	/**
+	 * The number of nanoseconds spent waiting
+	 * for free buffers in the outputs
+	 */
+	uint64_t blocked_out_ns;
+
+	/**
+	 * The number of nanoseconds the stage
+	 * function ran
+	 */
+	uint64_t run_ns;
+
+	/**
+	 * The CPU the stage was pinned to, -1 if none
+	 */
+	int cpu;
+};
+
+
+
+/**
+ * Create an empty pipeline
+ * 
+ * @return  The pipeline, `NULL` on error; on error,
+ *          `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for malloc(3)
+ */
+shr_pipeline_t *shr_pipeline_create(void)
+	SHR_COMPILER_GCC(__attribute__((warn_unused_result, malloc)));
+
+/**
+ * Stop and destroy a pipeline, and remove its shared ring buffers
+ * 
+ * If the pipeline has been started, `shr_pipeline_wait` is
+ * called first, unless it already has been
+ * 
+ * @param  pipeline  The pipeline, nothing will happen if this is `NULL`
+ */
+void shr_pipeline_destroy(shr_pipeline_t *);
+
+/**
+ * Add a stage to a pipeline
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @param   name      The name of the stage, must not be `NULL`
+ * @param   func      The function the stage runs, must not be `NULL`
+ * @param   user      The second argument for `func`
+ * @param   flags     Bitwise-OR of `enum shr_stage_flags` values
+ * @return            The index of the stage, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY   The pipeline has been started
+ * @throws  EEXIST  The pipeline already has a stage named `name`
+ * @throws  Any error specified for malloc(3)
+ */
+ssize_t shr_pipeline_add_stage(shr_pipeline_t *restrict, const char *restrict, shr_stage_func_t *, void *, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2, 3))));
+
+/**
+ * Connect two stages in a pipeline with a shared ring buffer,
+ * which will be the next output of `from` and the next input of `to`
+ * 
+ * If both stages run in threads, a local shared ring buffer is
+ * used, otherwise a private shared ring buffer is used
+ * 
+ * @param   pipeline      The pipeline, must not be `NULL`
+ * @param   from          The index of the writing stage
+ * @param   to            The index of the reading stage
+ * @param   buffer_size   The size of each buffer, 0 to select a size
+ *                        that lets the shared ring buffer fit in half
+ *                        of the level 2 cache
+ * @param   buffer_count  The number of buffers, 0 for 4
+ * @return                The index of the connection, -1 on error; on
+ *                        error, `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY   The pipeline has been started
+ * @throws  EINVAL  `from` or `to` is not the index of a stage
+ * @throws  Any error specified for malloc(3)
+ */
+ssize_t shr_pipeline_connect(shr_pipeline_t *restrict, size_t, size_t, size_t, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Add stages and connections to a pipeline from a configuration
+ * 
+ * The configuration is a text with one declaration per line;
+ * empty lines and text after a '#' are ignored:
+ * 
+ *     stage NAME FUNCTION [thread | process]
+ *     ring FROM TO [BUFFER_SIZE [BUFFER_COUNT]]
+ * 
+ * where FUNCTION is the name of a function in `functions`,
+ * and FROM and TO are the names of previously declared stages
+ * 
+ * @param   pipeline   The pipeline, must not be `NULL`
+ * @param   config     The configuration, must not be `NULL`
+ * @param   functions  Table of the functions the configuration may refer to,
+ *                     terminated by an entry whose `name` is `NULL`
+ * @param   user       The user-supplied argument for every stage
+ * @param   line       Output parameter for the line of the error, ignored if `NULL`
+ * @return             Zero on success, -1 on error; on error,
+ *                     `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The configuration is malformed, or refers to an
+ *                  unknown function or stage
+ * @throws  Any error specified for `shr_pipeline_add_stage` and
+ *          `shr_pipeline_connect`
+ */
+int shr_pipeline_load(shr_pipeline_t *restrict, const char *restrict, const struct shr_stage_func *, void *, size_t *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2, 3))));
+
+/**
+ * Create the shared ring buffers of a pipeline and start its stages,
+ * stages that run in processes are started before stages that
+ * run in threads
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @param   flags     Bitwise-OR of `enum shr_pipeline_flags` values
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY  The pipeline has already been started
+ * @throws  Any error specified for `shr_open`, `shr_open_local`, mmap(2),
+ *          fork(2) and pthread_create(3)
+ */
+int shr_pipeline_start(shr_pipeline_t *restrict, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Wait for all stages of a started pipeline to finish
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @return            Zero if all stages succeeded, -1 otherwise
+ */
+int shr_pipeline_wait(shr_pipeline_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Get the metrics of a stage in a pipeline, they
+ * are only complete after `shr_pipeline_wait`
+ * 
+ * @param   pipeline  The pipeline, must not be `NULL`
+ * @param   stage     The index of the stage
+ * @param   stats     Output parameter for the metrics, must not be `NULL`
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `stage` is not the index of a stage
+ */
+int shr_pipeline_stats(const shr_pipeline_t *restrict, size_t, struct shr_stage_stats *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Print a table of the metrics of all stages in a pipeline,
+ * and mark the stage that is most likely the bottleneck, that
+ * is, the stage that spent the smallest part of its time blocked
+ * 
+ * @param  pipeline  The pipeline, must not be `NULL`
+ * @param  stream    The stream to print to, must not be `NULL`
+ */
+void shr_pipeline_report(const shr_pipeline_t *restrict, FILE *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+
+/**
+ * Get the name of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @return         The name of the stage
+ */
+const char *shr_stage_name(const shr_stage_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Get the number of inputs of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @return         The number of inputs
+ */
+size_t shr_stage_inputs(const shr_stage_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Get the number of outputs of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @return         The number of outputs
+ */
+size_t shr_stage_outputs(const shr_stage_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Get the shared ring buffer of an input or output of a stage
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   output  Non-zero for an output, zero for an input
+ * @param   i       The index of the input or output
+ * @return          The shared ring buffer
+ */
+shr_t *shr_stage_ring(shr_stage_t *restrict, int, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Variant of `shr_read` for an input of a stage, that
+ * records metrics and recognises the end of the stream
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   i       The index of the input
+ * @param   buffer  Output parameter for the buffer to read, must not be `NULL`
+ * @param   length  Output parameter for the length of `*buffer`, must not be `NULL`
+ * @return          Zero on success, 1 at the end of the stream, -1 on error;
+ *                  on error, `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read` and `shr_read_done`
+ */
+int shr_stage_read(shr_stage_t *restrict, size_t, const char **restrict, size_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Variant of `shr_read_done` for an input of a stage
+ * 
+ * @param   stage  The stage, must not be `NULL`
+ * @param   i      The index of the input
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read_done`
+ */
+int shr_stage_read_done(shr_stage_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Variant of `shr_write` for an output of a stage,
+ * that records metrics
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   i       The index of the output
+ * @param   buffer  Output parameter for the buffer to write, must not be `NULL`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_write`
+ */
+int shr_stage_write(shr_stage_t *restrict, size_t, char **restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Variant of `shr_write_done` for an output of a stage,
+ * empty buffers mark the end of the stream, and must not
+ * be written by the stage
+ * 
+ * @param   stage   The stage, must not be `NULL`
+ * @param   i       The index of the output
+ * @param   length  The number of written bytes, must not be 0
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `length` is 0
+ * @throws  Any error specified for `shr_write_done`
+ */
+int shr_stage_write_done(shr_stage_t *restrict, size_t, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+
+
+#endif
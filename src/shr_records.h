@@ -0,0 +1,198 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_RECORDS_H
+#define SHR_RECORDS_H
+
+
+#include "shr.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * The number of 64-byte blocks `shr_records_next`
+ * scans at a time, so that the data is still
+ * cached when the records in it are returned
+ */
+#define SHR_RECORDS_WINDOW  16
+
+
+
+/**
+ * Iterator over delimited records, such as lines,
+ * in the data read from a shared ring buffer
+ * 
+ * The writer may split the data between buffers
+ * anywhere, records that lie within one buffer are
+ * returned in place, and records that straddle
+ * buffers are reassembled in `carry`
+ */
+typedef struct shr_records
+{
+	/**
+	 * The read end of the shared ring buffer
+	 */
+	shr_t *shr;
+
+	/**
+	 * The buffer being scanned, `NULL` if none is held
+	 */
+	const char *buffer;
+
+	/**
+	 * The length of the data in `buffer`
+	 */
+	size_t length;
+
+	/**
+	 * The offset, in `buffer`, of the next record
+	 */
+	size_t start;
+
+	/**
+	 * For each 64-byte block in the window of `buffer`
+	 * that has been scanned, the positions of the
+	 * delimiters in the block
+	 */
+	uint64_t masks[SHR_RECORDS_WINDOW];
+
+	/**
+	 * The index of the first block in the window
+	 */
+	size_t first;
+
+	/**
+	 * The index of the first block after the window
+	 */
+	size_t blocks;
+
+	/**
+	 * Bit i is set if and only if there
+	 * is a delimiter in block `first + i`
+	 */
+	uint32_t nonempty;
+
+	/**
+	 * The index of the current block in `buffer`
+	 */
+	size_t block;
+
+	/**
+	 * The positions of the delimiters, in the
+	 * current block, that have not been returned
+	 */
+	uint64_t mask;
+
+	/**
+	 * The part of a record that straddles
+	 * buffers, read from the previous buffers
+	 */
+	char *carry;
+
+	/**
+	 * The length of the data in `carry`
+	 */
+	size_t carry_length;
+
+	/**
+	 * The allocation size of `carry`
+	 */
+	size_t carry_size;
+
+	/**
+	 * Whether the last returned record was
+	 * in `carry` and shall be discarded
+	 */
+	int carried;
+
+	/**
+	 * Whether the end of the data has been reached
+	 */
+	int done;
+
+	/**
+	 * The delimiter
+	 */
+	unsigned char delimiter;
+
+} shr_records_t;
+
+
+
+/**
+ * Initialise an iterator over the records in the
+ * data read from a shared ring buffer
+ * 
+ * @param  it         Output parameter for the iterator, must not be `NULL`
+ * @param  shr        The read end of the shared ring buffer, must not
+ *                    be `NULL`, and must not be used otherwise until
+ *                    `shr_records_destroy` has been called
+ * @param  delimiter  The byte that ends each record, such as '\n' or '\0'
+ */
+void shr_records_init(shr_records_t *restrict, shr_t *restrict, unsigned char)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Get the next record from a shared ring buffer, waiting
+ * for the writer to publish more data if necessary
+ * 
+ * The data ends when the writer publishes an empty buffer,
+ * or when it has closed and all data has been read; if the
+ * data does not end with a delimiter, the remainder is
+ * returned as the last record
+ * 
+ * The delimiters are found with vector instructions,
+ * selected for the CPU at runtime, that scan 64 bytes
+ * at a time
+ * 
+ * @param   it      The iterator, must not be `NULL`
+ * @param   record  Output parameter for the record, without its delimiter,
+ *                  valid until the next call with `it`; it is in the
+ *                  shared ring buffer unless the record straddles buffers
+ * @param   length  Output parameter for the length of the record
+ * @return          1 if a record was returned, 0 at the end of the data,
+ *                  -1 on error; on error, `errno` will be set to describe
+ *                  the error
+ * 
+ * @throws  EBADMSG  The shared ring buffer has the flag `SHR_CHECKSUM`, and
+ *                   the checksum of a buffer does not match its content; the
+ *                   buffer, and the part of a record read before it, is discarded
+ * @throws  ENOMEM   Memory for reassembling a record could not be allocated
+ * @throws  Any error specified for `shr_read` and `shr_read_done`
+ */
+int shr_records_next(shr_records_t *restrict, const char **restrict, size_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Release the buffer an iterator holds, if any,
+ * and the memory it has allocated; the shared ring
+ * buffer itself is not closed
+ * 
+ * @param  it  The iterator, nothing will happen if this is `NULL`
+ */
+void shr_records_destroy(shr_records_t *restrict);
+
+
+#endif
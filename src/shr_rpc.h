@@ -0,0 +1,344 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_RPC_H
+#define SHR_RPC_H
+
+
+#include "shr.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * An end of a request/reply channel: a shared ring buffer
+ * of requests, from the client to the server, and a
+ * shared ring buffer of replies, from the server to the
+ * client, where each reply is tagged with the identifier
+ * of its request
+ */
+typedef struct shr_rpc shr_rpc_t;
+
+
+/**
+ * The ends of a request/reply channel
+ */
+enum shr_rpc_role
+{
+	/**
+	 * Open the end that sends requests
+	 */
+	SHR_RPC_CLIENT = 0,
+
+	/**
+	 * Open the end that replies to them
+	 */
+	SHR_RPC_SERVER = 1,
+
+};
+
+
+/**
+ * The keys of the shared ring buffers of a request/reply channel
+ */
+struct shr_rpc_key
+{
+	/**
+	 * The key of the shared ring buffer of requests
+	 */
+	shr_key_t request;
+
+	/**
+	 * The key of the shared ring buffer of replies
+	 */
+	shr_key_t reply;
+};
+
+
+/**
+ * Function that is called, by the client, when
+ * the reply to a request sent with `shr_rpc_send`
+ * has been received
+ * 
+ * @param  user    The user-supplied argument for the request
+ * @param  id      The identifier of the request
+ * @param  reply   The reply, only valid until the function returns,
+ *                 `NULL` if the reply's checksum did not match
+ * @param  length  The length of `reply`
+ */
+typedef void shr_rpc_callback_t(void *, uint64_t, const char *, size_t);
+
+/**
+ * Function that is called, by `shr_rpc_serve`,
+ * to write the reply to a request
+ * 
+ * @param   user     The user-supplied argument
+ * @param   id       The identifier of the request
+ * @param   request  The request
+ * @param   length   The length of `request`
+ * @param   reply    Output buffer for the reply
+ * @param   size     The size of `reply`
+ * @return           The length of the reply, -1 to make
+ *                   `shr_rpc_serve` fail with `errno` as set
+ */
+typedef ssize_t shr_rpc_handler_t(void *, uint64_t, const char *, size_t, char *, size_t);
+
+
+
+/**
+ * Create the shared ring buffers of a request/reply channel
+ * 
+ * @param   key           Output parameter for the keys, must not be `NULL`
+ * @param   buffer_size   The size of each buffer, which limits the
+ *                        length of requests and replies
+ * @param   buffer_count  The number of buffers in each shared ring buffer,
+ *                        which limits the number of outstanding requests
+ * @param   permissions   The permissions of the shared ring buffers
+ * @param   flags         Bitwise-OR of `enum shr_flags` values, `SHR_TAGGED`
+ *                        is always added, `SHR_OVERWRITE` and `SHR_LATEST`
+ *                        are not allowed
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error,
+ *                        and no shared ring buffer will have been created
+ * 
+ * @throws  EINVAL  `flags` contains `SHR_OVERWRITE` or `SHR_LATEST`,
+ *                  or `buffer_count` is greater than 65536
+ * @throws  Any error specified for `shr_create_flags`
+ */
+int shr_rpc_create(struct shr_rpc_key *restrict, size_t, size_t, mode_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Open an end of a request/reply channel
+ * 
+ * @param   key   The keys of the channel, must not be `NULL`
+ * @param   role  `SHR_RPC_CLIENT` or `SHR_RPC_SERVER`
+ * @return        The end, `NULL` on error; on error,
+ *                `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffers do not have the flag `SHR_TAGGED`,
+ *                  or have more than 65536 buffers, or `role` is not
+ *                  a value of `enum shr_rpc_role`
+ * @throws  Any error specified for `shr_open` and malloc(3)
+ */
+shr_rpc_t *shr_rpc_open(const struct shr_rpc_key *restrict, enum shr_rpc_role)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result, malloc)));
+
+/**
+ * Create a request/reply channel of local shared ring
+ * buffers, and open both of its ends; see `shr_open_local`
+ * 
+ * @param   client        Output parameter for the client end, must not be `NULL`
+ * @param   server        Output parameter for the server end, must not be `NULL`
+ * @param   buffer_size   The size of each buffer
+ * @param   buffer_count  The number of buffers in each shared ring buffer
+ * @param   flags         As for `shr_rpc_create`
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `flags` contains `SHR_OVERWRITE` or `SHR_LATEST`,
+ *                  or `buffer_count` is greater than 65536
+ * @throws  Any error specified for `shr_open_local` and malloc(3)
+ */
+int shr_rpc_open_local(shr_rpc_t **restrict, shr_rpc_t **restrict, size_t, size_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Close an end of a request/reply channel, when the client
+ * closes, the server's `shr_rpc_recv` returns 1 once it
+ * has received all requests
+ * 
+ * @param  rpc  The end, nothing will happen if this is `NULL`
+ */
+void shr_rpc_close(shr_rpc_t *);
+
+/**
+ * Close an end of a request/reply channel, and remove the
+ * shared ring buffers of the channel; for a local channel,
+ * the other end must have been closed first
+ * 
+ * @param  rpc  The end, nothing will happen if this is `NULL`
+ */
+void shr_rpc_remove(shr_rpc_t *);
+
+/**
+ * Send a request, and wait for its reply
+ * 
+ * Replies to requests sent with `shr_rpc_send` that are
+ * received meanwhile are passed to their callbacks
+ * 
+ * @param   rpc      The client, must not be `NULL`
+ * @param   request  The request, must not be `NULL` unless `length` is 0
+ * @param   length   The length of `request`
+ * @param   reply    Output buffer for the reply, must not be `NULL` unless `size` is 0
+ * @param   size     The size of `reply`, if the reply is longer, it is truncated
+ * @return           The length of the reply, which may be greater than `size`,
+ *                   -1 on error; on error, `errno` will be set to describe the error
+ * 
+ * @throws  EBADF     `rpc` is not a client
+ * @throws  EMSGSIZE  `length` is greater than the buffer size
+ * @throws  EBADMSG   The shared ring buffer of replies has the flag `SHR_CHECKSUM`,
+ *                    and the checksum of the reply does not match its content
+ * @throws  EPROTO    A reply does not match any outstanding request
+ * @throws  EPIPE     The server has closed
+ * @throws  Any error specified for `shr_write`, `shr_read` and `shr_read_done`
+ */
+ssize_t shr_rpc_call(shr_rpc_t *restrict, const void *restrict, size_t, void *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Send a request without waiting for its reply, which is
+ * passed to a callback by `shr_rpc_complete` or `shr_rpc_call`
+ * 
+ * At most as many requests as the shared ring buffer of replies
+ * has buffers can be outstanding, so that the server never has to
+ * wait for the client to take a reply; if that many are, this
+ * function waits for a reply, and passes it to its callback
+ * 
+ * @param   rpc       The client, must not be `NULL`
+ * @param   request   The request, must not be `NULL` unless `length` is 0
+ * @param   length    The length of `request`
+ * @param   callback  The function to call with the reply, must not be `NULL`
+ * @param   user      The first argument for `callback`
+ * @param   id        Output parameter for the identifier of the request, ignored if `NULL`
+ * @return            Zero on success, -1 on error; on error,
+ *                    `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_rpc_call`
+ */
+int shr_rpc_send(shr_rpc_t *restrict, const void *restrict, size_t, shr_rpc_callback_t *, void *, uint64_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 4), warn_unused_result)));
+
+/**
+ * Receive replies to requests sent with `shr_rpc_send`,
+ * and pass them to their callbacks
+ * 
+ * @param   rpc     The client, must not be `NULL`
+ * @param   nowait  Zero to wait for a reply if none has been received,
+ *                  non-zero to only take the replies already received
+ * @return          The number of replies passed to their callbacks, which,
+ *                  unless `nowait` is non-zero, is only 0 if no request is
+ *                  outstanding, -1 on error; on error, `errno` will be set
+ *                  to describe the error
+ * 
+ * @throws  EBADF   `rpc` is not a client
+ * @throws  EPROTO  A reply does not match any outstanding request
+ * @throws  EPIPE   The server has closed
+ * @throws  Any error specified for `shr_read` and `shr_read_done`
+ */
+ssize_t shr_rpc_complete(shr_rpc_t *restrict, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Get the number of outstanding requests of a client
+ * 
+ * @param   rpc  The client, must not be `NULL`
+ * @return       The number of requests that have been
+ *               sent but whose replies have not been received
+ */
+size_t shr_rpc_pending(const shr_rpc_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Wait for a request
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   rpc      The server, must not be `NULL`
+ * @param   id       Output parameter for the identifier of the request, must not be `NULL`
+ * @param   request  Output parameter for the request, must not be `NULL`
+ * @param   length   Output parameter for the length of `*request`, must not be `NULL`
+ * @return           Zero on success, 1 if the client has closed and all requests
+ *                   have been received, -1 on error; on error, `errno` will be set
+ *                   to describe the error
+ * 
+ * @throws  EBADF    `rpc` is not a server
+ * @throws  EBADMSG  The shared ring buffer of requests has the flag `SHR_CHECKSUM`,
+ *                   and the checksum of the request does not match its content;
+ *                   `*id` is set, and the request must still be replied to,
+ *                   for example with an empty reply, and marked as fully read
+ * @throws  Any error specified for `shr_read`
+ */
+int shr_rpc_recv(shr_rpc_t *restrict, uint64_t *restrict, const char **restrict, size_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Mark the request returned by `shr_rpc_recv` as fully read,
+ * the request may be replied to before or after this
+ * 
+ * @param   rpc  The server, must not be `NULL`
+ * @return       Zero on success, -1 on error; on error,
+ *               `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read_done`
+ */
+int shr_rpc_recv_done(shr_rpc_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Send the reply to a request, requests may
+ * be replied to in any order, but only once
+ * 
+ * @param   rpc     The server, must not be `NULL`
+ * @param   id      The identifier of the request
+ * @param   reply   The reply, must not be `NULL` unless `length` is 0
+ * @param   length  The length of `reply`
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EBADF     `rpc` is not a server
+ * @throws  EMSGSIZE  `length` is greater than the buffer size
+ * @throws  Any error specified for `shr_write` and `shr_write_done`
+ */
+int shr_rpc_reply(shr_rpc_t *restrict, uint64_t, const void *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+/**
+ * Reply to requests, in order, with a handler that writes
+ * each reply directly into the shared ring buffer of replies,
+ * until the client has closed and all requests have been served
+ * 
+ * A request that fails its checksum, and a request for which
+ * `handler` fails or returns a length greater than the buffer
+ * size, is answered with an empty reply and marked as fully
+ * read; in the latter case, the function then fails
+ * 
+ * @param   rpc      The server, must not be `NULL`
+ * @param   handler  The handler, must not be `NULL`
+ * @param   user     The first argument for `handler`
+ * @return           Zero on success, -1 on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EBADF     `rpc` is not a server
+ * @throws  EMSGSIZE  `handler` returned a length greater than the buffer size
+ * @throws  Any error specified for `shr_read`, `shr_read_done`,
+ *          `shr_write` and `shr_write_done`, and by `handler`
+ */
+int shr_rpc_serve(shr_rpc_t *restrict, shr_rpc_handler_t *, void *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2), warn_unused_result)));
+
+
+
+#endif
@@ -0,0 +1,291 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_SHARD_H
+#define SHR_SHARD_H
+
+
+#include "shr.h"
+
+#include <stdint.h>
+
+
+
+/**
+ * A logical channel striped over a number of shared ring
+ * buffers, its shards, where data is routed to a shard by
+ * a key, so that data with the same key stays in order
+ */
+typedef struct shr_shard shr_shard_t;
+
+
+/**
+ * Metrics for a shard, as seen by one end
+ */
+struct shr_shard_stats
+{
+	/**
+	 * The number of buffers written or read,
+	 * not counting those that mark the end of the stream
+	 */
+	uint64_t messages;
+
+	/**
+	 * The number of bytes written or read
+	 */
+	uint64_t bytes;
+
+	/**
+	 * The number of nanoseconds spent waiting for a free
+	 * buffer in the shard, or, when reading, for data in
+	 * any of the shards the reader owns
+	 */
+	uint64_t blocked_ns;
+};
+
+
+
+/**
+ * Create the shared ring buffers of a sharded channel
+ * 
+ * @param   keys          Output parameter for the keys of the shards, must
+ *                        not be `NULL`, must have room for `count` keys
+ * @param   count         The number of shards, at least 1
+ * @param   buffer_size   The size of each buffer
+ * @param   buffer_count  The number of buffers in each shard
+ * @param   permissions   The permissions for the shards
+ * @param   flags         Bitwise-OR of `enum shr_flags` values
+ * @return                Zero on success, -1 on error; on error,
+ *                        `errno` will be set to describe the error,
+ *                        and no shard will have been created
+ * 
+ * @throws  EINVAL  `count` is 0
+ * @throws  Any error specified for `shr_create_flags`
+ */
+int shr_shard_create(shr_key_t *restrict, size_t, size_t, size_t, mode_t, int)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Remove the shared ring buffers of a sharded channel
+ * 
+ * @param  keys   The keys of the shards, must not be `NULL`
+ * @param  count  The number of shards
+ */
+void shr_shard_remove(const shr_key_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Open the write end of every shard of a sharded channel
+ * 
+ * @param   keys   The keys of the shards, must not be `NULL`
+ * @param   count  The number of shards, at least 1
+ * @return         The write end, `NULL` on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `count` is 0
+ * @throws  Any error specified for `shr_open` and malloc(3)
+ */
+shr_shard_t *shr_shard_open(const shr_key_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result, malloc)));
+
+/**
+ * Join the consumer group of a sharded channel, that is, open
+ * the read end of the shards that belong to a member of the
+ * group: shard `i` belongs to the member `i % members`, so that
+ * each shard is read by exactly one member
+ * 
+ * @param   keys     The keys of the shards, must not be `NULL`
+ * @param   count    The number of shards, at least 1
+ * @param   member   The index of the member, less than `members`
+ * @param   members  The number of members in the group, at most `count`
+ * @return           The read end, `NULL` on error; on error,
+ *                   `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `count` is 0, `members` is 0 or greater than
+ *                  `count`, or `member` is not less than `members`
+ * @throws  Any error specified for `shr_open` and malloc(3)
+ */
+shr_shard_t *shr_shard_join(const shr_key_t *restrict, size_t, size_t, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result, malloc)));
+
+/**
+ * Close an end of a sharded channel
+ * 
+ * @param  shard  The end, nothing will happen if this is `NULL`
+ */
+void shr_shard_close(shr_shard_t *);
+
+/**
+ * Get the number of shards in a sharded channel
+ * 
+ * @param   shard  The end, must not be `NULL`
+ * @return         The number of shards
+ */
+size_t shr_shard_count(const shr_shard_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Get the shared ring buffer of a shard, for use
+ * with the other functions in <shr.h>
+ * 
+ * @param   shard  The end, must not be `NULL`
+ * @param   i      The index of the shard
+ * @return         The shared ring buffer, `NULL` if the
+ *                 end does not use the shard
+ */
+shr_t *shr_shard_ring(shr_shard_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+/**
+ * Get the shard data with a key is routed to
+ * 
+ * The shard is selected from the CRC32C checksum
+ * of the key, so it is the same in every process
+ * 
+ * @param   shard   The end, must not be `NULL`
+ * @param   key     The key, must not be `NULL` unless `length` is 0
+ * @param   length  The length of `key`
+ * @return          The index of the shard
+ */
+size_t shr_shard_of(const shr_shard_t *restrict, const void *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), pure)));
+
+/**
+ * Wait for a buffer, in the shard data with a key
+ * is routed to, to be ready for writing
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shard   The write end, must not be `NULL`
+ * @param   key     The key, must not be `NULL` unless `length` is 0
+ * @param   length  The length of `key`
+ * @param   buffer  Output parameter for the buffer to write, must not be `NULL`
+ * @return          The index of the shard, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EBADF  `shard` is not a write end
+ * @throws  Any error specified for `shr_write`
+ */
+ssize_t shr_shard_write(shr_shard_t *restrict, const void *restrict, size_t, char **restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 4), warn_unused_result)));
+
+/**
+ * Publish the buffer acquired with `shr_shard_write`, empty
+ * buffers mark the end of the stream, and must not be written
+ * 
+ * @param   shard   The write end, must not be `NULL`
+ * @param   length  The number of written bytes, must not be 0
+ * @return          Zero on success, -1 on error; on error,
+ *                  `errno` will be set to describe the error
+ * 
+ * @throws  EBADF   `shard` is not a write end
+ * @throws  EINVAL  `length` is 0, the buffer is given back unpublished
+ * @throws  Any error specified for `shr_write_done`
+ */
+int shr_shard_write_done(shr_shard_t *restrict, size_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Mark the end of the stream in every shard, so that
+ * `shr_shard_read` returns 1 once all data has been read
+ * 
+ * @param   shard  The write end, must not be `NULL`
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  EBADF  `shard` is not a write end
+ * @throws  Any error specified for `shr_write`
+ */
+int shr_shard_finish(shr_shard_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Wait for a buffer in any of the shards a member of a consumer
+ * group owns to be filled with readable data
+ * 
+ * The shards are taken in turn, so that none of them is starved;
+ * if the member owns one shard, the function blocks on it,
+ * otherwise the shards are polled, with exponential backoff,
+ * while none of them has any data
+ * 
+ * Undefined behaviour is invoked if multiple processes use this
+ * function, even if not concurrently
+ * 
+ * @param   shard   The read end, must not be `NULL`
+ * @param   index   Output parameter for the index of the shard, ignored if `NULL`
+ * @param   buffer  Output parameter for the buffer to read, must not be `NULL`
+ * @param   length  Output parameter for the length of `*buffer`, must not be `NULL`
+ * @return          Zero on success, 1 at the end of the stream in all of the
+ *                  shards, -1 on error; on error, `errno` will be set to
+ *                  describe the error
+ * 
+ * @throws  EBADF  `shard` is not a read end
+ * @throws  Any error specified for `shr_read`, `shr_read_try`
+ *          and `shr_read_done`, and nanosleep(3)
+ */
+int shr_shard_read(shr_shard_t *restrict, size_t *restrict, const char **restrict, size_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 3, 4), warn_unused_result)));
+
+/**
+ * Mark the buffer returned by `shr_shard_read` as fully read
+ * 
+ * @param   shard  The read end, must not be `NULL`
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  Any error specified for `shr_read_done`
+ */
+int shr_shard_read_done(shr_shard_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Get the metrics of a shard, as seen by an end
+ * 
+ * @param   shard  The end, must not be `NULL`
+ * @param   i      The index of the shard
+ * @param   stats  Output parameter for the metrics, must not be `NULL`
+ * @return         Zero on success, -1 on error; on error,
+ *                 `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  `i` is not the index of a shard the end uses
+ */
+int shr_shard_stats(const shr_shard_t *restrict, size_t, struct shr_shard_stats *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull)));
+
+/**
+ * Measure how unevenly data is spread over the shards an
+ * end uses: the number of messages in the busiest shard
+ * divided by the average number of messages per shard
+ * 
+ * @param   shard  The end, must not be `NULL`
+ * @return         The skew, 1 if the shards are evenly loaded, up to
+ *                 the number of shards if one shard gets all data; 0
+ *                 if no data has been written or read
+ */
+double shr_shard_skew(const shr_shard_t *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull, pure)));
+
+
+
+#endif
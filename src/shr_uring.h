@@ -0,0 +1,233 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHR_URING_H
+#define SHR_URING_H
+
+
+#include "shr.h"
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+
+
+/**
+ * The maximum number of buffers one submission transfers
+ */
+#define SHR_URING_MAX  16
+
+/**
+ * Get the `user_data` an end was given by `shr_uring_init`,
+ * from the `user_data` of any of its completion queue entries
+ * 
+ * @param   USER_DATA:uint64_t  The `user_data` of the completion queue entry
+ * @return  :uint64_t           The `user_data` given to `shr_uring_init`
+ */
+#define SHR_URING_USER_DATA(USER_DATA)  ((uint64_t)(USER_DATA) & ~(uint64_t)1)
+
+
+
+/**
+ * Function that returns an unused submission queue entry of
+ * the caller's io_uring, that will be submitted with the next
+ * call to io_uring_enter(2), or `NULL` if the queue is full
+ * 
+ * The entry is filled in by the caller of the function
+ * 
+ * @param   context  The context given to `shr_uring_submit` or `shr_uring_wait`
+ * @return           The submission queue entry, `NULL` if none is available
+ */
+typedef struct io_uring_sqe *shr_uring_get_sqe_t(void *);
+
+
+/**
+ * An end of a local shared ring buffer, or of a shared ring buffer
+ * in an arena, that is waited upon and pumped through an io_uring
+ * 
+ * The end has at most one submission pending at a time, and
+ * this structure must not be moved while one is pending
+ */
+typedef struct shr_uring
+{
+	/**
+	 * The shared ring buffer
+	 */
+	shr_t *shr;
+
+	/**
+	 * The file descriptor the data is read from,
+	 * or written to, when the end is pumped
+	 */
+	int fd;
+
+	/**
+	 * The number of completions the pending
+	 * submission still expects, 0 if none
+	 */
+	int pending;
+
+	/**
+	 * The result of the pending wait, if any
+	 */
+	int32_t wait_res;
+
+	/**
+	 * The result of the pending transfer, if any
+	 */
+	int32_t io_res;
+
+	/**
+	 * The `user_data` of the submitted transfers, the
+	 * `user_data` of the submitted waits has the lowest
+	 * bit set as well
+	 */
+	uint64_t user_data;
+
+	/**
+	 * The number of buffers in the pending
+	 * transfer, 0 if only a wait is pending
+	 */
+	size_t count;
+
+	/**
+	 * The number of bytes of the current buffer that have
+	 * already been written, only used by the read end
+	 */
+	size_t offset;
+
+	/**
+	 * The buffers in the pending transfer
+	 */
+	struct iovec iov[SHR_URING_MAX];
+
+} shr_uring_t;
+
+
+
+/**
+ * Prepare an end of a shared ring buffer for use with an io_uring
+ * 
+ * The shared ring buffer must be local, see `shr_open_local`,
+ * or be in an arena, see `shr_arena_ring`, because io_uring
+ * can wait on their counters, which are futexes, but not on
+ * XSI semaphores
+ * 
+ * @param   u          Output parameter for the end, must not be `NULL`
+ * @param   shr        The shared ring buffer, must not be `NULL`, it must
+ *                     not be used in any other way while `u` is in use
+ * @param   fd         The file descriptor to read the data from, for the write
+ *                     end, or write the data to, for the read end, -1 if
+ *                     `shr_uring_submit` will not be used
+ * @param   user_data  The `user_data` to give the submission queue entries,
+ *                     must be even
+ * @return             Zero on success, -1 on error; on error,
+ *                     `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer is neither local nor in an arena,
+ *                  it has the flag `SHR_OVERWRITE`, `SHR_LATEST` or
+ *                  `SHR_OBSERVABLE`, it is the read end and has the flag
+ *                  `SHR_CHECKSUM`, it was opened for observing, or
+ *                  `user_data` is odd
+ */
+int shr_uring_init(shr_uring_t *restrict, shr_t *restrict, int, uint64_t)
+	SHR_COMPILER_GCC(__attribute__((nonnull, warn_unused_result)));
+
+/**
+ * Submit a transfer between the file descriptor and the available
+ * buffers of an end of a shared ring buffer, up to a limit
+ * 
+ * For the write end, the data is read from the file descriptor
+ * into the buffers, with a single IORING_OP_READV, and they are
+ * published when it completes; if no buffer is available, the read
+ * is linked to an IORING_OP_FUTEX_WAIT on the reader's counter, and
+ * reads into the current buffer once the reader has released it
+ * 
+ * For the read end, the data in the buffers is written to the file
+ * descriptor with a single IORING_OP_WRITEV, and they are marked as
+ * fully read when it completes; if no buffer is readable, only an
+ * IORING_OP_FUTEX_WAIT on the writer's counter is submitted, since
+ * the length of the data is unknown until it is published. A buffer
+ * that is written partially is resumed by the next transfer. An empty
+ * buffer, which marks the end of the data, is consumed without
+ * submitting anything, if it is the current buffer, and is otherwise
+ * left to the next call
+ * 
+ * @param   u            The end, must not be `NULL`
+ * @param   max_buffers  The maximum number of buffers to transfer,
+ *                       silently limited to `SHR_URING_MAX`
+ * @param   get_sqe      Function that returns an unused submission queue entry
+ * @param   context      The argument for `get_sqe`
+ * @return               Zero if the transfer was prepared, 1 if the read end
+ *                       reached the end of the data, -1 on error; on error,
+ *                       `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY  A submission is already pending, or `get_sqe` returned `NULL`
+ */
+int shr_uring_submit(shr_uring_t *restrict, size_t, shr_uring_get_sqe_t *, void *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 3), warn_unused_result)));
+
+/**
+ * Submit an IORING_OP_FUTEX_WAIT, that completes when the current
+ * buffer of an end of a shared ring buffer may have become available,
+ * after which it can be acquired with `shr_read_try` or `shr_write_try`
+ * 
+ * @param   u        The end, must not be `NULL`
+ * @param   get_sqe  Function that returns an unused submission queue entry
+ * @param   context  The argument for `get_sqe`
+ * @return           Zero if the wait was prepared, 1 if the buffer is
+ *                   already available, -1 on error; on error, `errno`
+ *                   will be set to describe the error
+ * 
+ * @throws  EBUSY  A submission is already pending, or `get_sqe` returned `NULL`
+ */
+int shr_uring_wait(shr_uring_t *restrict, shr_uring_get_sqe_t *, void *)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1, 2), warn_unused_result)));
+
+/**
+ * Handle a completion queue entry for an end of a shared ring buffer,
+ * that is, one whose `SHR_URING_USER_DATA(user_data)` is the `user_data`
+ * given to `shr_uring_init`; every such entry must be handled
+ * 
+ * @param   u          The end, must not be `NULL`
+ * @param   user_data  The `user_data` of the completion queue entry
+ * @param   res        The `res` of the completion queue entry
+ * @param   closed     Output parameter for whether the write end has
+ *                     closed and all data has been read, ignored if `NULL`
+ * @return             The number of bytes transferred, 0 if end of file
+ *                     was reached by the write end, which published an empty
+ *                     buffer, -1 on error; on error, `errno` will be set
+ *                     to describe the error, and no buffer is transferred
+ * 
+ * @throws  EINPROGRESS  The submission has not completed yet
+ * @throws  EAGAIN       Nothing was transferred, because only a wait was
+ *                       submitted or the buffer became available before
+ *                       the wait started, submit again
+ * @throws  Any error specified for io_uring_enter(2), readv(2) or writev(2)
+ */
+ssize_t shr_uring_complete(shr_uring_t *restrict, uint64_t, int32_t, int *restrict)
+	SHR_COMPILER_GCC(__attribute__((nonnull(1), warn_unused_result)));
+
+
+#endif
@@ -0,0 +1,891 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/shm.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+
+/**
+ * The number of times each shared ring buffer
+ * is sampled between two refreshes
+ */
+#define SAMPLES  10
+
+/**
+ * Whether the flag `SHM_DEST` is set in the mode of a shared
+ * memory segment, that is, it has been removed, and only
+ * exists until every process has detached it
+ */
+#define REMOVED(mode)  ((mode) & 01000)
+
+
+
+/**
+ * A shared ring buffer, as seen by the monitor
+ */
+struct ring
+{
+	/**
+	 * The header of the shared ring buffer, attached read-only
+	 */
+	const struct shr_header *header;
+
+	/**
+	 * The index of the shared ring buffer in its arena, -1 if it
+	 * is not in an arena
+	 */
+	long index;
+
+	/**
+	 * The identifier of the semaphore array, -1 if
+	 * it does not have one or it cannot be read
+	 */
+	int sem;
+
+	/**
+	 * The number of published buffers, and the number
+	 * of fully read buffers, as of the last sample
+	 */
+	uint64_t published, consumed;
+
+	/**
+	 * `published` and `consumed` as of the last refresh
+	 */
+	uint64_t last_published, last_consumed;
+
+	/**
+	 * The values of the counters in the header of a shared
+	 * ring buffer in an arena as of the last sample
+	 */
+	uint32_t written_count, read_count;
+
+	/**
+	 * The number of buffers that have been published but
+	 * not read, as of the last sample, -1 if unknown
+	 */
+	long used;
+
+	/**
+	 * Whether `consumed` is known
+	 */
+	int have_consumed;
+
+	/**
+	 * The number of samples since the last refresh,
+	 * and in how many of them each end was waiting
+	 */
+	unsigned samples, writer_blocked, reader_blocked;
+
+	/**
+	 * The displayed rates, per second, and the displayed
+	 * part of the time, in percent, each end was waiting
+	 */
+	double write_rate, read_rate, writer_wait, reader_wait;
+
+	/**
+	 * The segment the shared ring buffer is in
+	 */
+	struct segment *segment;
+};
+
+
+/**
+ * A shared memory segment
+ */
+struct segment
+{
+	/**
+	 * The identifier of the segment
+	 */
+	int shm;
+
+	/**
+	 * The segment, attached read-only, `NULL` if
+	 * it is not a shared ring buffer or an arena
+	 */
+	char *address;
+
+	/**
+	 * The shared ring buffers in the segment
+	 */
+	struct ring *rings;
+
+	/**
+	 * The number of elements in `rings`
+	 */
+	size_t count;
+
+	/**
+	 * The owner, permissions, creator and number of
+	 * attachments of the segment, as of the last scan
+	 */
+	uid_t uid;
+	mode_t mode;
+	pid_t cpid;
+	unsigned long nattch;
+
+	/**
+	 * Whether the segment was found in the last scan
+	 */
+	int seen;
+};
+
+
+/**
+ * A column in the table
+ */
+struct column
+{
+	/**
+	 * The title of the column
+	 */
+	const char *title;
+
+	/**
+	 * The width of the column, negative for left-aligned columns
+	 */
+	int width;
+};
+
+
+
+/**
+ * The name of the process
+ */
+static const char *argv0 = "shrtop";
+
+/**
+ * The columns of the table, in order
+ */
+static const struct column columns[] = {
+	{"RING",    -12},
+	{"USER",     -9},
+	{"MODE",      4},
+	{"CPID",      7},
+	{"NATT",      4},
+	{"BSIZE",     8},
+	{"COUNT",     6},
+	{"FLAGS",    -8},
+	{"USED%",     5},
+	{"WRITE/S",  10},
+	{"READ/S",   10},
+	{"WWAIT%",    6},
+	{"RWAIT%",    6},
+	{"STATE",    -6},
+};
+
+/**
+ * The number of columns
+ */
+#define COLUMNS  (sizeof(columns) / sizeof(*columns))
+
+/**
+ * The known shared memory segments, each allocated
+ * separately, as the shared ring buffers refer to them
+ */
+static struct segment **segments;
+
+/**
+ * The number of elements in `segments`
+ */
+static size_t segment_count;
+
+/**
+ * Scratch space for the values of the semaphores of a shared ring buffer
+ */
+static unsigned short *values;
+
+/**
+ * The number of elements `values` has room for
+ */
+static size_t values_size;
+
+/**
+ * The index of the column the table is sorted by
+ */
+static size_t sort_column = 9;
+
+/**
+ * Whether the table is sorted in descending order
+ */
+static int descending = 1;
+
+/**
+ * The terminal settings to restore at exit
+ */
+static struct termios saved_termios;
+
+/**
+ * Whether `saved_termios` shall be restored
+ */
+static int termios_changed = 0;
+
+/**
+ * Set when the process shall exit
+ */
+static volatile sig_atomic_t stop = 0;
+
+
+
+/**
+ * Print usage information and exit
+ */
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-b] [-r] [-d delay] [-n refreshes] [-s column]\n", argv0);
+	exit(2);
+}
+
+
+/**
+ * Signal handler that asks the process to exit
+ * 
+ * @param  signo  The signal
+ */
+static void
+on_signal(int signo)
+{
+	(void) signo;
+	stop = 1;
+}
+
+
+/**
+ * Restore the terminal settings
+ */
+static void
+restore_terminal(void)
+{
+	if (termios_changed)
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+}
+
+
+/**
+ * Get the number of processes waiting for a semaphore to become positive
+ * 
+ * @param   sem  The semaphore array
+ * @param   i    The index of the semaphore
+ * @return       The number of waiting processes
+ */
+static int
+waiting(int sem, size_t i)
+{
+	int r = semctl(sem, (int)i, GETNCNT);
+	return r > 0 ? r : 0;
+}
+
+
+/**
+ * Sample the state of a shared ring buffer
+ * 
+ * @param  r  The shared ring buffer
+ */
+static void
+sample(struct ring *r)
+{
+	const struct shr_header *header = r->header;
+	size_t i, n = (size_t)header->buffer_count, w, readable = 0, held = 0;
+	unsigned short *new;
+	uint32_t count;
+	int writer_holds;
+
+	r->samples += 1;
+
+	if (header->local == SHR_LOCAL_ARENA) {
+		/* The counters wrap around, so only their differences are used. */
+		count = atomic_load_explicit(&header->written.count, memory_order_relaxed);
+		r->published += (uint32_t)(count - r->written_count);
+		r->written_count = count;
+		count = atomic_load_explicit(&header->read.count, memory_order_relaxed);
+		r->consumed += (uint32_t)(count - r->read_count);
+		r->read_count = count;
+		r->have_consumed = 1;
+		r->used = (long)(uint32_t)(r->written_count - r->read_count);
+		/* Each end sleeps on the counter of the other end. */
+		r->writer_blocked += atomic_load_explicit(&header->read.waiters, memory_order_relaxed) > 0;
+		r->reader_blocked += atomic_load_explicit(&header->written.waiters, memory_order_relaxed) > 0;
+		return;
+	}
+
+	r->published = atomic_load_explicit(&header->published, memory_order_relaxed);
+	if ((header->flags & (SHR_OVERWRITE | SHR_LATEST))) {
+		/* The writer never waits, and the readers do not report what they read. */
+		r->reader_blocked += atomic_load_explicit(&header->written.waiters, memory_order_relaxed) > 0;
+		return;
+	}
+	if (r->sem >= 0 && 2 * n > values_size) {
+		new = realloc(values, 2 * n * sizeof(*values));
+		if (!new) {
+			r->sem = -1;
+		} else {
+			values = new;
+			values_size = 2 * n;
+		}
+	}
+	if (r->sem < 0 || semctl(r->sem, 0, GETALL, values)) {
+		r->sem = -1;
+		r->used = -1;
+		r->have_consumed = 0;
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		readable += values[READ_SEM(i)] > 0;
+		held += !values[READ_SEM(i)] && !values[WRITE_SEM(i)];
+	}
+	/* The next buffer the writer will acquire, or has acquired. */
+	w = (size_t)(r->published % n);
+	writer_holds = !values[WRITE_SEM(w)] && !values[READ_SEM(w)];
+	if (!values[WRITE_SEM(w)] && waiting(r->sem, WRITE_SEM(w))) {
+		r->writer_blocked += 1;
+		writer_holds = 0;
+	}
+	/* A reader that has read everything waits for the buffer the writer will publish next. */
+	if (!readable && waiting(r->sem, READ_SEM(w)))
+		r->reader_blocked += 1;
+
+	r->used = (long)readable;
+	r->consumed = r->published - readable - (held - (size_t)writer_holds);
+	r->have_consumed = 1;
+}
+
+
+/**
+ * Compute the displayed values of a shared ring
+ * buffer, and start a new refresh period
+ * 
+ * @param  r        The shared ring buffer
+ * @param  elapsed  The time since the last refresh, in seconds
+ */
+static void
+refresh(struct ring *r, double elapsed)
+{
+	r->write_rate = (double)(r->published - r->last_published) / elapsed;
+	r->read_rate = r->have_consumed ? (double)(r->consumed - r->last_consumed) / elapsed : -1;
+	r->writer_wait = r->samples ? 100.0 * r->writer_blocked / r->samples : 0;
+	r->reader_wait = r->samples ? 100.0 * r->reader_blocked / r->samples : 0;
+	r->last_published = r->published;
+	r->last_consumed = r->consumed;
+	r->samples = r->writer_blocked = r->reader_blocked = 0;
+}
+
+
+/**
+ * Set up the shared ring buffers in a segment that
+ * has been attached, and detach it if it has none
+ * 
+ * @param  seg   The segment
+ * @param  size  The size of the segment
+ */
+static void
+identify(struct segment *seg, size_t size)
+{
+	const struct shr_arena_header *arena = (const void *)seg->address;
+	const struct shr_arena_entry *entry;
+	const struct shr_header *header = (const void *)seg->address;
+	struct semid_ds info;
+	size_t i, n;
+	int sem;
+
+	if (size >= SHR_HEADER_SIZE && header->magic == SHR_MAGIC && header->version == SHR_VERSION) {
+		if (!header->buffer_count || SHR_RING_SIZE(header->buffer_size, (int)header->flags, header->buffer_count) > size)
+			goto not_shr;
+		seg->rings = calloc(1, sizeof(*seg->rings));
+		if (!seg->rings)
+			goto not_shr;
+		seg->count = 1;
+		seg->rings->header = header;
+		seg->rings->index = -1;
+		sem = (int)header->semaphores - 1;
+		/* Check that the identifier has not been reused since the semaphore array was removed. */
+		if (sem >= 0 && (semctl(sem, 0, IPC_STAT, &info) || info.sem_nsems != 2 * header->buffer_count))
+			sem = -1;
+		seg->rings->sem = (header->flags & (SHR_OVERWRITE | SHR_LATEST)) ? -1 : sem;
+	} else if (size >= sizeof(*arena) && arena->magic == SHR_ARENA_MAGIC && arena->version == SHR_VERSION) {
+		if (!arena->count || arena->count > (size - sizeof(*arena)) / sizeof(*entry))
+			goto not_shr;
+		n = (size_t)arena->count;
+		seg->rings = calloc(n, sizeof(*seg->rings));
+		if (!seg->rings)
+			goto not_shr;
+		for (i = 0; i < n; i++) {
+			entry = (const void *)(seg->address + sizeof(*arena) + i * sizeof(*entry));
+			if (entry->offset % 64 || entry->offset > size - SHR_HEADER_SIZE)
+				break;
+			header = (const void *)(seg->address + entry->offset);
+			if (header->magic != SHR_MAGIC || header->local != SHR_LOCAL_ARENA || !header->buffer_count)
+				break;
+			seg->rings[i].header = header;
+			seg->rings[i].index = (long)i;
+			seg->rings[i].sem = -1;
+			seg->rings[i].written_count = atomic_load(&header->written.count);
+			seg->rings[i].read_count = atomic_load(&header->read.count);
+		}
+		if (i < n) {
+			free(seg->rings);
+			goto not_shr;
+		}
+		seg->count = n;
+	} else {
+		goto not_shr;
+	}
+
+	/* The first sample is the baseline for the rates. */
+	for (i = 0; i < seg->count; i++) {
+		seg->rings[i].segment = seg;
+		seg->rings[i].used = -1;
+		sample(seg->rings + i);
+		refresh(seg->rings + i, 1);
+		seg->rings[i].write_rate = 0;
+		seg->rings[i].read_rate = seg->rings[i].have_consumed ? 0 : -1;
+	}
+	return;
+
+ not_shr:
+	seg->rings = NULL;
+	seg->count = 0;
+	shmdt(seg->address);
+	seg->address = NULL;
+}
+
+
+/**
+ * Find the shared ring buffers on the system, by reading
+ * /proc/sysvipc/shm and checking the header of each segment
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int
+scan(void)
+{
+	struct segment *seg, **new;
+	char line[512];
+	FILE *f;
+	int key, shm, cpid, lpid;
+	unsigned mode, uid;
+	unsigned long nattch;
+	size_t size, i;
+
+	f = fopen("/proc/sysvipc/shm", "r");
+	if (!f)
+		return -1;
+
+	for (i = 0; i < segment_count; i++)
+		segments[i]->seen = 0;
+
+	/* The first line holds the titles. */
+	if (!fgets(line, sizeof(line), f))
+		goto done;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%d %d %o %zu %d %d %lu %u", &key, &shm, &mode, &size, &cpid, &lpid, &nattch, &uid) != 8)
+			continue;
+		if (REMOVED(mode))
+			continue;
+
+		for (i = 0; i < segment_count; i++)
+			if (segments[i]->shm == shm)
+				break;
+		if (i == segment_count) {
+			new = realloc(segments, (segment_count + 1) * sizeof(*segments));
+			if (!new)
+				break;
+			segments = new;
+			seg = calloc(1, sizeof(*seg));
+			if (!seg)
+				break;
+			segments[segment_count++] = seg;
+			seg->shm = shm;
+			/* Attaching read-only does not affect the users of the segment. */
+			seg->address = shmat(shm, NULL, SHM_RDONLY);
+			if (seg->address == (void *)-1)
+				seg->address = NULL;
+			else
+				identify(seg, size);
+		}
+		seg = segments[i];
+		seg->seen = 1;
+		seg->uid = (uid_t)uid;
+		seg->mode = (mode_t)(mode & 0777);
+		/* Do not count this process. */
+		seg->nattch = nattch - !!seg->address;
+		seg->cpid = (pid_t)cpid;
+	}
+
+ done:
+	fclose(f);
+
+	/* Detach segments that have been removed, so that they can be freed. */
+	for (i = 0; i < segment_count;) {
+		seg = segments[i];
+		if (seg->seen) {
+			i++;
+			continue;
+		}
+		if (seg->address)
+			shmdt(seg->address);
+		free(seg->rings);
+		free(seg);
+		segments[i] = segments[--segment_count];
+	}
+	return 0;
+}
+
+
+/**
+ * Get the name of the owner of a segment
+ * 
+ * @param   uid  The user ID of the owner
+ * @return       The name of the user, or the user ID
+ */
+static const char *
+user_name(uid_t uid)
+{
+	static char name[32];
+	static uid_t cached = (uid_t)-1;
+	struct passwd *pw;
+
+	if (uid == cached)
+		return name;
+	cached = uid;
+	pw = getpwuid(uid);
+	if (pw)
+		snprintf(name, sizeof(name), "%s", pw->pw_name);
+	else
+		snprintf(name, sizeof(name), "%lu", (unsigned long)uid);
+	return name;
+}
+
+
+/**
+ * Get the flags of a shared ring buffer, as letters
+ * 
+ * @param   flags   The flags
+ * @param   buffer  Output buffer, at least 9 bytes
+ * @return          `buffer`
+ */
+static const char *
+flag_letters(uint32_t flags, char *buffer)
+{
+	static const char letters[] = "COLAEDVT";
+	size_t i, n = 0;
+	for (i = 0; letters[i]; i++)
+		if (flags & ((uint32_t)1 << i))
+			buffer[n++] = letters[i];
+	if (!n)
+		buffer[n++] = '-';
+	buffer[n] = '\0';
+	return buffer;
+}
+
+
+/**
+ * Get the value of a numeric column of a shared ring buffer
+ * 
+ * @param   r       The shared ring buffer
+ * @param   column  The index of the column
+ * @return          The value
+ */
+static double
+numeric(const struct ring *r, size_t column)
+{
+	const struct shr_header *header = r->header;
+	switch (column) {
+	case 0:   return (double)r->segment->shm + (double)(r->index + 1) / 1e12;
+	case 2:   return (double)r->segment->mode;
+	case 3:   return (double)r->segment->cpid;
+	case 4:   return (double)r->segment->nattch;
+	case 5:   return (double)header->buffer_size;
+	case 6:   return (double)header->buffer_count;
+	case 7:   return (double)header->flags;
+	case 8:   return r->used < 0 ? -1 : 100.0 * (double)r->used / (double)header->buffer_count;
+	case 9:   return r->write_rate;
+	case 10:  return r->read_rate;
+	case 11:  return r->writer_wait;
+	case 12:  return r->reader_wait;
+	case 13:  return !!header->closed;
+	default:  return 0;
+	}
+}
+
+
+/**
+ * Compare two shared ring buffers by the sort column
+ * 
+ * @param   a  Pointer to the first shared ring buffer
+ * @param   b  Pointer to the second shared ring buffer
+ * @return     Negative if `a` goes first, positive if `b` goes first
+ */
+static int
+compare(const void *a, const void *b)
+{
+	const struct ring *x = *(struct ring *const *)a;
+	const struct ring *y = *(struct ring *const *)b;
+	double p, q;
+	int r;
+
+	if (sort_column == 1) {
+		r = (x->segment->uid > y->segment->uid) - (x->segment->uid < y->segment->uid);
+	} else {
+		p = numeric(x, sort_column);
+		q = numeric(y, sort_column);
+		r = (p > q) - (p < q);
+	}
+	if (!r) {
+		/* Keep the order stable between refreshes. */
+		p = numeric(x, 0);
+		q = numeric(y, 0);
+		return (p > q) - (p < q);
+	}
+	return descending ? -r : r;
+}
+
+
+/**
+ * Print the table
+ * 
+ * @param  interactive  Whether the table is redrawn on a terminal
+ * @return              Zero on success, -1 on error
+ */
+static int
+draw(int interactive)
+{
+	struct ring **order;
+	const struct ring *r;
+	struct winsize ws;
+	char cell[COLUMNS][32], flags[9];
+	size_t i, j, n = 0, rows = SIZE_MAX;
+	int width;
+
+	for (i = 0; i < segment_count; i++)
+		n += segments[i]->count;
+	order = malloc((n ? n : 1) * sizeof(*order));
+	if (!order)
+		return -1;
+	for (i = n = 0; i < segment_count; i++)
+		for (j = 0; j < segments[i]->count; j++)
+			order[n++] = segments[i]->rings + j;
+	qsort(order, n, sizeof(*order), compare);
+
+	if (interactive) {
+		printf("\033[H\033[2J");
+		if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_row > 2)
+			rows = (size_t)ws.ws_row - 2;
+		printf("%zu shared ring buffers, sorted by %s (</> to change, r to reverse, q to quit)\n",
+		       n, columns[sort_column].title);
+	}
+	for (i = 0; i < COLUMNS; i++) {
+		width = columns[i].width;
+		if (interactive && i == sort_column)
+			printf("\033[7m");
+		printf("%*s", i + 1 < COLUMNS ? width : 0, columns[i].title);
+		if (interactive && i == sort_column)
+			printf("\033[m");
+		printf(i + 1 < COLUMNS ? " " : "\n");
+	}
+
+	for (i = 0; i < n && i < rows; i++) {
+		r = order[i];
+		if (r->index < 0)
+			snprintf(cell[0], sizeof(cell[0]), "%i", r->segment->shm);
+		else
+			snprintf(cell[0], sizeof(cell[0]), "%i:%li", r->segment->shm, r->index);
+		snprintf(cell[1], sizeof(cell[1]), "%s", user_name(r->segment->uid));
+		snprintf(cell[2], sizeof(cell[2]), "%04o", (unsigned)r->segment->mode);
+		snprintf(cell[3], sizeof(cell[3]), "%li", (long)r->segment->cpid);
+		snprintf(cell[4], sizeof(cell[4]), "%lu", r->segment->nattch);
+		snprintf(cell[5], sizeof(cell[5]), "%llu", (unsigned long long)r->header->buffer_size);
+		snprintf(cell[6], sizeof(cell[6]), "%llu", (unsigned long long)r->header->buffer_count);
+		snprintf(cell[7], sizeof(cell[7]), "%s", flag_letters(r->header->flags, flags));
+		if (r->used < 0)
+			snprintf(cell[8], sizeof(cell[8]), "-");
+		else
+			snprintf(cell[8], sizeof(cell[8]), "%.0f", numeric(r, 8));
+		snprintf(cell[9], sizeof(cell[9]), "%.0f", r->write_rate);
+		if (r->read_rate < 0)
+			snprintf(cell[10], sizeof(cell[10]), "-");
+		else
+			snprintf(cell[10], sizeof(cell[10]), "%.0f", r->read_rate);
+		snprintf(cell[11], sizeof(cell[11]), "%.0f", r->writer_wait);
+		snprintf(cell[12], sizeof(cell[12]), "%.0f", r->reader_wait);
+		snprintf(cell[13], sizeof(cell[13]), "%s", r->header->closed ? "closed" : "open");
+		for (j = 0; j < COLUMNS; j++)
+			if (j + 1 < COLUMNS)
+				printf("%*s ", columns[j].width, cell[j]);
+			else
+				printf("%s\n", cell[j]);
+	}
+
+	free(order);
+	return fflush(stdout) ? -1 : 0;
+}
+
+
+/**
+ * Handle the keys the user has pressed
+ */
+static void
+read_keys(void)
+{
+	char c;
+	while (read(STDIN_FILENO, &c, 1) == 1) {
+		if (c == 'q')
+			stop = 1;
+		else if (c == '<' && sort_column > 0)
+			sort_column -= 1;
+		else if (c == '>' && sort_column + 1 < COLUMNS)
+			sort_column += 1;
+		else if (c == 'r')
+			descending ^= 1;
+	}
+}
+
+
+/**
+ * Get the current time
+ * 
+ * @return  The current time, in seconds
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	struct termios t;
+	struct sigaction sa;
+	struct pollfd pfd;
+	size_t i, j, s;
+	double delay = 1, last, next, wait;
+	long refreshes = 0, done;
+	int batch = 0, interactive, c;
+	char *end;
+
+	if (argc)
+		argv0 = argv[0];
+	while ((c = getopt(argc, argv, "bd:n:rs:")) != -1) {
+		switch (c) {
+		case 'b':
+			batch = 1;
+			break;
+		case 'd':
+			delay = strtod(optarg, &end);
+			if (*end || !(delay >= 0.01))
+				usage();
+			break;
+		case 'n':
+			refreshes = strtol(optarg, &end, 10);
+			if (*end || refreshes < 0)
+				usage();
+			break;
+		case 'r':
+			descending ^= 1;
+			break;
+		case 's':
+			for (i = 0; i < COLUMNS; i++)
+				if (!strcasecmp(optarg, columns[i].title))
+					break;
+			if (i == COLUMNS)
+				usage();
+			sort_column = i;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	interactive = !batch && isatty(STDOUT_FILENO);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	if (interactive && isatty(STDIN_FILENO) && !tcgetattr(STDIN_FILENO, &saved_termios)) {
+		t = saved_termios;
+		t.c_lflag &= (tcflag_t)~(ICANON | ECHO);
+		t.c_cc[VMIN] = 0;
+		t.c_cc[VTIME] = 0;
+		if (!tcsetattr(STDIN_FILENO, TCSAFLUSH, &t)) {
+			termios_changed = 1;
+			atexit(restore_terminal);
+		}
+	}
+	pfd.fd = termios_changed ? STDIN_FILENO : -1;
+	pfd.events = POLLIN;
+
+	if (scan()) {
+		fprintf(stderr, "%s: /proc/sysvipc/shm: %s\n", argv0, strerror(errno));
+		return 1;
+	}
+	last = next = now();
+	for (done = 0; !stop && (!refreshes || done < refreshes); done++) {
+		/* Sample every shared ring buffer a few times between refreshes. */
+		for (s = 0; s < SAMPLES && !stop; s++) {
+			for (i = 0; i < segment_count; i++)
+				for (j = 0; j < segments[i]->count; j++)
+					sample(segments[i]->rings + j);
+			next += delay / SAMPLES;
+			wait = next - now();
+			if (wait > 0 && poll(&pfd, 1, (int)(wait * 1000)) > 0)
+				read_keys();
+		}
+		wait = now() - last;
+		last += wait;
+		for (i = 0; i < segment_count; i++)
+			for (j = 0; j < segments[i]->count; j++)
+				refresh(segments[i]->rings + j, wait);
+		if (draw(interactive))
+			goto fail;
+		if (scan())
+			goto fail;
+	}
+
+	free(values);
+	return 0;
+
+ fail:
+	fprintf(stderr, "%s: %s\n", argv0, strerror(errno));
+	free(values);
+	return 1;
+}
@@ -0,0 +1,364 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <m@maandree.se>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "common.h"
+#include "shr_uring.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <string.h>
+
+
+
+/**
+ * The opcode of io_uring's futex wait, which was added in
+ * Linux 6.7 and may be missing from the installed headers
+ */
+#define OP_FUTEX_WAIT  51
+
+#ifndef FUTEX2_SIZE_U32
+# define FUTEX2_SIZE_U32  0x02
+#endif
+#ifndef FUTEX2_PRIVATE
+# define FUTEX2_PRIVATE  FUTEX_PRIVATE_FLAG
+#endif
+
+/**
+ * Get the counter the other end of a local
+ * shared ring buffer increases
+ * 
+ * @param   shr:shr_t *               The shared ring buffer
+ * @return  :struct shr_counter *     The counter
+ */
+#define PEER(shr)  \
+	((shr)->direction == SHR_WRITE ? &HEADER(shr)->read : &HEADER(shr)->written)
+
+
+
+/**
+ * Register the current end as waiting on the other end's counter,
+ * unless a buffer has become available
+ * 
+ * @param   shr  The shared ring buffer
+ * @return       The number of available buffers, if it
+ *               is 0, the end has been registered
+ */
+static size_t
+arm(shr_t *restrict shr)
+{
+	size_t n;
+	/* The sequentially consistent operations pair with those in `shr_local_release_`. */
+	atomic_fetch_add(&PEER(shr)->waiters, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	n = shr_local_available_(shr);
+	if (n)
+		atomic_fetch_sub(&PEER(shr)->waiters, 1);
+	return n;
+}
+
+
+/**
+ * Fill in a submission queue entry that waits
+ * until the other end's counter changes
+ * 
+ * @param  u    The end
+ * @param  sqe  The submission queue entry
+ */
+static void
+prep_wait(shr_uring_t *restrict u, struct io_uring_sqe *sqe)
+{
+	shr_t *shr = u->shr;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = OP_FUTEX_WAIT;
+	sqe->fd = FUTEX2_SIZE_U32 | (PROCESS_SHARED(shr) ? 0 : FUTEX2_PRIVATE);
+	sqe->addr = (uint64_t)(uintptr_t)(void *)&PEER(shr)->count;
+	sqe->addr2 = (uint64_t)shr->peer_released;
+	sqe->addr3 = FUTEX_BITSET_MATCH_ANY;
+	sqe->user_data = u->user_data | 1;
+	u->wait_res = 0;
+	u->count = 0;
+	u->pending = 1;
+}
+
+
+/**
+ * Wait until the other end's counter changes, unless
+ * the current buffer is available
+ * 
+ * @param   u        The end
+ * @param   get_sqe  Function that returns an unused submission queue entry
+ * @param   context  The argument for `get_sqe`
+ * @param   sqep     Output parameter for the submission queue entry of the wait,
+ *                   `NULL` if the current buffer is available
+ * @return           The number of available buffers, 0 if a wait was prepared,
+ *                   `(size_t)-1` on error; on error, `errno` will be set to
+ *                   describe the error
+ * 
+ * @throws  EBUSY  A submission is already pending, or `get_sqe` returned `NULL`
+ */
+static size_t
+wait_unless_available(shr_uring_t *restrict u, shr_uring_get_sqe_t *get_sqe, void *context,
+                      struct io_uring_sqe **sqep)
+{
+	size_t n;
+
+	*sqep = NULL;
+	if (u->pending)
+		return errno = EBUSY, (size_t)-1;
+
+	n = shr_local_available_(u->shr);
+	if (n || (n = arm(u->shr)))
+		return n;
+
+	*sqep = get_sqe(context);
+	if (!*sqep) {
+		atomic_fetch_sub(&PEER(u->shr)->waiters, 1);
+		return errno = EBUSY, (size_t)-1;
+	}
+	prep_wait(u, *sqep);
+	return 0;
+}
+
+
+
+/**
+ * Prepare an end of a shared ring buffer for use with an io_uring
+ * 
+ * @param   u          Output parameter for the end, must not be `NULL`
+ * @param   shr        The shared ring buffer, must not be `NULL`, it must
+ *                     not be used in any other way while `u` is in use
+ * @param   fd         The file descriptor to read the data from, for the write
+ *                     end, or write the data to, for the read end, -1 if
+ *                     `shr_uring_submit` will not be used
+ * @param   user_data  The `user_data` to give the submission queue entries,
+ *                     must be even
+ * @return             Zero on success, -1 on error; on error,
+ *                     `errno` will be set to describe the error
+ * 
+ * @throws  EINVAL  The shared ring buffer is neither local nor in an arena,
+ *                  it has the flag `SHR_OVERWRITE`, `SHR_LATEST` or
+ *                  `SHR_OBSERVABLE`, it is the read end and has the flag
+ *                  `SHR_CHECKSUM`, it was opened for observing, or
+ *                  `user_data` is odd
+ */
+int
+shr_uring_init(shr_uring_t *restrict u, shr_t *restrict shr, int fd, uint64_t user_data)
+{
+	if (!SHR_IS_LOCAL(shr) || SEQUENCE_FLAGS(shr->key.flags) || shr->direction == SHR_OBSERVE || (user_data & 1))
+		return errno = EINVAL, -1;
+	/* The data is sent before the read end could verify it. */
+	if (shr->direction == SHR_READ && (shr->key.flags & SHR_CHECKSUM))
+		return errno = EINVAL, -1;
+
+	memset(u, 0, sizeof(*u));
+	u->shr = shr;
+	u->fd = fd;
+	u->user_data = user_data;
+	return 0;
+}
+
+
+/**
+ * Submit a transfer between the file descriptor and the available
+ * buffers of an end of a shared ring buffer, up to a limit
+ * 
+ * @param   u            The end, must not be `NULL`
+ * @param   max_buffers  The maximum number of buffers to transfer,
+ *                       silently limited to `SHR_URING_MAX`
+ * @param   get_sqe      Function that returns an unused submission queue entry
+ * @param   context      The argument for `get_sqe`
+ * @return               Zero if the transfer was prepared, 1 if the read end
+ *                       reached the end of the data, -1 on error; on error,
+ *                       `errno` will be set to describe the error
+ * 
+ * @throws  EBUSY  A submission is already pending, or `get_sqe` returned `NULL`
+ */
+int
+shr_uring_submit(shr_uring_t *restrict u, size_t max_buffers, shr_uring_get_sqe_t *get_sqe, void *context)
+{
+	shr_t *shr = u->shr;
+	struct io_uring_sqe *wait, *sqe;
+	int write = shr->direction == SHR_WRITE;
+	size_t i, n;
+
+	n = wait_unless_available(u, get_sqe, context, &wait);
+	if (n == (size_t)-1)
+		return -1;
+	if (wait) {
+		/* The length of the data to send is not known until it is published. */
+		if (!write)
+			return 0;
+		/* A change of the reader's counter, from none available, makes the current buffer available. */
+		wait->flags |= IOSQE_IO_LINK;
+		n = 1;
+	} else if (!write && !*LENGTH(shr, shr->current_buffer)) {
+		shr_local_release_(shr, 1);
+		shr->current_buffer = next_buffer(shr, 1);
+		u->offset = 0;
+		return 1;
+	}
+
+	if (max_buffers > SHR_URING_MAX)  max_buffers = SHR_URING_MAX;
+	if (!max_buffers)                 max_buffers = 1;
+	if (n > max_buffers)              n = max_buffers;
+
+	sqe = get_sqe(context);
+	if (!sqe) {
+		if (wait) {
+			/* The wait cannot be taken back from the queue, so it is made into a silent no-op. */
+			memset(wait, 0, sizeof(*wait));
+			wait->opcode = IORING_OP_NOP;
+			wait->flags = IOSQE_CQE_SKIP_SUCCESS;
+			wait->user_data = u->user_data | 1;
+			atomic_fetch_sub(&PEER(shr)->waiters, 1);
+			u->pending = 0;
+		}
+		return errno = EBUSY, -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		u->iov[i].iov_base = BUFFER(shr, next_buffer(shr, i));
+		u->iov[i].iov_len = write ? shr->key.buffer_size : *LENGTH(shr, next_buffer(shr, i));
+		/* Empty buffers, that mark end of file, are left to the next call. */
+		if (!write && i && !u->iov[i].iov_len) {
+			n = i;
+			break;
+		}
+	}
+	if (!write) {
+		u->iov[0].iov_base = (char *)u->iov[0].iov_base + u->offset;
+		u->iov[0].iov_len -= u->offset;
+	}
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = u->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(void *)u->iov;
+	sqe->len = (uint32_t)n;
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = u->user_data;
+	u->io_res = 0;
+	if (!wait)
+		u->wait_res = 0;
+	u->count = n;
+	u->pending = wait ? 2 : 1;
+	return 0;
+}
+
+
+/**
+ * Submit an IORING_OP_FUTEX_WAIT, that completes when the current
+ * buffer of an end of a shared ring buffer may have become available
+ * 
+ * @param   u        The end, must not be `NULL`
+ * @param   get_sqe  Function that returns an unused submission queue entry
+ * @param   context  The argument for `get_sqe`
+ * @return           Zero if the wait was prepared, 1 if the buffer is
+ *                   already available, -1 on error; on error, `errno`
+ *                   will be set to describe the error
+ * 
+ * @throws  EBUSY  A submission is already pending, or `get_sqe` returned `NULL`
+ */
+int
+shr_uring_wait(shr_uring_t *restrict u, shr_uring_get_sqe_t *get_sqe, void *context)
+{
+	struct io_uring_sqe *wait;
+	size_t n = wait_unless_available(u, get_sqe, context, &wait);
+	if (n == (size_t)-1)
+		return -1;
+	return !wait;
+}
+
+
+/**
+ * Handle a completion queue entry for an end of a shared ring buffer
+ * 
+ * @param   u          The end, must not be `NULL`
+ * @param   user_data  The `user_data` of the completion queue entry
+ * @param   res        The `res` of the completion queue entry
+ * @param   closed     Output parameter for whether the write end has
+ *                     closed and all data has been read, ignored if `NULL`
+ * @return             The number of bytes transferred, 0 if end of file
+ *                     was reached by the write end, which published an empty
+ *                     buffer, -1 on error; on error, `errno` will be set
+ *                     to describe the error, and no buffer is transferred
+ * 
+ * @throws  EINPROGRESS  The submission has not completed yet
+ * @throws  EAGAIN       Nothing was transferred, because only a wait was
+ *                       submitted or the buffer became available before
+ *                       the wait started, submit again
+ * @throws  Any error specified for io_uring_enter(2), readv(2) or writev(2)
+ */
+ssize_t
+shr_uring_complete(shr_uring_t *restrict u, uint64_t user_data, int32_t res, int *restrict closed)
+{
+	shr_t *shr = u->shr;
+	size_t i, used, size = shr->key.buffer_size, left;
+
+	if (closed)
+		*closed = 0;
+
+	if (user_data & 1) {
+		atomic_fetch_sub(&PEER(shr)->waiters, 1);
+		u->wait_res = res;
+	} else {
+		u->io_res = res;
+	}
+	if (--u->pending)
+		return errno = EINPROGRESS, -1;
+
+	/* EAGAIN from the wait means that the counter had already changed, and the transfer was cancelled. */
+	if (u->wait_res && u->wait_res != -EAGAIN)
+		return errno = -u->wait_res, -1;
+	if (!u->count || u->wait_res)
+		return errno = EAGAIN, -1;
+	if (u->io_res < 0)
+		return errno = -u->io_res, -1;
+
+	if (shr->direction == SHR_WRITE) {
+		used = size ? ((size_t)u->io_res + size - 1) / size : 0;
+		if (!used)
+			used = 1;
+		for (i = 0; i < used; i++) {
+			*LENGTH(shr, next_buffer(shr, i)) = i + 1 < used ? size : (size_t)u->io_res - i * size;
+			shr_stamp_(shr, next_buffer(shr, i));
+		}
+	} else {
+		left = (size_t)u->io_res;
+		for (used = 0; used < u->count && left >= u->iov[used].iov_len; used++)
+			left -= u->iov[used].iov_len;
+		/* A partially written buffer is kept, and the rest of it is written by the next transfer. */
+		if (used)
+			u->offset = 0;
+		if (used < u->count)
+			u->offset += left;
+	}
+
+	if (used) {
+		shr_local_release_(shr, used);
+		shr->current_buffer = next_buffer(shr, used);
+	}
+	if (closed && shr->direction != SHR_WRITE)
+		*closed = HEADER(shr)->closed == shr->current_buffer + 1;
+	return (ssize_t)u->io_res;
+}